@@ -0,0 +1,93 @@
+// Decodes FPackedVertex of FigureGpuMesh: 16-bit fixed point position, octahedral normal, half float uv.
+// Every element arrives as four unnormalized bytes. The second vertex stream carries EFaceState bits in iColor.x
+// and baked ambient occlusion in iColor.y, 255 open. iColor.z is the face material slot, the layer of the
+// Texture2DArray of FigureMaterialArray on the diffuse unit. Texture arrays need GL3, HLSL/FigurePacked.hlsl is
+// the D3D11 port.
+// Figure instances share the chunk geometry, the INSTANCED variation takes the chunk transform per instance.
+#include "Uniforms.glsl"
+
+varying vec3 vNormal;
+varying vec2 vTexCoord;
+varying vec4 vStateTint;
+varying float vOcclusion;
+varying float vMaterial;
+
+#ifdef COMPILEVS
+
+attribute vec4 iPos;
+attribute vec4 iNormal;
+attribute vec4 iTexCoord;
+attribute vec4 iColor;
+#ifdef INSTANCED
+attribute vec4 iTexCoord4;
+attribute vec4 iTexCoord5;
+attribute vec4 iTexCoord6;
+#define iModelMatrix mat4(iTexCoord4, iTexCoord5, iTexCoord6, vec4(0.0, 0.0, 0.0, 1.0))
+#else
+#define iModelMatrix cModel
+#endif
+
+float DecodeHalf(float lo, float hi)
+{
+    float sign = hi >= 128.0 ? -1.0 : 1.0;
+    float h = mod(hi, 128.0);
+    float exponent = floor(h / 4.0);
+    float mantissa = mod(h, 4.0) * 256.0 + lo;
+    if (exponent == 0.0)
+        return sign * mantissa * exp2(-24.0);
+    return sign * (1.0 + mantissa / 1024.0) * exp2(exponent - 15.0);
+}
+
+vec3 DecodeOctahedral(vec2 e)
+{
+    e = e / 255.0 * 2.0 - 1.0;
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
+void VS()
+{
+    // Node scale is the fixed point step, node position the chunk origin.
+    vec3 localPos = vec3(iPos.x + iPos.y * 256.0, iPos.z + iPos.w * 256.0, iNormal.x + iNormal.y * 256.0);
+    vec3 worldPos = (vec4(localPos, 1.0) * iModelMatrix).xyz;
+    gl_Position = vec4(worldPos, 1.0) * cViewProj;
+    vNormal = normalize((vec4(DecodeOctahedral(iNormal.zw), 0.0) * iModelMatrix).xyz);
+    vTexCoord = vec2(DecodeHalf(iTexCoord.x, iTexCoord.y), DecodeHalf(iTexCoord.z, iTexCoord.w));
+
+    vOcclusion = iColor.y / 255.0;
+    vMaterial = iColor.z;
+
+    // Hovered wins over selected, selected over locked. Alpha is the tint strength.
+    float state = iColor.x;
+    float selected = mod(state, 2.0);
+    float hovered = mod(floor(state / 2.0), 2.0);
+    float locked = mod(floor(state / 4.0), 2.0);
+    if (hovered > 0.5)
+        vStateTint = vec4(1.0, 0.0, 0.0, 0.5);
+    else if (selected > 0.5)
+        vStateTint = vec4(1.0, 0.6, 0.0, 0.5);
+    else if (locked > 0.5)
+        vStateTint = vec4(0.2, 0.3, 0.6, 0.5);
+    else
+        vStateTint = vec4(0.0);
+}
+
+#else
+
+uniform sampler2DArray sDiffMap;
+uniform float cMaterialLayers;
+
+void PS()
+{
+    // Fixed key light, the editor view does not need scene lights to read shapes.
+    float light = 0.35 + 0.65 * max(dot(normalize(vNormal), normalize(vec3(0.3, 0.8, -0.5))), 0.0);
+    // All corners of a face carry the same slot, rounding undoes interpolation error.
+    float layer = min(floor(vMaterial + 0.5), max(cMaterialLayers - 1.0, 0.0));
+    vec3 albedo = texture(sDiffMap, vec3(vTexCoord, layer)).rgb * cMatDiffColor.rgb;
+    vec3 color = mix(albedo, vStateTint.rgb, vStateTint.a);
+    gl_FragColor = vec4(color * light * vOcclusion, cMatDiffColor.a);
+}
+
+#endif
@@ -0,0 +1,80 @@
+// D3D11 port of GLSL/FigurePacked.glsl, see there for the vertex layout of FigureGpuMesh.
+// UBYTE4 elements arrive as uint4 on D3D11. D3D9 has neither integer attributes nor texture arrays,
+// FigureGpuMesh::IsSupported keeps the packed path off there and on GL2.
+#include "Uniforms.hlsl"
+#include "Transform.hlsl"
+
+#ifdef COMPILEVS
+
+float3 DecodeOctahedral(float2 e)
+{
+    e = e / 255.0 * 2.0 - 1.0;
+    float3 n = float3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * float2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
+void VS(uint4 iPos : POSITION,
+    uint4 iNormal : NORMAL,
+    uint4 iTexCoord : TEXCOORD0,
+    uint4 iColor : COLOR0,
+#ifdef INSTANCED
+    float4x3 iModelInstance : TEXCOORD4,
+#endif
+    out float3 oNormal : TEXCOORD0,
+    out float2 oTexCoord : TEXCOORD1,
+    out float4 oStateTint : TEXCOORD2,
+    out float oOcclusion : TEXCOORD3,
+    out float oMaterial : TEXCOORD4,
+    out float4 oPos : OUTPOSITION)
+{
+    // Node scale is the fixed point step, node position the chunk origin.
+    const float4x3 modelMatrix = iModelMatrix;
+    float3 localPos = float3(iPos.x + iPos.y * 256, iPos.z + iPos.w * 256, iNormal.x + iNormal.y * 256);
+    float3 worldPos = mul(float4(localPos, 1.0), modelMatrix);
+    oPos = GetClipPos(worldPos);
+    oNormal = normalize(mul(DecodeOctahedral(float2(iNormal.zw)), (float3x3)modelMatrix));
+    oTexCoord = float2(f16tof32(iTexCoord.x | (iTexCoord.y << 8)), f16tof32(iTexCoord.z | (iTexCoord.w << 8)));
+
+    oOcclusion = iColor.y / 255.0;
+    oMaterial = iColor.z;
+
+    // Hovered wins over selected, selected over locked. Alpha is the tint strength.
+    if (iColor.x & 2)
+        oStateTint = float4(1.0, 0.0, 0.0, 0.5);
+    else if (iColor.x & 1)
+        oStateTint = float4(1.0, 0.6, 0.0, 0.5);
+    else if (iColor.x & 4)
+        oStateTint = float4(0.2, 0.3, 0.6, 0.5);
+    else
+        oStateTint = 0.0;
+}
+
+#else
+
+Texture2DArray tDiffMap : register(t0);
+SamplerState sDiffMap : register(s0);
+
+cbuffer CustomPS : register(b6)
+{
+    float cMaterialLayers;
+}
+
+void PS(float3 iNormal : TEXCOORD0,
+    float2 iTexCoord : TEXCOORD1,
+    float4 iStateTint : TEXCOORD2,
+    float iOcclusion : TEXCOORD3,
+    float iMaterial : TEXCOORD4,
+    out float4 oColor : OUTCOLOR0)
+{
+    // Fixed key light, the editor view does not need scene lights to read shapes.
+    float light = 0.35 + 0.65 * max(dot(normalize(iNormal), normalize(float3(0.3, 0.8, -0.5))), 0.0);
+    // All corners of a face carry the same slot, rounding undoes interpolation error.
+    float layer = min(floor(iMaterial + 0.5), max(cMaterialLayers - 1.0, 0.0));
+    float3 albedo = tDiffMap.Sample(sDiffMap, float3(iTexCoord, layer)).rgb * cMatDiffColor.rgb;
+    float3 color = lerp(albedo, iStateTint.rgb, iStateTint.a);
+    oColor = float4(color * light * iOcclusion, cMatDiffColor.a);
+}
+
+#endif
@@ -0,0 +1,444 @@
+#include "AutoSave.h"
+
+#include <Urho3D/Core/Thread.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Core/WorkQueue.h>
+#include <Urho3D/IO/Compression.h>
+#include <Urho3D/IO/FileSystem.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/IO/MemoryBuffer.h>
+#include <Urho3D/IO/VectorBuffer.h>
+
+#include <cstdio>
+#include <cstring>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace Redi;
+
+namespace
+{
+    const unsigned JOURNAL_VERSION = 3;
+    /// Raw bytes of one face in a chunk record.
+    const unsigned FACE_RAW_SIZE = 4 * sizeof(FVertex) + 1;
+    /// Journal smaller than this is never compacted.
+    const unsigned MIN_COMPACT_SIZE = 64 * 1024;
+
+    /// Decompressed faces of one chunk entry of a record, applied once the whole record checked out.
+    struct FRecordChunk
+    {
+        unsigned index;
+        unsigned first;
+        unsigned numChunkFaces;
+        ea::vector<unsigned char> raw;
+    };
+
+    /// Number of faces chunk index holds in a figure of numFaces faces.
+    unsigned GetChunkFaces(unsigned index, unsigned numFaces)
+    {
+        const unsigned begin = index * Figure::FACES_PER_CHUNK;
+        return begin < numFaces ? Min(numFaces - begin, (unsigned)Figure::FACES_PER_CHUNK) : 0;
+    }
+
+    unsigned Checksum(const void* data, unsigned size)
+    {
+        const auto* bytes = static_cast<const unsigned char*>(data);
+        unsigned hash = 0;
+        for (unsigned i = 0; i < size; ++i)
+        {
+            hash = SDBMHash(hash, bytes[i]);
+        }
+        return hash;
+    }
+
+    void WriteFaces(Serializer& dest, unsigned index, unsigned first, unsigned numChunkFaces, unsigned rawSize,
+        const ea::vector<unsigned char>& compressed)
+    {
+        dest.WriteVLE(index);
+        dest.WriteVLE(first);
+        dest.WriteVLE(numChunkFaces);
+        dest.WriteVLE(rawSize);
+        dest.WriteVLE(compressed.size());
+        dest.Write(compressed.data(), compressed.size());
+    }
+
+    /// Flush and fsync so a finished record survives a crash of the whole system.
+    void SyncToDisk(File& file)
+    {
+        file.Flush();
+        auto* handle = static_cast<FILE*>(file.GetHandle());
+        if (handle)
+        {
+#ifdef _WIN32
+            _commit(_fileno(handle));
+#else
+            fsync(fileno(handle));
+#endif
+        }
+    }
+}
+
+AutoSave::AutoSave(Context* context, const ea::string& fileName)
+    : context_(context),
+    fileName_(fileName)
+{
+}
+
+AutoSave::~AutoSave()
+{
+    Flush();
+}
+
+void AutoSave::Flush()
+{
+    while (workerRunning_)
+    {
+        Thread::Sleep(1);
+    }
+}
+
+void AutoSave::Discard()
+{
+    Flush();
+    auto* fileSystem = context_->GetSubsystem<FileSystem>();
+    fileSystem->Delete(fileName_);
+    fileSystem->Delete(fileName_ + ".tmp");
+
+    // The next save starts a new journal with every chunk.
+    savedRevision_ = 0;
+    savedMaterialRevision_ = 0;
+    savedChunkRevisions_.clear();
+    savedMaterialRevisions_.clear();
+    numSaves_ = 0;
+    needsCompaction_ = true;
+}
+
+void AutoSave::Update(const Figure& figure, float timeStep)
+{
+    elapsed_ += timeStep;
+    if (elapsed_ >= interval_ && !workerRunning_)
+    {
+        elapsed_ = 0.f;
+        Save(figure);
+    }
+}
+
+bool AutoSave::Save(const Figure& figure)
+{
+    if (workerRunning_)
+    {
+        return false;
+    }
+    if (figure.GetRevision() == savedRevision_ && figure.GetMaterialRevision() == savedMaterialRevision_ && numSaves_ > 0)
+    {
+        return true;
+    }
+
+    HiresTimer timer;
+    auto snapshot = ea::make_shared<FSnapshot>();
+    snapshot->numFaces = figure.faces.size();
+
+    const unsigned numChunks = figure.GetNumChunks();
+    savedChunkRevisions_.resize(numChunks, 0);
+    savedMaterialRevisions_.resize(numChunks, 0);
+    for (unsigned chunk = 0; chunk < numChunks; ++chunk)
+    {
+        const unsigned revision = figure.GetChunkRevision(chunk);
+        const unsigned materialRevision = figure.GetChunkMaterialRevision(chunk);
+        if (revision == savedChunkRevisions_[chunk] && materialRevision == savedMaterialRevisions_[chunk])
+        {
+            continue;
+        }
+        // Faces that only moved since the last save are the only ones recorded.
+        const unsigned chunkBegin = chunk * Figure::FACES_PER_CHUNK;
+        unsigned begin, end;
+        if (materialRevision == savedMaterialRevisions_[chunk] && figure.GetMovedRange(chunk, savedChunkRevisions_[chunk], begin, end))
+        {
+            begin -= chunkBegin;
+            end -= chunkBegin;
+        }
+        else
+        {
+            begin = 0;
+            end = Min(chunkBegin + Figure::FACES_PER_CHUNK, (unsigned)figure.faces.size()) - chunkBegin;
+        }
+        savedChunkRevisions_[chunk] = revision;
+        savedMaterialRevisions_[chunk] = materialRevision;
+        if (begin < end)
+        {
+            snapshot->chunks.push_back(FChunkSnapshot{chunk, figure.GetChunkVertices(chunk), figure.GetChunkMaterials(chunk), begin, end});
+        }
+    }
+    savedRevision_ = figure.GetRevision();
+    savedMaterialRevision_ = figure.GetMaterialRevision();
+    ++numSaves_;
+    lastNumChunks_ = snapshot->chunks.size();
+    lastSnapshotMs_ = timer.GetUSec(false) / 1000.0f;
+
+    workerRunning_ = true;
+    context_->GetSubsystem<WorkQueue>()->AddWorkItem([this, snapshot](unsigned) mutable
+    {
+        Write(*snapshot);
+        // Release the blocks before the next edit, so Figure writes them in place instead of copying.
+        snapshot.reset();
+        workerRunning_ = false;
+    });
+    return true;
+}
+
+void AutoSave::Write(const FSnapshot& snapshot)
+{
+    HiresTimer timer;
+
+    numFaces_ = snapshot.numFaces;
+    const unsigned numChunks = (numFaces_ + Figure::FACES_PER_CHUNK - 1) / Figure::FACES_PER_CHUNK;
+    compressedChunks_.resize(numChunks);
+    rawSizes_.resize(numChunks, 0);
+    compressedRanges_.resize(snapshot.chunks.size());
+    for (unsigned i = 0; i < snapshot.chunks.size(); ++i)
+    {
+        // The mirror keeps whole chunks, so compaction can rewrite the journal without the figure.
+        const FChunkSnapshot& chunk = snapshot.chunks[i];
+        const unsigned numChunkFaces = chunk.materials->size();
+        rawSizes_[chunk.index] = CompressFaces(chunk, 0, numChunkFaces, compressedChunks_[chunk.index]);
+        if (chunk.begin > 0 || chunk.end < numChunkFaces)
+        {
+            CompressFaces(chunk, chunk.begin, chunk.end, compressedRanges_[i]);
+        }
+    }
+
+    if (needsCompaction_ || journalSize_ > 2 * Max(compactedSize_, MIN_COMPACT_SIZE))
+    {
+        needsCompaction_ = !Compact();
+    }
+    else if (!AppendRecord(snapshot))
+    {
+        // Start over with a fresh journal next time.
+        needsCompaction_ = true;
+    }
+
+    size_t mirrorBytes = 0;
+    for (const ea::vector<unsigned char>& compressed : compressedChunks_)
+    {
+        mirrorBytes += compressed.capacity();
+    }
+    MemoryStats::SetUsage(MC_AUTOSAVE, mirrorBytes);
+
+    lastWriteMs_ = timer.GetUSec(false) / 1000.0f;
+}
+
+unsigned AutoSave::CompressFaces(const FChunkSnapshot& chunk, unsigned begin, unsigned end, ea::vector<unsigned char>& dest)
+{
+    const unsigned vertexSize = (end - begin) * 4 * sizeof(FVertex);
+    const unsigned rawSize = vertexSize + end - begin;
+    rawChunk_.resize(rawSize);
+    memcpy(rawChunk_.data(), chunk.vertices->data() + begin * 4, vertexSize);
+    memcpy(rawChunk_.data() + vertexSize, chunk.materials->data() + begin, end - begin);
+    dest.resize(EstimateCompressBound(rawSize));
+    dest.resize(CompressData(dest.data(), rawChunk_.data(), rawSize));
+    return rawSize;
+}
+
+void AutoSave::WriteChunk(Serializer& dest, unsigned index) const
+{
+    WriteFaces(dest, index, 0, rawSizes_[index] / FACE_RAW_SIZE, rawSizes_[index], compressedChunks_[index]);
+}
+
+bool AutoSave::AppendRecord(const FSnapshot& snapshot)
+{
+    VectorBuffer payload;
+    payload.WriteUInt(numFaces_);
+    payload.WriteVLE(snapshot.chunks.size());
+    for (unsigned i = 0; i < snapshot.chunks.size(); ++i)
+    {
+        const FChunkSnapshot& chunk = snapshot.chunks[i];
+        const unsigned numChunkFaces = chunk.materials->size();
+        if (chunk.begin > 0 || chunk.end < numChunkFaces)
+        {
+            WriteFaces(payload, chunk.index, chunk.begin, numChunkFaces, (chunk.end - chunk.begin) * FACE_RAW_SIZE, compressedRanges_[i]);
+        }
+        else
+        {
+            WriteChunk(payload, chunk.index);
+        }
+    }
+
+    File file(context_, fileName_, FILE_READWRITE);
+    if (!file.IsOpen())
+    {
+        return false;
+    }
+    file.Seek(file.GetSize());
+    file.WriteUInt(payload.GetSize());
+    file.WriteUInt(Checksum(payload.GetData(), payload.GetSize()));
+    file.Write(payload.GetData(), payload.GetSize());
+    SyncToDisk(file);
+    journalSize_ = file.GetSize();
+    return true;
+}
+
+bool AutoSave::Compact()
+{
+    VectorBuffer payload;
+    payload.WriteUInt(numFaces_);
+    payload.WriteVLE(compressedChunks_.size());
+    for (unsigned i = 0; i < compressedChunks_.size(); ++i)
+    {
+        WriteChunk(payload, i);
+    }
+
+    // Old journal stays valid until the new one is complete on disk.
+    const ea::string tempFileName = fileName_ + ".tmp";
+    {
+        File file(context_, tempFileName, FILE_WRITE);
+        if (!file.IsOpen())
+        {
+            return false;
+        }
+        file.WriteFileID("RJNL");
+        file.WriteUInt(JOURNAL_VERSION);
+        file.WriteUInt(payload.GetSize());
+        file.WriteUInt(Checksum(payload.GetData(), payload.GetSize()));
+        file.Write(payload.GetData(), payload.GetSize());
+        SyncToDisk(file);
+        journalSize_ = file.GetSize();
+    }
+
+    auto* fileSystem = context_->GetSubsystem<FileSystem>();
+#ifdef _WIN32
+    fileSystem->Delete(fileName_);
+#endif
+    if (!fileSystem->Rename(tempFileName, fileName_))
+    {
+        return false;
+    }
+    compactedSize_ = journalSize_;
+    ++numCompactions_;
+    return true;
+}
+
+bool AutoSave::Recover(Figure& figure)
+{
+    Flush();
+
+    File file(context_, fileName_, FILE_READ);
+    if (!file.IsOpen() || file.ReadFileID() != "RJNL" || file.ReadUInt() != JOURNAL_VERSION)
+    {
+        return false;
+    }
+
+    unsigned numFaces = 0;
+    unsigned numRecords = 0;
+    ea::vector<ea::vector<unsigned char>> chunks;
+    ea::vector<unsigned char> payloadData;
+    ea::vector<unsigned char> compressed;
+    ea::vector<FRecordChunk> entries;
+    while (file.GetSize() - file.GetPosition() >= 8)
+    {
+        const unsigned size = file.ReadUInt();
+        const unsigned checksum = file.ReadUInt();
+        if (size > file.GetSize() - file.GetPosition())
+        {
+            URHO3D_LOGWARNING("Autosave journal {} ends with an incomplete record", fileName_);
+            break;
+        }
+        payloadData.resize(size);
+        file.Read(payloadData.data(), size);
+        if (Checksum(payloadData.data(), size) != checksum)
+        {
+            URHO3D_LOGWARNING("Autosave journal {} has a corrupt record", fileName_);
+            break;
+        }
+
+        // Every entry has to fit the face count of the record and every chunk has to end up whole, a record that
+        // does not is rejected with all after it instead of shifting the faces of later chunks.
+        MemoryBuffer payload(payloadData.data(), size);
+        const unsigned recordFaces = payload.ReadUInt();
+        const unsigned numChunks = (recordFaces + Figure::FACES_PER_CHUNK - 1) / Figure::FACES_PER_CHUNK;
+        const unsigned numEntries = payload.ReadVLE();
+        ea::vector<bool> whole(numChunks, false);
+        entries.clear();
+        bool valid = numEntries <= numChunks;
+        for (unsigned i = 0; i < numEntries && valid; ++i)
+        {
+            FRecordChunk entry;
+            entry.index = payload.ReadVLE();
+            entry.first = payload.ReadVLE();
+            entry.numChunkFaces = payload.ReadVLE();
+            const unsigned rawSize = payload.ReadVLE();
+            compressed.resize(payload.ReadVLE());
+            const unsigned count = rawSize / FACE_RAW_SIZE;
+            valid = payload.Read(compressed.data(), compressed.size()) == compressed.size() && entry.index < numChunks
+                && entry.numChunkFaces == GetChunkFaces(entry.index, recordFaces) && rawSize % FACE_RAW_SIZE == 0
+                && count > 0 && entry.first + count <= entry.numChunkFaces;
+            if (!valid)
+            {
+                break;
+            }
+            // Whole chunks start with the first face, a part of a chunk patches the faces the chunk already has.
+            if (entry.first == 0 && count == entry.numChunkFaces)
+            {
+                whole[entry.index] = true;
+            }
+            else if (entry.index >= chunks.size() || chunks[entry.index].size() != entry.numChunkFaces * FACE_RAW_SIZE)
+            {
+                valid = false;
+                break;
+            }
+            // DecompressData returns the compressed bytes it consumed.
+            entry.raw.resize(rawSize);
+            valid = DecompressData(entry.raw.data(), compressed.data(), rawSize) == compressed.size();
+            entries.push_back(ea::move(entry));
+        }
+        for (unsigned index = 0; index < numChunks && valid; ++index)
+        {
+            valid = whole[index] || (index < chunks.size() && chunks[index].size() == GetChunkFaces(index, recordFaces) * FACE_RAW_SIZE);
+        }
+        if (!valid)
+        {
+            URHO3D_LOGWARNING("Autosave journal {} has a record that does not fit its face count", fileName_);
+            break;
+        }
+
+        numFaces = recordFaces;
+        chunks.resize(numChunks);
+        for (const FRecordChunk& entry : entries)
+        {
+            ea::vector<unsigned char>& chunk = chunks[entry.index];
+            const unsigned count = entry.raw.size() / FACE_RAW_SIZE;
+            if (entry.first == 0 && count == entry.numChunkFaces)
+            {
+                chunk.resize(entry.numChunkFaces * FACE_RAW_SIZE);
+            }
+            const unsigned vertexSize = count * 4 * sizeof(FVertex);
+            memcpy(chunk.data() + entry.first * 4 * sizeof(FVertex), entry.raw.data(), vertexSize);
+            memcpy(chunk.data() + entry.numChunkFaces * 4 * sizeof(FVertex) + entry.first, entry.raw.data() + vertexSize, count);
+        }
+        ++numRecords;
+    }
+
+    if (numRecords == 0)
+    {
+        return false;
+    }
+
+    figure.Clear();
+    figure.faces.reserve(numFaces);
+    for (const ea::vector<unsigned char>& chunk : chunks)
+    {
+        const unsigned chunkFaces = chunk.size() / FACE_RAW_SIZE;
+        const unsigned char* materials = chunk.data() + chunkFaces * 4 * sizeof(FVertex);
+        for (unsigned i = 0; i < chunkFaces; ++i)
+        {
+            FVertex v[4];
+            memcpy(v, chunk.data() + i * 4 * sizeof(FVertex), sizeof(v));
+            figure.AddFace(v[0], v[1], v[2], v[3]);
+            figure.SetFaceMaterial(figure.faces.back().idx, materials[i]);
+        }
+    }
+    URHO3D_LOGINFO("Recovered {} faces from {} autosave records", figure.faces.size(), numRecords);
+    return true;
+}
@@ -0,0 +1,112 @@
+#pragma once
+#include <EASTL/shared_ptr.h>
+#include <EASTL/string.h>
+#include <EASTL/vector.h>
+
+#include <atomic>
+
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/IO/File.h>
+
+#include "Figure.h"
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+/// Periodically saves Figure into an append-only journal, deleted again on a clean exit.
+/// The main thread only takes the shared vertex blocks of chunks whose revision changed since the previous save,
+/// Figure copies a block on write while a save still holds it. A worker thread compresses them,
+/// appends one record to the journal and syncs it to disk. When the journal grows past twice its compacted size,
+/// the worker rewrites it from its own copy of the latest chunks, so compaction never touches the Figure.
+/// Record: payload size, payload checksum, payload = face count, changed chunk count, per chunk index, first face,
+/// chunk face count, raw size, LZ4 data. Raw data is the four vertices of every face from the first one followed by one
+/// material byte per face. A chunk whose faces only moved since the last save records just the moved ones.
+/// Material edits leave chunk revisions alone, so chunks are saved again when either their revision or their
+/// material revision changed.
+class AutoSave
+{
+public:
+    AutoSave(Context* context, const ea::string& fileName);
+    ~AutoSave();
+
+    /// Save when interval has passed since the last save. Main thread only.
+    void Update(const Figure& figure, float timeStep);
+    /// Snapshot changed chunks and start writing them. Returns false when the previous save is still running.
+    bool Save(const Figure& figure);
+    /// Wait until the running save is written.
+    void Flush();
+    /// Wait for the running save and delete the journal. A clean exit leaves none, so only a crash is recovered.
+    void Discard();
+    /// Rebuild figure from the journal. Records after a torn or corrupt one are ignored.
+    bool Recover(Figure& figure);
+
+    void SetInterval(float seconds) { interval_ = seconds; }
+    bool IsBusy() const { return workerRunning_; }
+    const ea::string& GetFileName() const { return fileName_; }
+
+    unsigned GetNumSaves() const { return numSaves_; }
+    unsigned GetLastNumChunks() const { return lastNumChunks_; }
+    float GetLastSnapshotMs() const { return lastSnapshotMs_; }
+    /// Worker side values, valid while not busy.
+    float GetLastWriteMs() const { return lastWriteMs_; }
+    unsigned GetJournalSize() const { return journalSize_; }
+    unsigned GetNumCompactions() const { return numCompactions_; }
+
+private:
+    struct FChunkSnapshot
+    {
+        unsigned index;
+        ea::shared_ptr<const FVertexArray> vertices;
+        ea::shared_ptr<const ea::vector<unsigned char>> materials;
+        /// Faces of the chunk the record holds, the blocks are always whole.
+        unsigned begin;
+        unsigned end;
+    };
+
+    struct FSnapshot
+    {
+        unsigned numFaces{0};
+        ea::vector<FChunkSnapshot> chunks;
+    };
+
+    /// Worker thread.
+    void Write(const FSnapshot& snapshot);
+    bool AppendRecord(const FSnapshot& snapshot);
+    bool Compact();
+    void WriteChunk(Serializer& dest, unsigned index) const;
+    /// Compress faces [begin, end) of chunk into dest, returns the raw size.
+    unsigned CompressFaces(const FChunkSnapshot& chunk, unsigned begin, unsigned end, ea::vector<unsigned char>& dest);
+
+    Context* context_;
+    ea::string fileName_;
+    float interval_{30.0f};
+    float elapsed_{0.f};
+
+    /// Main thread state.
+    unsigned savedRevision_{0};
+    unsigned savedMaterialRevision_{0};
+    ea::vector<unsigned> savedChunkRevisions_;
+    ea::vector<unsigned> savedMaterialRevisions_;
+    unsigned numSaves_{0};
+    unsigned lastNumChunks_{0};
+    float lastSnapshotMs_{0.f};
+
+    /// Worker state, latest compressed data of every chunk.
+    std::atomic<bool> workerRunning_{false};
+    unsigned numFaces_{0};
+    ea::vector<ea::vector<unsigned char>> compressedChunks_;
+    ea::vector<unsigned> rawSizes_;
+    /// Vertices and materials of one chunk laid out for compression.
+    ea::vector<unsigned char> rawChunk_;
+    /// Compressed faces of the snapshot chunks that only record part of their chunk.
+    ea::vector<ea::vector<unsigned char>> compressedRanges_;
+    bool needsCompaction_{true};
+    unsigned journalSize_{0};
+    unsigned compactedSize_{0};
+    unsigned numCompactions_{0};
+    float lastWriteMs_{0.f};
+};
+
+}
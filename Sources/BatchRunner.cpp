@@ -0,0 +1,380 @@
+#include "BatchRunner.h"
+#include "FigureExporter.h"
+#include "FigureGenerator.h"
+
+#include <Urho3D/Core/StringUtils.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/FileSystem.h>
+#include <Urho3D/IO/Log.h>
+
+using namespace Redi;
+
+namespace
+{
+    EFaceDirection ParseFaceDirection(const ea::string& name)
+    {
+        if (name.comparei("forward") == 0) return FD_FORWARD;
+        if (name.comparei("back") == 0) return FD_BACK;
+        if (name.comparei("left") == 0) return FD_LEFT;
+        if (name.comparei("right") == 0) return FD_RIGHT;
+        if (name.comparei("up") == 0) return FD_UP;
+        if (name.comparei("down") == 0) return FD_DOWN;
+        return FD_NONE;
+    }
+
+    Vector3 ParseVector3(const ea::vector<ea::string>& args, unsigned first)
+    {
+        if (args.size() < first + 3)
+        {
+            return Vector3::ZERO;
+        }
+        return Vector3(ToFloat(args[first]), ToFloat(args[first + 1]), ToFloat(args[first + 2]));
+    }
+}
+
+BatchRunner::BatchRunner(Context* context)
+    : context_(context),
+    figure_(FT_QUAD),
+    ao_(context),
+    uvAtlas_(context)
+{
+}
+
+bool BatchRunner::Run(const ea::string& scriptFileName)
+{
+    File script(context_, scriptFileName, FILE_READ);
+    if (!script.IsOpen())
+    {
+        URHO3D_LOGERROR("Batch script {} not found", scriptFileName);
+        return false;
+    }
+
+    operations_.clear();
+    HiresTimer totalTimer;
+    unsigned lineNumber = 0;
+    bool success = true;
+    while (!script.IsEof() && success)
+    {
+        ++lineNumber;
+        ea::string line = script.ReadLine();
+        const auto comment = line.find('#');
+        if (comment != ea::string::npos)
+        {
+            line.resize(comment);
+        }
+        line.trim();
+        if (line.empty())
+        {
+            continue;
+        }
+
+        FBatchOperation operation;
+        operation.line = lineNumber;
+        operation.text = line;
+
+        HiresTimer timer;
+        operation.success = Execute(line.split(' '));
+        operation.timeMs = (float)timer.GetUSec(false) / 1000.0f;
+        operation.numFaces = figure_.faces.size();
+        operations_.push_back(operation);
+
+        URHO3D_LOGINFO("[batch] {}: {:.3f} ms, {} faces{}", operation.text, operation.timeMs, operation.numFaces,
+            operation.success ? "" : " FAILED");
+        if (!operation.success)
+        {
+            URHO3D_LOGERROR("Batch operation at {}:{} failed: {}", scriptFileName, lineNumber, line);
+            success = false;
+        }
+    }
+
+    URHO3D_LOGINFO("[batch] {} operations in {:.3f} ms", operations_.size(), (float)totalTimer.GetUSec(false) / 1000.0f);
+    return success;
+}
+
+bool BatchRunner::Execute(const ea::vector<ea::string>& args)
+{
+    const ea::string& op = args[0];
+    if (op == "clear")
+    {
+        figure_.Clear();
+        return true;
+    }
+    if (op == "box" && args.size() >= 4)
+    {
+        figure_.AddBox(ParseVector3(args, 1));
+        return true;
+    }
+    if (op == "import" && args.size() >= 2)
+    {
+        return LoadFigure(args[1], figure_);
+    }
+    if (op == "merge" && args.size() >= 2)
+    {
+        Figure other(FT_QUAD);
+        if (!LoadFigure(args[1], other))
+        {
+            return false;
+        }
+        figure_.Merge(other, ParseVector3(args, 2));
+        return true;
+    }
+    if (op == "extrude" && args.size() >= 2)
+    {
+        const unsigned idx = ToUInt(args[1]);
+        const unsigned times = args.size() >= 3 ? ToUInt(args[2]) : 1;
+        for (unsigned i = 0; i < times; ++i)
+        {
+            if (!figure_.ExtrudeFace(idx))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    if (op == "extrude_dir" && args.size() >= 2)
+    {
+        const EFaceDirection direction = ParseFaceDirection(args[1]);
+        if (direction == FD_NONE)
+        {
+            return false;
+        }
+
+        // Collect first, extrusion appends side faces that must not be extruded in the same pass.
+        ea::vector<unsigned> ids;
+        for (const FFace& face : figure_.faces)
+        {
+            if (figure_.GetFaceDirection(&face) == direction)
+            {
+                ids.push_back(face.idx);
+            }
+        }
+        const unsigned times = args.size() >= 3 ? ToUInt(args[2]) : 1;
+        for (unsigned i = 0; i < times; ++i)
+        {
+            for (unsigned idx : ids)
+            {
+                figure_.ExtrudeFace(idx);
+            }
+        }
+        return true;
+    }
+    if (op == "extrude_drag" && args.size() >= 3)
+    {
+        const EFaceDirection direction = ParseFaceDirection(args[1]);
+        if (direction == FD_NONE)
+        {
+            return false;
+        }
+
+        ea::vector<unsigned> ids;
+        for (const FFace& face : figure_.faces)
+        {
+            if (figure_.GetFaceDirection(&face) == direction)
+            {
+                ids.push_back(face.idx);
+            }
+        }
+        // Every step is one mouse move of an interactive drag.
+        FigureExtrudeDrag drag;
+        if (!drag.Begin(figure_, ids))
+        {
+            return false;
+        }
+        const float distance = ToFloat(args[2]);
+        const unsigned steps = args.size() >= 4 ? Max(ToUInt(args[3]), 1u) : 1;
+        for (unsigned i = 1; i <= steps; ++i)
+        {
+            drag.SetDistance(distance * i / steps);
+        }
+        drag.Commit();
+        return true;
+    }
+    if (op == "select" && args.size() >= 3 && (args[1] == "ring" || args[1] == "loop"))
+    {
+        const unsigned arrayIndex = figure_.GetFaceIndex(ToUInt(args[2]));
+        if (arrayIndex == M_MAX_UNSIGNED)
+        {
+            return false;
+        }
+        topology_.Update(figure_);
+        const unsigned edge = args.size() >= 4 ? ToUInt(args[3]) % 4 : 0;
+        const ea::vector<unsigned> ids = args[1] == "ring" ? topology_.GetFaceRing(figure_, arrayIndex, edge)
+            : topology_.GetEdgeLoop(figure_, arrayIndex, edge);
+        figure_.SelectFaces(ids);
+        URHO3D_LOGINFO("Selected {} faces, topology built in {:.2f} ms", ids.size(), topology_.GetBuildTimeMs());
+        return true;
+    }
+    if (op == "select" && args.size() >= 2)
+    {
+        const unsigned idx = ToUInt(args[1]);
+        figure_.SelectFace(idx);
+        return figure_.IsSelected(idx);
+    }
+    if (op == "extrude_selection")
+    {
+        const unsigned times = args.size() >= 2 ? ToUInt(args[1]) : 1;
+        for (unsigned i = 0; i < times; ++i)
+        {
+            if (figure_.ExtrudeSelection() == 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    if (op == "generate" && args.size() >= 3)
+    {
+        EGeneratorKind kind;
+        if (!FigureGenerator::ParseKind(args[1], kind))
+        {
+            return false;
+        }
+        FigureGenerator generator(context_, args.size() >= 4 ? ToUInt(args[3]) : 1);
+        return generator.Generate(figure_, kind, ToUInt(args[2])) > 0;
+    }
+    if (op == "csg" && args.size() >= 3)
+    {
+        ECsgOperation csgOp;
+        if (!FigureCsg::ParseOperation(args[1], csgOp))
+        {
+            return false;
+        }
+        if (args.size() >= 8)
+        {
+            const Vector3 min = ParseVector3(args, 2);
+            const Vector3 max = ParseVector3(args, 5);
+            csg_.ApplyBox(figure_, IntVector3(FloorToInt(min.x_), FloorToInt(min.y_), FloorToInt(min.z_)),
+                IntVector3(FloorToInt(max.x_), FloorToInt(max.y_), FloorToInt(max.z_)), csgOp);
+            return true;
+        }
+
+        Figure brush(FT_QUAD);
+        if (!LoadFigure(args[2], brush))
+        {
+            return false;
+        }
+        Figure moved(FT_QUAD);
+        moved.Merge(brush, ParseVector3(args, 3));
+        csg_.Apply(figure_, moved, csgOp);
+        return true;
+    }
+    if (op == "snap" && args.size() >= 2)
+    {
+        // Index the figure, then time count nearest-target queries at random points inside its bounds.
+        HiresTimer timer;
+        snap_.Update(figure_);
+        const float buildMs = timer.GetUSec(true) / 1000.0f;
+
+        BoundingBox bounds;
+        for (const FFace& face : figure_.faces)
+        {
+            bounds.Merge(face.boundingBox);
+        }
+        if (!bounds.Defined())
+        {
+            return false;
+        }
+
+        const unsigned count = ToUInt(args[1]);
+        const float radius = args.size() >= 3 ? ToFloat(args[2]) : 0.25f;
+        const Vector3 size = bounds.Size();
+        unsigned state = 0x9e3779b9u;
+        const auto random = [&state]()
+        {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            return (state & 0xffffff) / (float)0xffffff;
+        };
+        unsigned numHits = 0;
+        float maxUs = 0.f;
+        float totalUs = 0.f;
+        for (unsigned i = 0; i < count; ++i)
+        {
+            const Vector3 point = bounds.min_ + Vector3(random() * size.x_, random() * size.y_, random() * size.z_);
+            FSnapResult result;
+            numHits += snap_.FindNearest(point, radius, SK_VERTEX | SK_EDGE | SK_PLANE, result);
+            maxUs = Max(maxUs, snap_.GetLastQueryUs());
+            totalUs += snap_.GetLastQueryUs();
+        }
+        URHO3D_LOGINFO("Snap index of {} vertices and {} edges built in {:.2f} ms, {} queries: {} hits, {:.2f} us average, {:.2f} us max",
+            snap_.GetNumVertices(), snap_.GetNumEdges(), buildMs, count, numHits, count ? totalUs / count : 0.f, maxUs);
+        return true;
+    }
+    if (op == "ao")
+    {
+        if (args.size() >= 2)
+            ao_.SetMaxSamples(ToUInt(args[1]));
+        if (args.size() >= 3)
+            ao_.SetRadius(ToFloat(args[2]));
+        ao_.Bake(figure_);
+
+        unsigned open = 0;
+        for (unsigned char value : ao_.GetOcclusion())
+        {
+            open += value;
+        }
+        const unsigned numCorners = ao_.GetOcclusion().size();
+        URHO3D_LOGINFO("[batch] ao mean openness {:.3f} over {} corners", numCorners ? open / (255.0f * numCorners) : 1.f, numCorners);
+        return true;
+    }
+    if (op == "uvpack")
+    {
+        if (args.size() >= 2)
+            uvAtlas_.SetTexelsPerUnit(ToFloat(args[1]));
+        uvAtlas_.Update(figure_);
+        URHO3D_LOGINFO("[batch] uvpack {} charts in {}x{}, {:.1f}% filled", uvAtlas_.GetNumCharts(), uvAtlas_.GetAtlasSize(),
+            uvAtlas_.GetAtlasSize(), uvAtlas_.GetFillRatio() * 100.0f);
+        return true;
+    }
+    if (op == "weld")
+    {
+        const float epsilon = args.size() >= 2 ? ToFloat(args[1]) : 0.001f;
+        const unsigned removed = figure_.Weld(epsilon);
+        URHO3D_LOGINFO("[batch] weld removed {} faces", removed);
+        return true;
+    }
+    if (op == "export" && args.size() >= 2)
+    {
+        return SaveFigure(args[1]);
+    }
+
+    URHO3D_LOGERROR("Unknown batch operation '{}'", op);
+    return false;
+}
+
+bool BatchRunner::LoadFigure(const ea::string& fileName, Figure& figure) const
+{
+    File file(context_, fileName, FILE_READ);
+    return file.IsOpen() && figure.Load(file);
+}
+
+bool BatchRunner::SaveFigure(const ea::string& fileName) const
+{
+    if (GetExtension(fileName) == ".mdl")
+    {
+        FigureExporter exporter(context_);
+        return exporter.Export(figure_, fileName);
+    }
+
+    File file(context_, fileName, FILE_WRITE);
+    return file.IsOpen() && figure_.Save(file);
+}
+
+bool BatchRunner::WriteReport(const ea::string& fileName) const
+{
+    File file(context_, fileName, FILE_WRITE);
+    if (!file.IsOpen())
+    {
+        return false;
+    }
+
+    file.WriteLine("line;operation;time_ms;faces;success");
+    for (const FBatchOperation& operation : operations_)
+    {
+        file.WriteLine(Format("{};{};{:.3f};{};{}", operation.line, operation.text, operation.timeMs, operation.numFaces,
+            operation.success ? 1 : 0));
+    }
+    return true;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <EASTL/string.h>
+#include <EASTL/vector.h>
+
+#include <Urho3D/Core/Context.h>
+
+#include "Figure.h"
+#include "FigureAoBaker.h"
+#include "FigureCsg.h"
+#include "FigureExtrudeDrag.h"
+#include "FigureSnap.h"
+#include "FigureTopology.h"
+#include "FigureUvAtlas.h"
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+    struct FBatchOperation
+    {
+        unsigned line{0};
+        ea::string text;
+        float timeMs{0.f};
+        unsigned numFaces{0};
+        bool success{false};
+    };
+
+/// Runs Figure operations from a script file without any window or GPU.
+/// One operation per line, '#' starts a comment:
+///   clear
+///   box x y z
+///   import file.rfig
+///   merge file.rfig [x y z]
+///   extrude faceIdx [times]
+///   extrude_dir up|down|left|right|forward|back [times]
+///   extrude_drag up|down|left|right|forward|back distance [steps]
+///   select faceIdx | select ring|loop faceIdx [edge]
+///   extrude_selection [times]
+///   generate walls|cave|city size [seed]
+///   csg union|subtract|intersect x0 y0 z0 x1 y1 z1
+///   csg union|subtract|intersect file.rfig [x y z]
+///   snap count [radius]
+///   ao [samples] [radius]
+///   uvpack [texelsPerUnit]
+///   weld [epsilon]
+///   export file.rfig|file.mdl
+/// Every operation is timed, so the same scripts serve as performance regression jobs.
+class BatchRunner
+{
+public:
+    explicit BatchRunner(Context* context);
+
+    /// Run script, stops at the first failed operation.
+    bool Run(const ea::string& scriptFileName);
+    /// Write per-operation timings as CSV.
+    bool WriteReport(const ea::string& fileName) const;
+
+    const ea::vector<FBatchOperation>& GetOperations() const { return operations_; }
+    Figure& GetFigure() { return figure_; }
+
+private:
+    bool Execute(const ea::vector<ea::string>& args);
+    bool LoadFigure(const ea::string& fileName, Figure& figure) const;
+    bool SaveFigure(const ea::string& fileName) const;
+
+    Context* context_;
+    Figure figure_;
+    FigureCsg csg_;
+    FigureSnap snap_;
+    FigureTopology topology_;
+    FigureAoBaker ao_;
+    FigureUvAtlas uvAtlas_;
+    ea::vector<FBatchOperation> operations_;
+};
+
+}
@@ -0,0 +1,228 @@
+#include "Bvh.h"
+
+using namespace Redi;
+
+Bvh::Bvh(EMemoryCategory category)
+    : nodes_(CategoryAllocator(category)),
+    items_(CategoryAllocator(category)),
+    parents_(CategoryAllocator(category)),
+    itemLeaves_(CategoryAllocator(category))
+{
+}
+
+void Bvh::Clear()
+{
+    nodes_.clear();
+    items_.clear();
+    parents_.clear();
+    itemLeaves_.clear();
+}
+
+void Bvh::Build(const BoxVector& boxes, unsigned maxLeafSize)
+{
+    Clear();
+    if (boxes.empty())
+    {
+        return;
+    }
+
+    ea::vector<Vector3> centers(boxes.size());
+    items_.resize(boxes.size());
+    for (unsigned i = 0; i < boxes.size(); ++i)
+    {
+        centers[i] = boxes[i].Center();
+        items_[i] = i;
+    }
+    nodes_.reserve(boxes.size() * 2 / Max(maxLeafSize, 1u) + 1);
+    nodes_.emplace_back();
+    BuildNode(boxes, centers, 0, 0, boxes.size(), maxLeafSize);
+
+    parents_.assign(nodes_.size(), M_MAX_UNSIGNED);
+    itemLeaves_.resize(items_.size());
+    for (unsigned index = 0; index < nodes_.size(); ++index)
+    {
+        const FBvhNode& node = nodes_[index];
+        if (node.count > 0)
+        {
+            for (unsigned i = node.first; i < node.first + node.count; ++i)
+            {
+                itemLeaves_[items_[i]] = index;
+            }
+        }
+        else
+        {
+            parents_[node.first] = index;
+            parents_[node.first + 1] = index;
+        }
+    }
+}
+
+void Bvh::BuildNode(const BoxVector& boxes, const ea::vector<Vector3>& centers, unsigned index, unsigned first,
+    unsigned count, unsigned maxLeafSize)
+{
+    BoundingBox box;
+    BoundingBox centerBox;
+    for (unsigned i = first; i < first + count; ++i)
+    {
+        box.Merge(boxes[items_[i]]);
+        centerBox.Merge(centers[items_[i]]);
+    }
+    nodes_[index].box = box;
+
+    const Vector3 size = centerBox.Size();
+    const unsigned axis = size.x_ >= size.y_ && size.x_ >= size.z_ ? 0 : (size.y_ >= size.z_ ? 1 : 2);
+    if (count <= maxLeafSize)
+    {
+        nodes_[index].first = first;
+        nodes_[index].count = count;
+        return;
+    }
+
+    // Partition around the middle of the centroid bounds, in place within the item range. Coincident centroids
+    // end up on one side and fall back to an even split.
+    const float middle = centerBox.Center().Data()[axis];
+    unsigned lo = first;
+    unsigned hi = first + count;
+    while (lo < hi)
+    {
+        if (centers[items_[lo]].Data()[axis] < middle)
+        {
+            ++lo;
+        }
+        else
+        {
+            ea::swap(items_[lo], items_[--hi]);
+        }
+    }
+    unsigned leftCount = lo - first;
+    if (leftCount == 0 || leftCount == count)
+    {
+        leftCount = count / 2;
+    }
+
+    const unsigned left = nodes_.size();
+    nodes_.emplace_back();
+    nodes_.emplace_back();
+    nodes_[index].first = left;
+    nodes_[index].count = 0;
+    BuildNode(boxes, centers, left, first, leftCount, maxLeafSize);
+    BuildNode(boxes, centers, left + 1, first + leftCount, count - leftCount, maxLeafSize);
+}
+
+void Bvh::Refit(const BoxVector& boxes)
+{
+    if (nodes_.empty() || boxes.size() != items_.size())
+    {
+        Build(boxes);
+        return;
+    }
+    RefitNode(0, boxes);
+}
+
+void Bvh::RefitItems(const ea::vector<unsigned>& items, const BoxVector& boxes)
+{
+    if (nodes_.empty() || boxes.size() != items_.size())
+    {
+        Build(boxes);
+        return;
+    }
+
+    for (unsigned item : items)
+    {
+        if (item >= itemLeaves_.size())
+        {
+            continue;
+        }
+        unsigned index = itemLeaves_[item];
+        BoundingBox box;
+        const FBvhNode& leaf = nodes_[index];
+        for (unsigned i = leaf.first; i < leaf.first + leaf.count; ++i)
+        {
+            box.Merge(boxes[items_[i]]);
+        }
+        nodes_[index].box = box;
+
+        // Ancestors merge their two children, stop where the box no longer changes.
+        for (index = parents_[index]; index != M_MAX_UNSIGNED; index = parents_[index])
+        {
+            const FBvhNode& node = nodes_[index];
+            BoundingBox merged = nodes_[node.first].box;
+            merged.Merge(nodes_[node.first + 1].box);
+            if (merged.min_ == node.box.min_ && merged.max_ == node.box.max_)
+            {
+                break;
+            }
+            nodes_[index].box = merged;
+        }
+    }
+}
+
+void Bvh::RefitNode(unsigned index, const BoxVector& boxes)
+{
+    FBvhNode& node = nodes_[index];
+    BoundingBox box;
+    if (node.count > 0)
+    {
+        for (unsigned i = node.first; i < node.first + node.count; ++i)
+        {
+            box.Merge(boxes[items_[i]]);
+        }
+    }
+    else
+    {
+        RefitNode(node.first, boxes);
+        RefitNode(node.first + 1, boxes);
+        box.Merge(nodes_[node.first].box);
+        box.Merge(nodes_[node.first + 1].box);
+    }
+    nodes_[index].box = box;
+}
+
+float Bvh::HitDistance(const BoundingBox& box, const Vector3& origin, const Vector3& invDirection)
+{
+    float tx1 = (box.min_.x_ - origin.x_) * invDirection.x_;
+    float tx2 = (box.max_.x_ - origin.x_) * invDirection.x_;
+    float tmin = Min(tx1, tx2);
+    float tmax = Max(tx1, tx2);
+    const float ty1 = (box.min_.y_ - origin.y_) * invDirection.y_;
+    const float ty2 = (box.max_.y_ - origin.y_) * invDirection.y_;
+    tmin = Max(tmin, Min(ty1, ty2));
+    tmax = Min(tmax, Max(ty1, ty2));
+    const float tz1 = (box.min_.z_ - origin.z_) * invDirection.z_;
+    const float tz2 = (box.max_.z_ - origin.z_) * invDirection.z_;
+    tmin = Max(tmin, Min(tz1, tz2));
+    tmax = Min(tmax, Max(tz1, tz2));
+
+    if (tmax < 0.f || tmin > tmax)
+    {
+        return M_INFINITY;
+    }
+    return Max(tmin, 0.f);
+}
+
+float Bvh::HitTriangle(const Vector3& origin, const Vector3& direction, const Vector3& v0, const Vector3& v1, const Vector3& v2)
+{
+    const Vector3 edge1 = v1 - v0;
+    const Vector3 edge2 = v2 - v0;
+    const Vector3 p = direction.CrossProduct(edge2);
+    const float det = edge1.DotProduct(p);
+    if (Abs(det) < 1e-12f)
+    {
+        return M_INFINITY;
+    }
+    const float invDet = 1.0f / det;
+    const Vector3 t = origin - v0;
+    const float u = t.DotProduct(p) * invDet;
+    if (u < 0.f || u > 1.f)
+    {
+        return M_INFINITY;
+    }
+    const Vector3 q = t.CrossProduct(edge1);
+    const float v = direction.DotProduct(q) * invDet;
+    if (v < 0.f || u + v > 1.f)
+    {
+        return M_INFINITY;
+    }
+    const float distance = edge2.DotProduct(q) * invDet;
+    return distance >= 0.f ? distance : M_INFINITY;
+}
@@ -0,0 +1,192 @@
+#pragma once
+#include <EASTL/fixed_vector.h>
+#include <EASTL/vector.h>
+
+#include <Urho3D/Math/BoundingBox.h>
+#include <Urho3D/Math/MathDefs.h>
+
+#include "MemoryStats.h"
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+    struct FBvhNode
+    {
+        BoundingBox box;
+        /// Leaf: first item in the item list. Inner node: index of the left child, the right one follows it.
+        unsigned first{0};
+        /// Number of items, 0 for inner nodes.
+        unsigned count{0};
+    };
+
+/// Bounding volume hierarchy over item boxes, split at the middle of the longest centroid axis.
+/// Used as the bottom level over Figure faces and as the top level over figures and drawables of FigureRegistry.
+/// Nodes and item lists count in MemoryStats under the category the tree was created for.
+class Bvh
+{
+public:
+    /// Item boxes, counted under the category of their owner.
+    using BoxVector = ea::vector<BoundingBox, CategoryAllocator>;
+
+    explicit Bvh(EMemoryCategory category = MC_PICK);
+
+    void Build(const BoxVector& boxes, unsigned maxLeafSize = 4);
+    /// Recompute node boxes for moved items without changing the tree, boxes must have the size used by Build.
+    void Refit(const BoxVector& boxes);
+    /// Refit only the leaves holding items and their ancestors, O(k log n) for k moved items.
+    void RefitItems(const ea::vector<unsigned>& items, const BoxVector& boxes);
+    void Clear();
+
+    bool IsEmpty() const { return nodes_.empty(); }
+    const BoundingBox& GetBounds() const { return nodes_.front().box; }
+    unsigned GetNumItems() const { return items_.size(); }
+    unsigned GetNumNodes() const { return nodes_.size(); }
+
+    /// Visit leaf items whose boxes the ray enters before maxDistance, nearest nodes first.
+    /// leafTest(item, maxDistance) tests one item and lowers maxDistance on a closer hit.
+    /// Direction does not need to be normalized, distances are in units of its length.
+    template <class T> void Raycast(const Vector3& origin, const Vector3& direction, float& maxDistance, T&& leafTest) const;
+
+    /// Any-hit traversal of up to 32 rays from one origin, for occlusion. Bit i of activeMask stays set while ray i is
+    /// unblocked. leafTest(item, rays) tests the rays set in rays and clears the bits of those the item blocks.
+    /// A node is visited once for the whole packet when any active ray enters it, so coherent rays share the work.
+    template <class T> void OccludePacket(const Vector3& origin, const Vector3* invDirections, unsigned count, float maxDistance,
+        unsigned& activeMask, T&& leafTest) const;
+
+    /// Entry distance of the ray into box, M_INFINITY when missed.
+    static float HitDistance(const BoundingBox& box, const Vector3& origin, const Vector3& invDirection);
+    /// Two-sided ray triangle distance (Moller-Trumbore), M_INFINITY when missed.
+    static float HitTriangle(const Vector3& origin, const Vector3& direction, const Vector3& v0, const Vector3& v1, const Vector3& v2);
+
+private:
+    void BuildNode(const BoxVector& boxes, const ea::vector<Vector3>& centers, unsigned index, unsigned first,
+        unsigned count, unsigned maxLeafSize);
+    void RefitNode(unsigned index, const BoxVector& boxes);
+
+    ea::vector<FBvhNode, CategoryAllocator> nodes_;
+    ea::vector<unsigned, CategoryAllocator> items_;
+    /// Parent of every node, M_MAX_UNSIGNED for the root.
+    ea::vector<unsigned, CategoryAllocator> parents_;
+    /// Leaf node of every item.
+    ea::vector<unsigned, CategoryAllocator> itemLeaves_;
+};
+
+template <class T> void Bvh::Raycast(const Vector3& origin, const Vector3& direction, float& maxDistance, T&& leafTest) const
+{
+    if (nodes_.empty())
+    {
+        return;
+    }
+
+    const Vector3 invDirection(1.0f / direction.x_, 1.0f / direction.y_, 1.0f / direction.z_);
+    struct FEntry
+    {
+        unsigned node;
+        float distance;
+    };
+    // Midpoint splits of the centroid bounds are usually shallow, but clustered items can nest deeper than any
+    // fixed bound. The stack starts inline and spills to the heap rather than dropping subtrees.
+    ea::fixed_vector<FEntry, 64> stack;
+
+    const float rootDistance = HitDistance(nodes_[0].box, origin, invDirection);
+    if (rootDistance < maxDistance)
+    {
+        stack.push_back({0, rootDistance});
+    }
+
+    while (!stack.empty())
+    {
+        const FEntry entry = stack.back();
+        stack.pop_back();
+        if (entry.distance >= maxDistance)
+        {
+            continue;
+        }
+
+        const FBvhNode& node = nodes_[entry.node];
+        if (node.count > 0)
+        {
+            for (unsigned i = node.first; i < node.first + node.count; ++i)
+            {
+                leafTest(items_[i], maxDistance);
+            }
+            continue;
+        }
+
+        const float left = HitDistance(nodes_[node.first].box, origin, invDirection);
+        const float right = HitDistance(nodes_[node.first + 1].box, origin, invDirection);
+        // Far child first, so the near one is popped next.
+        const bool leftNear = left <= right;
+        const FEntry nearEntry{leftNear ? node.first : node.first + 1, leftNear ? left : right};
+        const FEntry farEntry{leftNear ? node.first + 1 : node.first, leftNear ? right : left};
+        if (farEntry.distance < maxDistance)
+        {
+            stack.push_back(farEntry);
+        }
+        if (nearEntry.distance < maxDistance)
+        {
+            stack.push_back(nearEntry);
+        }
+    }
+}
+
+template <class T> void Bvh::OccludePacket(const Vector3& origin, const Vector3* invDirections, unsigned count, float maxDistance,
+    unsigned& activeMask, T&& leafTest) const
+{
+    if (nodes_.empty())
+    {
+        return;
+    }
+
+    struct FEntry
+    {
+        unsigned node;
+        unsigned mask;
+    };
+    // Grows past the inline entries like the Raycast stack.
+    ea::fixed_vector<FEntry, 64> stack;
+    stack.push_back({0, activeMask});
+
+    while (!stack.empty() && activeMask != 0)
+    {
+        const FEntry entry = stack.back();
+        stack.pop_back();
+        const unsigned mask = entry.mask & activeMask;
+        if (mask == 0)
+        {
+            continue;
+        }
+
+        const FBvhNode& node = nodes_[entry.node];
+        unsigned hitMask = 0;
+        for (unsigned i = 0; i < count; ++i)
+        {
+            if ((mask & (1u << i)) && HitDistance(node.box, origin, invDirections[i]) < maxDistance)
+            {
+                hitMask |= 1u << i;
+            }
+        }
+        if (hitMask == 0)
+        {
+            continue;
+        }
+
+        if (node.count > 0)
+        {
+            unsigned rays = hitMask;
+            for (unsigned i = node.first; i < node.first + node.count && rays != 0; ++i)
+            {
+                leafTest(items_[i], rays);
+            }
+            activeMask &= ~(hitMask & ~rays);
+            continue;
+        }
+
+        stack.push_back({node.first + 1, hitMask});
+        stack.push_back({node.first, hitMask});
+    }
+}
+
+}
@@ -0,0 +1,250 @@
+#include "EventLog.h"
+
+#include <Urho3D/Core/Mutex.h>
+#include <Urho3D/Core/StringUtils.h>
+#include <Urho3D/Core/Thread.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/Log.h>
+
+#include <EASTL/sort.h>
+#include <EASTL/unique_ptr.h>
+#include <EASTL/vector.h>
+
+#include <chrono>
+
+using namespace Redi;
+
+namespace
+{
+    /// Records per thread ring, a power of two.
+    const unsigned RING_SIZE = 4096;
+    /// Sink sleep between drains.
+    const unsigned SINK_INTERVAL_MS = 10;
+
+    const char* categoryNames[EC_COUNT] = {"pick", "edit", "input", "io"};
+
+    /// Text of each EEventFormat, every {} takes the next argument.
+    const char* formatTexts[] = {
+        "candidate face {} at {}",
+        "hit face {} at {}",
+        "miss",
+        "select face {}, {} selected",
+        "extrude {} faces by {}",
+        "material {} to {} faces",
+        "mouse button {}",
+        "{} strings loaded"
+    };
+    static_assert(sizeof(formatTexts) / sizeof(formatTexts[0]) == EF_COUNT, "Every EEventFormat needs a text");
+
+    /// Written only by its thread at head, read only by the sink at tail.
+    struct FEventRing
+    {
+        FEventRecord records[RING_SIZE];
+        std::atomic<unsigned> head{0};
+        std::atomic<unsigned> tail{0};
+        /// Records lost to a full ring, written by the owning thread only.
+        std::atomic<unsigned long long> dropped{0};
+        unsigned thread{0};
+    };
+
+    Mutex ringsMutex;
+    /// Rings live until exit, a thread may write again after a sink restart.
+    ea::vector<ea::unique_ptr<FEventRing>> rings;
+    thread_local FEventRing* threadRing = nullptr;
+
+    const auto startTime = std::chrono::steady_clock::now();
+
+    FEventRing& GetThreadRing()
+    {
+        if (!threadRing)
+        {
+            MutexLock lock(ringsMutex);
+            rings.push_back(ea::make_unique<FEventRing>());
+            rings.back()->thread = rings.size() - 1;
+            threadRing = rings.back().get();
+        }
+        return *threadRing;
+    }
+
+    ea::string FormatRecord(const FEventRecord& record, unsigned thread)
+    {
+        ea::string line = Format("{:.3f} t{} {}: ", record.timeUs / 1000.0, thread, categoryNames[GetEventCategory(record.format)]);
+        unsigned arg = 0;
+        for (const char* c = formatTexts[record.format]; *c; ++c)
+        {
+            if (c[0] == '{' && c[1] == '}')
+            {
+                if (arg < record.numArgs)
+                    line += (record.floatMask & (1u << arg)) ? Format("{:.3f}", record.args[arg].f) : Format("{}", record.args[arg].i);
+                ++arg;
+                ++c;
+            }
+            else
+            {
+                line += *c;
+            }
+        }
+        return line;
+    }
+
+    class EventSink : public Thread
+    {
+    public:
+        EventSink(Context* context, const ea::string& fileName)
+            : file_(context, fileName, FILE_WRITE)
+        {
+        }
+
+        bool IsOpen() const { return file_.IsOpen(); }
+
+        void ThreadFunction() override
+        {
+            while (shouldRun_)
+            {
+                Drain();
+                Thread::Sleep(SINK_INTERVAL_MS);
+            }
+            Drain();
+            file_.Flush();
+        }
+
+    private:
+        struct FDrained
+        {
+            FEventRecord record;
+            unsigned thread;
+        };
+
+        void Drain()
+        {
+            ea::vector<FEventRing*> current;
+            {
+                MutexLock lock(ringsMutex);
+                for (const ea::unique_ptr<FEventRing>& ring : rings)
+                {
+                    current.push_back(ring.get());
+                }
+            }
+
+            drained_.clear();
+            for (FEventRing* ring : current)
+            {
+                const unsigned head = ring->head.load(std::memory_order_acquire);
+                unsigned tail = ring->tail.load(std::memory_order_relaxed);
+                for (; tail != head; ++tail)
+                {
+                    drained_.push_back(FDrained{ring->records[tail & (RING_SIZE - 1)], ring->thread});
+                }
+                ring->tail.store(tail, std::memory_order_release);
+            }
+            if (drained_.empty())
+            {
+                return;
+            }
+
+            ea::sort(drained_.begin(), drained_.end(), [](const FDrained& lhs, const FDrained& rhs)
+                { return lhs.record.timeUs < rhs.record.timeUs; });
+            for (const FDrained& entry : drained_)
+            {
+                file_.WriteLine(FormatRecord(entry.record, entry.thread));
+            }
+            file_.Flush();
+        }
+
+        File file_;
+        ea::vector<FDrained> drained_;
+    };
+
+    ea::unique_ptr<EventSink> sink;
+}
+
+bool EventLog::Start(Context* context, const ea::string& fileName)
+{
+    Stop();
+    auto newSink = ea::make_unique<EventSink>(context, fileName);
+    if (!newSink->IsOpen())
+    {
+        URHO3D_LOGERROR("Event log {} could not be opened", fileName);
+        return false;
+    }
+    sink = ea::move(newSink);
+    sink->Run();
+    URHO3D_LOGINFO("Event log started at {}", fileName);
+    return true;
+}
+
+void EventLog::Stop()
+{
+    if (sink)
+    {
+        sink->Stop();
+        sink.reset();
+    }
+}
+
+bool EventLog::IsRunning()
+{
+    return sink != nullptr;
+}
+
+void EventLog::SetEnabled(EEventCategory category, bool enable)
+{
+    if (enable)
+        enabledMask_.fetch_or(1u << category, std::memory_order_relaxed);
+    else
+        enabledMask_.fetch_and(~(1u << category), std::memory_order_relaxed);
+}
+
+const char* EventLog::GetCategoryName(EEventCategory category)
+{
+    return category < EC_COUNT ? categoryNames[category] : "";
+}
+
+EEventCategory EventLog::ParseCategory(const ea::string& name)
+{
+    for (unsigned i = 0; i < EC_COUNT; ++i)
+    {
+        if (name.comparei(categoryNames[i]) == 0)
+        {
+            return (EEventCategory)i;
+        }
+    }
+    return EC_COUNT;
+}
+
+unsigned long long EventLog::GetNumWritten()
+{
+    MutexLock lock(ringsMutex);
+    unsigned long long count = 0;
+    for (const ea::unique_ptr<FEventRing>& ring : rings)
+    {
+        count += ring->head.load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+unsigned long long EventLog::GetNumDropped()
+{
+    MutexLock lock(ringsMutex);
+    unsigned long long count = 0;
+    for (const ea::unique_ptr<FEventRing>& ring : rings)
+    {
+        count += ring->dropped.load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+void EventLog::Push(FEventRecord& record)
+{
+    FEventRing& ring = GetThreadRing();
+    const unsigned head = ring.head.load(std::memory_order_relaxed);
+    if (head - ring.tail.load(std::memory_order_acquire) >= RING_SIZE)
+    {
+        ring.dropped.store(ring.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+
+    record.timeUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+    ring.records[head & (RING_SIZE - 1)] = record;
+    ring.head.store(head + 1, std::memory_order_release);
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include <EASTL/string.h>
+
+#include <atomic>
+#include <type_traits>
+
+#include <Urho3D/Core/Context.h>
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+    enum EEventCategory : unsigned
+    {
+        EC_PICK, EC_EDIT, EC_INPUT, EC_IO, EC_COUNT
+    };
+
+    /// Every event kind, grouped by category. The text of each is in the format table of EventLog.cpp.
+    enum EEventFormat : unsigned short
+    {
+        EF_PICK_CANDIDATE, EF_PICK_HIT, EF_PICK_MISS,
+        EF_EDIT_SELECT, EF_EDIT_EXTRUDE, EF_EDIT_MATERIAL,
+        EF_INPUT_MOUSE,
+        EF_IO_STRINGS,
+        EF_COUNT
+    };
+
+    /// Category of a format, folded at compile time for constant formats.
+    constexpr EEventCategory GetEventCategory(EEventFormat format)
+    {
+        return format <= EF_PICK_MISS ? EC_PICK : format <= EF_EDIT_MATERIAL ? EC_EDIT : format <= EF_INPUT_MOUSE ? EC_INPUT : EC_IO;
+    }
+
+    /// Integer or float argument, records never own memory.
+    union FEventArg
+    {
+        long long i;
+        double f;
+    };
+
+    struct FEventRecord
+    {
+        /// Microseconds since program start.
+        unsigned long long timeUs;
+        EEventFormat format;
+        unsigned short numArgs;
+        /// Bit per argument, set for floats.
+        unsigned floatMask;
+        FEventArg args[4];
+    };
+
+/// Structured binary event log for hot paths. REDI_EVENT tests one bit of the category mask and returns when the
+/// category is disabled, without evaluating its arguments. Enabled events are copied as fixed size records into a
+/// lock-free ring owned by the writing thread, one producer and one consumer, no lock and no allocation.
+/// A sink thread drains all rings, orders records by time and formats them into a text file. A full ring drops
+/// new records and counts them.
+class EventLog
+{
+public:
+    /// Start the sink thread writing to fileName. Records written before Start wait in their rings.
+    static bool Start(Context* context, const ea::string& fileName);
+    /// Drain remaining records and stop the sink thread.
+    static void Stop();
+    static bool IsRunning();
+
+    static bool IsEnabled(EEventCategory category) { return (enabledMask_.load(std::memory_order_relaxed) & (1u << category)) != 0; }
+    static void SetEnabled(EEventCategory category, bool enable);
+    static const char* GetCategoryName(EEventCategory category);
+    /// Category by name, EC_COUNT when unknown.
+    static EEventCategory ParseCategory(const ea::string& name);
+
+    static unsigned long long GetNumWritten();
+    static unsigned long long GetNumDropped();
+
+    /// Record event with up to four integer, enum or float arguments. Use REDI_EVENT on hot paths.
+    template <class... T>
+    static void Write(EEventFormat format, T... args)
+    {
+        static_assert(sizeof...(T) <= 4, "Event records hold four arguments");
+        FEventRecord record;
+        record.format = format;
+        record.numArgs = sizeof...(T);
+        record.floatMask = 0;
+        unsigned index = 0;
+        (SetArg(record, index++, args), ...);
+        Push(record);
+    }
+
+private:
+    template <class T>
+    static void SetArg(FEventRecord& record, unsigned index, T value)
+    {
+        static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T>, "Event arguments are numbers");
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            record.args[index].f = value;
+            record.floatMask |= 1u << index;
+        }
+        else
+        {
+            record.args[index].i = (long long)value;
+        }
+    }
+
+    /// Stamp the time and append to the ring of the calling thread.
+    static void Push(FEventRecord& record);
+
+    inline static std::atomic<unsigned> enabledMask_{0};
+};
+
+}
+
+/// Record an event when its category is enabled. Arguments are evaluated only then.
+#define REDI_EVENT(format, ...) \
+    do { if (Redi::EventLog::IsEnabled(Redi::GetEventCategory(format))) Redi::EventLog::Write(format, ##__VA_ARGS__); } while (false)
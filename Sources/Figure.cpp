@@ -1,9 +1,33 @@
 ﻿#include "Figure.h"
+#include "EventLog.h"
 
 #include <Urho3D/IO/Log.h>
 
+#include <EASTL/algorithm.h>
+#include <EASTL/functional.h>
+#include <EASTL/sort.h>
+#include <EASTL/unordered_map.h>
+
 using namespace Redi;
 
+namespace
+{
+    /// Chunk block ready to be written, copied first when a reader still holds it. Only the main thread adds
+    /// references, so a block held by nobody else stays unshared while it is written.
+    template <class T> T& GetWritableBlock(ea::shared_ptr<T>& block)
+    {
+        if (!block)
+        {
+            block = ea::make_shared<T>();
+        }
+        else if (block.use_count() > 1)
+        {
+            block = ea::make_shared<T>(*block);
+        }
+        return *block;
+    }
+}
+
 Figure::Figure(EFigureType stype)
 {
     type_ = stype;
@@ -11,7 +35,11 @@ Figure::Figure(EFigureType stype)
     face_id = 0;
 }
 
-Vector3 Figure::GetFaceNormal(const ea::vector<FVertex>& vertices) const
+Figure::~Figure()
+{
+}
+
+Vector3 Figure::GetFaceNormal(const FVertexArray& vertices) const
 {
     float vx1 = vertices[0].position.x_ - vertices[1].position.x_;
     float vy1 = vertices[0].position.y_ - vertices[1].position.y_;
@@ -33,31 +61,683 @@ Vector3 Figure::GetFaceNormal(const ea::vector<FVertex>& vertices) const
 void Figure::AddFace(const FVertex& v1, const FVertex& v2, const FVertex& v3, const FVertex& v4)
 {
     face_id ++;
-    const ea::vector<FVertex> vertices = {v1, v2, v3, v4};
+    const FVertexArray vertices = {v1, v2, v3, v4};
     const Vector3 normal = GetFaceNormal(vertices);
     const BoundingBox bb = CalculateMinMax(vertices);
     const FFace face = FFace::CreateFace((int)face_id, vertices, normal, bb);
     faces.push_back(face);
+    face_lookup_[face_id] = faces.size() - 1;
+    MarkDirty(faces.size() - 1);
 }
 
-void Figure::render(Urho3D::DebugRenderer* debug_renderer)
+void Figure::AddFaces(const FVertex* vertices, unsigned numFaces)
 {
-    const float size = 0.1f;
-    for(const FFace* face = faces.begin(); face != faces.end(); ++face)
+    if (numFaces == 0)
+    {
+        return;
+    }
+
+    const unsigned first = faces.size();
+    Reserve(first + numFaces);
+    for (unsigned i = 0; i < numFaces; ++i, vertices += 4)
+    {
+        FFace& face = faces.push_back();
+        face.idx = (int)++face_id;
+        face.vertices.assign(vertices, vertices + 4);
+        face.normal = GetFaceNormal(face.vertices);
+        face.boundingBox = CalculateMinMax(face.vertices);
+        face_lookup_[face_id] = faces.size() - 1;
+    }
+    for (unsigned i = first; i < faces.size(); ++i)
+    {
+        WriteChunkVertices(i);
+        WriteChunkMaterial(i);
+    }
+
+    ++revision_;
+    const unsigned lastChunk = (faces.size() - 1) / FACES_PER_CHUNK;
+    chunk_revisions_.resize(lastChunk + 1, 0);
+    chunk_topology_revisions_.resize(lastChunk + 1, 0);
+    chunk_moved_ranges_.resize(lastChunk + 1);
+    for (unsigned chunk = first / FACES_PER_CHUNK; chunk <= lastChunk; ++chunk)
+    {
+        chunk_revisions_[chunk] = revision_;
+        chunk_topology_revisions_[chunk] = revision_;
+        chunk_moved_ranges_[chunk].clear();
+    }
+}
+
+void Figure::Reserve(unsigned numFaces)
+{
+    faces.reserve(numFaces);
+    face_lookup_.reserve(numFaces);
+}
+
+void Figure::MarkDirty(unsigned arrayIndex)
+{
+    ++revision_;
+    const unsigned chunk = arrayIndex / FACES_PER_CHUNK;
+    if (chunk >= chunk_revisions_.size())
+    {
+        chunk_revisions_.resize(chunk + 1, 0);
+        chunk_topology_revisions_.resize(chunk + 1, 0);
+        chunk_moved_ranges_.resize(chunk + 1);
+    }
+    chunk_revisions_[chunk] = revision_;
+    chunk_topology_revisions_[chunk] = revision_;
+    chunk_moved_ranges_[chunk].clear();
+    WriteChunkVertices(arrayIndex);
+    WriteChunkMaterial(arrayIndex);
+}
+
+void Figure::MarkMoved(unsigned arrayIndex)
+{
+    ++revision_;
+    const unsigned chunk = arrayIndex / FACES_PER_CHUNK;
+    if (chunk >= chunk_revisions_.size())
+    {
+        MarkDirty(arrayIndex);
+        return;
+    }
+    WriteChunkVertices(arrayIndex);
+    chunk_revisions_[chunk] = revision_;
+
+    // Faces moved by one edit are mostly neighbours in the array, they extend the newest range.
+    auto& ranges = chunk_moved_ranges_[chunk];
+    if (!ranges.empty() && arrayIndex + 1 >= ranges.back().begin && arrayIndex <= ranges.back().end)
+    {
+        FMovedRange& range = ranges.back();
+        range.revision = revision_;
+        range.begin = Min(range.begin, arrayIndex);
+        range.end = Max(range.end, arrayIndex + 1);
+        return;
+    }
+    if (ranges.size() == MAX_MOVED_RANGES)
+    {
+        // Readers synced before both refit their union, readers synced after the older one see no difference.
+        ranges[1].begin = Min(ranges[0].begin, ranges[1].begin);
+        ranges[1].end = Max(ranges[0].end, ranges[1].end);
+        ranges.erase(ranges.begin());
+    }
+    ranges.push_back(FMovedRange{revision_, arrayIndex, arrayIndex + 1});
+}
+
+void Figure::MarkAllDirty()
+{
+    ++revision_;
+    chunk_revisions_.assign(GetNumChunks(), revision_);
+    chunk_topology_revisions_.assign(GetNumChunks(), revision_);
+    chunk_moved_ranges_.clear();
+    chunk_moved_ranges_.resize(GetNumChunks());
+
+    // Readers keep the blocks they hold, the figure starts over with new ones.
+    chunk_vertices_.clear();
+    chunk_vertices_.resize(GetNumChunks());
+    chunk_materials_.clear();
+    chunk_materials_.resize(GetNumChunks());
+    for (unsigned chunk = 0; chunk < chunk_vertices_.size(); ++chunk)
     {
-        if(selected_faces.contains(face->idx))
+        const unsigned begin = chunk * FACES_PER_CHUNK;
+        const unsigned end = Min(begin + FACES_PER_CHUNK, (unsigned)faces.size());
+        chunk_vertices_[chunk] = ea::make_shared<FVertexArray>((end - begin) * 4);
+        chunk_materials_[chunk] = ea::make_shared<ea::vector<unsigned char>>(end - begin);
+        FVertex* block = chunk_vertices_[chunk]->data();
+        unsigned char* materials = chunk_materials_[chunk]->data();
+        for (unsigned i = begin; i < end; ++i)
         {
-            debug_renderer->AddPolygon(face->vertices[0].position, face->vertices[1].position, face->vertices[2].position, face->vertices[3].position, Color(1.0f, 0.f, 0.f, 0.5f), false);
+            const FVertexArray& vertices = faces[i].vertices;
+            for (unsigned corner = 0; corner < 4 && corner < vertices.size(); ++corner)
+            {
+                block[(i - begin) * 4 + corner] = vertices[corner];
+            }
+            materials[i - begin] = faces[i].material;
         }
-        else
+    }
+}
+
+void Figure::WriteChunkVertices(unsigned arrayIndex)
+{
+    const unsigned chunk = arrayIndex / FACES_PER_CHUNK;
+    chunk_vertices_.resize(GetNumChunks());
+    if (chunk >= chunk_vertices_.size())
+    {
+        return;
+    }
+
+    FVertexArray& block = GetWritableBlock(chunk_vertices_[chunk]);
+    block.resize(Min((unsigned)faces.size() - chunk * FACES_PER_CHUNK, FACES_PER_CHUNK) * 4);
+    if (arrayIndex < faces.size())
+    {
+        const FVertexArray& vertices = faces[arrayIndex].vertices;
+        for (unsigned corner = 0; corner < 4 && corner < vertices.size(); ++corner)
         {
-            debug_renderer->AddPolygon(face->vertices[0].position, face->vertices[1].position, face->vertices[2].position, face->vertices[3].position, Color(0.4f, 0.4f, 0.4f, 1.0f), true);
+            block[(arrayIndex % FACES_PER_CHUNK) * 4 + corner] = vertices[corner];
+        }
+    }
+}
+
+void Figure::WriteChunkMaterial(unsigned arrayIndex)
+{
+    const unsigned chunk = arrayIndex / FACES_PER_CHUNK;
+    chunk_materials_.resize(GetNumChunks());
+    if (chunk >= chunk_materials_.size())
+    {
+        return;
+    }
+
+    ea::vector<unsigned char>& block = GetWritableBlock(chunk_materials_[chunk]);
+    block.resize(Min((unsigned)faces.size() - chunk * FACES_PER_CHUNK, FACES_PER_CHUNK));
+    if (arrayIndex < faces.size())
+    {
+        block[arrayIndex % FACES_PER_CHUNK] = faces[arrayIndex].material;
+    }
+}
+
+ea::shared_ptr<const FVertexArray> Figure::GetChunkVertices(unsigned chunk) const
+{
+    return chunk < chunk_vertices_.size() ? chunk_vertices_[chunk] : ea::shared_ptr<const FVertexArray>();
+}
+
+ea::shared_ptr<const ea::vector<unsigned char>> Figure::GetChunkMaterials(unsigned chunk) const
+{
+    return chunk < chunk_materials_.size() ? chunk_materials_[chunk] : ea::shared_ptr<const ea::vector<unsigned char>>();
+}
+
+void Figure::RebuildLookup()
+{
+    face_lookup_.clear();
+    for (unsigned i = 0; i < faces.size(); ++i)
+    {
+        face_lookup_[faces[i].idx] = i;
+    }
+}
+
+void Figure::AddFaceDirection(EFaceDirection eDirection, const Vector3& Position)
+{
+    FVertex corners[4];
+    if (GetFaceCorners(eDirection, Position, corners))
+    {
+        AddFace(corners[0], corners[1], corners[2], corners[3]);
+    }
+}
+
+bool Figure::GetFaceCorners(EFaceDirection eDirection, const Vector3& Position, FVertex* corners)
+{
+    switch (eDirection)
+    {
+    default:
+        return false;
+    case FD_FORWARD:
+        //forward
+    {
+        corners[0] = { Position + Vector3(0.5f,-0.5f,-0.5f), Vector3(0,0,1), Vector2(1,1) };
+        corners[1] = { Position + Vector3(0.5f,0.5f,-0.5f), Vector3(0,0,1), Vector2(1,0) };
+        corners[2] = { Position + Vector3(-0.5f,0.5f,-0.5f), Vector3(0,0,1), Vector2(0,0) };
+        corners[3] = { Position + Vector3(-0.5f,-0.5f,-0.5f), Vector3(0,0,1), Vector2(0,1) };
+    }
+    return true;
+    case FD_BACK:
+        //backward
+    {
+        corners[0] = { Position + Vector3(-0.5f,-0.5f,0.5f), Vector3(0,0,-1), Vector2(0,1) };
+        corners[1] = { Position + Vector3(-0.5f,0.5f,0.5f), Vector3(0,0,-1), Vector2(0,0) };
+        corners[2] = { Position + Vector3(0.5f,0.5f,0.5f), Vector3(0,0,-1), Vector2(1,0) };
+        corners[3] = { Position + Vector3(0.5f,-0.5f,0.5f), Vector3(0,0,-1), Vector2(1,1) };
+    }
+    return true;
+    case FD_LEFT:
+        //left
+    {
+        corners[0] = { Position + Vector3(-0.5f,-0.5f,0.5f), Vector3(-1,0,0), Vector2(0,1) };
+        corners[1] = { Position + Vector3(-0.5f,0.5f,0.5f), Vector3(-1,0,0), Vector2(0,0) };
+        corners[2] = { Position + Vector3(-0.5f,0.5f,-0.5f), Vector3(-1,0,0), Vector2(1,0) };
+        corners[3] = { Position + Vector3(-0.5f,-0.5f,-0.5f), Vector3(-1,0,0), Vector2(1,1) };
+    }
+    return true;
+    case FD_RIGHT:
+        //right
+    {
+        corners[0] = { Position + Vector3(0.5f,-0.5f,-0.5f), Vector3(1,0,0), Vector2(1,1) };
+        corners[1] = { Position + Vector3(0.5f,0.5f,-0.5f), Vector3(1,0,0), Vector2(1,0) };
+        corners[2] = { Position + Vector3(0.5f,0.5f,0.5f), Vector3(1,0,0), Vector2(0,0) };
+        corners[3] = { Position + Vector3(0.5f,-0.5f,0.5f), Vector3(1,0,0), Vector2(0,1) };
+    }
+    return true;
+    case FD_UP:
+        //top
+    {
+        corners[0] = { Position + Vector3(-0.5f,+0.5f,-0.5f), Vector3(0,1,0), Vector2(0,1) };
+        corners[1] = { Position + Vector3(-0.5f,+0.5f,0.5f), Vector3(0,1,0), Vector2(0,0) };
+        corners[2] = { Position + Vector3(0.5f,+0.5f,0.5f), Vector3(0,1,0), Vector2(1,0) };
+        corners[3] = { Position + Vector3(0.5f,+0.5f,-0.5f), Vector3(0,1,0), Vector2(1,1) };
+    }
+    return true;
+    case FD_DOWN:
+        //bottom
+    {
+        corners[0] = { Position + Vector3(0.5f,-0.5f,-0.5f), Vector3(0,-1,0), Vector2(1,1) };
+        corners[1] = { Position + Vector3(0.5f,-0.5f,0.5f), Vector3(0,-1,0), Vector2(1,0) };
+        corners[2] = { Position + Vector3(-0.5f,-0.5f,0.5f), Vector3(0,-1,0), Vector2(0,0) };
+        corners[3] = { Position + Vector3(-0.5f,-0.5f,-0.5f), Vector3(0,-1,0), Vector2(0,1) };
+    }
+    return true;
+    }
+}
+
+IntVector3 Figure::GetFaceSide(EFaceDirection eDirection)
+{
+    switch (eDirection)
+    {
+    default:
+        return IntVector3::ZERO;
+    case FD_FORWARD:
+        return IntVector3(0, 0, -1);
+    case FD_BACK:
+        return IntVector3(0, 0, 1);
+    case FD_LEFT:
+        return IntVector3(-1, 0, 0);
+    case FD_RIGHT:
+        return IntVector3(1, 0, 0);
+    case FD_UP:
+        return IntVector3(0, 1, 0);
+    case FD_DOWN:
+        return IntVector3(0, -1, 0);
+    }
+}
+
+void Figure::RemoveFaces(ea::vector<unsigned> arrayIndices)
+{
+    ea::sort(arrayIndices.begin(), arrayIndices.end(), ea::greater<unsigned>());
+    arrayIndices.erase(ea::unique(arrayIndices.begin(), arrayIndices.end()), arrayIndices.end());
+
+    // Descending order, so the last face is never one still waiting for removal.
+    for (unsigned index : arrayIndices)
+    {
+        if (index >= faces.size())
+        {
+            continue;
+        }
+        selected_faces.erase(faces[index].idx);
+        if (hovered_face_ == faces[index].idx)
+        {
+            hovered_face_ = -1;
+        }
+        face_lookup_.erase(faces[index].idx);
+
+        const unsigned last = faces.size() - 1;
+        if (index != last)
+        {
+            faces[index] = ea::move(faces[last]);
+            face_lookup_[faces[index].idx] = index;
+            MarkDirty(index);
+        }
+        faces.pop_back();
+        MarkDirty(last);
+    }
+    chunk_revisions_.resize(GetNumChunks());
+    chunk_topology_revisions_.resize(GetNumChunks());
+    chunk_moved_ranges_.resize(GetNumChunks());
+}
+
+void Figure::AddBox(const Vector3& Position)
+{
+    AddFaceDirection(FD_FORWARD, Position);
+    AddFaceDirection(FD_BACK, Position);
+    AddFaceDirection(FD_LEFT, Position);
+    AddFaceDirection(FD_RIGHT, Position);
+    AddFaceDirection(FD_UP, Position);
+    AddFaceDirection(FD_DOWN, Position);
+}
+
+bool Figure::ExtrudeFace(unsigned idx)
+{
+    const FFace* face = GetFace(idx);
+    if (!face || (face->state & FS_LOCKED))
+    {
+        return false;
+    }
+
+    const ea::vector<EFaceDirection> directions = {FD_FORWARD, FD_BACK, FD_LEFT, FD_RIGHT, FD_UP, FD_DOWN};
+    const EFaceDirection eDirection = GetFaceDirection(face);
+    const EFaceDirection iDirection = InvertFaceDirection(eDirection);
+    const Vector3 normal = face->normal;
+    const Vector3 origin = face->boundingBox.Center() + normal/2.0f;
+    MoveFace(idx, normal);
+    for(EFaceDirection fDir : directions)
+    {
+        if(eDirection != fDir && iDirection != fDir)
+        {
+            AddFaceDirection(fDir, origin + GetVector3(fDir)/2.0f);
+        }
+    }
+    return true;
+}
+
+unsigned Figure::ExtrudeSelection()
+{
+    // Centres of the faces that move with a bit per direction they move in. A side between two faces moving the
+    // same way lies inside the extruded block, so only sides on the boundary of the selection get a wall.
+    ea::unordered_map<IntVector3, unsigned, FCellKeyHash> moving;
+    ea::vector<unsigned> extruded;
+    unsigned numExtruded = 0;
+    for (unsigned idx : selected_faces)
+    {
+        const FFace* face = GetFace(idx);
+        if (!face || (face->state & FS_LOCKED))
+        {
+            continue;
+        }
+        const EFaceDirection eDirection = GetFaceDirection(face);
+        if (eDirection == FD_NONE)
+        {
+            // Faces off the axes have no grid neighbours, they extrude on their own.
+            numExtruded += ExtrudeFace(idx);
+            continue;
+        }
+        moving[GetPositionKey(face->boundingBox.Center())] |= 1u << eDirection;
+        extruded.push_back(idx);
+    }
+
+    const ea::vector<EFaceDirection> directions = {FD_FORWARD, FD_BACK, FD_LEFT, FD_RIGHT, FD_UP, FD_DOWN};
+    for (unsigned idx : extruded)
+    {
+        const FFace* face = GetFace(idx);
+        const EFaceDirection eDirection = GetFaceDirection(face);
+        const EFaceDirection iDirection = InvertFaceDirection(eDirection);
+        const Vector3 normal = face->normal;
+        const Vector3 center = face->boundingBox.Center();
+        const Vector3 origin = center + normal/2.0f;
+        MoveFace(idx, normal);
+        for (EFaceDirection fDir : directions)
+        {
+            if (eDirection == fDir || iDirection == fDir)
+            {
+                continue;
+            }
+            const auto neighbour = moving.find(GetPositionKey(center + GetVector3(fDir)));
+            if (neighbour == moving.end() || !(neighbour->second & (1u << eDirection)))
+            {
+                AddFaceDirection(fDir, origin + GetVector3(fDir)/2.0f);
+            }
+        }
+        ++numExtruded;
+    }
+    return numExtruded;
+}
+
+void Figure::Merge(const Figure& other, const Vector3& offset)
+{
+    Reserve(faces.size() + other.faces.size());
+    for (const FFace& face : other.faces)
+    {
+        FVertex v[4];
+        for (unsigned i = 0; i < 4; ++i)
+        {
+            v[i] = face.vertices[i];
+            v[i].position += offset;
+        }
+        AddFace(v[0], v[1], v[2], v[3]);
+        SetFaceMaterial(faces.back().idx, face.material);
+    }
+}
+
+IntVector3 Figure::GetCellKey(const Vector3& position, float cellSize)
+{
+    const double invCellSize = 1.0 / Max(cellSize, M_EPSILON);
+    // One short of the int range, so a neighbour cell offset cannot overflow.
+    const auto axis = [invCellSize](float v) { return (int)Clamp(floor(v * invCellSize + 0.5), -2147483646.0, 2147483646.0); };
+    return IntVector3(axis(position.x_), axis(position.y_), axis(position.z_));
+}
+
+unsigned Figure::Weld(float epsilon)
+{
+    epsilon = Max(epsilon, M_EPSILON);
+    const float epsilonSquared = epsilon * epsilon;
+
+    // Canonical positions chained per cell of size epsilon. Two vertices closer than epsilon lie in the same or
+    // neighbouring cells, so probing the 27 cells around a vertex finds every canonical position it may snap to.
+    ea::unordered_map<IntVector3, unsigned, FCellKeyHash> cellHeads;
+    ea::vector<Vector3> canonical;
+    ea::vector<unsigned> nextInCell;
+    ea::vector<unsigned> cornerIds(faces.size() * 4, M_MAX_UNSIGNED);
+    for (unsigned i = 0; i < faces.size(); ++i)
+    {
+        FFace& face = faces[i];
+        for (unsigned j = 0; j < face.vertices.size(); ++j)
+        {
+            Vector3& position = face.vertices[j].position;
+            const IntVector3 cell = GetCellKey(position, epsilon);
+            unsigned found = M_MAX_UNSIGNED;
+            for (int dz = -1; dz <= 1 && found == M_MAX_UNSIGNED; ++dz)
+            {
+                for (int dy = -1; dy <= 1 && found == M_MAX_UNSIGNED; ++dy)
+                {
+                    for (int dx = -1; dx <= 1 && found == M_MAX_UNSIGNED; ++dx)
+                    {
+                        const auto it = cellHeads.find(cell + IntVector3(dx, dy, dz));
+                        for (unsigned c = it != cellHeads.end() ? it->second : M_MAX_UNSIGNED; c != M_MAX_UNSIGNED; c = nextInCell[c])
+                        {
+                            if ((canonical[c] - position).LengthSquared() <= epsilonSquared)
+                            {
+                                found = c;
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+            if (found == M_MAX_UNSIGNED)
+            {
+                found = canonical.size();
+                canonical.push_back(position);
+                auto head = cellHeads.emplace(cell, M_MAX_UNSIGNED).first;
+                nextInCell.push_back(head->second);
+                head->second = found;
+            }
+            position = canonical[found];
+            if (j < 4)
+            {
+                cornerIds[i * 4 + j] = found;
+            }
+        }
+        face.boundingBox = CalculateMinMax(face.vertices);
+        ea::sort(cornerIds.begin() + i * 4, cornerIds.begin() + i * 4 + 4);
+    }
+
+    // Faces sharing all four corners are either duplicates or two sides of an internal wall, neither is visible.
+    // Sorting by the corner ids groups them exactly, in array order within a group.
+    ea::vector<unsigned> order(faces.size());
+    for (unsigned i = 0; i < order.size(); ++i)
+    {
+        order[i] = i;
+    }
+    const auto corners = [&cornerIds](unsigned face) { return &cornerIds[face * 4]; };
+    ea::sort(order.begin(), order.end(), [&](unsigned lhs, unsigned rhs)
+    {
+        if (!ea::equal(corners(lhs), corners(lhs) + 4, corners(rhs)))
+        {
+            return ea::lexicographical_compare(corners(lhs), corners(lhs) + 4, corners(rhs), corners(rhs) + 4);
+        }
+        return lhs < rhs;
+    });
+
+    ea::vector<bool> removed(faces.size(), false);
+    unsigned numRemoved = 0;
+    for (unsigned k = 0; k < order.size();)
+    {
+        unsigned end = k + 1;
+        while (end < order.size() && ea::equal(corners(order[k]), corners(order[k]) + 4, corners(order[end])))
+        {
+            ++end;
+        }
+        unsigned kept = order[k];
+        for (unsigned m = k + 1; m < end; ++m)
+        {
+            const unsigned i = order[m];
+            if (removed[kept])
+            {
+                kept = i;
+                continue;
+            }
+            if (faces[kept].normal.DotProduct(faces[i].normal) < 0.0f)
+            {
+                removed[kept] = true;
+                ++numRemoved;
+            }
+            removed[i] = true;
+            ++numRemoved;
+        }
+        k = end;
+    }
+
+    if (numRemoved > 0)
+    {
+        unsigned dst = 0;
+        for (unsigned i = 0; i < faces.size(); ++i)
+        {
+            if (!removed[i])
+            {
+                if (dst != i)
+                {
+                    faces[dst] = ea::move(faces[i]);
+                }
+                ++dst;
+            }
+        }
+        faces.resize(dst);
+        RebuildLookup();
+        PruneSelection();
+    }
+    MarkAllDirty();
+    return numRemoved;
+}
+
+void Figure::Clear()
+{
+    faces.clear();
+    selected_faces.clear();
+    hovered_face_ = -1;
+    chunk_state_ranges_.clear();
+    face_lookup_.clear();
+    face_id = 0;
+    MarkAllDirty();
+}
+
+bool Figure::Save(Serializer& dest) const
+{
+    dest.WriteFileID("RFIG");
+    dest.WriteUInt(type_);
+    dest.WriteUInt(faces.size());
+    for (const FFace& face : faces)
+    {
+        for (const FVertex& vertex : face.vertices)
+        {
+            dest.WriteVector3(vertex.position);
+            dest.WriteVector3(vertex.normal);
+            dest.WriteVector2(vertex.uv);
+        }
+    }
+
+    // Optional trailing block, files without it load with material 0.
+    dest.WriteFileID("RMAT");
+    for (const FFace& face : faces)
+    {
+        dest.WriteUByte(face.material);
+    }
+    return true;
+}
+
+bool Figure::Load(Deserializer& source)
+{
+    if (source.ReadFileID() != "RFIG")
+    {
+        return false;
+    }
+
+    // The face count is only trusted as far as the bytes left can hold, four vertices of 32 bytes per face.
+    const auto type = (EFigureType)source.ReadUInt();
+    const unsigned numFaces = source.ReadUInt();
+    const unsigned bytesLeft = source.GetSize() - source.GetPosition();
+    if (numFaces > bytesLeft / (4 * 32))
+    {
+        URHO3D_LOGERROR("Figure {} claims {} faces, only {} bytes left", source.GetName(), numFaces, bytesLeft);
+        return false;
+    }
+
+    Clear();
+    type_ = type;
+    Reserve(numFaces);
+    for (unsigned i = 0; i < numFaces && !source.IsEof(); ++i)
+    {
+        FVertex v[4];
+        for (FVertex& vertex : v)
+        {
+            vertex.position = source.ReadVector3();
+            vertex.normal = source.ReadVector3();
+            vertex.uv = source.ReadVector2();
+        }
+        AddFace(v[0], v[1], v[2], v[3]);
+    }
+
+    if (!source.IsEof() && source.ReadFileID() == "RMAT")
+    {
+        for (FFace& face : faces)
+        {
+            face.material = source.ReadUByte();
+        }
+        MarkAllDirty();
+        // Readers that only follow material revisions, like the outliner and the autosave, pick the slots up too.
+        ++material_revision_;
+        chunk_material_revisions_.assign(GetNumChunks(), material_revision_);
+    }
+    return faces.size() == numFaces;
+}
+
+Color Figure::GetMaterialColor(unsigned char material)
+{
+    if (material == 0)
+    {
+        return Color(0.4f, 0.4f, 0.4f, 1.0f);
+    }
+    // Golden ratio hue steps keep neighbouring slots apart.
+    Color color;
+    color.FromHSV(fmodf(material * 0.618034f, 1.0f), 0.45f, 0.75f, 1.0f);
+    return color;
+}
+
+void Figure::render(Urho3D::DebugRenderer* debug_renderer, bool drawFaces, const FOcclusionArray* occlusion)
+{
+    const float size = 0.1f;
+    for(const FFace* face = faces.begin(); face != faces.end(); ++face)
+    {
+        // With a GPU mesh the state tint comes from its state stream, only the plain debug view draws it here.
+        if(drawFaces)
+        {
+            Color color = GetMaterialColor(face->material);
+            const unsigned corner = (unsigned)(face - faces.begin()) * 4;
+            if(occlusion && corner + 3 < occlusion->size())
+            {
+                const unsigned open = (*occlusion)[corner] + (*occlusion)[corner + 1] + (*occlusion)[corner + 2] + (*occlusion)[corner + 3];
+                color = color * (open / (4.0f * 255.0f));
+                color.a_ = 1.0f;
+            }
+            if(face->state & FS_HOVERED)
+                color = Color(1.0f, 0.f, 0.f, 0.5f);
+            else if(face->state & FS_SELECTED)
+                color = Color(1.0f, 0.6f, 0.f, 0.5f);
+            else if(face->state & FS_LOCKED)
+                color = Color(0.2f, 0.3f, 0.6f, 1.0f);
+            debug_renderer->AddPolygon(face->vertices[0].position, face->vertices[1].position, face->vertices[2].position, face->vertices[3].position, color, color.a_ >= 1.0f);
         }
         debug_renderer->AddLine(face->vertices[0].position, face->vertices[1].position, Color(0.2f, 0.2f, 0.2f, 0.5f), true);
         debug_renderer->AddLine(face->vertices[1].position, face->vertices[2].position, Color(0.2f, 0.2f, 0.2f, 0.5f), true);
         debug_renderer->AddLine(face->vertices[2].position, face->vertices[3].position, Color(0.2f, 0.2f, 0.2f, 0.5f), true);
         debug_renderer->AddLine(face->vertices[3].position, face->vertices[0].position, Color(0.2f, 0.2f, 0.2f, 0.5f), true);
     }
+
+    // Four outline lines per face and two triangles per filled face.
+    const size_t numFilled = drawFaces ? faces.size() : 0;
+    MemoryStats::SetUsage(MC_DEBUG, faces.size() * 4 * sizeof(DebugLine) + numFilled * 2 * sizeof(DebugTriangle));
 }
 
 Vector2 Figure::Cross(float a1, float b1, float c1, float a2, float b2, float c2)
@@ -120,7 +800,7 @@ float Figure::GetAngleBetweenPoints(const Vector3& Position1, const Vector3& For
 	
 }
 
-BoundingBox Figure::CalculateMinMax(const ea::vector<FVertex>& vertices) const
+BoundingBox Figure::CalculateMinMax(const FVertexArray& vertices) const
 {
     Vector3 Min(vertices[0].position.x_, vertices[0].position.y_, vertices[0].position.z_);
     Vector3 Max(vertices[0].position.x_, vertices[0].position.y_, vertices[0].position.z_);
@@ -194,9 +874,8 @@ bool Figure::TraceLine(Ray CameraRay, const float maxDistance, Vector3& hitPos)
     {
         normal = Vector3::FORWARD;
     }
-    //URHO3D_LOGINFO("{}", v);
 
-    selected_faces.clear();
+    int hovered = -1;
 
     ea::vector<FFaceRay> shotFaces;
 
@@ -205,7 +884,7 @@ bool Figure::TraceLine(Ray CameraRay, const float maxDistance, Vector3& hitPos)
         float v = CameraRay.HitDistance(faces[i].boundingBox);
         if(v > 0.1f && v < maxDistance)
         {
-            //URHO3D_LOGINFO("face:{}, v:{}", faces[i].idx, v);
+            REDI_EVENT(EF_PICK_CANDIDATE, faces[i].idx, v);
             const FFaceRay fRay = {i, GetDistance(faces[i], CameraRay.origin_)};
             shotFaces.push_back(fRay);
         }
@@ -219,10 +898,12 @@ bool Figure::TraceLine(Ray CameraRay, const float maxDistance, Vector3& hitPos)
         FFace face = faces[shotFaces[0].array_index];
         hitPos = Vector3(CameraRay.origin_ + CameraRay.direction_ * shotFaces[0].distance);
         hitPos -= Vector3(CameraRay.direction_ * Abs(Vector3(hitPos - face.boundingBox.Center()).Length()));
-        selected_faces.push_back(face.idx);
+        hovered = face.idx;
     }
 
-    if(selected_faces.size() > 0)
+    SetHoveredFace(hovered);
+
+    if(hovered_face_ >= 0)
     {
         return true;
     }
@@ -232,21 +913,195 @@ bool Figure::TraceLine(Ray CameraRay, const float maxDistance, Vector3& hitPos)
     }
 }
 
-Redi::FFace* Figure::GetSelectedFace()
+Redi::FFace* Figure::GetHoveredFace()
+{
+    return hovered_face_ >= 0 ? GetFace(hovered_face_) : nullptr;
+}
+
+void Figure::SetHoveredFace(int idx)
+{
+    if (idx == hovered_face_)
+    {
+        return;
+    }
+    if (hovered_face_ >= 0)
+        SetFaceState(hovered_face_, FS_HOVERED, false);
+    hovered_face_ = idx;
+    if (hovered_face_ >= 0)
+        SetFaceState(hovered_face_, FS_HOVERED, true);
+}
+
+void Figure::SelectFace(unsigned idx, bool add)
+{
+    if (!add)
+    {
+        ClearSelection();
+    }
+    if (GetFaceIndex(idx) != M_MAX_UNSIGNED && !IsLocked(idx))
+    {
+        selected_faces.insert(idx);
+        SetFaceState(idx, FS_SELECTED, true);
+    }
+}
+
+void Figure::SelectFaces(const ea::vector<unsigned>& ids, bool add)
+{
+    if (!add)
+    {
+        ClearSelection();
+    }
+    for (unsigned idx : ids)
+    {
+        if (GetFaceIndex(idx) != M_MAX_UNSIGNED && !IsLocked(idx))
+        {
+            selected_faces.insert(idx);
+            SetFaceState(idx, FS_SELECTED, true);
+        }
+    }
+}
+
+void Figure::ClearSelection()
+{
+    for (unsigned idx : selected_faces)
+    {
+        SetFaceState(idx, FS_SELECTED, false);
+    }
+    selected_faces.clear();
+}
+
+void Figure::SetLocked(unsigned idx, bool locked)
+{
+    if (locked && IsSelected(idx))
+    {
+        selected_faces.erase(idx);
+        SetFaceState(idx, FS_SELECTED, false);
+    }
+    SetFaceState(idx, FS_LOCKED, locked);
+}
+
+void Figure::SetFaceMaterial(unsigned idx, unsigned char material)
+{
+    const unsigned index = GetFaceIndex(idx);
+    if (index != M_MAX_UNSIGNED && faces[index].material != material)
+    {
+        faces[index].material = material;
+        MarkStateRange(index);
+        WriteChunkMaterial(index);
+
+        const unsigned chunk = index / FACES_PER_CHUNK;
+        if (chunk >= chunk_material_revisions_.size())
+        {
+            chunk_material_revisions_.resize(chunk + 1, 0);
+        }
+        chunk_material_revisions_[chunk] = ++material_revision_;
+    }
+}
+
+bool Figure::IsLocked(unsigned idx) const
+{
+    const unsigned index = GetFaceIndex(idx);
+    return index != M_MAX_UNSIGNED && (faces[index].state & FS_LOCKED) != 0;
+}
+
+void Figure::SetFaceState(unsigned idx, EFaceState bit, bool enable)
+{
+    const unsigned index = GetFaceIndex(idx);
+    if (index == M_MAX_UNSIGNED)
+    {
+        return;
+    }
+
+    FFace& face = faces[index];
+    const unsigned char state = enable ? face.state | bit : face.state & ~bit;
+    if (state == face.state)
+    {
+        return;
+    }
+    face.state = state;
+    MarkStateRange(index);
+}
+
+void Figure::MarkStateRange(unsigned index)
+{
+    const unsigned chunk = index / FACES_PER_CHUNK;
+    if (chunk >= chunk_state_ranges_.size())
+    {
+        chunk_state_ranges_.resize(chunk + 1);
+    }
+    FStateRange& range = chunk_state_ranges_[chunk];
+    range.begin = Min(range.begin, index);
+    range.end = Max(range.end, index + 1);
+}
+
+bool Figure::GetStateRange(unsigned chunk, unsigned& begin, unsigned& end) const
+{
+    if (chunk >= chunk_state_ranges_.size() || chunk_state_ranges_[chunk].begin >= chunk_state_ranges_[chunk].end)
+    {
+        return false;
+    }
+    begin = chunk_state_ranges_[chunk].begin;
+    end = Min(chunk_state_ranges_[chunk].end, (unsigned)faces.size());
+    return begin < end;
+}
+
+bool Figure::GetMovedRange(unsigned chunk, unsigned revision, unsigned& begin, unsigned& end) const
 {
-    if(selected_faces.size() > 0)
+    // Revisions only grow, a reader synced at or after the last topology change has every later move in the ranges.
+    if (chunk >= chunk_moved_ranges_.size() || revision > revision_ || revision < chunk_topology_revisions_[chunk])
+    {
+        return false;
+    }
+    begin = M_MAX_UNSIGNED;
+    end = 0;
+    for (const FMovedRange& range : chunk_moved_ranges_[chunk])
     {
-        for (FFace* face = faces.begin(); face != faces.end(); ++face)
+        if (range.revision > revision)
         {
-            if(face->idx == selected_faces[0])
-            {
-                return face;
-            }
+            begin = Min(begin, range.begin);
+            end = Max(end, range.end);
         }
     }
+    end = Min(end, (unsigned)faces.size());
+    if (begin >= end)
+    {
+        begin = end;
+    }
+    return true;
+}
+
+void Figure::ClearStateRange(unsigned chunk)
+{
+    if (chunk < chunk_state_ranges_.size())
+    {
+        chunk_state_ranges_[chunk] = FStateRange();
+    }
+}
+
+void Figure::PruneSelection()
+{
+    for (auto it = selected_faces.begin(); it != selected_faces.end();)
+    {
+        it = GetFaceIndex(*it) == M_MAX_UNSIGNED ? selected_faces.erase(it) : ea::next(it);
+    }
+    if (hovered_face_ >= 0 && GetFaceIndex(hovered_face_) == M_MAX_UNSIGNED)
+    {
+        hovered_face_ = -1;
+    }
+}
+
+Redi::FFace* Figure::GetFace(unsigned idx)
+{
+    const unsigned index = GetFaceIndex(idx);
+    return index != M_MAX_UNSIGNED ? &faces[index] : nullptr;
 }
 
-Redi::EFaceDirection Figure::GetFaceDirection(FFace* face)
+unsigned Figure::GetFaceIndex(unsigned idx) const
+{
+    const auto it = face_lookup_.find(idx);
+    return it != face_lookup_.end() ? it->second : M_MAX_UNSIGNED;
+}
+
+Redi::EFaceDirection Figure::GetFaceDirection(const FFace* face) const
 {
     if(face->normal.Equals(Vector3::UP))
     {
@@ -319,28 +1174,35 @@ Urho3D::Vector3 Figure::GetVector3(EFaceDirection eDirection)
 
 void Figure::MoveFace(unsigned idx, const Vector3& offset)
 {
-    for(const FFace* oldFace = faces.begin(); oldFace != faces.end(); ++oldFace)
+    // Updated in place so the face keeps its chunk and only that chunk is rebuilt.
+    const unsigned index = GetFaceIndex(idx);
+    if (index == M_MAX_UNSIGNED)
     {
-        if(oldFace->idx == idx)
-        {
-            ea::vector<FVertex> n_vertices;
-            for(unsigned j=0; j<oldFace->vertices.size(); ++j)
-            {
-                const FVertex vertex{Vector3(oldFace->vertices[j].position + offset), oldFace->vertices[j].normal, oldFace->vertices[j].uv};
-                n_vertices.push_back(vertex);
-            }
+        return;
+    }
 
-            if(selected_faces.contains(oldFace->idx))
-            {
-                selected_faces.clear();
-            }
+    FFace& face = faces[index];
+    for (FVertex& vertex : face.vertices)
+    {
+        vertex.position += offset;
+    }
+    face.boundingBox = CalculateMinMax(face.vertices);
+    MarkMoved(index);
+}
 
-            const BoundingBox bb = CalculateMinMax(n_vertices);
-            Redi::FFace nFace = FFace::CreateFace(oldFace->idx, n_vertices, Vector3(oldFace->normal), bb);
+void Figure::SetFaceVertices(unsigned idx, const Vector3* positions)
+{
+    const unsigned index = GetFaceIndex(idx);
+    if (index == M_MAX_UNSIGNED)
+    {
+        return;
+    }
 
-            faces.erase(oldFace);
-            faces.push_back(nFace);
-            break;
-        }
+    FFace& face = faces[index];
+    for (unsigned i = 0; i < face.vertices.size() && i < 4; ++i)
+    {
+        face.vertices[i].position = positions[i];
     }
+    face.boundingBox = CalculateMinMax(face.vertices);
+    MarkMoved(index);
 }
@@ -1,9 +1,15 @@
 ﻿#pragma once
 #include "Structures.h"
+#include "EASTL/fixed_vector.h"
+#include "EASTL/shared_ptr.h"
 #include "EASTL/vector.h"
+#include "EASTL/unordered_map.h"
+#include "EASTL/unordered_set.h"
 
 #include <Urho3D/Math/Ray.h>
 #include <Urho3D/Graphics/DebugRenderer.h>
+#include <Urho3D/IO/Deserializer.h>
+#include <Urho3D/IO/Serializer.h>
 
 namespace Redi
 {
@@ -20,31 +26,168 @@ private:
     unsigned face_id;
     EFigureType type_;
 
-    ea::vector<unsigned> selected_faces;
+    /// Persistent selection by face idx, drawn by render and extruded by ExtrudeSelection.
+    ea::unordered_set<unsigned, ea::hash<unsigned>, ea::equal_to<unsigned>, TrackedAllocator<MC_SELECTION>> selected_faces;
+    /// Face under the cursor from the last TraceLine, -1 when none.
+    int hovered_face_{-1};
+
+    /// Incremented on every change, chunk revisions hold the value of their last change.
+    unsigned revision_{0};
+    ea::vector<unsigned> chunk_revisions_;
+    /// Face idx to index in faces.
+    ea::unordered_map<unsigned, unsigned, ea::hash<unsigned>, ea::equal_to<unsigned>, TrackedAllocator<MC_MESH>> face_lookup_;
+
+    void MarkAllDirty();
+    void RebuildLookup();
+    /// Drop selected and hovered ids of faces that no longer exist.
+    void PruneSelection();
+    /// Set or clear EFaceState bit of face idx and record the change for the GPU state stream.
+    void SetFaceState(unsigned idx, EFaceState bit, bool enable);
+
+    /// Faces [begin, end) of one chunk whose state changed since the last ClearStateRange.
+    struct FStateRange
+    {
+        unsigned begin{M_MAX_UNSIGNED};
+        unsigned end{0};
+    };
+    ea::vector<FStateRange> chunk_state_ranges_;
+    /// Add faces[index] to the state range of its chunk.
+    void MarkStateRange(unsigned index);
+    /// Material changes travel through the state stream and leave chunk revisions alone, these track them instead.
+    unsigned material_revision_{0};
+    ea::vector<unsigned> chunk_material_revisions_;
+    /// Revision of the last change to the faces of a chunk other than vertex positions.
+    ea::vector<unsigned> chunk_topology_revisions_;
+    /// Faces [begin, end) of one chunk moved by an edit, revision is the last move of any of them.
+    struct FMovedRange
+    {
+        unsigned revision{0};
+        unsigned begin{0};
+        unsigned end{0};
+    };
+    /// Moved ranges kept per chunk, the oldest two merge when another one is added.
+    static const unsigned MAX_MOVED_RANGES = 8;
+    /// Faces of a chunk moved since its last topology change, newest range last. Readers ask for the moves after the
+    /// revision they synced, so nothing is cleared and each of them only refits what moved since its own sync.
+    ea::vector<ea::fixed_vector<FMovedRange, MAX_MOVED_RANGES, false>> chunk_moved_ranges_;
+    /// Mark chunk holding faces[arrayIndex] as changed in vertex positions only.
+    void MarkMoved(unsigned arrayIndex);
+    /// Flat vertices of every chunk, four per face, and face materials, kept in step with faces by the Mark
+    /// functions and SetFaceMaterial. Copy on write, a block a reader still holds is replaced by a copy before it changes.
+    ea::vector<ea::shared_ptr<FVertexArray>> chunk_vertices_;
+    ea::vector<ea::shared_ptr<ea::vector<unsigned char>>> chunk_materials_;
+    /// Write faces[arrayIndex] into the vertex block of its chunk, a removed face shrinks the block.
+    void WriteChunkVertices(unsigned arrayIndex);
+    /// Same for the material block.
+    void WriteChunkMaterial(unsigned arrayIndex);
 
 public:
-    ea::vector<FFace> faces;
+    /// Faces are grouped by array index into chunks, renderers rebuild only chunks whose revision changed.
+    static const unsigned FACES_PER_CHUNK = 4096;
+
+    ea::vector<FFace, TrackedAllocator<MC_MESH>> faces;
 
-    Vector3 GetFaceNormal(const ea::vector<FVertex>& vertices) const;
+    Vector3 GetFaceNormal(const FVertexArray& vertices) const;
     
     void AddFace(const FVertex& v1, const FVertex& v2, const FVertex& v3, const FVertex& v4);
+    /// Append numFaces quads, four vertices each. Marks every touched chunk dirty once instead of once per face.
+    void AddFaces(const FVertex* vertices, unsigned numFaces);
+    void Reserve(unsigned numFaces);
+    /// Corners of the unit box face facing eDirection, box centered at Position. Returns false for FD_NONE.
+    static bool GetFaceCorners(EFaceDirection eDirection, const Vector3& Position, FVertex* corners);
+    /// Offset of the neighbour cell a face of GetFaceCorners separates its box from.
+    static IntVector3 GetFaceSide(EFaceDirection eDirection);
+    /// Nearest cell of position in a grid of cellSize. Cells are full 32-bit integers per axis and clamp at the
+    /// ends of their range instead of wrapping onto unrelated positions.
+    static IntVector3 GetCellKey(const Vector3& position, float cellSize);
+    /// Cell of position on the 1/256 grid corners are matched on by topology, uv charts and subdivision.
+    static IntVector3 GetPositionKey(const Vector3& position) { return GetCellKey(position, 1.0f / 256.0f); }
+    /// Remove faces at array indices by moving the last faces into their place, so only touched chunks change.
+    void RemoveFaces(ea::vector<unsigned> arrayIndices);
+    /// Add unit quad facing eDirection of the unit box centered at Position.
+    void AddFaceDirection(EFaceDirection eDirection, const Vector3& Position);
+    /// Add six faces of the unit box centered at Position.
+    void AddBox(const Vector3& Position);
+    /// Move face along its normal by one unit and close the gap with side faces.
+    bool ExtrudeFace(unsigned idx);
+    /// Extrude every selected face like ExtrudeFace, as one block. Selected neighbours moving the same way share
+    /// their side, so walls are only added along the boundary of the selection. Returns number of extruded faces.
+    unsigned ExtrudeSelection();
+    /// Append faces of other figure moved by offset.
+    void Merge(const Figure& other, const Vector3& offset = Vector3::ZERO);
+    /// Snap vertices closer than epsilon together and remove coincident faces left inside the figure. Returns number of removed faces.
+    /// Vertices snap to the first earlier vertex within epsilon, found in their own and the 26 neighbouring cells.
+    unsigned Weld(float epsilon);
+    void Clear();
 
-    void render(DebugRenderer* debug_renderer);
+    bool Save(Serializer& dest) const;
+    bool Load(Deserializer& source);
+
+    /// Mark chunk holding faces[arrayIndex] as changed.
+    void MarkDirty(unsigned arrayIndex);
+    unsigned GetRevision() const { return revision_; }
+    unsigned GetNumChunks() const { return (faces.size() + FACES_PER_CHUNK - 1) / FACES_PER_CHUNK; }
+    unsigned GetChunkRevision(unsigned chunk) const { return chunk < chunk_revisions_.size() ? chunk_revisions_[chunk] : 0; }
+    /// Changes when faces of the chunk were added, removed or replaced, not when they only moved.
+    unsigned GetChunkTopologyRevision(unsigned chunk) const { return chunk < chunk_topology_revisions_.size() ? chunk_topology_revisions_[chunk] : 0; }
+    /// Faces of chunk moved after revision as array indices [begin, end), empty when none moved. Returns false when
+    /// the faces of the chunk were added, removed or replaced since, or revision is not one of this figure, a reader
+    /// synced at chunk revision revision then rebuilds the whole chunk instead of refitting these.
+    bool GetMovedRange(unsigned chunk, unsigned revision, unsigned& begin, unsigned& end) const;
+    /// Vertices of chunk, four per face, null past the last chunk. A returned block never changes, edits go to a copy,
+    /// so other threads can read it while the figure keeps changing.
+    ea::shared_ptr<const FVertexArray> GetChunkVertices(unsigned chunk) const;
+    /// Material of every face of chunk, shared like GetChunkVertices.
+    ea::shared_ptr<const ea::vector<unsigned char>> GetChunkMaterials(unsigned chunk) const;
+    /// Changes whenever any face material changed, chunk revisions do not.
+    unsigned GetMaterialRevision() const { return material_revision_; }
+    /// Changes whenever a face material of the chunk changed.
+    unsigned GetChunkMaterialRevision(unsigned chunk) const { return chunk < chunk_material_revisions_.size() ? chunk_material_revisions_[chunk] : 0; }
+
+    /// Flat colour of a material slot without a texture, slot 0 is the plain grey of untextured figures.
+    static Color GetMaterialColor(unsigned char material);
+    /// Draw outlines and selection, filled faces only when drawFaces is set (no GPU mesh).
+    /// Filled faces are shaded by the mean of their corner occlusion when given, see FigureAoBaker.
+    void render(DebugRenderer* debug_renderer, bool drawFaces = true, const FOcclusionArray* occlusion = nullptr);
     Vector2 Cross(float a1, float b1, float c1, float a2, float b2, float c2);
     FIntersect IntersectLine(const Vector2& pAB1, const Vector2& pAB2, const Vector3& pCD1, const Vector3& pCD2);
     float GetAngleBetweenPoints(const Vector3& Position1, const Vector3& ForwardVector, const Vector3& Position2);
-    BoundingBox CalculateMinMax(const ea::vector<FVertex>& vertices) const;
+    BoundingBox CalculateMinMax(const FVertexArray& vertices) const;
 
     float GetDistance(const FFace& face, const Vector3& origin) const;
 
     bool TraceLine(const Vector3& CameraPosition, const Vector3& CameraDirection, const float maxDistance, Vector3& hitPos);
     bool TraceLine(Ray CameraRay, const float maxDistance, Vector3& hitPos);
 
-    Redi::FFace* GetSelectedFace();
-    Redi::EFaceDirection GetFaceDirection(FFace* face);
+    Redi::FFace* GetHoveredFace();
+    /// Move the hover highlight, -1 clears it. TraceLine does this for its own hit.
+    void SetHoveredFace(int idx);
+    void SelectFace(unsigned idx, bool add = false);
+    void SelectFaces(const ea::vector<unsigned>& ids, bool add = false);
+    void ClearSelection();
+    bool IsSelected(unsigned idx) const { return selected_faces.find(idx) != selected_faces.end(); }
+    unsigned GetNumSelected() const { return selected_faces.size(); }
+    /// Selected face ids, in no particular order.
+    ea::vector<unsigned> GetSelectedFaces() const { return ea::vector<unsigned>(selected_faces.begin(), selected_faces.end()); }
+    /// Assign material slot. Recorded in the state range of the chunk like face state, no geometry rebuild.
+    void SetFaceMaterial(unsigned idx, unsigned char material);
+    /// Locked faces can not be selected or extruded.
+    void SetLocked(unsigned idx, bool locked);
+    bool IsLocked(unsigned idx) const;
+
+    /// Changed state faces of chunk as array indices [begin, end), false when nothing changed.
+    /// State changes never touch chunk revisions, so they cost no geometry rebuild.
+    bool GetStateRange(unsigned chunk, unsigned& begin, unsigned& end) const;
+    void ClearStateRange(unsigned chunk);
+    Redi::FFace* GetFace(unsigned idx);
+    /// Index of face in faces, M_MAX_UNSIGNED when not found.
+    unsigned GetFaceIndex(unsigned idx) const;
+    Redi::EFaceDirection GetFaceDirection(const FFace* face) const;
     Redi::EFaceDirection InvertFaceDirection(EFaceDirection eDirection);
     Urho3D::Vector3 GetVector3(EFaceDirection eDirection);
     void MoveFace(unsigned idx, const Vector3& offset);
+    /// Replace the four corner positions of face idx, keeping its normal. Refits through the moved range of its chunk.
+    void SetFaceVertices(unsigned idx, const Vector3* positions);
     
 };
 
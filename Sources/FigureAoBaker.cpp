@@ -0,0 +1,466 @@
+#include "FigureAoBaker.h"
+
+#include <Urho3D/Core/Thread.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Core/WorkQueue.h>
+#include <Urho3D/IO/Log.h>
+
+#include <EASTL/sort.h>
+
+using namespace Redi;
+
+namespace
+{
+    /// Corners per task, small enough that stealing balances a pass and large enough to amortize the pop.
+    const unsigned CORNERS_PER_TASK = 64;
+    /// Corners traced per pass, chunks with the fewest samples go first so restarted chunks refine quickly.
+    const unsigned CORNERS_PER_PASS = 65536;
+
+    float RadicalInverse(unsigned index, unsigned base)
+    {
+        const float invBase = 1.0f / base;
+        float factor = invBase;
+        float result = 0.f;
+        while (index > 0)
+        {
+            result += (index % base) * factor;
+            index /= base;
+            factor *= invBase;
+        }
+        return result;
+    }
+
+    /// Per corner rotation of the sample pattern, so neighbouring corners do not band.
+    float CornerRotation(unsigned corner)
+    {
+        corner = (corner ^ 61u) ^ (corner >> 16);
+        corner *= 9u;
+        corner ^= corner >> 4;
+        corner *= 0x27d4eb2du;
+        corner ^= corner >> 15;
+        return (corner & 0xffffu) / 65536.0f;
+    }
+}
+
+FigureAoBaker::FigureAoBaker(Context* context)
+    : context_(context)
+{
+}
+
+FigureAoBaker::~FigureAoBaker()
+{
+    while (workerRunning_)
+    {
+        Thread::Sleep(1);
+    }
+}
+
+void FigureAoBaker::SetRadius(float radius)
+{
+    radius_ = Max(radius, M_EPSILON);
+    Restart(BoundingBox(-M_LARGE_VALUE, M_LARGE_VALUE));
+}
+
+void FigureAoBaker::SetMaxSamples(unsigned samples)
+{
+    // Occluded counts are 16-bit per corner.
+    maxSamples_ = Clamp(samples, SAMPLES_PER_PASS, 4096u);
+}
+
+bool FigureAoBaker::IsConverged() const
+{
+    for (unsigned samples : chunkSamples_)
+    {
+        if (samples < maxSamples_)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+float FigureAoBaker::GetProgress() const
+{
+    if (chunkSamples_.empty())
+    {
+        return 1.f;
+    }
+    unsigned samples = 0;
+    for (unsigned chunkSamples : chunkSamples_)
+    {
+        samples += Min(chunkSamples, maxSamples_);
+    }
+    return (float)samples / (chunkSamples_.size() * maxSamples_);
+}
+
+void FigureAoBaker::Restart(const BoundingBox& box)
+{
+    for (unsigned chunk = 0; chunk < chunkBounds_.size(); ++chunk)
+    {
+        if (!chunkBounds_[chunk].Defined() || box.IsInside(chunkBounds_[chunk]) == OUTSIDE)
+        {
+            continue;
+        }
+        chunkSamples_[chunk] = 0;
+        ++chunkEpochs_[chunk];
+        const unsigned begin = Min(chunk * Figure::FACES_PER_CHUNK * 4, (unsigned)occluded_.size());
+        const unsigned end = Min(begin + Figure::FACES_PER_CHUNK * 4, (unsigned)occluded_.size());
+        ea::fill(occluded_.begin() + begin, occluded_.begin() + end, 0);
+    }
+}
+
+void FigureAoBaker::Update(const Figure& figure)
+{
+    if (figure_ != &figure)
+    {
+        if (workerRunning_)
+        {
+            return;
+        }
+        figure_ = &figure;
+        job_.reset();
+        scene_.reset();
+        sceneChunkRevisions_.clear();
+        chunkRevisions_.clear();
+        chunkBounds_.clear();
+        chunkSamples_.clear();
+        chunkEpochs_.clear();
+        aoRevisions_.clear();
+        occluded_.clear();
+        occlusion_.clear();
+    }
+
+    if (job_ && !workerRunning_)
+    {
+        ApplyPass(*job_);
+        lastPassMs_ = job_->timeMs;
+        job_.reset();
+    }
+
+    const unsigned numChunks = figure.GetNumChunks();
+    chunkRevisions_.resize(numChunks, M_MAX_UNSIGNED);
+    chunkBounds_.resize(numChunks);
+    chunkSamples_.resize(numChunks, 0);
+    chunkEpochs_.resize(numChunks, 0);
+    aoRevisions_.resize(numChunks, 0);
+    occluded_.resize(figure.faces.size() * 4, 0);
+    occlusion_.resize(figure.faces.size() * 4, 255);
+
+    // An edit changes occlusion within radius of the old and the new place of the changed faces.
+    for (unsigned chunk = 0; chunk < numChunks; ++chunk)
+    {
+        const unsigned revision = figure.GetChunkRevision(chunk);
+        if (chunkRevisions_[chunk] == revision)
+        {
+            continue;
+        }
+
+        BoundingBox changed;
+        unsigned begin, end;
+        if (scene_ && figure.GetMovedRange(chunk, chunkRevisions_[chunk], begin, end) && end * 4 <= scene_->corners.size())
+        {
+            // Faces that only moved take their old place from the scene copy. Places a face passed through after
+            // the copy was taken were restarted when it got there.
+            for (unsigned i = begin; i < end; ++i)
+            {
+                for (unsigned corner = 0; corner < 4; ++corner)
+                {
+                    changed.Merge(scene_->corners[i * 4 + corner]);
+                }
+                changed.Merge(figure.faces[i].boundingBox);
+            }
+            if (changed.Defined())
+            {
+                chunkBounds_[chunk].Merge(changed);
+            }
+        }
+        else
+        {
+            BoundingBox bounds;
+            begin = chunk * Figure::FACES_PER_CHUNK;
+            end = Min(begin + Figure::FACES_PER_CHUNK, (unsigned)figure.faces.size());
+            for (unsigned i = begin; i < end; ++i)
+            {
+                bounds.Merge(figure.faces[i].boundingBox);
+            }
+            changed = chunkBounds_[chunk];
+            changed.Merge(bounds);
+            chunkBounds_[chunk] = bounds;
+        }
+        chunkRevisions_[chunk] = revision;
+        if (changed.Defined())
+        {
+            Restart(BoundingBox(changed.min_ - Vector3::ONE * radius_, changed.max_ + Vector3::ONE * radius_));
+        }
+    }
+
+    if (!workerRunning_)
+    {
+        StartPass(figure);
+    }
+}
+
+void FigureAoBaker::Bake(const Figure& figure)
+{
+    HiresTimer timer;
+    while (true)
+    {
+        Update(figure);
+        if (!workerRunning_ && !job_ && IsConverged())
+        {
+            break;
+        }
+        if (workerRunning_)
+        {
+            Thread::Sleep(1);
+        }
+    }
+    URHO3D_LOGINFO("Baked occlusion of {} faces in {:.2f} ms", figure.faces.size(), timer.GetUSec(false) / 1000.0f);
+}
+
+bool FigureAoBaker::StartPass(const Figure& figure)
+{
+    ea::vector<unsigned> pending;
+    for (unsigned chunk = 0; chunk < chunkSamples_.size(); ++chunk)
+    {
+        if (chunkSamples_[chunk] < maxSamples_)
+        {
+            pending.push_back(chunk);
+        }
+    }
+    if (pending.empty())
+    {
+        return false;
+    }
+    ea::stable_sort(pending.begin(), pending.end(), [this](unsigned lhs, unsigned rhs) { return chunkSamples_[lhs] < chunkSamples_[rhs]; });
+
+    // Corners and BVH are shared by passes until the next edit.
+    SyncScene(figure);
+
+    auto job = ea::make_shared<FJob>();
+    job->scene = scene_;
+    job->radius = radius_;
+    const unsigned numFaces = figure.faces.size();
+    unsigned numCorners = 0;
+    for (unsigned chunk : pending)
+    {
+        const unsigned begin = chunk * Figure::FACES_PER_CHUNK * 4;
+        const unsigned end = Min(begin + Figure::FACES_PER_CHUNK * 4, numFaces * 4);
+        const unsigned slot = job->chunks.size();
+        job->chunks.push_back(chunk);
+        job->epochs.push_back(chunkEpochs_[chunk]);
+        job->baseSamples.push_back(chunkSamples_[chunk]);
+        job->hitOffsets.push_back(numCorners);
+        for (unsigned first = begin; first < end; first += CORNERS_PER_TASK)
+        {
+            job->tasks.push_back(FTask{slot, first, Min(first + CORNERS_PER_TASK, end), numCorners + first - begin});
+        }
+        numCorners += end - begin;
+        if (numCorners >= CORNERS_PER_PASS)
+        {
+            break;
+        }
+    }
+    // Every corner of the pass is written by its task, nothing to clear.
+    job->hits.resize(numCorners);
+
+    auto* queue = context_->GetSubsystem<WorkQueue>();
+    const unsigned numWorkers = queue ? queue->GetNumThreads() : 0;
+    job->ranges.Reset(job->tasks.size(), Max(numWorkers, 1u));
+    job_ = job;
+    workerRunning_ = true;
+
+    if (numWorkers == 0)
+    {
+        HiresTimer timer;
+        RunWorker(*job, 0);
+        job->timeMs = timer.GetUSec(false) / 1000.0f;
+        workerRunning_ = false;
+        return true;
+    }
+
+    job->numRunning = numWorkers;
+    auto timer = ea::make_shared<HiresTimer>();
+    for (unsigned worker = 0; worker < numWorkers; ++worker)
+    {
+        queue->AddWorkItem([this, job, timer, worker](unsigned)
+        {
+            RunWorker(*job, worker);
+            if (--job->numRunning == 0)
+            {
+                job->timeMs = timer->GetUSec(false) / 1000.0f;
+                workerRunning_ = false;
+            }
+        });
+    }
+    return true;
+}
+
+void FigureAoBaker::ApplyPass(FJob& job)
+{
+    for (unsigned slot = 0; slot < job.chunks.size(); ++slot)
+    {
+        // Chunks restarted while the pass ran were traced against old faces.
+        const unsigned chunk = job.chunks[slot];
+        if (chunk >= chunkSamples_.size() || chunkEpochs_[chunk] != job.epochs[slot] || chunkSamples_[chunk] != job.baseSamples[slot])
+        {
+            continue;
+        }
+
+        const unsigned samples = chunkSamples_[chunk] + SAMPLES_PER_PASS;
+        const unsigned firstHit = job.hitOffsets[slot];
+        const unsigned endHit = slot + 1 < job.hitOffsets.size() ? job.hitOffsets[slot + 1] : job.hits.size();
+        const unsigned begin = chunk * Figure::FACES_PER_CHUNK * 4;
+        const unsigned end = Min(begin + (endHit - firstHit), (unsigned)occluded_.size());
+        for (unsigned corner = begin; corner < end; ++corner)
+        {
+            occluded_[corner] += job.hits[firstHit + corner - begin];
+            occlusion_[corner] = (unsigned char)(255 - occluded_[corner] * 255 / samples);
+        }
+        chunkSamples_[chunk] = samples;
+        ++aoRevisions_[chunk];
+    }
+}
+
+void FigureAoBaker::SyncScene(const Figure& figure)
+{
+    // StartPass only runs with no worker left, so the snapshot can be patched in place.
+    const unsigned numFaces = figure.faces.size();
+    if (!scene_)
+    {
+        scene_ = ea::make_shared<FScene>();
+    }
+    bool changed = scene_->normals.size() != numFaces;
+    scene_->corners.resize(numFaces * 4);
+    scene_->normals.resize(numFaces);
+    sceneChunkRevisions_.resize(figure.GetNumChunks(), M_MAX_UNSIGNED);
+
+    for (unsigned chunk = 0; chunk < sceneChunkRevisions_.size(); ++chunk)
+    {
+        const unsigned revision = figure.GetChunkRevision(chunk);
+        if (sceneChunkRevisions_[chunk] == revision)
+        {
+            continue;
+        }
+        // A chunk whose faces only moved since the copy patches just them.
+        unsigned begin, end;
+        if (!figure.GetMovedRange(chunk, sceneChunkRevisions_[chunk], begin, end))
+        {
+            begin = chunk * Figure::FACES_PER_CHUNK;
+            end = Min(begin + Figure::FACES_PER_CHUNK, numFaces);
+        }
+        sceneChunkRevisions_[chunk] = revision;
+        changed = true;
+
+        for (unsigned i = begin; i < end; ++i)
+        {
+            const FFace& face = figure.faces[i];
+            for (unsigned corner = 0; corner < 4 && corner < face.vertices.size(); ++corner)
+            {
+                scene_->corners[i * 4 + corner] = face.vertices[corner].position;
+            }
+            // Normals of forward and back faces point inside, the side of the face direction points out.
+            const IntVector3 side = Figure::GetFaceSide(figure.GetFaceDirection(&face));
+            scene_->normals[i] = side != IntVector3::ZERO ? Vector3(side) : face.normal;
+        }
+    }
+
+    if (changed)
+    {
+        scene_->state = 0;
+    }
+}
+
+void FigureAoBaker::BuildScene(FScene& scene)
+{
+    // Faces are flat, padded boxes keep the slab test away from zero thickness.
+    const unsigned numFaces = scene.normals.size();
+    Bvh::BoxVector boxes(numFaces, CategoryAllocator(MC_AO));
+    for (unsigned i = 0; i < numFaces; ++i)
+    {
+        BoundingBox box;
+        for (unsigned corner = 0; corner < 4; ++corner)
+        {
+            box.Merge(scene.corners[i * 4 + corner]);
+        }
+        boxes[i] = BoundingBox(box.min_ - Vector3::ONE * 1e-4f, box.max_ + Vector3::ONE * 1e-4f);
+    }
+    scene.bvh.Build(boxes);
+}
+
+void FigureAoBaker::RunWorker(FJob& job, unsigned worker)
+{
+    FScene& scene = *job.scene;
+    unsigned expected = 0;
+    if (scene.state.compare_exchange_strong(expected, 1))
+    {
+        BuildScene(scene);
+        scene.state = 2;
+    }
+    while (scene.state != 2)
+    {
+        Thread::Sleep(0);
+    }
+
+    unsigned task;
+    while (job.ranges.Pop(worker, task))
+    {
+        const FTask& range = job.tasks[task];
+        const unsigned baseSample = job.baseSamples[range.chunk];
+        for (unsigned corner = range.firstCorner; corner < range.endCorner; ++corner)
+        {
+            BakeCorner(job, corner, baseSample, job.hits[range.firstHit + corner - range.firstCorner]);
+        }
+    }
+}
+
+void FigureAoBaker::BakeCorner(const FJob& job, unsigned corner, unsigned baseSample, unsigned char& hits)
+{
+    const FScene& scene = *job.scene;
+    const unsigned face = corner / 4;
+    const Vector3& normal = scene.normals[face];
+    const Vector3 center = (scene.corners[face * 4] + scene.corners[face * 4 + 2]) * 0.5f;
+    // Slightly inside the face and above it, so rays neither start on the face nor on the edge of a neighbour.
+    const Vector3 origin = scene.corners[corner] + (center - scene.corners[corner]) * 0.02f + normal * 1e-3f;
+
+    const Vector3 tangent = (Abs(normal.x_) > 0.9f ? Vector3::UP : Vector3::RIGHT).CrossProduct(normal).Normalized();
+    const Vector3 bitangent = normal.CrossProduct(tangent);
+    const float rotation = CornerRotation(corner);
+
+    // Cosine weighted Halton directions continue where the previous pass stopped.
+    Vector3 directions[SAMPLES_PER_PASS];
+    Vector3 invDirections[SAMPLES_PER_PASS];
+    for (unsigned i = 0; i < SAMPLES_PER_PASS; ++i)
+    {
+        const unsigned sample = baseSample + i + 1;
+        const float u = RadicalInverse(sample, 2);
+        float v = RadicalInverse(sample, 3) + rotation;
+        v -= floorf(v);
+        const float r = sqrtf(u);
+        const float phi = 2.0f * M_PI * v;
+        directions[i] = tangent * (r * cosf(phi)) + bitangent * (r * sinf(phi)) + normal * sqrtf(Max(1.0f - u, 0.f));
+        invDirections[i] = Vector3(1.0f / directions[i].x_, 1.0f / directions[i].y_, 1.0f / directions[i].z_);
+    }
+
+    unsigned active = (1u << SAMPLES_PER_PASS) - 1;
+    const float radius = job.radius;
+    scene.bvh.OccludePacket(origin, invDirections, SAMPLES_PER_PASS, radius, active, [&](unsigned item, unsigned& rays)
+    {
+        const Vector3* c = &scene.corners[item * 4];
+        for (unsigned i = 0; i < SAMPLES_PER_PASS; ++i)
+        {
+            if ((rays & (1u << i)) && (Bvh::HitTriangle(origin, directions[i], c[0], c[1], c[2]) < radius
+                || Bvh::HitTriangle(origin, directions[i], c[0], c[2], c[3]) < radius))
+            {
+                rays &= ~(1u << i);
+            }
+        }
+    });
+
+    unsigned blocked = 0;
+    for (unsigned i = 0; i < SAMPLES_PER_PASS; ++i)
+    {
+        blocked += (active & (1u << i)) ? 0 : 1;
+    }
+    hits = (unsigned char)blocked;
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include <EASTL/shared_ptr.h>
+#include <EASTL/vector.h>
+
+#include <atomic>
+
+#include <Urho3D/Core/Context.h>
+
+#include "Bvh.h"
+#include "Figure.h"
+#include "Parallel.h"
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+/// Per-vertex ambient occlusion of a Figure, baked on the CPU without a GPU.
+/// Every face corner casts a cosine weighted hemisphere of rays against a BVH of the faces. The rays of one corner
+/// share their origin and are traced as one packet. A pass adds samplesPerPass rays to every unconverged corner,
+/// its tasks are spread over all worker threads with work stealing. Passes repeat until maxSamples, an edit
+/// restarts only the chunks within radius of the changed chunks, or of the moved faces when a chunk only moved.
+class FigureAoBaker
+{
+public:
+    explicit FigureAoBaker(Context* context);
+    ~FigureAoBaker();
+
+    /// Apply a finished pass, restart chunks touched by edits and start the next pass. Main thread, once per frame.
+    void Update(const Figure& figure);
+    /// Bake every chunk to maxSamples before returning, for batch runs.
+    void Bake(const Figure& figure);
+
+    /// Occlusion of faces[arrayIndex].vertices[corner] at arrayIndex * 4 + corner, 255 open, 0 fully occluded.
+    const FOcclusionArray& GetOcclusion() const { return occlusion_; }
+    /// Changes whenever occlusion of the chunk changed.
+    unsigned GetChunkRevision(unsigned chunk) const { return chunk < aoRevisions_.size() ? aoRevisions_[chunk] : 0; }
+
+    /// Rays longer than radius do not count as occluded. Restarts the bake.
+    void SetRadius(float radius);
+    float GetRadius() const { return radius_; }
+    void SetMaxSamples(unsigned samples);
+    unsigned GetMaxSamples() const { return maxSamples_; }
+
+    bool IsBusy() const { return workerRunning_; }
+    bool IsConverged() const;
+    /// Fraction of chunks at maxSamples.
+    float GetProgress() const;
+    float GetLastPassMs() const { return lastPassMs_; }
+
+    /// Rays per corner and pass, one packet.
+    static const unsigned SAMPLES_PER_PASS = 16;
+
+private:
+    /// Face corners and outward normals with their BVH, shared by passes. An edit patches the changed chunks and has
+    /// the next pass rebuild the BVH.
+    struct FScene
+    {
+        ea::vector<Vector3, TrackedAllocator<MC_AO>> corners;
+        ea::vector<Vector3, TrackedAllocator<MC_AO>> normals;
+        Bvh bvh{MC_AO};
+        /// 0 not built, 1 building, 2 ready. The first worker of a pass builds it, the others wait.
+        std::atomic<unsigned> state{0};
+    };
+
+    struct FTask
+    {
+        unsigned chunk;
+        unsigned firstCorner;
+        unsigned endCorner;
+        /// Index of firstCorner in FJob::hits.
+        unsigned firstHit;
+    };
+
+    struct FJob
+    {
+        ea::shared_ptr<FScene> scene;
+        ea::vector<FTask> tasks;
+        /// Per chunk of the job: chunk index, epoch when started and samples done before the pass.
+        ea::vector<unsigned> chunks;
+        ea::vector<unsigned> epochs;
+        ea::vector<unsigned> baseSamples;
+        /// Index of the first corner of every chunk of the job in hits.
+        ea::vector<unsigned> hitOffsets;
+        /// Occluded rays of this pass per corner of the job's chunks, written by the task owning the corner.
+        ea::vector<unsigned char, TrackedAllocator<MC_AO>> hits;
+        float radius{0.f};
+        TaskRanges ranges;
+        std::atomic<unsigned> numRunning{0};
+        float timeMs{0.f};
+    };
+
+    /// Restart chunks whose bounds intersect box.
+    void Restart(const BoundingBox& box);
+    /// Start a pass over unconverged chunks, false when all are converged.
+    bool StartPass(const Figure& figure);
+    void ApplyPass(FJob& job);
+    /// Worker thread.
+    static void RunWorker(FJob& job, unsigned worker);
+    /// Copy corners and normals of faces changed since the scene was last synced, the BVH is rebuilt by the pass.
+    void SyncScene(const Figure& figure);
+    static void BuildScene(FScene& scene);
+    static void BakeCorner(const FJob& job, unsigned corner, unsigned baseSample, unsigned char& hits);
+
+    Context* context_;
+    const Figure* figure_{nullptr};
+    float radius_{2.0f};
+    unsigned maxSamples_{128};
+
+    /// Per chunk: last seen figure revision, bounds, samples done, restart epoch and occlusion revision.
+    ea::vector<unsigned> chunkRevisions_;
+    ea::vector<BoundingBox> chunkBounds_;
+    ea::vector<unsigned> chunkSamples_;
+    ea::vector<unsigned> chunkEpochs_;
+    ea::vector<unsigned> aoRevisions_;
+    /// Occluded ray count per corner over all samples of its chunk.
+    ea::vector<unsigned short, TrackedAllocator<MC_AO>> occluded_;
+    FOcclusionArray occlusion_;
+
+    ea::shared_ptr<FScene> scene_;
+    /// Figure chunk revision each chunk of scene_ was copied at.
+    ea::vector<unsigned> sceneChunkRevisions_;
+    ea::shared_ptr<FJob> job_;
+    std::atomic<bool> workerRunning_{false};
+    float lastPassMs_{0.f};
+};
+
+}
@@ -0,0 +1,136 @@
+#include "FigureCsg.h"
+
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/IO/Log.h>
+
+using namespace Redi;
+
+namespace
+{
+    const EFaceDirection faceDirections[6] = {FD_FORWARD, FD_BACK, FD_LEFT, FD_RIGHT, FD_UP, FD_DOWN};
+
+    bool IsInside(const IntVector3& cell, const IntVector3& min, const IntVector3& max)
+    {
+        return cell.x_ >= min.x_ && cell.y_ >= min.y_ && cell.z_ >= min.z_ && cell.x_ < max.x_ && cell.y_ < max.y_ && cell.z_ < max.z_;
+    }
+
+    Vector3 CellCenter(const IntVector3& cell)
+    {
+        return Vector3(cell.x_ + 0.5f, cell.y_ + 0.5f, cell.z_ + 0.5f);
+    }
+}
+
+bool FigureCsg::ParseOperation(const ea::string& name, ECsgOperation& op)
+{
+    if (name.comparei("union") == 0)
+        op = CSG_UNION;
+    else if (name.comparei("subtract") == 0)
+        op = CSG_SUBTRACT;
+    else if (name.comparei("intersect") == 0)
+        op = CSG_INTERSECT;
+    else
+        return false;
+    return true;
+}
+
+bool FigureCsg::Apply(Figure& target, const Figure& brush, ECsgOperation op)
+{
+    VoxelGrid brushGrid;
+    brushGrid.Voxelize(brush);
+    return Apply(target, brushGrid, op);
+}
+
+bool FigureCsg::ApplyBox(Figure& target, const IntVector3& min, const IntVector3& max, ECsgOperation op)
+{
+    VoxelGrid brushGrid;
+    brushGrid.FillBox(min, max);
+    return Apply(target, brushGrid, op);
+}
+
+bool FigureCsg::Apply(Figure& target, const VoxelGrid& brush, ECsgOperation op)
+{
+    HiresTimer timer;
+
+    if (gridFigure_ != &target || gridRevision_ != target.GetRevision())
+    {
+        grid_.Voxelize(target);
+        gridFigure_ = &target;
+    }
+
+    // Cells can change only inside the brush, except for intersect which clears everything outside of it.
+    IntVector3 min, max;
+    const bool hasRegion = op == CSG_INTERSECT ? grid_.GetBounds(min, max) : brush.GetBounds(min, max);
+    if (!hasRegion)
+    {
+        gridRevision_ = target.GetRevision();
+        return false;
+    }
+
+    grid_.Combine(brush, op);
+    Extract(target, min, max);
+    gridRevision_ = target.GetRevision();
+
+    lastTimeMs_ = timer.GetUSec(false) / 1000.0f;
+    URHO3D_LOGINFO("CSG removed {} and added {} faces in {:.2f} ms", lastRemoved_, lastAdded_, lastTimeMs_);
+    return true;
+}
+
+void FigureCsg::Extract(Figure& target, const IntVector3& min, const IntVector3& max)
+{
+    // A face separates two cells along its flat axis, it is rebuilt when either of them is in the region.
+    ea::vector<unsigned> removed;
+    for (unsigned i = 0; i < target.faces.size(); ++i)
+    {
+        const BoundingBox& box = target.faces[i].boundingBox;
+        const Vector3 size = box.Size();
+        const Vector3 center = box.Center();
+        const unsigned axis = size.x_ <= size.y_ && size.x_ <= size.z_ ? 0 : (size.y_ <= size.z_ ? 1 : 2);
+
+        IntVector3 cell(FloorToInt(center.x_), FloorToInt(center.y_), FloorToInt(center.z_));
+        int* axisCoord = axis == 0 ? &cell.x_ : (axis == 1 ? &cell.y_ : &cell.z_);
+        *axisCoord = RoundToInt(center.Data()[axis]);
+        if (IsInside(cell, min, max))
+        {
+            removed.push_back(i);
+            continue;
+        }
+        --*axisCoord;
+        if (IsInside(cell, min, max))
+        {
+            removed.push_back(i);
+        }
+    }
+    lastRemoved_ = removed.size();
+    target.RemoveFaces(ea::move(removed));
+
+    // Each solid/empty pair touching the region gets one face, owned by its solid cell.
+    ea::vector<FVertex> vertices;
+    for (int z = min.z_; z < max.z_; ++z)
+    {
+        for (int y = min.y_; y < max.y_; ++y)
+        {
+            for (int x = min.x_; x < max.x_; ++x)
+            {
+                const IntVector3 cell(x, y, z);
+                const bool solid = grid_.Get(cell);
+                for (EFaceDirection direction : faceDirections)
+                {
+                    const IntVector3 neighbour = cell + Figure::GetFaceSide(direction);
+                    const bool neighbourSolid = grid_.Get(neighbour);
+                    if (solid && !neighbourSolid)
+                    {
+                        vertices.resize(vertices.size() + 4);
+                        Figure::GetFaceCorners(direction, CellCenter(cell), vertices.end() - 4);
+                    }
+                    else if (!solid && neighbourSolid && !IsInside(neighbour, min, max))
+                    {
+                        vertices.resize(vertices.size() + 4);
+                        Figure::GetFaceCorners(target.InvertFaceDirection(direction), CellCenter(neighbour), vertices.end() - 4);
+                    }
+                }
+            }
+        }
+    }
+    lastAdded_ = vertices.size() / 4;
+    target.AddFaces(vertices.data(), lastAdded_);
+}
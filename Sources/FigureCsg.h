@@ -0,0 +1,41 @@
+#pragma once
+#include "Figure.h"
+#include "VoxelGrid.h"
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+/// Boolean operations on Figures through VoxelGrid.
+/// The target grid is cached by figure revision, so repeated operations on the same figure skip voxelization.
+/// Only faces next to cells in the brush region are removed and extracted again, the rest of the figure is untouched.
+class FigureCsg
+{
+public:
+    /// Combine target with brush figure. Returns false when the brush is empty.
+    bool Apply(Figure& target, const Figure& brush, ECsgOperation op);
+    /// Combine target with box of cells [min, max).
+    bool ApplyBox(Figure& target, const IntVector3& min, const IntVector3& max, ECsgOperation op);
+
+    float GetLastTimeMs() const { return lastTimeMs_; }
+    unsigned GetLastRemoved() const { return lastRemoved_; }
+    unsigned GetLastAdded() const { return lastAdded_; }
+
+    static bool ParseOperation(const ea::string& name, ECsgOperation& op);
+
+private:
+    bool Apply(Figure& target, const VoxelGrid& brush, ECsgOperation op);
+    /// Replace faces touching cells in [min, max) with the boundary of grid_ there.
+    void Extract(Figure& target, const IntVector3& min, const IntVector3& max);
+
+    VoxelGrid grid_;
+    const Figure* gridFigure_{nullptr};
+    unsigned gridRevision_{0};
+
+    float lastTimeMs_{0.f};
+    unsigned lastRemoved_{0};
+    unsigned lastAdded_{0};
+};
+
+}
@@ -0,0 +1,425 @@
+#include "FigureExporter.h"
+
+#include <EASTL/algorithm.h>
+#include <EASTL/sort.h>
+#include <EASTL/unordered_map.h>
+
+#include <Urho3D/Graphics/ModelView.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/Log.h>
+
+#include <cmath>
+#include <cstring>
+
+using namespace Redi;
+
+namespace
+{
+    const unsigned FORSYTH_CACHE_SIZE = 32;
+    const unsigned MAX_GEOMETRY_VERTICES = 65535;
+
+    float ForsythVertexScore(unsigned numActiveTriangles, int cachePosition)
+    {
+        if (numActiveTriangles == 0)
+        {
+            return -1.0f;
+        }
+
+        float score = 0.0f;
+        if (cachePosition >= 0)
+        {
+            // The last triangle's vertices get a fixed score, so the next triangle does not simply reuse them.
+            if (cachePosition < 3)
+            {
+                score = 0.75f;
+            }
+            else
+            {
+                const float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+                score = powf(1.0f - (cachePosition - 3) * scaler, 1.5f);
+            }
+        }
+        // Vertices with few remaining triangles are finished first so they leave the cache for good.
+        return score + 2.0f * powf((float)numActiveTriangles, -0.5f);
+    }
+
+    struct FVertexKey
+    {
+        float data[8];
+
+        bool operator==(const FVertexKey& rhs) const { return memcmp(data, rhs.data, sizeof(data)) == 0; }
+    };
+
+    struct FVertexKeyHash
+    {
+        size_t operator()(const FVertexKey& key) const
+        {
+            size_t h = 14695981039346656037ull;
+            const auto* bytes = reinterpret_cast<const unsigned char*>(key.data);
+            for (unsigned i = 0; i < sizeof(key.data); ++i)
+            {
+                h = (h ^ bytes[i]) * 1099511628211ull;
+            }
+            return h;
+        }
+    };
+}
+
+FigureExporter::FigureExporter(Context* context)
+    : context_(context)
+{
+}
+
+float FigureExporter::ComputeAcmr(const ea::vector<unsigned>& indices, unsigned numVertices, unsigned cacheSize)
+{
+    if (indices.empty())
+    {
+        return 0.0f;
+    }
+
+    // FIFO cache: a vertex is a hit if it was transformed less than cacheSize misses ago.
+    ea::vector<unsigned> timestamps(numVertices, 0);
+    unsigned time = cacheSize + 1;
+    unsigned misses = 0;
+    for (unsigned index : indices)
+    {
+        if (time - timestamps[index] > cacheSize)
+        {
+            timestamps[index] = time++;
+            ++misses;
+        }
+    }
+    return (float)misses / (float)(indices.size() / 3);
+}
+
+void FigureExporter::Weld(const Figure& figure)
+{
+    vertices_.clear();
+    indices_.clear();
+    vertices_.reserve(figure.faces.size() * 2);
+    indices_.reserve(figure.faces.size() * 6);
+
+    ea::unordered_map<FVertexKey, unsigned, FVertexKeyHash> lookup;
+    for (const FFace& face : figure.faces)
+    {
+        unsigned corners[4];
+        for (unsigned i = 0; i < 4; ++i)
+        {
+            const FVertex& vertex = face.vertices[i];
+            const FVertexKey key{{vertex.position.x_, vertex.position.y_, vertex.position.z_,
+                face.normal.x_, face.normal.y_, face.normal.z_, vertex.uv.x_, vertex.uv.y_}};
+            const auto result = lookup.emplace(key, vertices_.size());
+            if (result.second)
+            {
+                vertices_.push_back({vertex.position, face.normal, vertex.uv});
+            }
+            corners[i] = result.first->second;
+        }
+
+        indices_.push_back(corners[0]);
+        indices_.push_back(corners[1]);
+        indices_.push_back(corners[2]);
+        indices_.push_back(corners[0]);
+        indices_.push_back(corners[2]);
+        indices_.push_back(corners[3]);
+    }
+}
+
+void FigureExporter::OptimizeVertexCache()
+{
+    const unsigned numVertices = vertices_.size();
+    const unsigned numTriangles = indices_.size() / 3;
+
+    // Vertex to triangle adjacency in compact arrays.
+    ea::vector<unsigned> numActive(numVertices, 0);
+    for (unsigned index : indices_)
+    {
+        ++numActive[index];
+    }
+    ea::vector<unsigned> offsets(numVertices + 1, 0);
+    for (unsigned v = 0; v < numVertices; ++v)
+    {
+        offsets[v + 1] = offsets[v] + numActive[v];
+    }
+    ea::vector<unsigned> adjacency(indices_.size());
+    ea::vector<unsigned> fill(offsets.begin(), offsets.end() - 1);
+    for (unsigned t = 0; t < numTriangles; ++t)
+    {
+        for (unsigned k = 0; k < 3; ++k)
+        {
+            adjacency[fill[indices_[t * 3 + k]]++] = t;
+        }
+    }
+
+    ea::vector<int> cachePosition(numVertices, -1);
+    ea::vector<float> vertexScore(numVertices);
+    for (unsigned v = 0; v < numVertices; ++v)
+    {
+        vertexScore[v] = ForsythVertexScore(numActive[v], -1);
+    }
+    ea::vector<bool> emitted(numTriangles, false);
+
+    ea::vector<unsigned> cache;
+    cache.reserve(FORSYTH_CACHE_SIZE + 3);
+    ea::vector<unsigned> newCache;
+    newCache.reserve(FORSYTH_CACHE_SIZE + 3);
+    ea::vector<unsigned> result;
+    result.reserve(indices_.size());
+
+    unsigned cursor = 0;
+    int best = -1;
+    for (unsigned emittedCount = 0; emittedCount < numTriangles; ++emittedCount)
+    {
+        if (best < 0)
+        {
+            // Nothing adjacent to the cache left, continue with the next unused triangle.
+            while (emitted[cursor])
+            {
+                ++cursor;
+            }
+            best = (int)cursor;
+        }
+
+        const unsigned* tri = &indices_[best * 3];
+        emitted[best] = true;
+        result.insert(result.end(), tri, tri + 3);
+
+        // Remove triangle from adjacency of its vertices.
+        for (unsigned k = 0; k < 3; ++k)
+        {
+            const unsigned v = tri[k];
+            unsigned* begin = &adjacency[offsets[v]];
+            unsigned* end = begin + numActive[v];
+            unsigned* it = ea::find(begin, end, (unsigned)best);
+            *it = *(end - 1);
+            --numActive[v];
+        }
+
+        // New cache: triangle vertices at the front, then old entries.
+        newCache.assign(tri, tri + 3);
+        for (unsigned v : cache)
+        {
+            if (v != tri[0] && v != tri[1] && v != tri[2])
+            {
+                newCache.push_back(v);
+            }
+        }
+        for (unsigned i = 0; i < newCache.size(); ++i)
+        {
+            cachePosition[newCache[i]] = i < FORSYTH_CACHE_SIZE ? (int)i : -1;
+        }
+        if (newCache.size() > FORSYTH_CACHE_SIZE)
+        {
+            // Vertices pushed out of the cache lose their cache bonus.
+            for (unsigned i = FORSYTH_CACHE_SIZE; i < newCache.size(); ++i)
+            {
+                vertexScore[newCache[i]] = ForsythVertexScore(numActive[newCache[i]], -1);
+            }
+            newCache.resize(FORSYTH_CACHE_SIZE);
+        }
+        cache.swap(newCache);
+
+        // Rescore cached vertices and pick the best triangle touching the cache.
+        best = -1;
+        float bestScore = -1.0f;
+        for (unsigned v : cache)
+        {
+            vertexScore[v] = ForsythVertexScore(numActive[v], cachePosition[v]);
+        }
+        for (unsigned v : cache)
+        {
+            for (unsigned j = 0; j < numActive[v]; ++j)
+            {
+                const unsigned t = adjacency[offsets[v] + j];
+                const float score = vertexScore[indices_[t * 3]] + vertexScore[indices_[t * 3 + 1]] + vertexScore[indices_[t * 3 + 2]];
+                if (score > bestScore)
+                {
+                    bestScore = score;
+                    best = (int)t;
+                }
+            }
+        }
+    }
+
+    indices_.swap(result);
+}
+
+void FigureExporter::OptimizeOverdraw()
+{
+    const unsigned numTriangles = indices_.size() / 3;
+    if (numTriangles == 0)
+    {
+        return;
+    }
+
+    // Split the cache optimised order into clusters at hard boundaries, where a triangle misses the cache with all three vertices.
+    // Reordering whole clusters keeps the vertex cache efficiency inside them.
+    const unsigned cacheSize = 16;
+    ea::vector<unsigned> timestamps(vertices_.size(), 0);
+    unsigned time = cacheSize + 1;
+    ea::vector<unsigned> clusterStarts;
+    for (unsigned t = 0; t < numTriangles; ++t)
+    {
+        unsigned misses = 0;
+        for (unsigned k = 0; k < 3; ++k)
+        {
+            const unsigned index = indices_[t * 3 + k];
+            if (time - timestamps[index] > cacheSize)
+            {
+                timestamps[index] = time++;
+                ++misses;
+            }
+        }
+        if (t == 0 || misses == 3)
+        {
+            clusterStarts.push_back(t);
+        }
+    }
+    clusterStarts.push_back(numTriangles);
+
+    Vector3 meshCentroid = Vector3::ZERO;
+    for (const FExportVertex& vertex : vertices_)
+    {
+        meshCentroid += vertex.position;
+    }
+    meshCentroid /= vertices_.empty() ? 1.0f : (float)vertices_.size();
+
+    // Clusters facing away from the mesh center occlude the rest, draw them first.
+    struct FCluster
+    {
+        unsigned begin;
+        unsigned end;
+        float key;
+    };
+    ea::vector<FCluster> clusters;
+    for (unsigned c = 0; c + 1 < clusterStarts.size(); ++c)
+    {
+        Vector3 centroid = Vector3::ZERO;
+        Vector3 normal = Vector3::ZERO;
+        float area = 0.0f;
+        for (unsigned t = clusterStarts[c]; t < clusterStarts[c + 1]; ++t)
+        {
+            const Vector3& p0 = vertices_[indices_[t * 3]].position;
+            const Vector3& p1 = vertices_[indices_[t * 3 + 1]].position;
+            const Vector3& p2 = vertices_[indices_[t * 3 + 2]].position;
+            const Vector3 cross = (p1 - p0).CrossProduct(p2 - p0);
+            const float triangleArea = cross.Length();
+            centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            normal += cross;
+            area += triangleArea;
+        }
+        centroid = area > 0.0f ? centroid / area : vertices_[indices_[clusterStarts[c] * 3]].position;
+        clusters.push_back({clusterStarts[c], clusterStarts[c + 1], (centroid - meshCentroid).DotProduct(normal.Normalized())});
+    }
+    ea::stable_sort(clusters.begin(), clusters.end(), [](const FCluster& lhs, const FCluster& rhs) { return lhs.key > rhs.key; });
+
+    ea::vector<unsigned> result;
+    result.reserve(indices_.size());
+    for (const FCluster& cluster : clusters)
+    {
+        result.insert(result.end(), indices_.begin() + cluster.begin * 3, indices_.begin() + cluster.end * 3);
+    }
+    indices_.swap(result);
+}
+
+void FigureExporter::OptimizeVertexFetch()
+{
+    // Renumber vertices in order of first use, so the vertex buffer is read sequentially.
+    ea::vector<unsigned> remap(vertices_.size(), M_MAX_UNSIGNED);
+    ea::vector<FExportVertex> result;
+    result.reserve(vertices_.size());
+    for (unsigned& index : indices_)
+    {
+        if (remap[index] == M_MAX_UNSIGNED)
+        {
+            remap[index] = result.size();
+            result.push_back(vertices_[index]);
+        }
+        index = remap[index];
+    }
+    vertices_.swap(result);
+}
+
+SharedPtr<Model> FigureExporter::BuildModel(const Figure& figure)
+{
+    stats_ = FExportStats();
+    Weld(figure);
+    stats_.numTriangles = indices_.size() / 3;
+    stats_.numVertices = vertices_.size();
+    stats_.acmrBefore = ComputeAcmr(indices_, vertices_.size());
+
+    OptimizeVertexCache();
+    OptimizeOverdraw();
+    OptimizeVertexFetch();
+    stats_.acmrAfter = ComputeAcmr(indices_, vertices_.size());
+
+    // Split into geometries small enough for 16-bit indices, in the optimised triangle order.
+    ea::vector<GeometryView> geometries;
+    ea::vector<unsigned> localIndex(vertices_.size(), M_MAX_UNSIGNED);
+    unsigned triangle = 0;
+    const unsigned numTriangles = indices_.size() / 3;
+    while (triangle < numTriangles)
+    {
+        GeometryLODView lod;
+        ea::vector<unsigned> used;
+        for (; triangle < numTriangles; ++triangle)
+        {
+            unsigned numNew = 0;
+            for (unsigned k = 0; k < 3; ++k)
+            {
+                numNew += localIndex[indices_[triangle * 3 + k]] == M_MAX_UNSIGNED ? 1 : 0;
+            }
+            if (lod.vertices_.size() + numNew > MAX_GEOMETRY_VERTICES)
+            {
+                break;
+            }
+
+            for (unsigned k = 0; k < 3; ++k)
+            {
+                const unsigned index = indices_[triangle * 3 + k];
+                if (localIndex[index] == M_MAX_UNSIGNED)
+                {
+                    localIndex[index] = lod.vertices_.size();
+                    used.push_back(index);
+
+                    const FExportVertex& source = vertices_[index];
+                    ModelVertex vertex;
+                    vertex.position_ = Vector4(source.position, 1.0f);
+                    vertex.normal_ = Vector4(source.normal, 0.0f);
+                    vertex.uv_[0] = Vector4(source.uv.x_, source.uv.y_, 0.0f, 0.0f);
+                    lod.vertices_.push_back(vertex);
+                }
+                lod.indices_.push_back(localIndex[index]);
+            }
+        }
+        for (unsigned index : used)
+        {
+            localIndex[index] = M_MAX_UNSIGNED;
+        }
+
+        GeometryView geometry;
+        geometry.lods_.push_back(ea::move(lod));
+        geometries.push_back(ea::move(geometry));
+    }
+    stats_.numGeometries = geometries.size();
+
+    ModelVertexFormat format;
+    format.position_ = TYPE_VECTOR3;
+    format.normal_ = TYPE_VECTOR3;
+    format.uv_[0] = TYPE_VECTOR2;
+
+    auto view = MakeShared<ModelView>(context_);
+    view->SetVertexFormat(format);
+    view->SetGeometries(ea::move(geometries));
+    return view->ExportModel();
+}
+
+bool FigureExporter::Export(const Figure& figure, const ea::string& fileName)
+{
+    SharedPtr<Model> model = BuildModel(figure);
+    URHO3D_LOGINFO("Exported {} triangles, {} vertices, {} geometries, ACMR {:.3f} -> {:.3f}", stats_.numTriangles,
+        stats_.numVertices, stats_.numGeometries, stats_.acmrBefore, stats_.acmrAfter);
+
+    File file(context_, fileName, FILE_WRITE);
+    return model && file.IsOpen() && model->Save(file);
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <EASTL/vector.h>
+
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Graphics/Model.h>
+
+#include "Figure.h"
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+    struct FExportStats
+    {
+        unsigned numTriangles{0};
+        unsigned numVertices{0};
+        unsigned numGeometries{0};
+        /// Average cache miss ratio (transformed vertices per triangle) in a 16 entry FIFO cache.
+        float acmrBefore{0.f};
+        float acmrAfter{0.f};
+    };
+
+/// Converts Figure to a binary Model resource.
+/// Quads are triangulated and welded, triangles are reordered for the post-transform vertex cache (Forsyth),
+/// then clusters are sorted front to back for overdraw and vertices are reordered for fetch locality.
+class FigureExporter
+{
+public:
+    explicit FigureExporter(Context* context);
+
+    /// Build model from figure. Geometries are split so each one fits 16-bit indices.
+    SharedPtr<Model> BuildModel(const Figure& figure);
+    /// Build model and save it as .mdl.
+    bool Export(const Figure& figure, const ea::string& fileName);
+
+    const FExportStats& GetStats() const { return stats_; }
+
+    static float ComputeAcmr(const ea::vector<unsigned>& indices, unsigned numVertices, unsigned cacheSize = 16);
+
+private:
+    struct FExportVertex
+    {
+        Vector3 position;
+        Vector3 normal;
+        Vector2 uv;
+    };
+
+    void Weld(const Figure& figure);
+    void OptimizeVertexCache();
+    void OptimizeOverdraw();
+    void OptimizeVertexFetch();
+
+    Context* context_;
+    ea::vector<FExportVertex> vertices_;
+    ea::vector<unsigned> indices_;
+    FExportStats stats_;
+};
+
+}
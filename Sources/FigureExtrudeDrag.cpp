@@ -0,0 +1,161 @@
+#include "FigureExtrudeDrag.h"
+
+using namespace Redi;
+
+bool FigureExtrudeDrag::Begin(Figure& figure, const ea::vector<unsigned>& ids)
+{
+    if (IsActive())
+    {
+        Commit();
+    }
+
+    faces_.clear();
+    sides_.clear();
+    distance_ = 0.f;
+
+    const EFaceDirection directions[] = {FD_FORWARD, FD_BACK, FD_LEFT, FD_RIGHT, FD_UP, FD_DOWN};
+    ea::vector<FVertex> vertices;
+    for (unsigned idx : ids)
+    {
+        const FFace* face = figure.GetFace(idx);
+        if (!face || (face->state & FS_LOCKED) || face->vertices.size() != 4)
+        {
+            continue;
+        }
+        const EFaceDirection eDirection = figure.GetFaceDirection(face);
+        if (eDirection == FD_NONE)
+        {
+            continue;
+        }
+
+        FDragFace dragFace;
+        dragFace.idx = idx;
+        dragFace.axis = Vector3(Figure::GetFaceSide(eDirection));
+        for (unsigned i = 0; i < 4; ++i)
+        {
+            dragFace.corners[i] = face->vertices[i].position;
+        }
+
+        // Side faces of the unit box the extrusion fills at distance 1, corners on the face stay, the others follow it.
+        const Vector3 faceCenter = face->boundingBox.Center();
+        const Vector3 boxCenter = faceCenter + dragFace.axis * 0.5f;
+        const EFaceDirection iDirection = figure.InvertFaceDirection(eDirection);
+        for (EFaceDirection fDir : directions)
+        {
+            if (fDir == eDirection || fDir == iDirection)
+            {
+                continue;
+            }
+            vertices.resize(vertices.size() + 4);
+            Figure::GetFaceCorners(fDir, boxCenter, vertices.end() - 4);
+
+            FDragSide side;
+            side.face = faces_.size();
+            for (unsigned i = 0; i < 4; ++i)
+            {
+                const Vector3& corner = vertices[vertices.size() - 4 + i].position;
+                side.lift[i] = (corner - faceCenter).DotProduct(dragFace.axis) > 0.5f ? 1.f : 0.f;
+                side.base[i] = corner - dragFace.axis * side.lift[i];
+            }
+            sides_.push_back(side);
+        }
+        faces_.push_back(dragFace);
+    }
+    if (faces_.empty())
+    {
+        return false;
+    }
+
+    figure_ = &figure;
+    const unsigned first = figure.faces.size();
+    figure.AddFaces(vertices.data(), sides_.size());
+    for (unsigned i = 0; i < sides_.size(); ++i)
+    {
+        sides_[i].idx = figure.faces[first + i].idx;
+    }
+    SetDistance(0.f);
+    return true;
+}
+
+ea::vector<unsigned> FigureExtrudeDrag::GetMovingFaces() const
+{
+    ea::vector<unsigned> ids;
+    ids.reserve(faces_.size() + sides_.size());
+    for (const FDragFace& face : faces_)
+    {
+        ids.push_back(face.idx);
+    }
+    for (const FDragSide& side : sides_)
+    {
+        ids.push_back(side.idx);
+    }
+    return ids;
+}
+
+void FigureExtrudeDrag::SetDistance(float distance)
+{
+    if (!IsActive())
+    {
+        return;
+    }
+
+    distance_ = Max(distance, 0.f);
+    Vector3 positions[4];
+    for (const FDragFace& face : faces_)
+    {
+        const Vector3 offset = face.axis * distance_;
+        for (unsigned i = 0; i < 4; ++i)
+        {
+            positions[i] = face.corners[i] + offset;
+        }
+        figure_->SetFaceVertices(face.idx, positions);
+    }
+    for (const FDragSide& side : sides_)
+    {
+        const Vector3 offset = faces_[side.face].axis * distance_;
+        for (unsigned i = 0; i < 4; ++i)
+        {
+            positions[i] = side.base[i] + offset * side.lift[i];
+        }
+        figure_->SetFaceVertices(side.idx, positions);
+    }
+}
+
+unsigned FigureExtrudeDrag::Commit()
+{
+    const unsigned numFaces = distance_ > 0.f ? faces_.size() : 0;
+    Finish(numFaces == 0);
+    return numFaces;
+}
+
+void FigureExtrudeDrag::Cancel()
+{
+    SetDistance(0.f);
+    Finish(true);
+}
+
+void FigureExtrudeDrag::Finish(bool removeSides)
+{
+    if (!IsActive())
+    {
+        return;
+    }
+
+    if (removeSides)
+    {
+        ea::vector<unsigned> arrayIndices;
+        for (const FDragSide& side : sides_)
+        {
+            const unsigned index = figure_->GetFaceIndex(side.idx);
+            if (index != M_MAX_UNSIGNED)
+            {
+                arrayIndices.push_back(index);
+            }
+        }
+        figure_->RemoveFaces(arrayIndices);
+    }
+    figure_ = nullptr;
+    faces_.clear();
+    sides_.clear();
+    distance_ = 0.f;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <EASTL/vector.h>
+
+#include "Figure.h"
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+/// Extrusion dragged to any distance with live preview. Begin adds the four side faces of every face once, in one
+/// batch. Each SetDistance after that only rewrites vertex positions in place through Figure::SetFaceVertices, so
+/// chunk topology stays and every reader of the figure refits just the moved face ranges.
+/// Faces are the unit quads of Figure::GetFaceCorners, the side faces are those of ExtrudeFace stretched to distance.
+class FigureExtrudeDrag
+{
+public:
+    /// Start extruding faces ids of figure at distance 0, locked faces are skipped. Commits a drag still active.
+    /// False when no face was left to extrude.
+    bool Begin(Figure& figure, const ea::vector<unsigned>& ids);
+    /// Move the faces distance along their outward side, negative distances clamp to 0.
+    void SetDistance(float distance);
+    /// Keep the extrusion. Ended at distance 0 the side faces are removed again. Returns number of extruded faces.
+    unsigned Commit();
+    /// Put the faces back and remove the side faces.
+    void Cancel();
+
+    bool IsActive() const { return figure_ != nullptr; }
+    float GetDistance() const { return distance_; }
+    unsigned GetNumFaces() const { return faces_.size(); }
+    /// Outward direction of the first face in figure space, the axis a mouse drag follows.
+    Vector3 GetAxis() const { return faces_.empty() ? Vector3::ZERO : faces_.front().axis; }
+    /// Id of the first face, the one a mouse drag snaps.
+    unsigned GetFirstFace() const { return faces_.empty() ? M_MAX_UNSIGNED : faces_.front().idx; }
+    /// Ids of the dragged faces and of their side faces, everything that moves with the drag.
+    ea::vector<unsigned> GetMovingFaces() const;
+
+private:
+    struct FDragFace
+    {
+        unsigned idx{0};
+        Vector3 axis{Vector3::ZERO};
+        /// Corner positions when the drag began.
+        Vector3 corners[4];
+    };
+
+    /// Corner i of a side face is at base[i] + axis * distance * lift[i].
+    struct FDragSide
+    {
+        unsigned idx{0};
+        /// Index into faces_.
+        unsigned face{0};
+        Vector3 base[4];
+        float lift[4]{};
+    };
+
+    /// Remove the side faces from the figure and end the drag.
+    void Finish(bool removeSides);
+
+    Figure* figure_{nullptr};
+    ea::vector<FDragFace> faces_;
+    ea::vector<FDragSide> sides_;
+    float distance_{0.f};
+};
+
+}
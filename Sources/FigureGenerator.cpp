@@ -0,0 +1,301 @@
+#include "FigureGenerator.h"
+#include "Parallel.h"
+
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/IO/Log.h>
+
+using namespace Redi;
+
+FigureGenerator::FigureGenerator(Context* context, unsigned seed)
+    : context_(context),
+    state_(seed != 0 ? seed : 0x9e3779b9u)
+{
+}
+
+bool FigureGenerator::ParseKind(const ea::string& name, EGeneratorKind& kind)
+{
+    if (name.comparei("walls") == 0)
+        kind = GK_WALLS;
+    else if (name.comparei("cave") == 0)
+        kind = GK_CAVE;
+    else if (name.comparei("city") == 0)
+        kind = GK_CITY;
+    else
+        return false;
+    return true;
+}
+
+unsigned FigureGenerator::NextRandom()
+{
+    state_ ^= state_ << 13;
+    state_ ^= state_ >> 17;
+    state_ ^= state_ << 5;
+    return state_;
+}
+
+bool FigureGenerator::Resize(unsigned sizeX, unsigned sizeY, unsigned sizeZ)
+{
+    // Each partial product stays below 2^60, so the check itself can not wrap.
+    const unsigned long long area = (unsigned long long)sizeX * sizeY;
+    if (area > MAX_VOXELS || area * sizeZ > MAX_VOXELS)
+    {
+        URHO3D_LOGERROR("Generator grid {}x{}x{} exceeds {} cells", sizeX, sizeY, sizeZ, (unsigned)MAX_VOXELS);
+        return false;
+    }
+    sizeX_ = sizeX;
+    sizeY_ = sizeY;
+    sizeZ_ = sizeZ;
+    cells_.assign((size_t)sizeX_ * sizeY_ * sizeZ_, 0);
+    return true;
+}
+
+bool FigureGenerator::IsSolid(int x, int y, int z) const
+{
+    if (x < 0 || y < 0 || z < 0 || x >= (int)sizeX_ || y >= (int)sizeY_ || z >= (int)sizeZ_)
+    {
+        return false;
+    }
+    return cells_[(y * sizeZ_ + z) * sizeX_ + x] != 0;
+}
+
+unsigned FigureGenerator::Generate(Figure& figure, EGeneratorKind kind, unsigned size)
+{
+    HiresTimer timer;
+    size = Max(size, 4u);
+    bool built = false;
+    switch (kind)
+    {
+    case GK_WALLS:
+        built = BuildWalls(size);
+        break;
+    case GK_CAVE:
+        built = BuildCave(size);
+        break;
+    case GK_CITY:
+        built = BuildCity(size);
+        break;
+    }
+    if (!built)
+    {
+        return 0;
+    }
+    const long long buildUSec = timer.GetUSec(true);
+
+    figure.Clear();
+    EmitFaces(figure);
+
+    const float emitMs = timer.GetUSec(false) / 1000.0f;
+    URHO3D_LOGINFO("Generated {} faces on {}x{}x{} cells: voxels {:.2f} ms, faces {:.2f} ms ({:.2f} M faces/s)", figure.faces.size(),
+        sizeX_, sizeY_, sizeZ_, buildUSec / 1000.0f, emitMs, emitMs > 0.f ? figure.faces.size() / (emitMs * 1000.0f) : 0.f);
+    return figure.faces.size();
+}
+
+bool FigureGenerator::BuildWalls(unsigned size)
+{
+    // Maze cells sit on odd coordinates, even ones are walls until a passage is carved through.
+    const unsigned mazeSize = Max(size / 2, 2u);
+    const unsigned side = mazeSize * 2 + 1;
+    if (!Resize(side, 4, side))
+    {
+        return false;
+    }
+    for (unsigned y = 0; y < sizeY_; ++y)
+    {
+        for (unsigned z = 0; z < sizeZ_; ++z)
+        {
+            for (unsigned x = 0; x < sizeX_; ++x)
+            {
+                SetSolid(x, y, z, true);
+            }
+        }
+    }
+
+    const auto carve = [this](unsigned x, unsigned z)
+    {
+        for (unsigned y = 1; y < sizeY_; ++y)
+        {
+            SetSolid(x, y, z, false);
+        }
+    };
+
+    // Iterative depth-first backtracker.
+    ea::vector<bool> visited(mazeSize * mazeSize, false);
+    ea::vector<unsigned> stack;
+    stack.push_back(0);
+    visited[0] = true;
+    carve(1, 1);
+    while (!stack.empty())
+    {
+        const unsigned cell = stack.back();
+        const int cx = cell % mazeSize;
+        const int cz = cell / mazeSize;
+
+        unsigned candidates[4];
+        unsigned numCandidates = 0;
+        const int offsets[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+        for (const auto& offset : offsets)
+        {
+            const int nx = cx + offset[0];
+            const int nz = cz + offset[1];
+            if (nx >= 0 && nz >= 0 && nx < (int)mazeSize && nz < (int)mazeSize && !visited[nz * mazeSize + nx])
+            {
+                candidates[numCandidates++] = nz * mazeSize + nx;
+            }
+        }
+
+        if (numCandidates == 0)
+        {
+            stack.pop_back();
+            continue;
+        }
+
+        const unsigned next = candidates[NextRandom(numCandidates)];
+        const int nx = next % mazeSize;
+        const int nz = next / mazeSize;
+        visited[next] = true;
+        carve(cx + nx + 1, cz + nz + 1);
+        carve(nx * 2 + 1, nz * 2 + 1);
+        stack.push_back(next);
+    }
+    return true;
+}
+
+bool FigureGenerator::BuildCave(unsigned size)
+{
+    if (!Resize(size, Max(size / 2, 4u), size))
+    {
+        return false;
+    }
+    for (unsigned y = 0; y < sizeY_; ++y)
+    {
+        for (unsigned z = 0; z < sizeZ_; ++z)
+        {
+            for (unsigned x = 0; x < sizeX_; ++x)
+            {
+                const bool border = x == 0 || y == 0 || z == 0 || x == sizeX_ - 1 || y == sizeY_ - 1 || z == sizeZ_ - 1;
+                SetSolid(x, y, z, border || NextRandom(100) < 55);
+            }
+        }
+    }
+
+    // Majority smoothing turns noise into connected tunnels. Each pass reads the previous one, layers run in parallel.
+    ea::vector<unsigned char> next(cells_.size());
+    for (unsigned pass = 0; pass < 4; ++pass)
+    {
+        ParallelFor(context_, sizeY_, 1, [&](unsigned begin, unsigned end)
+        {
+            for (unsigned y = begin; y < end; ++y)
+            {
+                for (unsigned z = 0; z < sizeZ_; ++z)
+                {
+                    for (unsigned x = 0; x < sizeX_; ++x)
+                    {
+                        const unsigned index = (y * sizeZ_ + z) * sizeX_ + x;
+                        if (x == 0 || y == 0 || z == 0 || x == sizeX_ - 1 || y == sizeY_ - 1 || z == sizeZ_ - 1)
+                        {
+                            next[index] = 1;
+                            continue;
+                        }
+
+                        unsigned numSolid = 0;
+                        for (int dy = -1; dy <= 1; ++dy)
+                            for (int dz = -1; dz <= 1; ++dz)
+                                for (int dx = -1; dx <= 1; ++dx)
+                                    numSolid += IsSolid(x + dx, y + dy, z + dz);
+                        next[index] = numSolid >= 14;
+                    }
+                }
+            }
+        });
+        cells_.swap(next);
+    }
+    return true;
+}
+
+bool FigureGenerator::BuildCity(unsigned size)
+{
+    const unsigned blockSize = 10;
+    const unsigned streetWidth = 2;
+    if (!Resize(size, 25, size))
+    {
+        return false;
+    }
+    for (unsigned z = 0; z < sizeZ_; ++z)
+    {
+        for (unsigned x = 0; x < sizeX_; ++x)
+        {
+            SetSolid(x, 0, z, true);
+        }
+    }
+
+    for (unsigned bz = 0; bz + blockSize <= sizeZ_; bz += blockSize)
+    {
+        for (unsigned bx = 0; bx + blockSize <= sizeX_; bx += blockSize)
+        {
+            const unsigned lot = blockSize - streetWidth;
+            const unsigned x0 = bx + NextRandom(3);
+            const unsigned z0 = bz + NextRandom(3);
+            const unsigned x1 = bx + lot - NextRandom(3);
+            const unsigned z1 = bz + lot - NextRandom(3);
+            // Mostly low blocks with an occasional tower.
+            const unsigned height = NextRandom(10) == 0 ? 10 + NextRandom(sizeY_ - 11) : 2 + NextRandom(8);
+            for (unsigned y = 1; y <= height; ++y)
+            {
+                for (unsigned z = z0; z < z1; ++z)
+                {
+                    for (unsigned x = x0; x < x1; ++x)
+                    {
+                        SetSolid(x, y, z, true);
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void FigureGenerator::EmitFaces(Figure& figure)
+{
+    ea::vector<ea::vector<FVertex>> layers(sizeY_);
+    ParallelFor(context_, sizeY_, 1, [&](unsigned begin, unsigned end)
+    {
+        for (unsigned y = begin; y < end; ++y)
+        {
+            ea::vector<FVertex>& vertices = layers[y];
+            for (unsigned z = 0; z < sizeZ_; ++z)
+            {
+                for (unsigned x = 0; x < sizeX_; ++x)
+                {
+                    if (!IsSolid(x, y, z))
+                    {
+                        continue;
+                    }
+                    // Cell (0, 0, 0) is the box of CreateFigureBox.
+                    const Vector3 center(x + 0.5f, y + 0.5f, z + 0.5f);
+                    for (EFaceDirection direction : {FD_FORWARD, FD_BACK, FD_LEFT, FD_RIGHT, FD_UP, FD_DOWN})
+                    {
+                        const IntVector3 side = Figure::GetFaceSide(direction);
+                        if (!IsSolid(x + side.x_, y + side.y_, z + side.z_))
+                        {
+                            vertices.resize(vertices.size() + 4);
+                            Figure::GetFaceCorners(direction, center, vertices.end() - 4);
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    unsigned numFaces = 0;
+    for (const ea::vector<FVertex>& vertices : layers)
+    {
+        numFaces += vertices.size() / 4;
+    }
+    figure.Reserve(numFaces);
+    for (ea::vector<FVertex>& vertices : layers)
+    {
+        figure.AddFaces(vertices.data(), vertices.size() / 4);
+        vertices.clear();
+        vertices.shrink_to_fit();
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <EASTL/string.h>
+#include <EASTL/vector.h>
+
+#include <Urho3D/Core/Context.h>
+
+#include "Figure.h"
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+    enum EGeneratorKind : unsigned
+    {
+        /// Maze of three unit high walls on a floor.
+        GK_WALLS,
+        /// Rock volume with cellular automaton tunnels.
+        GK_CAVE,
+        /// Street grid with buildings of random footprint and height.
+        GK_CITY
+    };
+
+/// Builds large reproducible Figures from a seed.
+/// Shapes are filled into a voxel grid of unit cells, then every cell side facing an empty cell becomes a face.
+/// That is the same surface repeated ExtrudeFace and Weld produce, without the per-face cost.
+class FigureGenerator
+{
+public:
+    FigureGenerator(Context* context, unsigned seed);
+
+    /// Replace figure with a generated one, size is the grid side in cells. Returns number of faces, 0 without touching
+    /// figure when the grid would exceed MAX_VOXELS.
+    unsigned Generate(Figure& figure, EGeneratorKind kind, unsigned size);
+
+    static bool ParseKind(const ea::string& name, EGeneratorKind& kind);
+
+    /// Largest voxel grid, one byte per cell. Keeps cell indices within 32 bits.
+    static const unsigned MAX_VOXELS = 1u << 28;
+
+private:
+    /// xorshift32, the same sequence on every platform.
+    unsigned NextRandom();
+    unsigned NextRandom(unsigned range) { return NextRandom() % range; }
+
+    /// False with an error logged when the grid exceeds MAX_VOXELS.
+    bool Resize(unsigned sizeX, unsigned sizeY, unsigned sizeZ);
+    bool IsSolid(int x, int y, int z) const;
+    void SetSolid(unsigned x, unsigned y, unsigned z, bool solid) { cells_[(y * sizeZ_ + z) * sizeX_ + x] = solid; }
+
+    bool BuildWalls(unsigned size);
+    bool BuildCave(unsigned size);
+    bool BuildCity(unsigned size);
+    /// Emit faces between solid and empty cells, layers in parallel.
+    void EmitFaces(Figure& figure);
+
+    Context* context_;
+    unsigned state_;
+    unsigned sizeX_{0};
+    unsigned sizeY_{0};
+    unsigned sizeZ_{0};
+    ea::vector<unsigned char> cells_;
+};
+
+}
@@ -0,0 +1,476 @@
+#include "FigureGpuMesh.h"
+
+#include <Urho3D/Graphics/Geometry.h>
+#include <Urho3D/Graphics/Graphics.h>
+#include <Urho3D/Graphics/StaticModel.h>
+#include <Urho3D/Math/MathDefs.h>
+
+#include <cstring>
+
+using namespace Redi;
+
+namespace
+{
+    /// Finest fixed point step, exact for positions on the 1/256 grid.
+    const float MIN_POSITION_STEP = 1.0f / 256.0f;
+
+    static_assert(sizeof(FPackedVertex) == 12, "Packed vertex must match GetVertexElements");
+    static_assert(Figure::FACES_PER_CHUNK * 4 <= 65536, "Chunk vertices must fit 16-bit indices");
+}
+
+FigureGpuMesh::FigureGpuMesh(Context* context, Node* parent, Figure* figure, Material* material)
+    : context_(context),
+    figure_(figure),
+    material_(material)
+{
+    parents_.push_back(WeakPtr<Node>(parent));
+}
+
+bool FigureGpuMesh::IsSupported(Context* context)
+{
+    // The packed shaders need integer vertex attributes and texture arrays.
+    const ea::string& api = Graphics::GetApiName();
+    return context->GetSubsystem<Graphics>() && api != "D3D9" && api != "GL2" && api != "GLES2";
+}
+
+FigureGpuMesh::~FigureGpuMesh()
+{
+    for (FGpuChunk& chunk : chunks_)
+    {
+        for (Node* node : chunk.nodes)
+        {
+            node->Remove();
+        }
+    }
+}
+
+void FigureGpuMesh::SetOcclusion(const FigureAoBaker* baker)
+{
+    occlusion_ = baker;
+    for (FGpuChunk& chunk : chunks_)
+    {
+        chunk.occlusionRevision = M_MAX_UNSIGNED;
+    }
+}
+
+void FigureGpuMesh::SetVisible(bool visible)
+{
+    visible_ = visible;
+    for (FGpuChunk& chunk : chunks_)
+    {
+        if (!chunk.nodes.empty())
+        {
+            chunk.nodes.front()->SetEnabled(visible_);
+        }
+    }
+}
+
+void FigureGpuMesh::AddInstance(Node* node)
+{
+    parents_.push_back(WeakPtr<Node>(node));
+}
+
+void FigureGpuMesh::RemoveInstance(Node* node)
+{
+    for (unsigned i = 0; i < parents_.size(); ++i)
+    {
+        if (parents_[i].Get() == node)
+        {
+            for (FGpuChunk& chunk : chunks_)
+            {
+                if (i < chunk.nodes.size())
+                {
+                    chunk.nodes[i]->Remove();
+                    chunk.nodes.erase(chunk.nodes.begin() + i);
+                }
+            }
+            parents_.erase(parents_.begin() + i);
+            return;
+        }
+    }
+}
+
+unsigned FigureGpuMesh::GetNumInstances() const
+{
+    unsigned count = 0;
+    for (const WeakPtr<Node>& parent : parents_)
+    {
+        if (parent)
+        {
+            ++count;
+        }
+    }
+    return count;
+}
+
+const ea::vector<VertexElement>& FigureGpuMesh::GetVertexElements()
+{
+    static const ea::vector<VertexElement> elements = {
+        VertexElement(TYPE_UBYTE4, SEM_POSITION),
+        VertexElement(TYPE_UBYTE4, SEM_NORMAL),
+        VertexElement(TYPE_UBYTE4, SEM_TEXCOORD)
+    };
+    return elements;
+}
+
+const ea::vector<VertexElement>& FigureGpuMesh::GetStateElements()
+{
+    static const ea::vector<VertexElement> elements = {
+        VertexElement(TYPE_UBYTE4, SEM_COLOR)
+    };
+    return elements;
+}
+
+unsigned short FigureGpuMesh::FloatToHalf(float value)
+{
+    unsigned bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    const unsigned sign = (bits >> 16) & 0x8000;
+    const int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+    unsigned mantissa = bits & 0x7fffff;
+
+    if (exponent <= 0)
+    {
+        // Denormals and zero.
+        if (exponent < -10)
+        {
+            return (unsigned short)sign;
+        }
+        mantissa |= 0x800000;
+        return (unsigned short)(sign | (mantissa >> (14 - exponent)));
+    }
+    if (exponent >= 31)
+    {
+        return (unsigned short)(sign | 0x7c00);
+    }
+    return (unsigned short)(sign | (exponent << 10) | (mantissa >> 13));
+}
+
+void FigureGpuMesh::EncodeOctahedral(const Vector3& normal, unsigned char& x, unsigned char& y)
+{
+    const Vector3 n = normal / (Abs(normal.x_) + Abs(normal.y_) + Abs(normal.z_));
+    Vector2 e(n.x_, n.y_);
+    if (n.z_ < 0.0f)
+    {
+        e = Vector2((1.0f - Abs(n.y_)) * (n.x_ >= 0.0f ? 1.0f : -1.0f), (1.0f - Abs(n.x_)) * (n.y_ >= 0.0f ? 1.0f : -1.0f));
+    }
+    x = (unsigned char)RoundToInt((e.x_ * 0.5f + 0.5f) * 255.0f);
+    y = (unsigned char)RoundToInt((e.y_ * 0.5f + 0.5f) * 255.0f);
+}
+
+void FigureGpuMesh::SetMaterial(Material* material)
+{
+    material_ = material;
+    for (FGpuChunk& chunk : chunks_)
+    {
+        for (Node* node : chunk.nodes)
+        {
+            node->GetComponent<StaticModel>()->SetMaterial(material_);
+        }
+    }
+}
+
+void FigureGpuMesh::Update()
+{
+    if (!figure_)
+    {
+        return;
+    }
+
+    // Chunk nodes of a removed parent went with it.
+    for (unsigned i = 0; i < parents_.size();)
+    {
+        if (parents_[i])
+        {
+            ++i;
+            continue;
+        }
+        for (FGpuChunk& chunk : chunks_)
+        {
+            if (i < chunk.nodes.size())
+            {
+                chunk.nodes.erase(chunk.nodes.begin() + i);
+            }
+        }
+        parents_.erase(parents_.begin() + i);
+    }
+    if (parents_.empty())
+    {
+        return;
+    }
+
+    const unsigned numChunks = figure_->GetNumChunks();
+    while (chunks_.size() > numChunks)
+    {
+        for (Node* node : chunks_.back().nodes)
+        {
+            node->Remove();
+        }
+        chunks_.pop_back();
+    }
+    chunks_.resize(numChunks);
+
+    lastStateUpload_ = 0;
+    lastPositionUpload_ = 0;
+    for (unsigned i = 0; i < numChunks; ++i)
+    {
+        unsigned begin, end;
+        const bool changed = chunks_[i].revision != figure_->GetChunkRevision(i);
+        const bool moved = changed && chunks_[i].model && figure_->GetMovedRange(i, chunks_[i].revision, begin, end)
+            && UpdatePositions(i, begin, end);
+        if (!chunks_[i].model || (changed && !moved))
+        {
+            BuildChunk(i);
+        }
+        else
+        {
+            const unsigned occlusionRevision = occlusion_ ? occlusion_->GetChunkRevision(i) : 0;
+            if (occlusion_ && chunks_[i].occlusionRevision != occlusionRevision)
+            {
+                chunks_[i].occlusionRevision = occlusionRevision;
+                UpdateStates(i, i * Figure::FACES_PER_CHUNK, Min((i + 1) * Figure::FACES_PER_CHUNK, (unsigned)figure_->faces.size()));
+            }
+            else if (figure_->GetStateRange(i, begin, end))
+            {
+                UpdateStates(i, begin, end);
+            }
+            if (chunks_[i].nodes.size() != parents_.size())
+            {
+                PlaceChunk(i);
+            }
+        }
+        figure_->ClearStateRange(i);
+    }
+    MemoryStats::SetUsage(MC_GPU, GetMemoryUse());
+}
+
+void FigureGpuMesh::BuildChunk(unsigned index)
+{
+    FGpuChunk& chunk = chunks_[index];
+    chunk.revision = figure_->GetChunkRevision(index);
+
+    const unsigned begin = index * Figure::FACES_PER_CHUNK;
+    const unsigned end = Min(begin + Figure::FACES_PER_CHUNK, (unsigned)figure_->faces.size());
+
+    BoundingBox bounds;
+    for (unsigned i = begin; i < end; ++i)
+    {
+        bounds.Merge(figure_->faces[i].boundingBox);
+    }
+
+    // Power of two steps and step aligned origins put every chunk of one step on the same world grid, so chunks
+    // sharing a border meet without cracks while their steps match. Positions on the 1/256 grid are exact only at
+    // MIN_POSITION_STEP, chunks over 256 units across round to a coarser step and may show hairline cracks where
+    // they border a chunk of another step.
+    const Vector3 size = bounds.Size();
+    float step = MIN_POSITION_STEP;
+    while (step * 65535.0f < Max(Max(size.x_, size.y_), size.z_))
+    {
+        step *= 2.0f;
+    }
+    const Vector3 origin(floorf(bounds.min_.x_ / step) * step, floorf(bounds.min_.y_ / step) * step, floorf(bounds.min_.z_ / step) * step);
+    chunk.origin = origin;
+    chunk.step = step;
+    chunk.bounds = bounds;
+
+    EncodeFaces(chunk, begin, end);
+    indices_.clear();
+    indices_.reserve((end - begin) * 6);
+    for (unsigned first = 0; first < vertices_.size(); first += 4)
+    {
+        indices_.push_back(first);
+        indices_.push_back(first + 1);
+        indices_.push_back(first + 2);
+        indices_.push_back(first);
+        indices_.push_back(first + 2);
+        indices_.push_back(first + 3);
+    }
+
+    if (!chunk.model)
+    {
+        chunk.model = MakeShared<Model>(context_);
+        chunk.vertexBuffer = MakeShared<VertexBuffer>(context_);
+        chunk.indexBuffer = MakeShared<IndexBuffer>(context_);
+        chunk.stateBuffer = MakeShared<VertexBuffer>(context_);
+
+        auto geometry = MakeShared<Geometry>(context_);
+        geometry->SetNumVertexBuffers(2);
+        geometry->SetVertexBuffer(0, chunk.vertexBuffer);
+        geometry->SetVertexBuffer(1, chunk.stateBuffer);
+        geometry->SetIndexBuffer(chunk.indexBuffer);
+        chunk.model->SetNumGeometries(1);
+        chunk.model->SetGeometry(0, 0, geometry);
+    }
+
+    const unsigned numVertices = vertices_.size();
+    // Without a shadow copy the buffers never take part in triangle raycasts, which would read packed data as floats.
+    if (chunk.vertexBuffer->GetVertexCount() != numVertices)
+    {
+        chunk.vertexBuffer->SetSize(numVertices, GetVertexElements(), true);
+    }
+    chunk.vertexBuffer->SetData(vertices_.data());
+
+    if (chunk.stateBuffer->GetVertexCount() != numVertices)
+    {
+        chunk.stateBuffer->SetSize(numVertices, GetStateElements(), true);
+    }
+    chunk.occlusionRevision = occlusion_ ? occlusion_->GetChunkRevision(index) : 0;
+    UpdateStates(index, begin, end);
+
+    if (chunk.indexBuffer->GetIndexCount() != indices_.size())
+    {
+        chunk.indexBuffer->SetSize(indices_.size(), false, true);
+    }
+    chunk.indexBuffer->SetData(indices_.data());
+
+    chunk.model->GetGeometry(0, 0)->SetDrawRange(TRIANGLE_LIST, 0, indices_.size(), 0, numVertices);
+    chunk.model->SetBoundingBox(BoundingBox(Vector3::ZERO, (bounds.max_ - origin) / step));
+
+    PlaceChunk(index);
+    // Reassign so the drawables pick up the new bounding box.
+    for (Node* node : chunk.nodes)
+    {
+        auto* staticModel = node->GetComponent<StaticModel>();
+        staticModel->SetModel(chunk.model);
+        staticModel->SetMaterial(material_);
+    }
+}
+
+void FigureGpuMesh::EncodeFaces(const FGpuChunk& chunk, unsigned begin, unsigned end)
+{
+    const float step = chunk.step;
+    const auto quantize = [step](float value) { return (unsigned short)Clamp(RoundToInt(value / step), 0, 65535); };
+
+    vertices_.clear();
+    vertices_.reserve((end - begin) * 4);
+    for (unsigned i = begin; i < end; ++i)
+    {
+        const FFace& face = figure_->faces[i];
+        unsigned char nx, ny;
+        EncodeOctahedral(face.normal, nx, ny);
+        for (const FVertex& vertex : face.vertices)
+        {
+            const Vector3 local = vertex.position - chunk.origin;
+            vertices_.push_back({quantize(local.x_), quantize(local.y_), quantize(local.z_), nx, ny, FloatToHalf(vertex.uv.x_), FloatToHalf(vertex.uv.y_)});
+        }
+    }
+}
+
+bool FigureGpuMesh::UpdatePositions(unsigned index, unsigned begin, unsigned end)
+{
+    FGpuChunk& chunk = chunks_[index];
+    const unsigned chunkBegin = index * Figure::FACES_PER_CHUNK;
+    const unsigned firstVertex = (begin - chunkBegin) * 4;
+    if (firstVertex + (end - begin) * 4 > chunk.vertexBuffer->GetVertexCount())
+    {
+        return false;
+    }
+
+    // The origin and step stay, so a face moved below the origin or past the last step needs a rebuild.
+    BoundingBox bounds = chunk.bounds;
+    for (unsigned i = begin; i < end; ++i)
+    {
+        bounds.Merge(figure_->faces[i].boundingBox);
+    }
+    const Vector3 limit = chunk.origin + Vector3::ONE * (chunk.step * 65535.0f);
+    if (bounds.min_.x_ < chunk.origin.x_ || bounds.min_.y_ < chunk.origin.y_ || bounds.min_.z_ < chunk.origin.z_
+        || bounds.max_.x_ > limit.x_ || bounds.max_.y_ > limit.y_ || bounds.max_.z_ > limit.z_)
+    {
+        return false;
+    }
+
+    EncodeFaces(chunk, begin, end);
+    chunk.vertexBuffer->SetDataRange(vertices_.data(), firstVertex, vertices_.size());
+    lastPositionUpload_ += vertices_.size() * sizeof(FPackedVertex);
+    chunk.revision = figure_->GetChunkRevision(index);
+
+    // Bounds only grow here, culling stays correct and a drag does not reassign models every frame once it stopped growing.
+    if (bounds.max_ != chunk.bounds.max_ || bounds.min_ != chunk.bounds.min_)
+    {
+        chunk.bounds = bounds;
+        chunk.model->SetBoundingBox(BoundingBox(Vector3::ZERO, (bounds.max_ - chunk.origin) / chunk.step));
+        for (Node* node : chunk.nodes)
+        {
+            auto* staticModel = node->GetComponent<StaticModel>();
+            staticModel->SetModel(chunk.model);
+            staticModel->SetMaterial(material_);
+        }
+    }
+    return true;
+}
+
+void FigureGpuMesh::PlaceChunk(unsigned index)
+{
+    FGpuChunk& chunk = chunks_[index];
+    while (chunk.nodes.size() < parents_.size())
+    {
+        SharedPtr<Node> node(parents_[chunk.nodes.size()]->CreateChild(Format("FigureChunk{}", index)));
+        node->SetEnabled(chunk.nodes.empty() ? visible_ : true);
+        auto* staticModel = node->CreateComponent<StaticModel>();
+        staticModel->SetModel(chunk.model);
+        staticModel->SetMaterial(material_);
+        chunk.nodes.push_back(node);
+    }
+    for (Node* node : chunk.nodes)
+    {
+        node->SetPosition(chunk.origin);
+        node->SetScale(chunk.step);
+    }
+}
+
+void FigureGpuMesh::UpdateStates(unsigned index, unsigned begin, unsigned end)
+{
+    FGpuChunk& chunk = chunks_[index];
+    const unsigned chunkBegin = index * Figure::FACES_PER_CHUNK;
+    const unsigned firstVertex = (begin - chunkBegin) * 4;
+    if (begin >= end || firstVertex + (end - begin) * 4 > chunk.stateBuffer->GetVertexCount())
+    {
+        return;
+    }
+
+    // Faces are quads, four vertices each in face order.
+    states_.clear();
+    const FOcclusionArray* occlusion = occlusion_ ? &occlusion_->GetOcclusion() : nullptr;
+    for (unsigned i = begin; i < end; ++i)
+    {
+        const unsigned state = figure_->faces[i].state | (figure_->faces[i].material << 16);
+        for (unsigned corner = 0; corner < 4; ++corner)
+        {
+            const unsigned vertex = i * 4 + corner;
+            const unsigned open = occlusion && vertex < occlusion->size() ? (*occlusion)[vertex] : 255;
+            states_.push_back(state | (open << 8));
+        }
+    }
+    chunk.stateBuffer->SetDataRange(states_.data(), firstVertex, states_.size());
+    lastStateUpload_ += states_.size() * sizeof(unsigned);
+}
+
+unsigned FigureGpuMesh::GetMemoryUse() const
+{
+    unsigned bytes = 0;
+    for (const FGpuChunk& chunk : chunks_)
+    {
+        if (chunk.vertexBuffer)
+        {
+            bytes += chunk.vertexBuffer->GetVertexCount() * chunk.vertexBuffer->GetVertexSize();
+            bytes += chunk.indexBuffer->GetIndexCount() * chunk.indexBuffer->GetIndexSize();
+            bytes += chunk.stateBuffer->GetVertexCount() * chunk.stateBuffer->GetVertexSize();
+        }
+    }
+    return bytes;
+}
+
+unsigned FigureGpuMesh::GetUnpackedMemoryUse() const
+{
+    unsigned bytes = 0;
+    for (const FGpuChunk& chunk : chunks_)
+    {
+        if (chunk.vertexBuffer)
+        {
+            bytes += chunk.vertexBuffer->GetVertexCount() * sizeof(FVertex);
+            bytes += chunk.indexBuffer->GetIndexCount() * sizeof(unsigned);
+        }
+    }
+    return bytes;
+}
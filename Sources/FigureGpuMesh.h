@@ -0,0 +1,124 @@
+#pragma once
+#include <EASTL/vector.h>
+
+#include <Urho3D/Graphics/GraphicsDefs.h>
+#include <Urho3D/Graphics/IndexBuffer.h>
+#include <Urho3D/Graphics/Material.h>
+#include <Urho3D/Graphics/Model.h>
+#include <Urho3D/Graphics/VertexBuffer.h>
+#include <Urho3D/Scene/Node.h>
+
+#include "Figure.h"
+#include "FigureAoBaker.h"
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+    /// 12 bytes per vertex instead of 32 of FVertex, decoded by Shaders/GLSL/FigurePacked.glsl and its
+    /// D3D11 port Shaders/HLSL/FigurePacked.hlsl.
+    struct FPackedVertex
+    {
+        /// Position relative to the chunk node in 16-bit fixed point, node scale is the fixed point step.
+        unsigned short x, y, z;
+        /// Octahedral normal.
+        unsigned char nx, ny;
+        /// Half float uv.
+        unsigned short u, v;
+    };
+
+/// Renders Figure faces through per-chunk vertex and index buffers in the packed vertex format.
+/// Only chunks whose Figure revision changed since the last Update are rebuilt. Chunks whose faces only moved
+/// re-encode and upload the moved face range of their vertex buffer, keeping indices and the fixed point origin.
+/// Face state (selected, hovered, locked) lives in a second four byte per vertex stream, state changes upload
+/// only the changed face range of that stream and never rebuild geometry. The second byte of that stream carries
+/// baked ambient occlusion, a chunk with new occlusion uploads its whole stream. The third byte is the face material
+/// slot, the layer of the texture array on the figure material, so any number of materials is one draw per chunk.
+/// Instances share the chunk models and only add a node with a StaticModel per chunk, the renderer draws them
+/// with hardware instancing. Rebuilding a chunk updates every instance.
+class FigureGpuMesh
+{
+public:
+    FigureGpuMesh(Context* context, Node* parent, Figure* figure, Material* material);
+    ~FigureGpuMesh();
+
+    /// Rebuild changed chunks, remove chunks past the end of the figure.
+    void Update();
+    void SetMaterial(Material* material);
+    /// Draw the figure again under node, chunks are placed on the next Update.
+    void AddInstance(Node* node);
+    void RemoveInstance(Node* node);
+    /// Parent nodes still alive, including the one from the constructor.
+    unsigned GetNumInstances() const;
+    /// Take vertex occlusion from baker, null draws every vertex open. The baker must update the same figure first.
+    void SetOcclusion(const FigureAoBaker* baker);
+    /// Hide the chunks under the parent from the constructor while another mesh draws it there. Instances stay visible
+    /// and chunks still update.
+    void SetVisible(bool visible);
+
+    unsigned GetNumChunks() const { return chunks_.size(); }
+    /// GPU memory of vertex and index buffers in bytes.
+    unsigned GetMemoryUse() const;
+    /// Same vertices as FVertex floats with 32-bit indices, for comparison.
+    unsigned GetUnpackedMemoryUse() const;
+
+    /// State bytes uploaded by the last Update.
+    unsigned GetLastStateUpload() const { return lastStateUpload_; }
+    /// Vertex bytes uploaded for moved faces by the last Update, rebuilt chunks not included.
+    unsigned GetLastPositionUpload() const { return lastPositionUpload_; }
+
+    /// Graphics exists and its API runs the packed shaders, D3D9 and GL2 have no texture arrays. Without it the
+    /// figure is only drawn by the debug renderer.
+    static bool IsSupported(Context* context);
+    /// The 12 bytes of FPackedVertex as three UBYTE4 elements. Position spans bytes 0-5, the shader rebuilds it from
+    /// iPos.xy, iPos.zw and iNormal.xy. The normal is iNormal.zw, the half float uv the texcoord element.
+    static const ea::vector<VertexElement>& GetVertexElements();
+    /// EFaceState bits, occlusion and material slot in the first three bytes of one UBYTE4 color element.
+    static const ea::vector<VertexElement>& GetStateElements();
+    static unsigned short FloatToHalf(float value);
+    /// Map unit vector to two bytes.
+    static void EncodeOctahedral(const Vector3& normal, unsigned char& x, unsigned char& y);
+
+private:
+    struct FGpuChunk
+    {
+        /// One node per parent, in the order of parents_.
+        ea::vector<SharedPtr<Node>> nodes;
+        SharedPtr<Model> model;
+        SharedPtr<VertexBuffer> vertexBuffer;
+        SharedPtr<IndexBuffer> indexBuffer;
+        SharedPtr<VertexBuffer> stateBuffer;
+        unsigned revision{0};
+        unsigned occlusionRevision{M_MAX_UNSIGNED};
+        Vector3 origin{Vector3::ZERO};
+        float step{1.f};
+        /// Figure space bounds of the faces, grows with moved faces until the next rebuild.
+        BoundingBox bounds;
+    };
+
+    void BuildChunk(unsigned index);
+    /// Upload positions of moved faces [begin, end) of chunk. False when one left the fixed point range of the chunk.
+    bool UpdatePositions(unsigned index, unsigned begin, unsigned end);
+    /// Encode faces [begin, end) into vertices_ relative to the chunk origin.
+    void EncodeFaces(const FGpuChunk& chunk, unsigned begin, unsigned end);
+    /// Create missing instance nodes of chunk and move all of them to its origin and step.
+    void PlaceChunk(unsigned index);
+    /// Upload state of faces [begin, end) of chunk.
+    void UpdateStates(unsigned index, unsigned begin, unsigned end);
+
+    Context* context_;
+    ea::vector<WeakPtr<Node>> parents_;
+    Figure* figure_;
+    SharedPtr<Material> material_;
+    const FigureAoBaker* occlusion_{nullptr};
+    bool visible_{true};
+    ea::vector<FGpuChunk> chunks_;
+    ea::vector<FPackedVertex> vertices_;
+    ea::vector<unsigned short> indices_;
+    ea::vector<unsigned> states_;
+    unsigned lastStateUpload_{0};
+    unsigned lastPositionUpload_{0};
+};
+
+}
@@ -0,0 +1,135 @@
+#include "FigureMaterialArray.h"
+#include "Figure.h"
+
+#include <Urho3D/Graphics/Graphics.h>
+#include <Urho3D/IO/Log.h>
+
+using namespace Redi;
+
+namespace
+{
+    /// Fewest layers a texture is created with.
+    const unsigned MIN_CAPACITY = 8;
+}
+
+FigureMaterialArray::FigureMaterialArray(Context* context)
+    : context_(context)
+{
+}
+
+void FigureMaterialArray::Apply(Material* material)
+{
+    if (!material)
+    {
+        return;
+    }
+    materials_.push_back(WeakPtr<Material>(material));
+    Reserve(0);
+    material->SetTexture(TU_DIFFUSE, texture_);
+    material->SetShaderParameter("MaterialLayers", (float)layers_.size());
+}
+
+void FigureMaterialArray::Reserve(unsigned char slot)
+{
+    while (layers_.size() <= slot)
+    {
+        const unsigned char next = (unsigned char)layers_.size();
+        layers_.push_back(MakeShared<Image>(context_));
+        dirty_.push_back(true);
+        layers_.back()->SetSize(LAYER_SIZE, LAYER_SIZE, 4);
+        layers_.back()->Clear(Figure::GetMaterialColor(next));
+    }
+}
+
+void FigureMaterialArray::Reserve(const Figure& figure)
+{
+    unsigned char last = 0;
+    for (const FFace& face : figure.faces)
+    {
+        last = Max(last, face.material);
+    }
+    Reserve(last);
+}
+
+void FigureMaterialArray::SetSlotColor(unsigned char slot, const Color& color)
+{
+    Reserve(slot);
+    layers_[slot]->Clear(color);
+    dirty_[slot] = true;
+}
+
+bool FigureMaterialArray::SetSlotImage(unsigned char slot, Image* image)
+{
+    if (!image || image->IsCompressed())
+    {
+        return false;
+    }
+
+    SharedPtr<Image> layer = image->ConvertToRGBA();
+    if (!layer || (layer->GetWidth() != LAYER_SIZE || layer->GetHeight() != LAYER_SIZE) && !layer->Resize(LAYER_SIZE, LAYER_SIZE))
+    {
+        return false;
+    }
+    Reserve(slot);
+    layers_[slot] = layer;
+    dirty_[slot] = true;
+    return true;
+}
+
+void FigureMaterialArray::Update()
+{
+    if (layers_.empty() || !context_->GetSubsystem<Graphics>())
+    {
+        return;
+    }
+
+    bool changed = false;
+    if (!texture_ || capacity_ < layers_.size())
+    {
+        capacity_ = Max(capacity_, MIN_CAPACITY);
+        while (capacity_ < layers_.size())
+        {
+            capacity_ *= 2;
+        }
+        texture_ = MakeShared<Texture2DArray>(context_);
+        if (!texture_->SetSize(capacity_, LAYER_SIZE, LAYER_SIZE, Graphics::GetRGBAFormat()))
+        {
+            URHO3D_LOGERROR("Figure material array of {} layers could not be created", capacity_);
+            texture_.Reset();
+            return;
+        }
+        dirty_.assign(layers_.size(), true);
+    }
+    if (materialLayers_ != layers_.size())
+    {
+        materialLayers_ = layers_.size();
+        changed = true;
+    }
+
+    for (unsigned i = 0; i < layers_.size(); ++i)
+    {
+        if (dirty_[i])
+        {
+            texture_->SetData(i, layers_[i]);
+            dirty_[i] = false;
+            changed = true;
+        }
+    }
+
+    if (!changed)
+    {
+        return;
+    }
+    // The shader clamps slots to the layer count, faces of slots without a layer draw as the last one.
+    for (unsigned i = 0; i < materials_.size();)
+    {
+        if (!materials_[i])
+        {
+            materials_.erase(materials_.begin() + i);
+            continue;
+        }
+        materials_[i]->SetTexture(TU_DIFFUSE, texture_);
+        materials_[i]->SetShaderParameter("MaterialLayers", (float)layers_.size());
+        ++i;
+    }
+}
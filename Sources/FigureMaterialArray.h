@@ -0,0 +1,53 @@
+#pragma once
+#include <EASTL/vector.h>
+
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Graphics/Material.h>
+#include <Urho3D/Graphics/Texture2DArray.h>
+#include <Urho3D/Resource/Image.h>
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+class Figure;
+
+/// One Texture2DArray layer per face material slot, sampled by Shaders/GLSL/FigurePacked.glsl with the slot from
+/// the state stream of FigureGpuMesh. Slots without an image are a flat Figure::GetMaterialColor.
+/// Layer capacity grows in powers of two, only growing recreates the texture. Changing a slot uploads its layer.
+class FigureMaterialArray
+{
+public:
+    explicit FigureMaterialArray(Context* context);
+
+    /// Put the array on the diffuse unit of material and keep it there when the texture is recreated.
+    void Apply(Material* material);
+    /// Make slots [0, slot] exist.
+    void Reserve(unsigned char slot);
+    /// Make the slot of every face of figure exist, for figures loaded or recovered with their materials.
+    void Reserve(const Figure& figure);
+    void SetSlotColor(unsigned char slot, const Color& color);
+    /// Image is converted to RGBA and scaled to LAYER_SIZE. False for compressed images.
+    bool SetSlotImage(unsigned char slot, Image* image);
+    /// Upload changed layers. Main thread, needs Graphics.
+    void Update();
+
+    unsigned GetNumSlots() const { return layers_.size(); }
+    Texture2DArray* GetTexture() const { return texture_; }
+
+    /// Width and height of every layer.
+    static const unsigned LAYER_SIZE = 128;
+
+private:
+    Context* context_;
+    ea::vector<SharedPtr<Image>> layers_;
+    ea::vector<bool> dirty_;
+    SharedPtr<Texture2DArray> texture_;
+    unsigned capacity_{0};
+    /// Layer count last given to the materials.
+    unsigned materialLayers_{0};
+    ea::vector<WeakPtr<Material>> materials_;
+};
+
+}
@@ -0,0 +1,202 @@
+#include "FigureOutliner.h"
+
+#include <Urho3D/Core/Thread.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Core/WorkQueue.h>
+
+#include <EASTL/sort.h>
+
+using namespace Redi;
+
+FigureOutliner::FigureOutliner(Context* context)
+    : context_(context)
+{
+}
+
+FigureOutliner::~FigureOutliner()
+{
+    while (workerRunning_)
+    {
+        Thread::Sleep(1);
+    }
+}
+
+float FigureOutliner::GetFaceArea(const FFace& face)
+{
+    if (face.vertices.size() < 4)
+    {
+        return 0.f;
+    }
+    // Half the cross product of the diagonals, exact for any planar quad.
+    const Vector3 d1 = face.vertices[2].position - face.vertices[0].position;
+    const Vector3 d2 = face.vertices[3].position - face.vertices[1].position;
+    return d1.CrossProduct(d2).Length() * 0.5f;
+}
+
+void FigureOutliner::SetFilter(const FOutlinerFilter& filter)
+{
+    if (filter != filter_)
+    {
+        filter_ = filter;
+        dirty_ = true;
+    }
+}
+
+void FigureOutliner::Update(const Figure& figure)
+{
+    if (figure_ != &figure)
+    {
+        figure_ = &figure;
+        chunkRevisions_.clear();
+        chunkMaterialRevisions_.clear();
+        chunks_.clear();
+    }
+
+    // Only changed chunks get new column blocks, unchanged ones keep their block and the worker's cached result.
+    const unsigned numChunks = figure.GetNumChunks();
+    if (chunks_.size() != numChunks || numFaces_ != figure.faces.size())
+    {
+        dirty_ = true;
+    }
+    chunks_.resize(numChunks);
+    chunkRevisions_.resize(numChunks, M_MAX_UNSIGNED);
+    chunkMaterialRevisions_.resize(numChunks, M_MAX_UNSIGNED);
+    numFaces_ = figure.faces.size();
+    for (unsigned chunk = 0; chunk < numChunks; ++chunk)
+    {
+        const unsigned revision = figure.GetChunkRevision(chunk);
+        const unsigned materialRevision = figure.GetChunkMaterialRevision(chunk);
+        if (chunks_[chunk] && chunkRevisions_[chunk] == revision && chunkMaterialRevisions_[chunk] == materialRevision)
+        {
+            continue;
+        }
+        const unsigned chunkBegin = chunk * Figure::FACES_PER_CHUNK;
+        const unsigned chunkEnd = Min(chunkBegin + Figure::FACES_PER_CHUNK, numFaces_);
+        unsigned begin, end;
+        ea::shared_ptr<ColumnChunk> columns;
+        if (chunks_[chunk] && chunkMaterialRevisions_[chunk] == materialRevision
+            && figure.GetMovedRange(chunk, chunkRevisions_[chunk], begin, end))
+        {
+            // Faces that only moved change area and direction, the new block copies the old one and redoes just them.
+            columns = ea::make_shared<ColumnChunk>(*chunks_[chunk]);
+        }
+        else
+        {
+            begin = chunkBegin;
+            end = chunkEnd;
+            columns = ea::make_shared<ColumnChunk>(end - begin);
+        }
+        chunkRevisions_[chunk] = revision;
+        chunkMaterialRevisions_[chunk] = materialRevision;
+
+        for (unsigned i = begin; i < end; ++i)
+        {
+            const FFace& face = figure.faces[i];
+            (*columns)[i - chunkBegin] = FOutlinerRow{(unsigned)face.idx, GetFaceArea(face), (unsigned char)figure.GetFaceDirection(&face), face.material};
+        }
+        chunks_[chunk] = columns;
+        dirty_ = true;
+    }
+
+    if (workerRunning_)
+    {
+        return;
+    }
+    if (job_)
+    {
+        rows_.swap(job_->result);
+        lastJobMs_ = job_->timeMs;
+        job_.reset();
+    }
+    if (!dirty_)
+    {
+        return;
+    }
+
+    dirty_ = false;
+    auto job = ea::make_shared<FJob>();
+    job->chunks = chunks_;
+    job->filter = filter_;
+    job_ = job;
+    workerRunning_ = true;
+    context_->GetSubsystem<WorkQueue>()->AddWorkItem([this, job](unsigned)
+    {
+        Run(*job);
+        workerRunning_ = false;
+    });
+}
+
+bool FigureOutliner::Matches(const FOutlinerRow& row, const FOutlinerFilter& filter)
+{
+    return (filter.direction == FD_NONE || row.direction == filter.direction) && row.area >= filter.minArea && row.area <= filter.maxArea
+        && (filter.material < 0 || row.material == filter.material);
+}
+
+void FigureOutliner::Run(FJob& job)
+{
+    HiresTimer timer;
+    const FOutlinerFilter& filter = job.filter;
+
+    // Sorting options do not change which rows match, the per-block results survive them.
+    FOutlinerFilter matchFilter = filter;
+    matchFilter.sort = workerFilter_.sort;
+    matchFilter.descending = workerFilter_.descending;
+    if (matchFilter != workerFilter_)
+    {
+        filteredSources_.clear();
+        filtered_.clear();
+    }
+    workerFilter_ = filter;
+
+    filteredSources_.resize(job.chunks.size());
+    filtered_.resize(job.chunks.size());
+    unsigned numRows = 0;
+    for (unsigned chunk = 0; chunk < job.chunks.size(); ++chunk)
+    {
+        if (filteredSources_[chunk] != job.chunks[chunk])
+        {
+            filteredSources_[chunk] = job.chunks[chunk];
+            ColumnChunk& rows = filtered_[chunk];
+            rows.clear();
+            for (const FOutlinerRow& row : *job.chunks[chunk])
+            {
+                if (Matches(row, filter))
+                {
+                    rows.push_back(row);
+                }
+            }
+        }
+        numRows += filtered_[chunk].size();
+    }
+
+    job.result.reserve(numRows);
+    for (const ColumnChunk& rows : filtered_)
+    {
+        job.result.insert(job.result.end(), rows.begin(), rows.end());
+    }
+
+    const bool descending = filter.descending;
+    switch (filter.sort)
+    {
+    case OS_NONE:
+        break;
+    case OS_INDEX:
+        ea::sort(job.result.begin(), job.result.end(), [descending](const FOutlinerRow& lhs, const FOutlinerRow& rhs)
+            { return descending ? lhs.idx > rhs.idx : lhs.idx < rhs.idx; });
+        break;
+    case OS_AREA:
+        ea::sort(job.result.begin(), job.result.end(), [descending](const FOutlinerRow& lhs, const FOutlinerRow& rhs)
+            { return lhs.area != rhs.area ? (descending ? lhs.area > rhs.area : lhs.area < rhs.area) : lhs.idx < rhs.idx; });
+        break;
+    case OS_DIRECTION:
+        ea::sort(job.result.begin(), job.result.end(), [descending](const FOutlinerRow& lhs, const FOutlinerRow& rhs)
+            { return lhs.direction != rhs.direction ? (descending ? lhs.direction > rhs.direction : lhs.direction < rhs.direction) : lhs.idx < rhs.idx; });
+        break;
+    case OS_MATERIAL:
+        ea::sort(job.result.begin(), job.result.end(), [descending](const FOutlinerRow& lhs, const FOutlinerRow& rhs)
+            { return lhs.material != rhs.material ? (descending ? lhs.material > rhs.material : lhs.material < rhs.material) : lhs.idx < rhs.idx; });
+        break;
+    }
+
+    job.timeMs = timer.GetUSec(false) / 1000.0f;
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <EASTL/shared_ptr.h>
+#include <EASTL/vector.h>
+
+#include <atomic>
+
+#include <Urho3D/Core/Context.h>
+
+#include "Figure.h"
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+    enum EOutlinerSort : unsigned
+    {
+        OS_NONE, OS_INDEX, OS_AREA, OS_DIRECTION, OS_MATERIAL
+    };
+
+    struct FOutlinerFilter
+    {
+        /// FD_NONE matches every direction.
+        EFaceDirection direction{FD_NONE};
+        float minArea{0.f};
+        float maxArea{M_LARGE_VALUE};
+        /// Negative matches every material.
+        int material{-1};
+        EOutlinerSort sort{OS_NONE};
+        bool descending{false};
+
+        bool operator ==(const FOutlinerFilter& rhs) const
+        {
+            return direction == rhs.direction && minArea == rhs.minArea && maxArea == rhs.maxArea && material == rhs.material
+                && sort == rhs.sort && descending == rhs.descending;
+        }
+        bool operator !=(const FOutlinerFilter& rhs) const { return !(*this == rhs); }
+    };
+
+    /// Precomputed columns of one face.
+    struct FOutlinerRow
+    {
+        unsigned idx;
+        float area;
+        unsigned char direction;
+        unsigned char material;
+    };
+
+    using OutlinerRows = ea::vector<FOutlinerRow, TrackedAllocator<MC_OUTLINER>>;
+
+/// Filtered and sorted face list for the outliner panel.
+/// Columns are kept per Figure chunk as immutable blocks, a changed chunk gets a new block. A worker thread filters
+/// the blocks and reuses its result for every block it has already seen with the same filter, so an edit costs one
+/// chunk of filtering plus the final sort. The main thread only swaps in finished results.
+class FigureOutliner
+{
+public:
+    explicit FigureOutliner(Context* context);
+    ~FigureOutliner();
+
+    /// Refresh columns of changed chunks, pick up a finished result and start the next one. Main thread, once per frame.
+    void Update(const Figure& figure);
+    void SetFilter(const FOutlinerFilter& filter);
+    const FOutlinerFilter& GetFilter() const { return filter_; }
+
+    /// Latest finished result.
+    const OutlinerRows& GetRows() const { return rows_; }
+    unsigned GetNumFaces() const { return numFaces_; }
+    bool IsBusy() const { return workerRunning_ || dirty_; }
+    float GetLastJobMs() const { return lastJobMs_; }
+
+    static float GetFaceArea(const FFace& face);
+
+private:
+    using ColumnChunk = OutlinerRows;
+
+    struct FJob
+    {
+        ea::vector<ea::shared_ptr<const ColumnChunk>> chunks;
+        FOutlinerFilter filter;
+        OutlinerRows result;
+        float timeMs{0.f};
+    };
+
+    /// Worker thread.
+    void Run(FJob& job);
+    static bool Matches(const FOutlinerRow& row, const FOutlinerFilter& filter);
+
+    Context* context_;
+
+    /// Main thread state.
+    ea::vector<unsigned> chunkRevisions_;
+    ea::vector<unsigned> chunkMaterialRevisions_;
+    ea::vector<ea::shared_ptr<const ColumnChunk>> chunks_;
+    const Figure* figure_{nullptr};
+    unsigned numFaces_{0};
+    FOutlinerFilter filter_;
+    bool dirty_{true};
+    OutlinerRows rows_;
+    float lastJobMs_{0.f};
+    ea::shared_ptr<FJob> job_;
+
+    /// Worker state, filtered rows of every block seen with workerFilter_.
+    std::atomic<bool> workerRunning_{false};
+    FOutlinerFilter workerFilter_;
+    ea::vector<ea::shared_ptr<const ColumnChunk>> filteredSources_;
+    ea::vector<ColumnChunk> filtered_;
+};
+
+}
@@ -0,0 +1,305 @@
+#include "FigureRegistry.h"
+
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Graphics/OctreeQuery.h>
+
+#include <EASTL/algorithm.h>
+
+using namespace Redi;
+
+namespace
+{
+    /// Refits loosen the tree as faces move, rebuild from scratch after this many.
+    const unsigned MAX_REFITS = 32;
+    /// Padding of PadFaceBox.
+    const float FACE_BOX_PADDING = 1e-4f;
+}
+
+void FigureRegistry::AddFigure(Figure* figure, Node* node)
+{
+    for (const FInstance& instance : instances_)
+    {
+        if (instance.figure == figure && instance.node.Get() == node)
+        {
+            return;
+        }
+    }
+    FInstance instance;
+    instance.figure = figure;
+    instance.node = node;
+    instance.hasNode = node != nullptr;
+    instances_.push_back(ea::move(instance));
+}
+
+void FigureRegistry::RemoveFigure(Figure* figure)
+{
+    instances_.erase(ea::remove_if(instances_.begin(), instances_.end(), [figure](const FInstance& instance) { return instance.figure == figure; }),
+        instances_.end());
+    figures_.erase(ea::remove_if(figures_.begin(), figures_.end(), [figure](const FFigureEntry& entry) { return entry.figure == figure; }),
+        figures_.end());
+    top_.Clear();
+}
+
+void FigureRegistry::AddDrawableRoot(Node* root)
+{
+    drawableRoots_.push_back(WeakPtr<Node>(root));
+}
+
+void FigureRegistry::Update()
+{
+    HiresTimer timer;
+    boxes_.clear();
+
+    // An instance whose node was removed from the scene is gone with it.
+    instances_.erase(ea::remove_if(instances_.begin(), instances_.end(), [](const FInstance& instance) { return instance.hasNode && !instance.node; }),
+        instances_.end());
+
+    // One entry per distinct figure, however many instances place it.
+    ea::vector<FFigureEntry> figures;
+    for (FInstance& instance : instances_)
+    {
+        auto it = ea::find_if(figures.begin(), figures.end(), [&](const FFigureEntry& entry) { return entry.figure == instance.figure; });
+        if (it == figures.end())
+        {
+            auto old = ea::find_if(figures_.begin(), figures_.end(), [&](const FFigureEntry& entry) { return entry.figure == instance.figure; });
+            if (old != figures_.end())
+            {
+                figures.push_back(ea::move(*old));
+            }
+            else
+            {
+                figures.push_back(FFigureEntry());
+                figures.back().figure = instance.figure;
+            }
+            it = figures.end() - 1;
+        }
+        instance.entry = it - figures.begin();
+    }
+    figures_.swap(figures);
+
+    for (FFigureEntry& entry : figures_)
+    {
+        if (entry.revision != entry.figure->GetRevision() || entry.faces.GetNumItems() != entry.figure->faces.size())
+        {
+            UpdateFaces(entry);
+        }
+    }
+
+    for (FInstance& instance : instances_)
+    {
+        const Bvh& faces = figures_[instance.entry].faces;
+        instance.transform = instance.node ? instance.node->GetWorldTransform() : Matrix3x4::IDENTITY;
+        instance.inverse = instance.transform.Inverse();
+        boxes_.push_back(faces.IsEmpty() ? BoundingBox() : faces.GetBounds().Transformed(instance.transform));
+    }
+
+    drawables_.clear();
+    for (unsigned i = 0; i < drawableRoots_.size();)
+    {
+        if (!drawableRoots_[i])
+        {
+            drawableRoots_.erase(drawableRoots_.begin() + i);
+            continue;
+        }
+        ea::vector<Drawable*> drawables;
+        drawableRoots_[i]->GetDerivedComponents<Drawable>(drawables, true);
+        for (Drawable* drawable : drawables)
+        {
+            if ((drawable->GetDrawableFlags() & DRAWABLE_GEOMETRY) && drawable->IsEnabledEffective())
+            {
+                drawables_.push_back(drawable);
+                boxes_.push_back(drawable->GetWorldBoundingBox());
+            }
+        }
+        ++i;
+    }
+
+    top_.Build(boxes_, 1);
+    lastUpdateMs_ = timer.GetUSec(false) / 1000.0f;
+}
+
+void FigureRegistry::UpdateFaces(FFigureEntry& entry)
+{
+    const Figure& figure = *entry.figure;
+    if (!RefitMovedFaces(entry))
+    {
+        const auto& faces = figure.faces;
+        entry.boxes.resize(faces.size());
+        for (unsigned i = 0; i < faces.size(); ++i)
+        {
+            entry.boxes[i] = PadFaceBox(faces[i].boundingBox);
+        }
+
+        if (entry.faces.GetNumItems() == faces.size() && !entry.faces.IsEmpty() && entry.numRefits < MAX_REFITS)
+        {
+            entry.faces.Refit(entry.boxes);
+            ++entry.numRefits;
+        }
+        else
+        {
+            entry.faces.Build(entry.boxes);
+            entry.numRefits = 0;
+        }
+    }
+
+    entry.chunkRevisions.resize(figure.GetNumChunks());
+    for (unsigned chunk = 0; chunk < figure.GetNumChunks(); ++chunk)
+    {
+        entry.chunkRevisions[chunk] = figure.GetChunkRevision(chunk);
+    }
+    entry.revision = figure.GetRevision();
+}
+
+bool FigureRegistry::RefitMovedFaces(FFigureEntry& entry)
+{
+    const Figure& figure = *entry.figure;
+    const auto& faces = figure.faces;
+    const unsigned numChunks = figure.GetNumChunks();
+    if (entry.faces.IsEmpty() || entry.boxes.size() != faces.size() || entry.chunkRevisions.size() != numChunks)
+    {
+        return false;
+    }
+
+    entry.moved.clear();
+    for (unsigned chunk = 0; chunk < numChunks; ++chunk)
+    {
+        if (entry.chunkRevisions[chunk] == figure.GetChunkRevision(chunk))
+        {
+            continue;
+        }
+        unsigned begin, end;
+        if (!figure.GetMovedRange(chunk, entry.chunkRevisions[chunk], begin, end))
+        {
+            return false;
+        }
+        for (unsigned i = begin; i < end; ++i)
+        {
+            entry.moved.push_back(i);
+        }
+    }
+
+    // Boxes of the whole range are refreshed, faces in it that did not move keep their box. Not counted against
+    // MAX_REFITS, a drag only loosens the few leaves it keeps moving.
+    for (unsigned i : entry.moved)
+    {
+        entry.boxes[i] = PadFaceBox(faces[i].boundingBox);
+    }
+    entry.faces.RefitItems(entry.moved, entry.boxes);
+    return true;
+}
+
+BoundingBox FigureRegistry::PadFaceBox(const BoundingBox& box)
+{
+    return BoundingBox(box.min_ - Vector3::ONE * FACE_BOX_PADDING, box.max_ + Vector3::ONE * FACE_BOX_PADDING);
+}
+
+float FigureRegistry::HitFace(const FFace& face, const Vector3& origin, const Vector3& direction)
+{
+    float nearest = M_INFINITY;
+    for (unsigned i = 2; i < face.vertices.size(); ++i)
+    {
+        nearest = Min(nearest, Bvh::HitTriangle(origin, direction, face.vertices[0].position, face.vertices[i - 1].position,
+            face.vertices[i].position));
+    }
+    return nearest;
+}
+
+bool FigureRegistry::Raycast(const Ray& ray, float maxDistance, FPickResult& result) const
+{
+    result = FPickResult();
+    Traverse(ray, maxDistance, true, true, result);
+    return FinishHit(ray, result);
+}
+
+bool FigureRegistry::RaycastFigures(const Ray& ray, float maxDistance, FPickResult& result) const
+{
+    result = FPickResult();
+    Traverse(ray, maxDistance, true, false, result);
+    return FinishHit(ray, result);
+}
+
+bool FigureRegistry::RaycastDrawables(const Ray& ray, float maxDistance, FPickResult& result) const
+{
+    Traverse(ray, Min(maxDistance, result.distance), false, true, result);
+    return FinishHit(ray, result);
+}
+
+void FigureRegistry::Traverse(const Ray& ray, float maxDistance, bool figures, bool drawables, FPickResult& result) const
+{
+    const unsigned numInstances = instances_.size();
+    ea::vector<RayQueryResult> drawableHits;
+
+    top_.Raycast(ray.origin_, ray.direction_, maxDistance, [&](unsigned item, float& distance)
+    {
+        if (item < numInstances)
+        {
+            if (!figures)
+            {
+                return;
+            }
+            const FInstance& instance = instances_[item];
+            const FFigureEntry& entry = figures_[instance.entry];
+            const auto& faces = entry.figure->faces;
+            // The direction stays unnormalized in figure space, so figure space distances equal world distances.
+            const Vector3 origin = instance.inverse * ray.origin_;
+            const Vector3 direction = instance.inverse.ToMatrix3() * ray.direction_;
+            unsigned hitFace = M_MAX_UNSIGNED;
+            entry.faces.Raycast(origin, direction, distance, [&](unsigned arrayIndex, float& faceDistance)
+            {
+                const float hit = HitFace(faces[arrayIndex], origin, direction);
+                if (hit < faceDistance)
+                {
+                    faceDistance = hit;
+                    hitFace = arrayIndex;
+                }
+            });
+            if (hitFace != M_MAX_UNSIGNED)
+            {
+                result.figure = entry.figure;
+                result.faceIdx = faces[hitFace].idx;
+                result.drawable = nullptr;
+                result.node = instance.node;
+                result.localPosition = origin + direction * distance;
+                result.normal = (instance.inverse.ToMatrix3().Transpose() * faces[hitFace].normal).Normalized();
+                result.distance = distance;
+            }
+            return;
+        }
+
+        if (!drawables)
+        {
+            return;
+        }
+        Drawable* drawable = drawables_[item - numInstances];
+        drawableHits.clear();
+        RayOctreeQuery query(drawableHits, ray, RAY_TRIANGLE, distance, DRAWABLE_GEOMETRY);
+        drawable->ProcessRayQuery(query, drawableHits);
+        for (const RayQueryResult& hit : drawableHits)
+        {
+            if (hit.distance_ < distance)
+            {
+                distance = hit.distance_;
+                result.figure = nullptr;
+                result.faceIdx = -1;
+                result.drawable = hit.drawable_;
+                result.node = nullptr;
+                result.normal = hit.normal_;
+                result.distance = distance;
+            }
+        }
+    });
+}
+
+bool FigureRegistry::FinishHit(const Ray& ray, FPickResult& result)
+{
+    if (result.distance == M_INFINITY)
+    {
+        return false;
+    }
+    result.position = ray.origin_ + ray.direction_ * result.distance;
+    if (!result.figure)
+    {
+        result.localPosition = result.position;
+    }
+    return true;
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <EASTL/vector.h>
+
+#include <Urho3D/Graphics/Drawable.h>
+#include <Urho3D/Math/Ray.h>
+#include <Urho3D/Scene/Node.h>
+
+#include "Bvh.h"
+#include "Figure.h"
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+    /// Closest hit of FigureRegistry::Raycast, either a figure face or an imported drawable.
+    struct FPickResult
+    {
+        Figure* figure{nullptr};
+        /// Face idx of the hit figure face, -1 for drawables.
+        int faceIdx{-1};
+        Drawable* drawable{nullptr};
+        /// Instance node of the hit figure, null for the identity placement.
+        Node* node{nullptr};
+        Vector3 position{Vector3::ZERO};
+        /// Hit position in figure space, equal to position for drawables.
+        Vector3 localPosition{Vector3::ZERO};
+        Vector3 normal{Vector3::ZERO};
+        float distance{M_INFINITY};
+    };
+
+/// Picking over every figure of the scene and the models under the import roots.
+/// Each figure keeps one face BVH in its local space, refitted when only chunk contents changed and rebuilt when the
+/// face count changed. Faces that only moved, e.g. during an extrude drag, refit just their leaves and ancestors.
+/// A figure may be placed any number of times, instances only hold a transform and share the BVH.
+/// A small top level BVH over the world bounds of all instances and drawables is rebuilt every update, so
+/// moving a node costs nothing below it. A ray walks the top level nearest first and enters an instance transformed
+/// into figure space, one query returns the closest hit of the whole scene.
+/// Drawables answer through Drawable::ProcessRayQuery, which reads their nodes and models and so stays on the main
+/// thread. A pick on a worker asks RaycastFigures and lets the main thread add RaycastDrawables.
+class FigureRegistry
+{
+public:
+    /// Place figure by the world transform of node, null node means identity. Adding a figure again with another
+    /// node adds an instance.
+    void AddFigure(Figure* figure, Node* node = nullptr);
+    /// Remove every instance of figure.
+    void RemoveFigure(Figure* figure);
+    /// Geometry drawables below root take part in picking, e.g. an imported scene.
+    void AddDrawableRoot(Node* root);
+
+    /// Refresh changed figures and transforms and rebuild the top level. Main thread, before picking.
+    void Update();
+    /// Closest hit within maxDistance, false when nothing was hit. Main thread.
+    bool Raycast(const Ray& ray, float maxDistance, FPickResult& result) const;
+    /// Closest figure hit within maxDistance. Touches no node or drawable, so it may run on a worker thread while
+    /// no figure changes.
+    bool RaycastFigures(const Ray& ray, float maxDistance, FPickResult& result) const;
+    /// Replace result by a closer drawable hit within maxDistance, false when result holds no hit. Main thread.
+    bool RaycastDrawables(const Ray& ray, float maxDistance, FPickResult& result) const;
+
+    unsigned GetNumFigures() const { return figures_.size(); }
+    unsigned GetNumInstances() const { return instances_.size(); }
+    unsigned GetNumDrawables() const { return drawables_.size(); }
+    float GetLastUpdateMs() const { return lastUpdateMs_; }
+
+private:
+    struct FFigureEntry
+    {
+        Figure* figure{nullptr};
+        unsigned revision{M_MAX_UNSIGNED};
+        unsigned numRefits{0};
+        Bvh faces;
+        /// Padded face boxes the BVH was fitted to, by array index.
+        Bvh::BoxVector boxes;
+        /// Chunk revisions of the figure at the last update.
+        ea::vector<unsigned, TrackedAllocator<MC_PICK>> chunkRevisions;
+        ea::vector<unsigned> moved;
+    };
+
+    struct FInstance
+    {
+        Figure* figure{nullptr};
+        WeakPtr<Node> node;
+        bool hasNode{false};
+        /// Index into figures_, refreshed by Update.
+        unsigned entry{0};
+        Matrix3x4 transform{Matrix3x4::IDENTITY};
+        Matrix3x4 inverse{Matrix3x4::IDENTITY};
+    };
+
+    /// Walk the top level and keep hits of the chosen kinds closer than result.
+    void Traverse(const Ray& ray, float maxDistance, bool figures, bool drawables, FPickResult& result) const;
+    /// Fill in the world and local hit positions, false when result holds no hit.
+    static bool FinishHit(const Ray& ray, FPickResult& result);
+    /// Rebuild or refit the face BVH of entry after its figure changed.
+    void UpdateFaces(FFigureEntry& entry);
+    /// Refit only the moved ranges of changed chunks, false when a chunk changed more than vertex positions.
+    bool RefitMovedFaces(FFigureEntry& entry);
+    /// Faces are flat, padded boxes keep the slab test away from zero thickness.
+    static BoundingBox PadFaceBox(const BoundingBox& box);
+    /// Nearest two-sided hit of the local ray with the quad, M_INFINITY when missed.
+    static float HitFace(const FFace& face, const Vector3& origin, const Vector3& direction);
+
+    ea::vector<FFigureEntry> figures_;
+    ea::vector<FInstance> instances_;
+    ea::vector<WeakPtr<Node>> drawableRoots_;
+    ea::vector<Drawable*> drawables_;
+    /// Items below instances_.size() are figure instances, the rest index drawables_.
+    Bvh top_;
+    Bvh::BoxVector boxes_;
+    float lastUpdateMs_{0.f};
+};
+
+}
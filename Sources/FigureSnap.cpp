@@ -0,0 +1,578 @@
+#include "FigureSnap.h"
+
+#include <Urho3D/Core/Timer.h>
+
+using namespace Redi;
+
+namespace
+{
+    /// Cell coordinates are stored with this bias in 21 bits per axis.
+    const int CELL_BIAS = 1 << 20;
+
+    bool SamePosition(const Vector3& a, const Vector3& b)
+    {
+        return RoundToInt(a.x_ * 1024.0f) == RoundToInt(b.x_ * 1024.0f) && RoundToInt(a.y_ * 1024.0f) == RoundToInt(b.y_ * 1024.0f)
+            && RoundToInt(a.z_ * 1024.0f) == RoundToInt(b.z_ * 1024.0f);
+    }
+
+    /// Lexicographic order of quantized positions, used to store each edge one way only.
+    bool PositionLess(const Vector3& a, const Vector3& b)
+    {
+        const int ax = RoundToInt(a.x_ * 1024.0f), bx = RoundToInt(b.x_ * 1024.0f);
+        if (ax != bx)
+            return ax < bx;
+        const int ay = RoundToInt(a.y_ * 1024.0f), by = RoundToInt(b.y_ * 1024.0f);
+        if (ay != by)
+            return ay < by;
+        return RoundToInt(a.z_ * 1024.0f) < RoundToInt(b.z_ * 1024.0f);
+    }
+
+    Vector3 ClosestPointOnSegment(const Vector3& point, const Vector3& start, const Vector3& end)
+    {
+        const Vector3 direction = end - start;
+        const float lengthSquared = direction.LengthSquared();
+        if (lengthSquared <= M_EPSILON)
+        {
+            return start;
+        }
+        const float t = Clamp((point - start).DotProduct(direction) / lengthSquared, 0.f, 1.f);
+        return start + direction * t;
+    }
+
+    Vector3 WithAxis(const Vector3& point, unsigned axis, float value)
+    {
+        return Vector3(axis == 0 ? value : point.x_, axis == 1 ? value : point.y_, axis == 2 ? value : point.z_);
+    }
+
+    /// Axis of an axis aligned normal, M_MAX_UNSIGNED for any other.
+    unsigned GetNormalAxis(const Vector3& normal)
+    {
+        const Vector3 n = normal.Normalized();
+        for (unsigned axis = 0; axis < 3; ++axis)
+        {
+            if (Abs(n.Data()[axis]) > 0.999f)
+            {
+                return axis;
+            }
+        }
+        return M_MAX_UNSIGNED;
+    }
+}
+
+FigureSnap::FigureSnap(float cellSize)
+    : cellSize_(Max(cellSize, 0.01f))
+{
+}
+
+int FigureSnap::Quantize(float value)
+{
+    return RoundToInt(value * 1024.0f);
+}
+
+IntVector3 FigureSnap::GetCell(const Vector3& position) const
+{
+    return IntVector3(FloorToInt(position.x_ / cellSize_), FloorToInt(position.y_ / cellSize_), FloorToInt(position.z_ / cellSize_));
+}
+
+unsigned long long FigureSnap::CellKey(const IntVector3& cell)
+{
+    return (unsigned long long)((cell.x_ + CELL_BIAS) & 0x1fffff)
+        | ((unsigned long long)((cell.y_ + CELL_BIAS) & 0x1fffff) << 21)
+        | ((unsigned long long)((cell.z_ + CELL_BIAS) & 0x1fffff) << 42);
+}
+
+void FigureSnap::Clear()
+{
+    chunks_.clear();
+    cells_.clear();
+    for (PlaneMap& planes : planes_)
+    {
+        planes.clear();
+    }
+    excluded_.clear();
+    numVertices_ = 0;
+    numEdges_ = 0;
+    figure_ = nullptr;
+}
+
+void FigureSnap::SetExcludedFaces(const Figure& figure, const ea::vector<unsigned>& ids)
+{
+    Update(figure);
+
+    excluded_.clear();
+    for (unsigned idx : ids)
+    {
+        const unsigned index = figure.GetFaceIndex(idx);
+        if (index != M_MAX_UNSIGNED)
+        {
+            excluded_.push_back(index);
+        }
+    }
+    ea::sort(excluded_.begin(), excluded_.end());
+
+    // Only chunks with faces excluded before or now are walked, the corners stored for a face add and remove it.
+    for (unsigned chunk = 0; chunk < chunks_.size(); ++chunk)
+    {
+        FSnapChunk& snapChunk = chunks_[chunk];
+        const unsigned chunkBegin = chunk * Figure::FACES_PER_CHUNK;
+        const unsigned chunkEnd = chunkBegin + snapChunk.numCorners.size();
+        const auto it = ea::lower_bound(excluded_.begin(), excluded_.end(), chunkBegin);
+        if (snapChunk.numExcluded == 0 && (it == excluded_.end() || *it >= chunkEnd))
+        {
+            continue;
+        }
+
+        const Vector3* corners = snapChunk.corners.data();
+        for (unsigned local = 0; local < snapChunk.numCorners.size(); ++local)
+        {
+            const bool excluded = IsExcluded(chunkBegin + local);
+            if ((snapChunk.excluded[local] != 0) != excluded)
+            {
+                ChangeFace(corners, snapChunk.numCorners[local], snapChunk.normals[local], excluded ? -1 : 1);
+                snapChunk.excluded[local] = excluded;
+                snapChunk.numExcluded += excluded ? 1 : -1;
+            }
+            corners += snapChunk.numCorners[local];
+        }
+    }
+}
+
+void FigureSnap::Update(const Figure& figure)
+{
+    if (figure_ != &figure)
+    {
+        Clear();
+        figure_ = &figure;
+    }
+
+    const unsigned numChunks = figure.GetNumChunks();
+    for (unsigned chunk = numChunks; chunk < chunks_.size(); ++chunk)
+    {
+        RemoveChunk(chunk);
+    }
+    chunks_.resize(numChunks);
+
+    for (unsigned chunk = 0; chunk < numChunks; ++chunk)
+    {
+        const unsigned revision = figure.GetChunkRevision(chunk);
+        if (chunks_[chunk].revision == revision)
+        {
+            continue;
+        }
+        unsigned begin, end;
+        if (figure.GetMovedRange(chunk, chunks_[chunk].revision, begin, end))
+        {
+            MoveFaces(figure, chunk, begin, end);
+        }
+        else
+        {
+            RemoveChunk(chunk);
+            AddChunk(figure, chunk);
+        }
+        chunks_[chunk].revision = revision;
+    }
+}
+
+void FigureSnap::AddChunk(const Figure& figure, unsigned chunk)
+{
+    FSnapChunk& snapChunk = chunks_[chunk];
+    const unsigned begin = chunk * Figure::FACES_PER_CHUNK;
+    const unsigned end = Min(begin + Figure::FACES_PER_CHUNK, (unsigned)figure.faces.size());
+    snapChunk.corners.reserve((end - begin) * 4);
+    snapChunk.numCorners.reserve(end - begin);
+    snapChunk.normals.reserve(end - begin);
+    snapChunk.excluded.reserve(end - begin);
+
+    for (unsigned i = begin; i < end; ++i)
+    {
+        const FFace& face = figure.faces[i];
+        const unsigned first = snapChunk.corners.size();
+        const unsigned numCorners = Min((unsigned)face.vertices.size(), 255u);
+        for (unsigned j = 0; j < numCorners; ++j)
+        {
+            snapChunk.corners.push_back(face.vertices[j].position);
+        }
+        snapChunk.numCorners.push_back((unsigned char)numCorners);
+        snapChunk.normals.push_back(face.normal);
+        const bool excluded = IsExcluded(i);
+        snapChunk.excluded.push_back(excluded);
+        if (excluded)
+        {
+            ++snapChunk.numExcluded;
+        }
+        else
+        {
+            ChangeFace(snapChunk.corners.data() + first, numCorners, face.normal, 1);
+        }
+    }
+}
+
+void FigureSnap::RemoveChunk(unsigned chunk)
+{
+    FSnapChunk& snapChunk = chunks_[chunk];
+    const Vector3* corners = snapChunk.corners.data();
+    for (unsigned i = 0; i < snapChunk.numCorners.size(); ++i)
+    {
+        if (!snapChunk.excluded[i])
+        {
+            ChangeFace(corners, snapChunk.numCorners[i], snapChunk.normals[i], -1);
+        }
+        corners += snapChunk.numCorners[i];
+    }
+    snapChunk.corners.clear();
+    snapChunk.numCorners.clear();
+    snapChunk.normals.clear();
+    snapChunk.excluded.clear();
+    snapChunk.numExcluded = 0;
+    snapChunk.revision = M_MAX_UNSIGNED;
+}
+
+void FigureSnap::MoveFaces(const Figure& figure, unsigned chunk, unsigned begin, unsigned end)
+{
+    // Moves keep the corner count of every face, so the corners of the range stay where they are.
+    FSnapChunk& snapChunk = chunks_[chunk];
+    const unsigned chunkBegin = chunk * Figure::FACES_PER_CHUNK;
+    unsigned first = 0;
+    for (unsigned i = chunkBegin; i < begin; ++i)
+    {
+        first += snapChunk.numCorners[i - chunkBegin];
+    }
+
+    for (unsigned i = begin; i < end; ++i)
+    {
+        const FFace& face = figure.faces[i];
+        const unsigned local = i - chunkBegin;
+        const unsigned numCorners = snapChunk.numCorners[local];
+        Vector3* corners = snapChunk.corners.data() + first;
+        // Excluded faces, usually the ones being dragged, only keep their stored corners current.
+        const bool excluded = snapChunk.excluded[local] != 0;
+        if (!excluded)
+        {
+            ChangeFace(corners, numCorners, snapChunk.normals[local], -1);
+        }
+        for (unsigned j = 0; j < numCorners; ++j)
+        {
+            corners[j] = face.vertices[j].position;
+        }
+        snapChunk.normals[local] = face.normal;
+        if (!excluded)
+        {
+            ChangeFace(corners, numCorners, face.normal, 1);
+        }
+        first += numCorners;
+    }
+}
+
+void FigureSnap::ChangeFace(const Vector3* corners, unsigned numCorners, const Vector3& normal, int delta)
+{
+    if (numCorners == 0)
+    {
+        return;
+    }
+    for (unsigned i = 0; i < numCorners; ++i)
+    {
+        ChangePoint(corners[i], delta);
+        ChangeEdge(corners[i], corners[(i + 1) % numCorners], delta);
+    }
+    ChangePlane(corners[0], normal, delta);
+}
+
+void FigureSnap::ChangePoint(const Vector3& position, int delta)
+{
+    // Removals look the cell up, so they never insert an empty one.
+    const unsigned long long key = CellKey(GetCell(position));
+    const auto it = cells_.find(key);
+    if (it == cells_.end())
+    {
+        if (delta > 0)
+        {
+            cells_[key].points.push_back(FSnapPoint{position, (unsigned)delta});
+            ++numVertices_;
+        }
+        return;
+    }
+
+    FSnapCell& cell = it->second;
+    for (unsigned i = 0; i < cell.points.size(); ++i)
+    {
+        FSnapPoint& point = cell.points[i];
+        if (SamePosition(point.position, position))
+        {
+            point.count += delta;
+            if (point.count == 0)
+            {
+                cell.points.erase_unsorted(cell.points.begin() + i);
+                --numVertices_;
+                if (cell.points.empty() && cell.edges.empty())
+                {
+                    cells_.erase(key);
+                }
+            }
+            return;
+        }
+    }
+
+    if (delta > 0)
+    {
+        cell.points.push_back(FSnapPoint{position, (unsigned)delta});
+        ++numVertices_;
+    }
+}
+
+void FigureSnap::ChangeEdge(Vector3 start, Vector3 end, int delta)
+{
+    if (PositionLess(end, start))
+    {
+        ea::swap(start, end);
+    }
+
+    // Edges are listed in every cell their bounds overlap, so a query only looks at its own cells.
+    const IntVector3 first = GetCell(VectorMin(start, end));
+    const IntVector3 last = GetCell(VectorMax(start, end));
+    bool added = false;
+    bool removed = false;
+    for (int z = first.z_; z <= last.z_; ++z)
+    {
+        for (int y = first.y_; y <= last.y_; ++y)
+        {
+            for (int x = first.x_; x <= last.x_; ++x)
+            {
+                const unsigned long long key = CellKey(IntVector3(x, y, z));
+                const auto it = cells_.find(key);
+                if (it == cells_.end())
+                {
+                    if (delta > 0)
+                    {
+                        cells_[key].edges.push_back(FSnapEdge{start, end, (unsigned)delta});
+                        added = true;
+                    }
+                    continue;
+                }
+                FSnapCell& cell = it->second;
+                bool found = false;
+                for (unsigned i = 0; i < cell.edges.size(); ++i)
+                {
+                    FSnapEdge& edge = cell.edges[i];
+                    if (SamePosition(edge.start, start) && SamePosition(edge.end, end))
+                    {
+                        found = true;
+                        edge.count += delta;
+                        if (edge.count == 0)
+                        {
+                            cell.edges.erase_unsorted(cell.edges.begin() + i);
+                            removed = true;
+                            if (cell.points.empty() && cell.edges.empty())
+                            {
+                                cells_.erase(key);
+                            }
+                        }
+                        break;
+                    }
+                }
+                if (!found && delta > 0)
+                {
+                    cell.edges.push_back(FSnapEdge{start, end, (unsigned)delta});
+                    added = true;
+                }
+            }
+        }
+    }
+
+    if (added)
+        ++numEdges_;
+    else if (removed)
+        --numEdges_;
+}
+
+void FigureSnap::ChangePlane(const Vector3& corner, const Vector3& normal, int delta)
+{
+    const unsigned axis = GetNormalAxis(normal);
+    if (axis == M_MAX_UNSIGNED)
+    {
+        return;
+    }
+
+    PlaneMap& planes = planes_[axis];
+    const int key = Quantize(corner.Data()[axis]);
+    if (delta > 0)
+    {
+        planes[key] += delta;
+        return;
+    }
+
+    auto it = planes.find(key);
+    if (it != planes.end() && (it->second += delta) == 0)
+    {
+        planes.erase(it);
+    }
+}
+
+bool FigureSnap::FindNearest(const Vector3& point, float radius, unsigned kinds, FSnapResult& result) const
+{
+    HiresTimer timer;
+    result = FSnapResult();
+
+    if (kinds & (SK_VERTEX | SK_EDGE))
+    {
+        const IntVector3 first = GetCell(point - Vector3::ONE * radius);
+        const IntVector3 last = GetCell(point + Vector3::ONE * radius);
+        float vertexDistance = radius;
+        float edgeDistance = radius;
+        Vector3 vertexPosition, edgePosition;
+        bool vertexFound = false;
+        bool edgeFound = false;
+        for (int z = first.z_; z <= last.z_; ++z)
+        {
+            for (int y = first.y_; y <= last.y_; ++y)
+            {
+                for (int x = first.x_; x <= last.x_; ++x)
+                {
+                    const auto it = cells_.find(CellKey(IntVector3(x, y, z)));
+                    if (it == cells_.end())
+                    {
+                        continue;
+                    }
+                    if (kinds & SK_VERTEX)
+                    {
+                        for (const FSnapPoint& candidate : it->second.points)
+                        {
+                            const float distance = (candidate.position - point).Length();
+                            if (distance <= vertexDistance)
+                            {
+                                vertexDistance = distance;
+                                vertexPosition = candidate.position;
+                                vertexFound = true;
+                            }
+                        }
+                    }
+                    if (kinds & SK_EDGE)
+                    {
+                        for (const FSnapEdge& candidate : it->second.edges)
+                        {
+                            const Vector3 closest = ClosestPointOnSegment(point, candidate.start, candidate.end);
+                            const float distance = (closest - point).Length();
+                            if (distance <= edgeDistance)
+                            {
+                                edgeDistance = distance;
+                                edgePosition = closest;
+                                edgeFound = true;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        if (vertexFound)
+        {
+            result = FSnapResult{SK_VERTEX, vertexPosition, vertexDistance};
+        }
+        else if (edgeFound)
+        {
+            result = FSnapResult{SK_EDGE, edgePosition, edgeDistance};
+        }
+    }
+
+    if (result.kind == SK_NONE && (kinds & SK_PLANE))
+    {
+        float bestDistance = radius;
+        for (unsigned axis = 0; axis < 3; ++axis)
+        {
+            const float value = point.Data()[axis];
+            const PlaneMap& planes = planes_[axis];
+            for (auto it = planes.lower_bound(Quantize(value - radius)); it != planes.end() && it->first <= Quantize(value + radius); ++it)
+            {
+                const float distance = Abs(it->first / 1024.0f - value);
+                if (distance <= bestDistance)
+                {
+                    bestDistance = distance;
+                    result = FSnapResult{SK_PLANE, WithAxis(point, axis, it->first / 1024.0f), distance};
+                }
+            }
+        }
+    }
+
+    // The grid always snaps, it is the fallback when nothing else is near.
+    if (result.kind == SK_NONE && (kinds & SK_GRID) && gridStep_ > 0.f)
+    {
+        result.kind = SK_GRID;
+        result.position = SnapToGrid(point, gridStep_);
+        result.distance = (result.position - point).Length();
+    }
+
+    lastQueryUs_ = (float)timer.GetUSec(false);
+    return result.kind != SK_NONE;
+}
+
+Vector3 FigureSnap::SnapFaceOffset(const Figure& figure, unsigned idx, const Vector3& offset, float radius, unsigned kinds,
+    FSnapResult& result) const
+{
+    result = FSnapResult();
+    const unsigned arrayIndex = figure.GetFaceIndex(idx);
+    if (arrayIndex == M_MAX_UNSIGNED)
+    {
+        return offset;
+    }
+
+    const FFace& face = figure.faces[arrayIndex];
+    const Vector3 axis = face.normal.Normalized();
+    if (axis == Vector3::ZERO || face.vertices.empty())
+    {
+        return offset;
+    }
+
+    // Any corner landing on a vertex or edge moves the face plane to the axial position of that target.
+    float bestDistance = M_INFINITY;
+    float bestDelta = 0.f;
+    if (kinds & (SK_VERTEX | SK_EDGE))
+    {
+        for (const FVertex& vertex : face.vertices)
+        {
+            const Vector3 moved = vertex.position + offset;
+            FSnapResult hit;
+            if (FindNearest(moved, radius, kinds & (SK_VERTEX | SK_EDGE), hit) && hit.distance < bestDistance)
+            {
+                bestDistance = hit.distance;
+                bestDelta = (hit.position - moved).DotProduct(axis);
+                result = hit;
+            }
+        }
+    }
+
+    // Otherwise the face plane goes to the nearest parallel plane, or to the grid along the normal.
+    const unsigned normalAxis = GetNormalAxis(axis);
+    const Vector3 center = face.boundingBox.Center() + offset;
+    if (result.kind == SK_NONE && (kinds & SK_PLANE) && normalAxis != M_MAX_UNSIGNED)
+    {
+        const PlaneMap& planes = planes_[normalAxis];
+        const float value = center.Data()[normalAxis];
+        auto it = planes.lower_bound(Quantize(value - radius));
+        for (; it != planes.end() && it->first <= Quantize(value + radius); ++it)
+        {
+            const float delta = it->first / 1024.0f - value;
+            if (Abs(delta) < bestDistance)
+            {
+                bestDistance = Abs(delta);
+                bestDelta = delta * axis.Data()[normalAxis];
+                result = FSnapResult{SK_PLANE, center + axis * bestDelta, bestDistance};
+            }
+        }
+    }
+    if (result.kind == SK_NONE && (kinds & SK_GRID) && gridStep_ > 0.f)
+    {
+        const float value = center.DotProduct(axis);
+        bestDelta = Round(value / gridStep_) * gridStep_ - value;
+        result = FSnapResult{SK_GRID, center + axis * bestDelta, Abs(bestDelta)};
+    }
+
+    return offset + axis * bestDelta;
+}
+
+Vector3 FigureSnap::SnapToGrid(const Vector3& point, float step)
+{
+    if (step <= 0.f)
+    {
+        return point;
+    }
+    return Vector3(Round(point.x_ / step) * step, Round(point.y_ / step) * step, Round(point.z_ / step) * step);
+}
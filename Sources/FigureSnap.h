@@ -0,0 +1,129 @@
+#pragma once
+#include <EASTL/algorithm.h>
+#include <EASTL/map.h>
+#include <EASTL/unordered_map.h>
+#include <EASTL/vector.h>
+
+#include <Urho3D/Math/Vector3.h>
+
+#include "Figure.h"
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+    enum ESnapKind : unsigned
+    {
+        SK_NONE = 0,
+        SK_VERTEX = 1 << 0,
+        SK_EDGE = 1 << 1,
+        SK_PLANE = 1 << 2,
+        SK_GRID = 1 << 3,
+        SK_ALL = SK_VERTEX | SK_EDGE | SK_PLANE | SK_GRID
+    };
+
+    struct FSnapResult
+    {
+        ESnapKind kind{SK_NONE};
+        Vector3 position{Vector3::ZERO};
+        float distance{0.f};
+    };
+
+/// Snapping queries against the vertices, edges and face planes of a Figure.
+/// Vertices and edges live in a hash grid of cellSize cells, planes of axis aligned faces in one sorted map per axis,
+/// so a query touches only the cells around the point and costs the same for small and million-vertex figures.
+/// Shared vertices and edges are stored once with a reference count. Update re-indexes only chunks whose revision changed,
+/// and of a chunk whose faces only moved just the moved ones.
+class FigureSnap
+{
+public:
+    explicit FigureSnap(float cellSize = 1.0f);
+
+    /// Bring the index up to date with figure. Switching to another figure rebuilds it.
+    void Update(const Figure& figure);
+    void Clear();
+
+    /// Nearest target of kinds within radius of point. Vertices win over edges, edges over planes, planes over the grid.
+    bool FindNearest(const Vector3& point, float radius, unsigned kinds, FSnapResult& result) const;
+    /// Offset moving face idx by about offset so that it lands on nearby geometry. Snapping is along the face normal only.
+    /// Exclude the moving faces first, or the face snaps onto its own corners and plane.
+    Vector3 SnapFaceOffset(const Figure& figure, unsigned idx, const Vector3& offset, float radius, unsigned kinds, FSnapResult& result) const;
+
+    /// Leave faces ids of figure out of the index until the next call, pass none to put them back.
+    void SetExcludedFaces(const Figure& figure, const ea::vector<unsigned>& ids);
+
+    void SetGridStep(float step) { gridStep_ = step; }
+    float GetGridStep() const { return gridStep_; }
+    unsigned GetNumVertices() const { return numVertices_; }
+    unsigned GetNumEdges() const { return numEdges_; }
+    /// Time spent by the last FindNearest call.
+    float GetLastQueryUs() const { return lastQueryUs_; }
+
+    static Vector3 SnapToGrid(const Vector3& point, float step);
+
+private:
+    struct FSnapPoint
+    {
+        Vector3 position;
+        unsigned count;
+    };
+
+    struct FSnapEdge
+    {
+        Vector3 start;
+        Vector3 end;
+        unsigned count;
+    };
+
+    struct FSnapCell
+    {
+        ea::vector<FSnapPoint, TrackedAllocator<MC_SNAP>> points;
+        ea::vector<FSnapEdge, TrackedAllocator<MC_SNAP>> edges;
+    };
+
+    /// Face corners and normals of one Figure chunk as they were indexed, used to take them out again.
+    struct FSnapChunk
+    {
+        unsigned revision{M_MAX_UNSIGNED};
+        ea::vector<Vector3, TrackedAllocator<MC_SNAP>> corners;
+        ea::vector<unsigned char, TrackedAllocator<MC_SNAP>> numCorners;
+        ea::vector<Vector3, TrackedAllocator<MC_SNAP>> normals;
+        /// Faces stored but left out of the index, with their count.
+        ea::vector<unsigned char, TrackedAllocator<MC_SNAP>> excluded;
+        unsigned numExcluded{0};
+    };
+
+    using PlaneMap = ea::map<int, unsigned, ea::less<int>, TrackedAllocator<MC_SNAP>>;
+
+    void AddChunk(const Figure& figure, unsigned chunk);
+    void RemoveChunk(unsigned chunk);
+    /// Re-index faces [begin, end) of chunk, which only moved since it was indexed.
+    void MoveFaces(const Figure& figure, unsigned chunk, unsigned begin, unsigned end);
+    bool IsExcluded(unsigned index) const { return ea::binary_search(excluded_.begin(), excluded_.end(), index); }
+    /// Add (delta = 1) or remove (delta = -1) one face.
+    void ChangeFace(const Vector3* corners, unsigned numCorners, const Vector3& normal, int delta);
+    void ChangePoint(const Vector3& position, int delta);
+    void ChangeEdge(Vector3 start, Vector3 end, int delta);
+    void ChangePlane(const Vector3& corner, const Vector3& normal, int delta);
+
+    IntVector3 GetCell(const Vector3& position) const;
+    static unsigned long long CellKey(const IntVector3& cell);
+    /// Positions are compared and plane offsets keyed at 1/1024 units.
+    static int Quantize(float value);
+
+    float cellSize_;
+    float gridStep_{1.0f};
+    const Figure* figure_{nullptr};
+    ea::vector<FSnapChunk> chunks_;
+    ea::unordered_map<unsigned long long, FSnapCell, ea::hash<unsigned long long>, ea::equal_to<unsigned long long>, TrackedAllocator<MC_SNAP>> cells_;
+    /// Quantized plane offset to face count, X, Y and Z.
+    PlaneMap planes_[3];
+    /// Sorted face array indices left out of the index.
+    ea::vector<unsigned> excluded_;
+    unsigned numVertices_{0};
+    unsigned numEdges_{0};
+    mutable float lastQueryUs_{0.f};
+};
+
+}
@@ -0,0 +1,1129 @@
+#include "FigureSubdivision.h"
+#include "Parallel.h"
+
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Math/MathDefs.h>
+
+#include <EASTL/algorithm.h>
+#include <EASTL/sort.h>
+#include <EASTL/unordered_map.h>
+
+#if defined(URHO3D_SSE)
+#include <xmmintrin.h>
+#endif
+
+using namespace Redi;
+
+namespace
+{
+    /// Top bit of FChunkStencils::faces, set for refined faces.
+    const unsigned REFINED_FACE = 0x80000000u;
+    /// Faces per ParallelFor range when evaluating.
+    const unsigned EVALUATE_GRAIN = 512;
+    /// Flattened stencil weights below this are dropped.
+    const float MIN_WEIGHT = 1e-6f;
+
+    unsigned long long HashCombine(unsigned long long hash, unsigned long long value)
+    {
+        return (hash ^ value) * 1099511628211ull;
+    }
+
+    const Vector3& SlotPosition(const Figure& figure, unsigned slot)
+    {
+        return figure.faces[slot / 4].vertices[slot % 4].position;
+    }
+
+    /// Normals of forward and back faces point inside, the side of the face direction points out.
+    Vector3 OutwardNormal(const Figure& figure, const FFace& face)
+    {
+        const IntVector3 side = Figure::GetFaceSide(figure.GetFaceDirection(&face));
+        return side != IntVector3::ZERO ? Vector3(side) : face.normal;
+    }
+
+    /// Uniform cubic B-spline basis at t.
+    void BSplineBasis(float t, float* basis)
+    {
+        const float s = 1.f - t;
+        basis[0] = s * s * s / 6.f;
+        basis[1] = (3.f * t * t * t - 6.f * t * t + 4.f) / 6.f;
+        basis[2] = (-3.f * t * t * t + 3.f * t * t + 3.f * t + 1.f) / 6.f;
+        basis[3] = t * t * t / 6.f;
+    }
+
+    void AddScaled(float* dest, const float* source, float weight, unsigned count)
+    {
+        for (unsigned i = 0; i < count; ++i)
+        {
+            dest[i] += source[i] * weight;
+        }
+    }
+
+    struct FEdgeRecord
+    {
+        unsigned a;
+        unsigned b;
+        /// face * 4 + edge.
+        unsigned faceEdge;
+    };
+
+    bool EdgeRecordLess(const FEdgeRecord& lhs, const FEdgeRecord& rhs)
+    {
+        return lhs.a != rhs.a ? lhs.a < rhs.a : (lhs.b != rhs.b ? lhs.b < rhs.b : lhs.faceEdge < rhs.faceEdge);
+    }
+
+    /// Quad mesh around one face during local refinement. Every vertex is a dense stencil over the ring controls.
+    struct FLocalMesh
+    {
+        unsigned numControls{0};
+        /// numControls weights per vertex.
+        ea::vector<float> stencils;
+        /// Four vertices per face.
+        ea::vector<unsigned> faces;
+        /// Per face edge, 1 when sharp.
+        ea::vector<unsigned char> sharp;
+        /// Per face, 1 for the face being sampled and the faces refined from it.
+        ea::vector<unsigned char> target;
+        /// Per vertex grid position on the sampled face in final level units, -1 when off it.
+        ea::vector<IntVector2> params;
+
+        unsigned GetNumVertices() const { return params.size(); }
+        unsigned GetNumFaces() const { return faces.size() / 4; }
+        float* GetStencil(unsigned vertex) { return stencils.data() + vertex * numControls; }
+        const float* GetStencil(unsigned vertex) const { return stencils.data() + vertex * numControls; }
+    };
+
+    struct FLocalEdge
+    {
+        unsigned a;
+        unsigned b;
+        unsigned faces[2];
+        unsigned numFaces;
+        bool sharp;
+    };
+
+    /// Edges and vertex adjacency of a local mesh.
+    struct FLocalEdges
+    {
+        ea::vector<FLocalEdge> edges;
+        /// Edge of every face edge.
+        ea::vector<unsigned> faceEdges;
+        /// Edges around vertex v are vertexEdges[vertexEdgeOffsets[v], vertexEdgeOffsets[v + 1]).
+        ea::vector<unsigned> vertexEdgeOffsets;
+        ea::vector<unsigned> vertexEdges;
+        /// Face corners (face * 4 + corner) around every vertex, same layout.
+        ea::vector<unsigned> vertexCornerOffsets;
+        ea::vector<unsigned> vertexCorners;
+    };
+
+    void BuildLocalEdges(const FLocalMesh& mesh, FLocalEdges& result)
+    {
+        const unsigned numFaces = mesh.GetNumFaces();
+        const unsigned numVertices = mesh.GetNumVertices();
+        ea::vector<FEdgeRecord> records;
+        records.reserve(numFaces * 4);
+        for (unsigned i = 0; i < numFaces * 4; ++i)
+        {
+            const unsigned a = mesh.faces[i];
+            const unsigned b = mesh.faces[(i & ~3u) + ((i + 1) & 3u)];
+            records.push_back(FEdgeRecord{Min(a, b), Max(a, b), i});
+        }
+        ea::sort(records.begin(), records.end(), EdgeRecordLess);
+
+        result.edges.clear();
+        result.faceEdges.assign(numFaces * 4, 0);
+        for (unsigned i = 0; i < records.size();)
+        {
+            unsigned j = i;
+            FLocalEdge edge{records[i].a, records[i].b, {records[i].faceEdge / 4, records[i].faceEdge / 4}, 0, false};
+            for (; j < records.size() && records[j].a == records[i].a && records[j].b == records[i].b; ++j)
+            {
+                if (j == i + 1)
+                {
+                    edge.faces[1] = records[j].faceEdge / 4;
+                }
+                edge.sharp |= mesh.sharp[records[j].faceEdge] != 0;
+                result.faceEdges[records[j].faceEdge] = result.edges.size();
+            }
+            edge.numFaces = j - i;
+            edge.sharp |= edge.numFaces != 2;
+            result.edges.push_back(edge);
+            i = j;
+        }
+
+        result.vertexEdgeOffsets.assign(numVertices + 1, 0);
+        for (const FLocalEdge& edge : result.edges)
+        {
+            ++result.vertexEdgeOffsets[edge.a + 1];
+            ++result.vertexEdgeOffsets[edge.b + 1];
+        }
+        for (unsigned v = 0; v < numVertices; ++v)
+        {
+            result.vertexEdgeOffsets[v + 1] += result.vertexEdgeOffsets[v];
+        }
+        result.vertexEdges.resize(result.vertexEdgeOffsets.back());
+        ea::vector<unsigned> fill(result.vertexEdgeOffsets.begin(), result.vertexEdgeOffsets.end() - 1);
+        for (unsigned e = 0; e < result.edges.size(); ++e)
+        {
+            result.vertexEdges[fill[result.edges[e].a]++] = e;
+            result.vertexEdges[fill[result.edges[e].b]++] = e;
+        }
+
+        result.vertexCornerOffsets.assign(numVertices + 1, 0);
+        for (unsigned i = 0; i < numFaces * 4; ++i)
+        {
+            ++result.vertexCornerOffsets[mesh.faces[i] + 1];
+        }
+        for (unsigned v = 0; v < numVertices; ++v)
+        {
+            result.vertexCornerOffsets[v + 1] += result.vertexCornerOffsets[v];
+        }
+        result.vertexCorners.resize(numFaces * 4);
+        fill.assign(result.vertexCornerOffsets.begin(), result.vertexCornerOffsets.end() - 1);
+        for (unsigned i = 0; i < numFaces * 4; ++i)
+        {
+            result.vertexCorners[fill[mesh.faces[i]]++] = i;
+        }
+    }
+
+    /// Number of sharp edges around vertex and the far ends of the first two.
+    unsigned GetSharpEdges(const FLocalEdges& edges, unsigned vertex, unsigned* ends)
+    {
+        unsigned numSharp = 0;
+        for (unsigned i = edges.vertexEdgeOffsets[vertex]; i < edges.vertexEdgeOffsets[vertex + 1]; ++i)
+        {
+            const FLocalEdge& edge = edges.edges[edges.vertexEdges[i]];
+            if (edge.sharp)
+            {
+                if (numSharp < 2)
+                {
+                    ends[numSharp] = edge.a == vertex ? edge.b : edge.a;
+                }
+                ++numSharp;
+            }
+        }
+        return numSharp;
+    }
+
+    /// One Catmull-Clark step with crease and corner rules. New vertices are the old vertex points, then one per
+    /// edge, then one per face. Sub-face i of a face starts at its corner i, so corner order and orientation carry over.
+    void Refine(const FLocalMesh& source, const FLocalEdges& edges, FLocalMesh& dest)
+    {
+        const unsigned numVertices = source.GetNumVertices();
+        const unsigned numEdges = edges.edges.size();
+        const unsigned numFaces = source.GetNumFaces();
+        const unsigned numControls = source.numControls;
+        const unsigned edgeBase = numVertices;
+        const unsigned faceBase = numVertices + numEdges;
+
+        dest.numControls = numControls;
+        dest.stencils.assign((faceBase + numFaces) * numControls, 0.f);
+        dest.params.assign(faceBase + numFaces, IntVector2(-1, -1));
+
+        for (unsigned f = 0; f < numFaces; ++f)
+        {
+            float* stencil = dest.GetStencil(faceBase + f);
+            IntVector2 param(0, 0);
+            for (unsigned corner = 0; corner < 4; ++corner)
+            {
+                AddScaled(stencil, source.GetStencil(source.faces[f * 4 + corner]), 0.25f, numControls);
+                param += source.params[source.faces[f * 4 + corner]];
+            }
+            if (source.target[f])
+            {
+                dest.params[faceBase + f] = param / 4;
+            }
+        }
+
+        for (unsigned e = 0; e < numEdges; ++e)
+        {
+            const FLocalEdge& edge = edges.edges[e];
+            float* stencil = dest.GetStencil(edgeBase + e);
+            if (edge.sharp)
+            {
+                AddScaled(stencil, source.GetStencil(edge.a), 0.5f, numControls);
+                AddScaled(stencil, source.GetStencil(edge.b), 0.5f, numControls);
+            }
+            else
+            {
+                AddScaled(stencil, source.GetStencil(edge.a), 0.25f, numControls);
+                AddScaled(stencil, source.GetStencil(edge.b), 0.25f, numControls);
+                AddScaled(stencil, dest.GetStencil(faceBase + edge.faces[0]), 0.25f, numControls);
+                AddScaled(stencil, dest.GetStencil(faceBase + edge.faces[1]), 0.25f, numControls);
+            }
+            const IntVector2& a = source.params[edge.a];
+            const IntVector2& b = source.params[edge.b];
+            if (a.x_ >= 0 && b.x_ >= 0 && (source.target[edge.faces[0]] || source.target[edge.faces[1]]))
+            {
+                dest.params[edgeBase + e] = (a + b) / 2;
+            }
+        }
+
+        for (unsigned v = 0; v < numVertices; ++v)
+        {
+            float* stencil = dest.GetStencil(v);
+            const float* vertex = source.GetStencil(v);
+            const unsigned firstEdge = edges.vertexEdgeOffsets[v];
+            const unsigned valence = edges.vertexEdgeOffsets[v + 1] - firstEdge;
+            unsigned ends[2];
+            const unsigned numSharp = GetSharpEdges(edges, v, ends);
+            dest.params[v] = source.params[v];
+
+            if (valence == 0 || numSharp > 2)
+            {
+                AddScaled(stencil, vertex, 1.f, numControls);
+            }
+            else if (numSharp == 2)
+            {
+                AddScaled(stencil, vertex, 0.75f, numControls);
+                AddScaled(stencil, source.GetStencil(ends[0]), 0.125f, numControls);
+                AddScaled(stencil, source.GetStencil(ends[1]), 0.125f, numControls);
+            }
+            else
+            {
+                // (Q + 2R + (n - 3)V) / n, Q the mean of the face points, R the mean of the edge midpoints.
+                const float n = (float)valence;
+                const unsigned firstCorner = edges.vertexCornerOffsets[v];
+                const unsigned numCorners = edges.vertexCornerOffsets[v + 1] - firstCorner;
+                for (unsigned i = 0; i < numCorners; ++i)
+                {
+                    AddScaled(stencil, dest.GetStencil(faceBase + edges.vertexCorners[firstCorner + i] / 4), 1.f / (numCorners * n), numControls);
+                }
+                for (unsigned i = 0; i < valence; ++i)
+                {
+                    const FLocalEdge& edge = edges.edges[edges.vertexEdges[firstEdge + i]];
+                    AddScaled(stencil, source.GetStencil(edge.a == v ? edge.b : edge.a), 1.f / (n * n), numControls);
+                }
+                AddScaled(stencil, vertex, 1.f / n + (n - 3.f) / n, numControls);
+            }
+        }
+
+        dest.faces.resize(numFaces * 16);
+        dest.sharp.resize(numFaces * 16);
+        dest.target.resize(numFaces * 4);
+        for (unsigned f = 0; f < numFaces; ++f)
+        {
+            for (unsigned i = 0; i < 4; ++i)
+            {
+                const unsigned next = edges.faceEdges[f * 4 + i];
+                const unsigned previous = edges.faceEdges[f * 4 + (i + 3) % 4];
+                const unsigned sub = (f * 4 + i) * 4;
+                dest.faces[sub + 0] = source.faces[f * 4 + i];
+                dest.faces[sub + 1] = edgeBase + next;
+                dest.faces[sub + 2] = faceBase + f;
+                dest.faces[sub + 3] = edgeBase + previous;
+                dest.sharp[sub + 0] = edges.edges[next].sharp;
+                dest.sharp[sub + 1] = 0;
+                dest.sharp[sub + 2] = 0;
+                dest.sharp[sub + 3] = edges.edges[previous].sharp;
+                dest.target[f * 4 + i] = source.target[f];
+            }
+        }
+    }
+
+    /// Limit position of vertex as a dense stencil: (n^2 V + 4 sum E + sum D) / (n (n + 5)) for smooth vertices,
+    /// (A + 4V + B) / 6 on creases, the vertex itself at corners.
+    void GetLimitStencil(const FLocalMesh& mesh, const FLocalEdges& edges, unsigned v, float* stencil)
+    {
+        const unsigned numControls = mesh.numControls;
+        const float* vertex = mesh.GetStencil(v);
+        const unsigned firstEdge = edges.vertexEdgeOffsets[v];
+        const unsigned valence = edges.vertexEdgeOffsets[v + 1] - firstEdge;
+        unsigned ends[2];
+        const unsigned numSharp = GetSharpEdges(edges, v, ends);
+        ea::fill(stencil, stencil + numControls, 0.f);
+
+        if (valence == 0 || numSharp > 2)
+        {
+            AddScaled(stencil, vertex, 1.f, numControls);
+        }
+        else if (numSharp == 2)
+        {
+            AddScaled(stencil, vertex, 4.f / 6.f, numControls);
+            AddScaled(stencil, mesh.GetStencil(ends[0]), 1.f / 6.f, numControls);
+            AddScaled(stencil, mesh.GetStencil(ends[1]), 1.f / 6.f, numControls);
+        }
+        else
+        {
+            const float n = (float)valence;
+            const float scale = 1.f / (n * (n + 5.f));
+            AddScaled(stencil, vertex, n * n * scale, numControls);
+            for (unsigned i = 0; i < valence; ++i)
+            {
+                const FLocalEdge& edge = edges.edges[edges.vertexEdges[firstEdge + i]];
+                AddScaled(stencil, mesh.GetStencil(edge.a == v ? edge.b : edge.a), 4.f * scale, numControls);
+            }
+            for (unsigned i = edges.vertexCornerOffsets[v]; i < edges.vertexCornerOffsets[v + 1]; ++i)
+            {
+                const unsigned corner = edges.vertexCorners[i];
+                AddScaled(stencil, mesh.GetStencil(mesh.faces[(corner & ~3u) + ((corner + 2) & 3u)]), scale, numControls);
+            }
+        }
+    }
+}
+
+FigureSubdivision::FigureSubdivision(Context* context)
+    : context_(context)
+{
+}
+
+void FigureSubdivision::SetLevel(unsigned level)
+{
+    level = Clamp(level, 1u, MAX_LEVEL);
+    if (level != level_)
+    {
+        // Sample counts change, every chunk is evaluated again from the stencils cached for level.
+        level_ = level;
+        for (FChunk& chunk : chunks_)
+        {
+            chunk.vertices.clear();
+        }
+    }
+}
+
+void FigureSubdivision::SetCreaseAngle(float degrees)
+{
+    degrees = Clamp(degrees, 0.f, 180.f);
+    if (degrees != creaseAngle_)
+    {
+        creaseAngle_ = degrees;
+        topologyDirty_ = true;
+    }
+}
+
+void FigureSubdivision::Clear()
+{
+    figure_ = nullptr;
+    topologyDirty_ = true;
+    chunks_.clear();
+    cornerVertices_.clear();
+    vertexSlots_.clear();
+    vertexFaceOffsets_.clear();
+    vertexFaces_.clear();
+    sharpEdges_.clear();
+    for (ea::vector<FChunkStencils>& stencils : stencils_)
+    {
+        stencils.clear();
+    }
+    marks_.clear();
+    numPatchFaces_ = 0;
+    numRefinedFaces_ = 0;
+}
+
+void FigureSubdivision::ReleaseSamples()
+{
+    for (FChunk& data : chunks_)
+    {
+        data.vertices.set_capacity(0);
+        data.dirtyBegin = M_MAX_UNSIGNED;
+        data.dirtyEnd = 0;
+    }
+    marks_.set_capacity(0);
+}
+
+bool FigureSubdivision::GetDirtyRange(unsigned chunk, unsigned& begin, unsigned& end) const
+{
+    if (chunk >= chunks_.size() || chunks_[chunk].dirtyBegin >= chunks_[chunk].dirtyEnd)
+    {
+        return false;
+    }
+    begin = chunks_[chunk].dirtyBegin;
+    end = chunks_[chunk].dirtyEnd;
+    return true;
+}
+
+void FigureSubdivision::ClearDirtyRange(unsigned chunk)
+{
+    if (chunk < chunks_.size())
+    {
+        chunks_[chunk].dirtyBegin = M_MAX_UNSIGNED;
+        chunks_[chunk].dirtyEnd = 0;
+    }
+}
+
+void FigureSubdivision::Update(const Figure& figure)
+{
+    if (figure_ != &figure)
+    {
+        Clear();
+        figure_ = &figure;
+    }
+
+    const unsigned numFaces = figure.faces.size();
+    const unsigned numChunks = figure.GetNumChunks();
+    const unsigned samples = GetSamplesPerFace();
+    lastNumRebuilt_ = 0;
+    lastNumEvaluated_ = 0;
+
+    // Faces whose corners changed. Chunks that only moved give their moved range, others count whole.
+    bool topologyChanged = topologyDirty_ || chunks_.size() != numChunks;
+    for (unsigned chunk = 0; chunk < numChunks && !topologyChanged; ++chunk)
+    {
+        topologyChanged = chunks_[chunk].topologyRevision != figure.GetChunkTopologyRevision(chunk);
+    }
+    ea::vector<unsigned> changed;
+    for (unsigned chunk = 0; chunk < numChunks; ++chunk)
+    {
+        if (chunk < chunks_.size() && chunks_[chunk].revision == figure.GetChunkRevision(chunk))
+        {
+            continue;
+        }
+        unsigned begin = chunk * Figure::FACES_PER_CHUNK;
+        unsigned end = Min(begin + Figure::FACES_PER_CHUNK, numFaces);
+        if (!topologyChanged && !figure.GetMovedRange(chunk, chunks_[chunk].revision, begin, end))
+        {
+            topologyChanged = true;
+        }
+        for (unsigned i = begin; i < end; ++i)
+        {
+            changed.push_back(i);
+            // A face moved apart from the corners it was welded to changes the topology.
+            if (!topologyChanged && !IsWelded(figure, i))
+            {
+                topologyChanged = true;
+            }
+        }
+    }
+
+    if (topologyChanged)
+    {
+        HiresTimer timer;
+        BuildTopology(figure);
+        lastTopologyMs_ = timer.GetUSec(false) / 1000.0f;
+    }
+
+    if (marks_.size() != numFaces)
+    {
+        marks_.assign(numFaces, 0);
+        markEpoch_ = 0;
+    }
+    if (++markEpoch_ == 0)
+    {
+        ea::fill(marks_.begin(), marks_.end(), 0u);
+        markEpoch_ = 1;
+    }
+    ea::vector<unsigned> evaluate;
+    const auto mark = [&](unsigned face)
+    {
+        if (marks_[face] != markEpoch_)
+        {
+            marks_[face] = markEpoch_;
+            evaluate.push_back(face);
+        }
+    };
+
+    // Stencils of chunks whose ring topology changed since the table of this level was built.
+    HiresTimer stencilTimer;
+    ea::vector<FChunkStencils>& stencils = stencils_[level_];
+    stencils.resize(numChunks);
+    ea::vector<unsigned> rebuild;
+    for (unsigned chunk = 0; chunk < numChunks; ++chunk)
+    {
+        if (stencils[chunk].key != chunks_[chunk].key)
+        {
+            rebuild.push_back(chunk);
+        }
+    }
+    if (patchWeights_[level_].empty())
+    {
+        const unsigned side = (1u << level_) + 1;
+        patchWeights_[level_].resize(samples * 16);
+        for (unsigned j = 0; j < side; ++j)
+        {
+            for (unsigned i = 0; i < side; ++i)
+            {
+                float bu[4], bv[4];
+                BSplineBasis((float)i / (side - 1), bu);
+                BSplineBasis((float)j / (side - 1), bv);
+                float* weights = &patchWeights_[level_][(j * side + i) * 16];
+                for (unsigned row = 0; row < 4; ++row)
+                {
+                    for (unsigned column = 0; column < 4; ++column)
+                    {
+                        weights[row * 4 + column] = bv[row] * bu[column];
+                    }
+                }
+            }
+        }
+    }
+    ParallelFor(context_, rebuild.size(), 1, [&](unsigned begin, unsigned end)
+    {
+        for (unsigned i = begin; i < end; ++i)
+        {
+            BuildStencils(figure, rebuild[i], stencils[rebuild[i]]);
+            stencils[rebuild[i]].key = chunks_[rebuild[i]].key;
+        }
+    });
+    lastNumRebuilt_ = rebuild.size();
+    lastStencilMs_ = stencilTimer.GetUSec(false) / 1000.0f;
+    if (!rebuild.empty() || topologyChanged)
+    {
+        numPatchFaces_ = 0;
+        numRefinedFaces_ = 0;
+        for (unsigned chunk = 0; chunk < numChunks; ++chunk)
+        {
+            numRefinedFaces_ += stencils[chunk].numRefined;
+            numPatchFaces_ += stencils[chunk].faces.size() - stencils[chunk].numRefined;
+        }
+    }
+
+    // Whole chunks for new stencils or sample counts, the two ring of changed faces otherwise: a sample reads the
+    // vertices of faces sharing a vertex with its face.
+    unsigned nextRebuilt = 0;
+    for (unsigned chunk = 0; chunk < numChunks; ++chunk)
+    {
+        const unsigned begin = chunk * Figure::FACES_PER_CHUNK;
+        const unsigned end = Min(begin + Figure::FACES_PER_CHUNK, numFaces);
+        FChunk& data = chunks_[chunk];
+        const bool rebuilt = nextRebuilt < rebuild.size() && rebuild[nextRebuilt] == chunk;
+        nextRebuilt += rebuilt;
+        if (rebuilt || data.vertices.size() != (end - begin) * samples * 6)
+        {
+            data.vertices.resize((end - begin) * samples * 6);
+            for (unsigned i = begin; i < end; ++i)
+            {
+                mark(i);
+            }
+        }
+    }
+    for (unsigned face : changed)
+    {
+        if (face >= numFaces)
+        {
+            continue;
+        }
+        for (unsigned corner = 0; corner < 4; ++corner)
+        {
+            const unsigned v = cornerVertices_[face * 4 + corner];
+            for (unsigned i = vertexFaceOffsets_[v]; i < vertexFaceOffsets_[v + 1]; ++i)
+            {
+                const unsigned ringFace = vertexFaces_[i];
+                for (unsigned ringCorner = 0; ringCorner < 4; ++ringCorner)
+                {
+                    const unsigned u = cornerVertices_[ringFace * 4 + ringCorner];
+                    for (unsigned k = vertexFaceOffsets_[u]; k < vertexFaceOffsets_[u + 1]; ++k)
+                    {
+                        mark(vertexFaces_[k]);
+                    }
+                }
+            }
+        }
+    }
+
+    HiresTimer evaluateTimer;
+    ea::sort(evaluate.begin(), evaluate.end());
+    ParallelFor(context_, evaluate.size(), EVALUATE_GRAIN, [&](unsigned begin, unsigned end)
+    {
+        for (unsigned i = begin; i < end; ++i)
+        {
+            const unsigned face = evaluate[i];
+            const unsigned chunk = face / Figure::FACES_PER_CHUNK;
+            const unsigned local = face % Figure::FACES_PER_CHUNK;
+            EvaluateFace(figure, stencils[chunk], face, chunks_[chunk].vertices.data() + local * samples * 6);
+        }
+    });
+    for (unsigned face : evaluate)
+    {
+        FChunk& data = chunks_[face / Figure::FACES_PER_CHUNK];
+        const unsigned local = face % Figure::FACES_PER_CHUNK;
+        data.dirtyBegin = Min(data.dirtyBegin, local);
+        data.dirtyEnd = Max(data.dirtyEnd, local + 1);
+    }
+
+    // Bounds only grow between topology changes, like the chunk models of FigureGpuMesh.
+    for (unsigned chunk = 0; chunk < numChunks; ++chunk)
+    {
+        FChunk& data = chunks_[chunk];
+        if (data.dirtyBegin < data.dirtyEnd)
+        {
+            unsigned first = data.dirtyBegin * samples;
+            unsigned last = data.dirtyEnd * samples;
+            if (topologyChanged)
+            {
+                data.bounds = BoundingBox();
+                first = 0;
+                last = data.vertices.size() / 6;
+            }
+            for (unsigned i = first; i < last; ++i)
+            {
+                data.bounds.Merge(Vector3(&data.vertices[i * 6]));
+            }
+        }
+        data.revision = figure.GetChunkRevision(chunk);
+        data.topologyRevision = figure.GetChunkTopologyRevision(chunk);
+    }
+    lastNumEvaluated_ = evaluate.size();
+    lastEvaluateMs_ = evaluateTimer.GetUSec(false) / 1000.0f;
+}
+
+void FigureSubdivision::BuildTopology(const Figure& figure)
+{
+    const unsigned numFaces = figure.faces.size();
+    const unsigned numChunks = figure.GetNumChunks();
+    topologyDirty_ = false;
+
+    // Weld corners, the first corner of a vertex in array order is the one its stencils read.
+    cornerVertices_.resize(numFaces * 4);
+    vertexSlots_.clear();
+    // Corner positions are matched on Figure::GetPositionKey like FigureTopology.
+    ea::unordered_map<IntVector3, unsigned, FCellKeyHash> vertices;
+    vertices.reserve(numFaces * 2);
+    for (unsigned slot = 0; slot < numFaces * 4; ++slot)
+    {
+        const auto result = vertices.emplace(Figure::GetPositionKey(SlotPosition(figure, slot)), (unsigned)vertexSlots_.size());
+        if (result.second)
+        {
+            vertexSlots_.push_back(slot);
+        }
+        cornerVertices_[slot] = result.first->second;
+    }
+
+    // Faces around every vertex, a degenerate face listed once per distinct corner.
+    const unsigned numVertices = vertexSlots_.size();
+    const auto isFirstCorner = [this](unsigned face, unsigned corner)
+    {
+        for (unsigned k = 0; k < corner; ++k)
+        {
+            if (cornerVertices_[face * 4 + k] == cornerVertices_[face * 4 + corner])
+                return false;
+        }
+        return true;
+    };
+    vertexFaceOffsets_.assign(numVertices + 1, 0);
+    for (unsigned face = 0; face < numFaces; ++face)
+    {
+        for (unsigned corner = 0; corner < 4; ++corner)
+        {
+            if (isFirstCorner(face, corner))
+                ++vertexFaceOffsets_[cornerVertices_[face * 4 + corner] + 1];
+        }
+    }
+    for (unsigned v = 0; v < numVertices; ++v)
+    {
+        vertexFaceOffsets_[v + 1] += vertexFaceOffsets_[v];
+    }
+    vertexFaces_.resize(vertexFaceOffsets_.back());
+    ea::vector<unsigned> fill(vertexFaceOffsets_.begin(), vertexFaceOffsets_.end() - 1);
+    for (unsigned face = 0; face < numFaces; ++face)
+    {
+        for (unsigned corner = 0; corner < 4; ++corner)
+        {
+            if (isFirstCorner(face, corner))
+                vertexFaces_[fill[cornerVertices_[face * 4 + corner]]++] = face;
+        }
+    }
+
+    // Sharp edges: open, non-manifold or folded past the crease angle.
+    const float creaseCos = Cos(creaseAngle_);
+    ea::vector<FEdgeRecord> records;
+    records.reserve(numFaces * 4);
+    sharpEdges_.assign(numFaces * 4, 1);
+    for (unsigned i = 0; i < numFaces * 4; ++i)
+    {
+        const unsigned a = cornerVertices_[i];
+        const unsigned b = cornerVertices_[(i & ~3u) + ((i + 1) & 3u)];
+        if (a != b)
+        {
+            records.push_back(FEdgeRecord{Min(a, b), Max(a, b), i});
+        }
+    }
+    ea::sort(records.begin(), records.end(), EdgeRecordLess);
+    for (unsigned i = 0; i < records.size();)
+    {
+        unsigned j = i;
+        while (j < records.size() && records[j].a == records[i].a && records[j].b == records[i].b)
+        {
+            ++j;
+        }
+        if (j - i == 2)
+        {
+            const FFace& first = figure.faces[records[i].faceEdge / 4];
+            const FFace& second = figure.faces[records[i + 1].faceEdge / 4];
+            const unsigned char sharp = OutwardNormal(figure, first).DotProduct(OutwardNormal(figure, second)) < creaseCos;
+            sharpEdges_[records[i].faceEdge] = sharp;
+            sharpEdges_[records[i + 1].faceEdge] = sharp;
+        }
+        i = j;
+    }
+
+    // Key of a chunk: everything its stencils depend on, the faces, corner slots and sharp edges of every ring.
+    chunks_.resize(numChunks);
+    ParallelFor(context_, numChunks, 1, [&](unsigned begin, unsigned end)
+    {
+        for (unsigned chunk = begin; chunk < end; ++chunk)
+        {
+            unsigned long long key = 14695981039346656037ull;
+            const unsigned lastFace = Min((chunk + 1) * Figure::FACES_PER_CHUNK, numFaces);
+            for (unsigned face = chunk * Figure::FACES_PER_CHUNK; face < lastFace; ++face)
+            {
+                for (unsigned corner = 0; corner < 4; ++corner)
+                {
+                    const unsigned v = cornerVertices_[face * 4 + corner];
+                    key = HashCombine(key, vertexSlots_[v]);
+                    for (unsigned i = vertexFaceOffsets_[v]; i < vertexFaceOffsets_[v + 1]; ++i)
+                    {
+                        const unsigned ringFace = vertexFaces_[i];
+                        key = HashCombine(key, ringFace);
+                        for (unsigned k = 0; k < 4; ++k)
+                        {
+                            key = HashCombine(key, vertexSlots_[cornerVertices_[ringFace * 4 + k]] * 2 + sharpEdges_[ringFace * 4 + k]);
+                        }
+                    }
+                }
+            }
+            // Zero marks a table never built.
+            chunks_[chunk].key = key | 1;
+        }
+    });
+}
+
+void FigureSubdivision::BuildStencils(const Figure& figure, unsigned chunk, FChunkStencils& stencils) const
+{
+    stencils.faces.clear();
+    stencils.patchSlots.clear();
+    stencils.sampleOffsets.clear();
+    stencils.slots.clear();
+    stencils.weights.clear();
+    stencils.numRefined = 0;
+
+    const unsigned begin = chunk * Figure::FACES_PER_CHUNK;
+    const unsigned end = Min(begin + Figure::FACES_PER_CHUNK, (unsigned)figure.faces.size());
+    unsigned slots[16];
+    for (unsigned face = begin; face < end; ++face)
+    {
+        if (GetPatchSlots(figure, face, slots))
+        {
+            stencils.faces.push_back(stencils.patchSlots.size());
+            stencils.patchSlots.insert(stencils.patchSlots.end(), slots, slots + 16);
+        }
+        else
+        {
+            stencils.faces.push_back(stencils.sampleOffsets.size() | REFINED_FACE);
+            AppendRefinedStencils(figure, face, stencils);
+            ++stencils.numRefined;
+        }
+    }
+    // Ends the stencil of the last sample.
+    stencils.sampleOffsets.push_back(stencils.slots.size());
+}
+
+bool FigureSubdivision::GetPatchSlots(const Figure& figure, unsigned arrayIndex, unsigned* slots) const
+{
+    const unsigned* corners = &cornerVertices_[arrayIndex * 4];
+    const auto cornerOf = [this](unsigned face, unsigned vertex)
+    {
+        for (unsigned k = 0; k < 4; ++k)
+        {
+            if (cornerVertices_[face * 4 + k] == vertex)
+                return k;
+        }
+        return 4u;
+    };
+
+    // Regular: every corner joins four faces with four distinct corners and no sharp edge at the corner.
+    for (unsigned corner = 0; corner < 4; ++corner)
+    {
+        const unsigned v = corners[corner];
+        if (vertexFaceOffsets_[v + 1] - vertexFaceOffsets_[v] != 4)
+        {
+            return false;
+        }
+        for (unsigned i = vertexFaceOffsets_[v]; i < vertexFaceOffsets_[v + 1]; ++i)
+        {
+            const unsigned face = vertexFaces_[i];
+            const unsigned k = cornerOf(face, v);
+            const unsigned* faceCorners = &cornerVertices_[face * 4];
+            if (faceCorners[0] == faceCorners[1] || faceCorners[0] == faceCorners[2] || faceCorners[0] == faceCorners[3]
+                || faceCorners[1] == faceCorners[2] || faceCorners[1] == faceCorners[3] || faceCorners[2] == faceCorners[3]
+                || sharpEdges_[face * 4 + k] || sharpEdges_[face * 4 + (k + 3) % 4])
+            {
+                return false;
+            }
+        }
+    }
+
+    // The 4x4 grid, face corner 0 at row 1 column 1, corner 1 along the row, corner 3 along the column.
+    static const unsigned inner[4] = {5, 6, 10, 9};
+    static const unsigned across[4][2] = {{1, 2}, {7, 11}, {14, 13}, {8, 4}};
+    static const unsigned diagonal[4] = {0, 3, 15, 12};
+    unsigned grid[16];
+    unsigned sides[4];
+    for (unsigned i = 0; i < 4; ++i)
+    {
+        grid[inner[i]] = corners[i];
+    }
+    for (unsigned i = 0; i < 4; ++i)
+    {
+        const unsigned a = corners[i];
+        const unsigned b = corners[(i + 1) % 4];
+        sides[i] = M_MAX_UNSIGNED;
+        for (unsigned k = vertexFaceOffsets_[a]; k < vertexFaceOffsets_[a + 1]; ++k)
+        {
+            const unsigned face = vertexFaces_[k];
+            if (face != arrayIndex && cornerOf(face, b) < 4)
+            {
+                sides[i] = face;
+            }
+        }
+        if (sides[i] == M_MAX_UNSIGNED)
+        {
+            return false;
+        }
+        const unsigned ka = cornerOf(sides[i], a);
+        const unsigned kb = cornerOf(sides[i], b);
+        grid[across[i][0]] = cornerVertices_[sides[i] * 4 + ((ka + 1) % 4 == kb ? (ka + 3) % 4 : (ka + 1) % 4)];
+        grid[across[i][1]] = cornerVertices_[sides[i] * 4 + ((kb + 1) % 4 == ka ? (kb + 3) % 4 : (kb + 1) % 4)];
+    }
+    for (unsigned i = 0; i < 4; ++i)
+    {
+        const unsigned v = corners[i];
+        unsigned opposite = M_MAX_UNSIGNED;
+        for (unsigned k = vertexFaceOffsets_[v]; k < vertexFaceOffsets_[v + 1]; ++k)
+        {
+            const unsigned face = vertexFaces_[k];
+            if (face != arrayIndex && face != sides[i] && face != sides[(i + 3) % 4])
+            {
+                opposite = cornerVertices_[face * 4 + (cornerOf(face, v) + 2) % 4];
+            }
+        }
+        if (opposite == M_MAX_UNSIGNED)
+        {
+            return false;
+        }
+        grid[diagonal[i]] = opposite;
+    }
+    for (unsigned i = 0; i < 16; ++i)
+    {
+        slots[i] = vertexSlots_[grid[i]];
+    }
+    return true;
+}
+
+void FigureSubdivision::AppendRefinedStencils(const Figure& figure, unsigned arrayIndex, FChunkStencils& stencils) const
+{
+    const unsigned side = (1u << level_) + 1;
+    const unsigned n = side - 1;
+    const unsigned* corners = &cornerVertices_[arrayIndex * 4];
+    const auto isDegenerate = [this](unsigned face)
+    {
+        const unsigned* c = &cornerVertices_[face * 4];
+        return c[0] == c[1] || c[0] == c[2] || c[0] == c[3] || c[1] == c[2] || c[1] == c[3] || c[2] == c[3];
+    };
+
+    // A collapsed face has no surface of its own, it is sampled bilinearly between its corners.
+    if (isDegenerate(arrayIndex))
+    {
+        for (unsigned j = 0; j < side; ++j)
+        {
+            for (unsigned i = 0; i < side; ++i)
+            {
+                const float u = (float)i / n;
+                const float v = (float)j / n;
+                const float weights[4] = {(1.f - u) * (1.f - v), u * (1.f - v), u * v, (1.f - u) * v};
+                stencils.sampleOffsets.push_back(stencils.slots.size());
+                for (unsigned corner = 0; corner < 4; ++corner)
+                {
+                    stencils.slots.push_back(arrayIndex * 4 + corner);
+                    stencils.weights.push_back(weights[corner]);
+                }
+            }
+        }
+        return;
+    }
+
+    // One ring: the face and every other face sharing one of its vertices, collapsed faces left out.
+    ea::vector<unsigned> ring;
+    ring.push_back(arrayIndex);
+    for (unsigned corner = 0; corner < 4; ++corner)
+    {
+        const unsigned v = corners[corner];
+        for (unsigned i = vertexFaceOffsets_[v]; i < vertexFaceOffsets_[v + 1]; ++i)
+        {
+            const unsigned face = vertexFaces_[i];
+            if (!isDegenerate(face) && ea::find(ring.begin(), ring.end(), face) == ring.end())
+            {
+                ring.push_back(face);
+            }
+        }
+    }
+
+    ea::vector<unsigned> controls;
+    FLocalMesh mesh;
+    for (unsigned face : ring)
+    {
+        for (unsigned corner = 0; corner < 4; ++corner)
+        {
+            const unsigned v = cornerVertices_[face * 4 + corner];
+            auto it = ea::find(controls.begin(), controls.end(), v);
+            if (it == controls.end())
+            {
+                controls.push_back(v);
+                it = controls.end() - 1;
+            }
+            mesh.faces.push_back(it - controls.begin());
+            mesh.sharp.push_back(sharpEdges_[face * 4 + corner]);
+        }
+        mesh.target.push_back(face == arrayIndex);
+    }
+    mesh.numControls = controls.size();
+    mesh.stencils.assign(mesh.numControls * mesh.numControls, 0.f);
+    mesh.params.assign(mesh.numControls, IntVector2(-1, -1));
+    for (unsigned i = 0; i < mesh.numControls; ++i)
+    {
+        mesh.stencils[i * mesh.numControls + i] = 1.f;
+    }
+    const IntVector2 cornerParams[4] = {IntVector2(0, 0), IntVector2(n, 0), IntVector2(n, n), IntVector2(0, n)};
+    for (unsigned corner = 0; corner < 4; ++corner)
+    {
+        mesh.params[mesh.faces[corner]] = cornerParams[corner];
+    }
+
+    FLocalEdges edges;
+    FLocalMesh refined;
+    for (unsigned level = 0; level < level_; ++level)
+    {
+        BuildLocalEdges(mesh, edges);
+        Refine(mesh, edges, refined);
+        ea::swap(mesh, refined);
+    }
+    BuildLocalEdges(mesh, edges);
+
+    ea::vector<unsigned> sampleVertices(side * side, M_MAX_UNSIGNED);
+    for (unsigned v = 0; v < mesh.GetNumVertices(); ++v)
+    {
+        const IntVector2& param = mesh.params[v];
+        if (param.x_ >= 0 && param.y_ >= 0 && param.x_ <= (int)n && param.y_ <= (int)n)
+        {
+            sampleVertices[param.y_ * side + param.x_] = v;
+        }
+    }
+
+    ea::vector<float> limit(mesh.numControls);
+    for (unsigned sample = 0; sample < side * side; ++sample)
+    {
+        stencils.sampleOffsets.push_back(stencils.slots.size());
+        if (sampleVertices[sample] == M_MAX_UNSIGNED)
+        {
+            continue;
+        }
+        GetLimitStencil(mesh, edges, sampleVertices[sample], limit.data());
+        for (unsigned k = 0; k < mesh.numControls; ++k)
+        {
+            if (Abs(limit[k]) > MIN_WEIGHT)
+            {
+                stencils.slots.push_back(vertexSlots_[controls[k]]);
+                stencils.weights.push_back(limit[k]);
+            }
+        }
+    }
+}
+
+void FigureSubdivision::EvaluateFace(const Figure& figure, const FChunkStencils& stencils, unsigned arrayIndex, float* dest) const
+{
+    const unsigned side = (1u << level_) + 1;
+    const unsigned samples = side * side;
+    const unsigned entry = stencils.faces[arrayIndex % Figure::FACES_PER_CHUNK];
+    Vector3 positions[(1u << MAX_LEVEL) + 1][(1u << MAX_LEVEL) + 1];
+
+    if (entry & REFINED_FACE)
+    {
+        const unsigned first = entry & ~REFINED_FACE;
+        for (unsigned sample = 0; sample < samples; ++sample)
+        {
+            Vector3 position = Vector3::ZERO;
+            for (unsigned k = stencils.sampleOffsets[first + sample]; k < stencils.sampleOffsets[first + sample + 1]; ++k)
+            {
+                position += SlotPosition(figure, stencils.slots[k]) * stencils.weights[k];
+            }
+            positions[sample / side][sample % side] = position;
+        }
+    }
+    else
+    {
+        const unsigned* slots = &stencils.patchSlots[entry];
+        const float* weights = patchWeights_[level_].data();
+        unsigned sample = 0;
+#if defined(URHO3D_SSE)
+        // Control points as (x, y, z, 0), one multiply-add of all three axes per weight.
+        __m128 controls[16];
+        for (unsigned k = 0; k < 16; ++k)
+        {
+            const Vector3& p = SlotPosition(figure, slots[k]);
+            controls[k] = _mm_set_ps(0.f, p.z_, p.y_, p.x_);
+        }
+        for (; sample < samples; ++sample)
+        {
+            const float* w = weights + sample * 16;
+            __m128 sum = _mm_mul_ps(_mm_set1_ps(w[0]), controls[0]);
+            for (unsigned k = 1; k < 16; ++k)
+            {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(w[k]), controls[k]));
+            }
+            alignas(16) float xyz[4];
+            _mm_store_ps(xyz, sum);
+            positions[sample / side][sample % side] = Vector3(xyz[0], xyz[1], xyz[2]);
+        }
+#endif
+        for (; sample < samples; ++sample)
+        {
+            const float* w = weights + sample * 16;
+            Vector3 position = Vector3::ZERO;
+            for (unsigned k = 0; k < 16; ++k)
+            {
+                position += SlotPosition(figure, slots[k]) * w[k];
+            }
+            positions[sample / side][sample % side] = position;
+        }
+    }
+
+    // Normals from differences along the grid, turned to the outside of the control face.
+    const Vector3 outward = OutwardNormal(figure, figure.faces[arrayIndex]);
+    for (unsigned j = 0; j < side; ++j)
+    {
+        for (unsigned i = 0; i < side; ++i)
+        {
+            const Vector3 du = positions[j][Min(i + 1, side - 1)] - positions[j][i > 0 ? i - 1 : 0];
+            const Vector3 dv = positions[Min(j + 1, side - 1)][i] - positions[j > 0 ? j - 1 : 0][i];
+            Vector3 normal = du.CrossProduct(dv);
+            const float length = normal.Length();
+            normal = length > M_EPSILON ? normal / length : outward;
+            if (normal.DotProduct(outward) < 0.f)
+            {
+                normal = -normal;
+            }
+
+            float* vertex = dest + (j * side + i) * 6;
+            const Vector3& position = positions[j][i];
+            vertex[0] = position.x_;
+            vertex[1] = position.y_;
+            vertex[2] = position.z_;
+            vertex[3] = normal.x_;
+            vertex[4] = normal.y_;
+            vertex[5] = normal.z_;
+        }
+    }
+}
+
+bool FigureSubdivision::IsWelded(const Figure& figure, unsigned arrayIndex) const
+{
+    if (arrayIndex * 4 + 4 > cornerVertices_.size())
+    {
+        return false;
+    }
+    for (unsigned corner = 0; corner < 4; ++corner)
+    {
+        const unsigned v = cornerVertices_[arrayIndex * 4 + corner];
+        const IntVector3 key = Figure::GetPositionKey(SlotPosition(figure, arrayIndex * 4 + corner));
+        for (unsigned i = vertexFaceOffsets_[v]; i < vertexFaceOffsets_[v + 1]; ++i)
+        {
+            const unsigned face = vertexFaces_[i];
+            for (unsigned k = 0; k < 4; ++k)
+            {
+                if (cornerVertices_[face * 4 + k] == v && Figure::GetPositionKey(SlotPosition(figure, face * 4 + k)) != key)
+                {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include <EASTL/vector.h>
+
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Math/BoundingBox.h>
+
+#include "Figure.h"
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+/// Catmull-Clark limit surface of a quad Figure, sampled on a (2^level + 1)^2 grid per face for a smooth preview.
+/// Face corners are welded by position into control vertices like FigureTopology. Open and non-manifold edges and
+/// edges folding more than the crease angle are sharp and follow the crease and corner rules.
+/// Subdivision is adaptive. A face whose four corners each join four faces without a sharp edge is a bicubic
+/// B-spline patch of its 16 ring vertices, evaluated with one weight table per level shared by all such faces.
+/// Only faces at extraordinary vertices, creases and open edges are refined, locally over their one ring, and
+/// flattened into stencils over the control vertices.
+/// Stencils read face corners of the figure, so moving vertices only re-evaluates the samples around the moved
+/// faces. Stencil tables are cached per level and per chunk under a key of the ring topology of the chunk. A topology
+/// change rebuilds only chunks whose key changed, switching back to an earlier level reuses its tables.
+class FigureSubdivision
+{
+public:
+    explicit FigureSubdivision(Context* context);
+
+    /// Refinement level, samples per face side are 2^level + 1.
+    void SetLevel(unsigned level);
+    /// Edges folding more than degrees stay sharp, 180 smooths everything but open edges.
+    void SetCreaseAngle(float degrees);
+    /// Bring stencils and samples up to date with figure. Main thread, stencils and samples are computed in parallel.
+    void Update(const Figure& figure);
+    /// Free all stencil tables and samples.
+    void Clear();
+    /// Free the samples only. Topology and stencil tables stay, the next Update evaluates every face again.
+    void ReleaseSamples();
+
+    unsigned GetLevel() const { return level_; }
+    float GetCreaseAngle() const { return creaseAngle_; }
+    unsigned GetSamplesPerFace() const { return ((1u << level_) + 1) * ((1u << level_) + 1); }
+    unsigned GetNumChunks() const { return chunks_.size(); }
+    /// Position and normal of every sample, six floats each, GetSamplesPerFace samples per face in face order.
+    const ea::vector<float, TrackedAllocator<MC_SUBDIV>>& GetChunkVertices(unsigned chunk) const { return chunks_[chunk].vertices; }
+    const BoundingBox& GetChunkBounds(unsigned chunk) const { return chunks_[chunk].bounds; }
+    /// Faces of chunk with new samples since ClearDirtyRange, as chunk relative [begin, end).
+    bool GetDirtyRange(unsigned chunk, unsigned& begin, unsigned& end) const;
+    void ClearDirtyRange(unsigned chunk);
+
+    unsigned GetNumPatchFaces() const { return numPatchFaces_; }
+    unsigned GetNumRefinedFaces() const { return numRefinedFaces_; }
+    /// Chunks whose stencil table was rebuilt by the last Update.
+    unsigned GetLastNumRebuilt() const { return lastNumRebuilt_; }
+    /// Faces re-evaluated by the last Update.
+    unsigned GetLastNumEvaluated() const { return lastNumEvaluated_; }
+    float GetLastTopologyMs() const { return lastTopologyMs_; }
+    float GetLastStencilMs() const { return lastStencilMs_; }
+    float GetLastEvaluateMs() const { return lastEvaluateMs_; }
+
+    static const unsigned MAX_LEVEL = 4;
+
+private:
+    /// Stencils of the faces of one chunk at one level.
+    struct FChunkStencils
+    {
+        /// Ring topology key the table was built for, 0 when never built.
+        unsigned long long key{0};
+        unsigned numRefined{0};
+        /// Per face: offset into patchSlots for patch faces, into sampleOffsets with the top bit set otherwise.
+        ea::vector<unsigned, TrackedAllocator<MC_SUBDIV>> faces;
+        /// 16 corner slots per patch face, row by row of the 4x4 control grid.
+        ea::vector<unsigned, TrackedAllocator<MC_SUBDIV>> patchSlots;
+        /// Per sample of a refined face the first entry of its stencil, one extra entry ends the last stencil.
+        ea::vector<unsigned, TrackedAllocator<MC_SUBDIV>> sampleOffsets;
+        /// Corner slot (array index * 4 + corner) and weight of every stencil entry.
+        ea::vector<unsigned, TrackedAllocator<MC_SUBDIV>> slots;
+        ea::vector<float, TrackedAllocator<MC_SUBDIV>> weights;
+    };
+
+    struct FChunk
+    {
+        unsigned revision{M_MAX_UNSIGNED};
+        unsigned topologyRevision{M_MAX_UNSIGNED};
+        /// Ring topology key of the chunk in the current figure.
+        unsigned long long key{0};
+        ea::vector<float, TrackedAllocator<MC_SUBDIV>> vertices;
+        BoundingBox bounds;
+        unsigned dirtyBegin{M_MAX_UNSIGNED};
+        unsigned dirtyEnd{0};
+    };
+
+    /// Weld corners, find sharp edges and key every chunk by its ring topology.
+    void BuildTopology(const Figure& figure);
+    /// Stencil table of chunk at the current level.
+    void BuildStencils(const Figure& figure, unsigned chunk, FChunkStencils& stencils) const;
+    /// Control grid of a regular face in slots, false when the face is not regular.
+    bool GetPatchSlots(const Figure& figure, unsigned arrayIndex, unsigned* slots) const;
+    /// Refine the one ring of face and append the flattened limit stencil of each of its samples.
+    void AppendRefinedStencils(const Figure& figure, unsigned arrayIndex, FChunkStencils& stencils) const;
+    /// Evaluate samples and normals of face.
+    void EvaluateFace(const Figure& figure, const FChunkStencils& stencils, unsigned arrayIndex, float* dest) const;
+    /// Every corner welded to a vertex of face still shares its position key. False after a face was moved apart
+    /// from its neighbours, the welding is then rebuilt. Faces moved onto each other stay apart until then.
+    bool IsWelded(const Figure& figure, unsigned arrayIndex) const;
+
+    Context* context_;
+    unsigned level_{2};
+    float creaseAngle_{180.f};
+    const Figure* figure_{nullptr};
+    bool topologyDirty_{true};
+
+    /// Control vertex of every face corner, array index * 4 + corner.
+    ea::vector<unsigned, TrackedAllocator<MC_SUBDIV>> cornerVertices_;
+    /// Corner slot a control vertex reads its position from.
+    ea::vector<unsigned, TrackedAllocator<MC_SUBDIV>> vertexSlots_;
+    /// Faces around every vertex, vertexFaces_[vertexFaceOffsets_[v], vertexFaceOffsets_[v + 1]).
+    ea::vector<unsigned, TrackedAllocator<MC_SUBDIV>> vertexFaceOffsets_;
+    ea::vector<unsigned, TrackedAllocator<MC_SUBDIV>> vertexFaces_;
+    /// Per face edge: 1 when sharp. Edge e runs from corner e to corner e + 1.
+    ea::vector<unsigned char, TrackedAllocator<MC_SUBDIV>> sharpEdges_;
+
+    ea::vector<FChunk> chunks_;
+    /// Stencil tables per level, per chunk.
+    ea::vector<FChunkStencils> stencils_[MAX_LEVEL + 1];
+    /// B-spline weights of every sample of a patch face per level, 16 per sample.
+    ea::vector<float> patchWeights_[MAX_LEVEL + 1];
+    /// Faces marked for evaluation by the current Update.
+    ea::vector<unsigned> marks_;
+    unsigned markEpoch_{0};
+
+    unsigned numPatchFaces_{0};
+    unsigned numRefinedFaces_{0};
+    unsigned lastNumRebuilt_{0};
+    unsigned lastNumEvaluated_{0};
+    float lastTopologyMs_{0.f};
+    float lastStencilMs_{0.f};
+    float lastEvaluateMs_{0.f};
+};
+
+}
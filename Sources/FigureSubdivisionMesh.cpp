@@ -0,0 +1,181 @@
+#include "FigureSubdivisionMesh.h"
+
+#include <Urho3D/Graphics/Geometry.h>
+#include <Urho3D/Graphics/StaticModel.h>
+
+using namespace Redi;
+
+FigureSubdivisionMesh::FigureSubdivisionMesh(Context* context, Node* parent, Material* material)
+    : context_(context),
+    parent_(parent),
+    material_(material)
+{
+}
+
+FigureSubdivisionMesh::~FigureSubdivisionMesh()
+{
+    for (FMeshChunk& chunk : chunks_)
+    {
+        chunk.node->Remove();
+    }
+}
+
+const ea::vector<VertexElement>& FigureSubdivisionMesh::GetVertexElements()
+{
+    static const ea::vector<VertexElement> elements = {
+        VertexElement(TYPE_VECTOR3, SEM_POSITION),
+        VertexElement(TYPE_VECTOR3, SEM_NORMAL)
+    };
+    return elements;
+}
+
+void FigureSubdivisionMesh::SetEnabled(bool enable)
+{
+    enabled_ = enable;
+    for (FMeshChunk& chunk : chunks_)
+    {
+        chunk.node->SetEnabled(enable);
+    }
+}
+
+void FigureSubdivisionMesh::SetMaterial(Material* material)
+{
+    material_ = material;
+    for (FMeshChunk& chunk : chunks_)
+    {
+        chunk.node->GetComponent<StaticModel>()->SetMaterial(material_);
+    }
+}
+
+void FigureSubdivisionMesh::Update(FigureSubdivision& subdivision)
+{
+    lastUpload_ = 0;
+    if (!parent_)
+    {
+        return;
+    }
+
+    const unsigned numChunks = subdivision.GetNumChunks();
+    while (chunks_.size() > numChunks)
+    {
+        chunks_.back().node->Remove();
+        chunks_.pop_back();
+    }
+    chunks_.resize(numChunks);
+
+    const unsigned level = subdivision.GetLevel();
+    const unsigned samples = subdivision.GetSamplesPerFace();
+    const unsigned floatsPerFace = samples * 6;
+    for (unsigned i = 0; i < numChunks; ++i)
+    {
+        FMeshChunk& chunk = chunks_[i];
+        const auto& vertices = subdivision.GetChunkVertices(i);
+        const unsigned numFaces = vertices.size() / floatsPerFace;
+        const unsigned numVertices = numFaces * samples;
+        if (!chunk.model)
+        {
+            chunk.model = MakeShared<Model>(context_);
+            chunk.vertexBuffer = MakeShared<VertexBuffer>(context_);
+            auto geometry = MakeShared<Geometry>(context_);
+            geometry->SetVertexBuffer(0, chunk.vertexBuffer);
+            chunk.model->SetNumGeometries(1);
+            chunk.model->SetGeometry(0, 0, geometry);
+
+            chunk.node = parent_->CreateChild(Format("FigureSubdivisionChunk{}", i));
+            chunk.node->SetEnabled(enabled_);
+            chunk.node->CreateComponent<StaticModel>();
+        }
+
+        unsigned begin, end;
+        if (chunk.vertexBuffer->GetVertexCount() != numVertices || chunk.level != level)
+        {
+            if (numVertices > 0)
+            {
+                chunk.vertexBuffer->SetSize(numVertices, GetVertexElements(), true);
+                chunk.vertexBuffer->SetData(vertices.data());
+                lastUpload_ += vertices.size() * sizeof(float);
+            }
+            Geometry* geometry = chunk.model->GetGeometry(0, 0);
+            const unsigned side = (1u << level) + 1;
+            geometry->SetIndexBuffer(GetIndexBuffer(level, numFaces));
+            geometry->SetDrawRange(TRIANGLE_LIST, 0, numFaces * (side - 1) * (side - 1) * 6, 0, numVertices);
+            chunk.level = level;
+        }
+        else if (subdivision.GetDirtyRange(i, begin, end))
+        {
+            chunk.vertexBuffer->SetDataRange(vertices.data() + begin * floatsPerFace, begin * samples, (end - begin) * samples);
+            lastUpload_ += (end - begin) * floatsPerFace * sizeof(float);
+        }
+        subdivision.ClearDirtyRange(i);
+
+        // Reassign so the drawable picks up new bounds, only when they changed.
+        const BoundingBox& bounds = subdivision.GetChunkBounds(i);
+        auto* staticModel = chunk.node->GetComponent<StaticModel>();
+        if (staticModel->GetModel() != chunk.model || bounds.min_ != chunk.model->GetBoundingBox().min_ || bounds.max_ != chunk.model->GetBoundingBox().max_)
+        {
+            chunk.model->SetBoundingBox(bounds);
+            staticModel->SetModel(chunk.model);
+            staticModel->SetMaterial(material_);
+        }
+    }
+}
+
+IndexBuffer* FigureSubdivisionMesh::GetIndexBuffer(unsigned level, unsigned numFaces)
+{
+    SharedPtr<IndexBuffer>& indexBuffer = indexBuffers_[level];
+    const unsigned side = (1u << level) + 1;
+    const unsigned indicesPerFace = (side - 1) * (side - 1) * 6;
+    if (!indexBuffer)
+    {
+        indexBuffer = MakeShared<IndexBuffer>(context_);
+    }
+    if (indexBuffer->GetIndexCount() >= numFaces * indicesPerFace)
+    {
+        return indexBuffer;
+    }
+
+    // Faces are added a chunk at a time, size for a full chunk so the buffer grows once.
+    const unsigned capacity = Max(numFaces, (unsigned)Figure::FACES_PER_CHUNK);
+    ea::vector<unsigned> indices;
+    indices.reserve(capacity * indicesPerFace);
+    for (unsigned face = 0; face < capacity; ++face)
+    {
+        const unsigned first = face * side * side;
+        for (unsigned j = 0; j + 1 < side; ++j)
+        {
+            for (unsigned i = 0; i + 1 < side; ++i)
+            {
+                const unsigned corner = first + j * side + i;
+                indices.push_back(corner);
+                indices.push_back(corner + 1);
+                indices.push_back(corner + side + 1);
+                indices.push_back(corner);
+                indices.push_back(corner + side + 1);
+                indices.push_back(corner + side);
+            }
+        }
+    }
+    indexBuffer->SetSize(indices.size(), true);
+    indexBuffer->SetData(indices.data());
+    return indexBuffer;
+}
+
+unsigned FigureSubdivisionMesh::GetMemoryUse() const
+{
+    unsigned bytes = 0;
+    for (const FMeshChunk& chunk : chunks_)
+    {
+        if (chunk.vertexBuffer)
+        {
+            bytes += chunk.vertexBuffer->GetVertexCount() * chunk.vertexBuffer->GetVertexSize();
+        }
+    }
+    for (const SharedPtr<IndexBuffer>& indexBuffer : indexBuffers_)
+    {
+        if (indexBuffer)
+        {
+            bytes += indexBuffer->GetIndexCount() * indexBuffer->GetIndexSize();
+        }
+    }
+    return bytes;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <EASTL/vector.h>
+
+#include <Urho3D/Graphics/IndexBuffer.h>
+#include <Urho3D/Graphics/Material.h>
+#include <Urho3D/Graphics/Model.h>
+#include <Urho3D/Graphics/VertexBuffer.h>
+#include <Urho3D/Scene/Node.h>
+
+#include "FigureSubdivision.h"
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+/// Draws the samples of a FigureSubdivision, one float position and normal vertex buffer and StaticModel per chunk.
+/// Every face has the same sample grid, so one index buffer per level serves all chunks, each drawing the range of
+/// its own faces. Only the dirty face range of a chunk is uploaded, a chunk changing size uploads all of it.
+class FigureSubdivisionMesh
+{
+public:
+    FigureSubdivisionMesh(Context* context, Node* parent, Material* material);
+    ~FigureSubdivisionMesh();
+
+    /// Upload samples changed since the last Update and clear the dirty ranges of subdivision.
+    void Update(FigureSubdivision& subdivision);
+    void SetEnabled(bool enable);
+    void SetMaterial(Material* material);
+
+    bool IsEnabled() const { return enabled_; }
+    /// GPU memory of vertex and index buffers in bytes.
+    unsigned GetMemoryUse() const;
+    /// Vertex bytes uploaded by the last Update.
+    unsigned GetLastUpload() const { return lastUpload_; }
+
+    /// Position and normal as floats, the layout of FigureSubdivision::GetChunkVertices.
+    static const ea::vector<VertexElement>& GetVertexElements();
+
+private:
+    struct FMeshChunk
+    {
+        SharedPtr<Node> node;
+        SharedPtr<Model> model;
+        SharedPtr<VertexBuffer> vertexBuffer;
+        unsigned level{0};
+    };
+
+    /// Index buffer of level holding at least numFaces faces, grown in place so geometries keep it.
+    IndexBuffer* GetIndexBuffer(unsigned level, unsigned numFaces);
+
+    Context* context_;
+    WeakPtr<Node> parent_;
+    SharedPtr<Material> material_;
+    ea::vector<FMeshChunk> chunks_;
+    SharedPtr<IndexBuffer> indexBuffers_[FigureSubdivision::MAX_LEVEL + 1];
+    bool enabled_{true};
+    unsigned lastUpload_{0};
+};
+
+}
@@ -0,0 +1,255 @@
+#include "FigureTopology.h"
+
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/IO/Log.h>
+
+#include <EASTL/algorithm.h>
+#include <EASTL/sort.h>
+
+using namespace Redi;
+
+namespace
+{
+    /// Faces sharing a vertex are at most this many around it before the walk gives up.
+    const unsigned MAX_VALENCE = 16;
+
+    struct FEdgeRecord
+    {
+        IntVector3 a;
+        IntVector3 b;
+        /// arrayIndex * 4 + edge.
+        unsigned faceEdge;
+    };
+
+    bool EdgeRecordLess(const FEdgeRecord& lhs, const FEdgeRecord& rhs)
+    {
+        const FCellKeyLess less;
+        return lhs.a != rhs.a ? less(lhs.a, rhs.a) : (lhs.b != rhs.b ? less(lhs.b, rhs.b) : lhs.faceEdge < rhs.faceEdge);
+    }
+
+    float DistanceToSegment(const Vector3& point, const Vector3& start, const Vector3& end)
+    {
+        const Vector3 direction = end - start;
+        const float lengthSquared = direction.LengthSquared();
+        const float t = lengthSquared > M_EPSILON ? Clamp((point - start).DotProduct(direction) / lengthSquared, 0.f, 1.f) : 0.f;
+        return (start + direction * t - point).Length();
+    }
+}
+
+void FigureTopology::Update(const Figure& figure)
+{
+    if (IsValid(figure))
+    {
+        return;
+    }
+
+    HiresTimer timer;
+    figure_ = &figure;
+    revision_ = figure.GetRevision();
+
+    const unsigned numFaces = figure.faces.size();
+    corners_.assign(numFaces * 4, IntVector3::ZERO);
+    neighbours_.assign(numFaces * 4, M_MAX_UNSIGNED);
+    neighbourEdges_.assign(numFaces * 4, 0);
+
+    // Every face edge keyed by its sorted corner pair, sorting brings the faces of one edge together.
+    ea::vector<FEdgeRecord> records;
+    records.reserve(numFaces * 4);
+    for (unsigned i = 0; i < numFaces; ++i)
+    {
+        const FFace& face = figure.faces[i];
+        if (face.vertices.size() != 4)
+        {
+            continue;
+        }
+        for (unsigned corner = 0; corner < 4; ++corner)
+        {
+            corners_[i * 4 + corner] = Figure::GetPositionKey(face.vertices[corner].position);
+        }
+        for (unsigned edge = 0; edge < 4; ++edge)
+        {
+            const IntVector3& a = corners_[i * 4 + edge];
+            const IntVector3& b = corners_[i * 4 + (edge + 1) % 4];
+            const bool ordered = FCellKeyLess()(a, b);
+            records.push_back(FEdgeRecord{ordered ? a : b, ordered ? b : a, i * 4 + edge});
+        }
+    }
+    ea::sort(records.begin(), records.end(), EdgeRecordLess);
+
+    for (unsigned first = 0; first < records.size();)
+    {
+        unsigned last = first + 1;
+        while (last < records.size() && records[last].a == records[first].a && records[last].b == records[first].b)
+        {
+            ++last;
+        }
+
+        if (last - first == 2)
+        {
+            const unsigned lhs = records[first].faceEdge;
+            const unsigned rhs = records[first + 1].faceEdge;
+            neighbours_[lhs] = rhs / 4;
+            neighbourEdges_[lhs] = rhs % 4;
+            neighbours_[rhs] = lhs / 4;
+            neighbourEdges_[rhs] = lhs % 4;
+        }
+        else if (last - first > 2)
+        {
+            // Non-manifold edge, e.g. two boxes touching along it. Continue onto the face closest to flat,
+            // skipping the back side of the face itself.
+            for (unsigned i = first; i < last; ++i)
+            {
+                const unsigned faceEdge = records[i].faceEdge;
+                const Vector3& normal = figure.faces[faceEdge / 4].normal;
+                float bestDot = -0.999f;
+                for (unsigned j = first; j < last; ++j)
+                {
+                    const unsigned other = records[j].faceEdge;
+                    const float dot = normal.DotProduct(figure.faces[other / 4].normal);
+                    if (other / 4 != faceEdge / 4 && dot > bestDot)
+                    {
+                        bestDot = dot;
+                        neighbours_[faceEdge] = other / 4;
+                        neighbourEdges_[faceEdge] = other % 4;
+                    }
+                }
+            }
+        }
+        first = last;
+    }
+
+    buildTimeMs_ = timer.GetUSec(false) / 1000.0f;
+    URHO3D_LOGDEBUG("Topology of {} faces built in {:.2f} ms", numFaces, buildTimeMs_);
+}
+
+unsigned FigureTopology::GetNearestEdge(const FFace& face, const Vector3& point)
+{
+    unsigned nearest = 0;
+    float nearestDistance = M_INFINITY;
+    for (unsigned edge = 0; edge < face.vertices.size(); ++edge)
+    {
+        const float distance = DistanceToSegment(point, face.vertices[edge].position,
+            face.vertices[(edge + 1) % face.vertices.size()].position);
+        if (distance < nearestDistance)
+        {
+            nearestDistance = distance;
+            nearest = edge;
+        }
+    }
+    return nearest;
+}
+
+ea::vector<unsigned> FigureTopology::GetFaceRing(const Figure& figure, unsigned arrayIndex, unsigned edge) const
+{
+    ea::vector<unsigned> faces;
+    if (!IsValid(figure) || arrayIndex >= figure.faces.size())
+    {
+        return faces;
+    }
+
+    ea::vector<bool> visited(figure.faces.size(), false);
+    visited[arrayIndex] = true;
+    ea::vector<unsigned> backward;
+    WalkRing(figure, arrayIndex, (edge + 2) % 4, visited, backward);
+    WalkRing(figure, arrayIndex, edge, visited, faces);
+
+    ea::reverse(backward.begin(), backward.end());
+    backward.push_back(figure.faces[arrayIndex].idx);
+    backward.insert(backward.end(), faces.begin(), faces.end());
+    return backward;
+}
+
+void FigureTopology::WalkRing(const Figure& figure, unsigned arrayIndex, unsigned edge, ea::vector<bool>& visited,
+    ea::vector<unsigned>& faces) const
+{
+    unsigned current = arrayIndex;
+    while (true)
+    {
+        const unsigned next = GetNeighbour(current, edge);
+        if (next == M_MAX_UNSIGNED || visited[next])
+        {
+            break;
+        }
+        visited[next] = true;
+        faces.push_back(figure.faces[next].idx);
+        edge = (neighbourEdges_[current * 4 + edge] + 2) % 4;
+        current = next;
+    }
+}
+
+ea::vector<unsigned> FigureTopology::GetEdgeLoop(const Figure& figure, unsigned arrayIndex, unsigned edge) const
+{
+    ea::vector<unsigned> faces;
+    if (!IsValid(figure) || arrayIndex >= figure.faces.size())
+    {
+        return faces;
+    }
+
+    ea::vector<bool> visited(figure.faces.size(), false);
+    visited[arrayIndex] = true;
+    ea::vector<unsigned> backward;
+    WalkLoop(figure, arrayIndex, edge, false, visited, backward);
+    WalkLoop(figure, arrayIndex, edge, true, visited, faces);
+
+    ea::reverse(backward.begin(), backward.end());
+    backward.push_back(figure.faces[arrayIndex].idx);
+    backward.insert(backward.end(), faces.begin(), faces.end());
+    return backward;
+}
+
+void FigureTopology::WalkLoop(const Figure& figure, unsigned arrayIndex, unsigned edge, bool forward, ea::vector<bool>& visited,
+    ea::vector<unsigned>& faces) const
+{
+    unsigned current = arrayIndex;
+    while (true)
+    {
+        const unsigned vertexCorner = forward ? (edge + 1) % 4 : edge;
+        const IntVector3 vertex = GetCorner(current, vertexCorner);
+        // Only a regular quad vertex has a well defined edge straight across it.
+        if (GetValence(current, vertexCorner) != 4)
+        {
+            break;
+        }
+
+        const unsigned sideEdge = GetOtherEdge(current, edge, vertex);
+        const unsigned next = GetNeighbour(current, sideEdge);
+        if (next == M_MAX_UNSIGNED || visited[next])
+        {
+            break;
+        }
+        const unsigned nextEdge = GetOtherEdge(next, neighbourEdges_[current * 4 + sideEdge], vertex);
+
+        visited[next] = true;
+        faces.push_back(figure.faces[next].idx);
+        forward = GetCorner(next, nextEdge) == vertex;
+        edge = nextEdge;
+        current = next;
+    }
+}
+
+unsigned FigureTopology::GetValence(unsigned arrayIndex, unsigned corner) const
+{
+    const IntVector3 vertex = GetCorner(arrayIndex, corner);
+    unsigned current = arrayIndex;
+    unsigned edge = corner;
+    for (unsigned valence = 1; valence <= MAX_VALENCE; ++valence)
+    {
+        const unsigned next = GetNeighbour(current, edge);
+        if (next == M_MAX_UNSIGNED)
+        {
+            return 0;
+        }
+        if (next == arrayIndex)
+        {
+            return valence;
+        }
+        edge = GetOtherEdge(next, neighbourEdges_[current * 4 + edge], vertex);
+        current = next;
+    }
+    return 0;
+}
+
+unsigned FigureTopology::GetOtherEdge(unsigned arrayIndex, unsigned edge, const IntVector3& corner) const
+{
+    return GetCorner(arrayIndex, edge) == corner ? (edge + 3) % 4 : (edge + 1) % 4;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <EASTL/vector.h>
+
+#include "Figure.h"
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+/// Edge-to-face adjacency of a quad Figure, rebuilt once per figure revision.
+/// Edge e of a face runs from corner e to corner e + 1. For every face edge the table holds the face across it
+/// and the index of the same edge in that face, so loops and rings walk the mesh in constant time per step.
+class FigureTopology
+{
+public:
+    /// Rebuild when figure changed since the last call.
+    void Update(const Figure& figure);
+    bool IsValid(const Figure& figure) const { return figure_ == &figure && revision_ == figure.GetRevision(); }
+
+    /// Face array index across edge of face, M_MAX_UNSIGNED on open edges.
+    unsigned GetNeighbour(unsigned arrayIndex, unsigned edge) const { return neighbours_[arrayIndex * 4 + edge]; }
+    /// Edge of face nearest to point, used to pick the loop direction from the cursor.
+    static unsigned GetNearestEdge(const FFace& face, const Vector3& point);
+
+    /// Faces crossed by walking over edge and then always over the opposite edge, in both directions.
+    /// Returns face idx values in walk order.
+    ea::vector<unsigned> GetFaceRing(const Figure& figure, unsigned arrayIndex, unsigned edge) const;
+    /// Faces on one side of the edge loop through edge. The loop continues through vertices shared by four faces.
+    /// Returns face idx values in walk order.
+    ea::vector<unsigned> GetEdgeLoop(const Figure& figure, unsigned arrayIndex, unsigned edge) const;
+
+    float GetBuildTimeMs() const { return buildTimeMs_; }
+
+private:
+    /// Corner of face as Figure::GetPositionKey.
+    const IntVector3& GetCorner(unsigned arrayIndex, unsigned corner) const { return corners_[arrayIndex * 4 + corner]; }
+    /// Walk one direction of a ring, appending to faces.
+    void WalkRing(const Figure& figure, unsigned arrayIndex, unsigned edge, ea::vector<bool>& visited, ea::vector<unsigned>& faces) const;
+    /// Walk one direction of a loop from the end vertex of edge, appending to faces.
+    void WalkLoop(const Figure& figure, unsigned arrayIndex, unsigned edge, bool forward, ea::vector<bool>& visited,
+        ea::vector<unsigned>& faces) const;
+    /// Number of faces around corner of face, 0 when the fan is open.
+    unsigned GetValence(unsigned arrayIndex, unsigned corner) const;
+    /// Edge of face other than edge that touches corner key.
+    unsigned GetOtherEdge(unsigned arrayIndex, unsigned edge, const IntVector3& corner) const;
+
+    const Figure* figure_{nullptr};
+    unsigned revision_{M_MAX_UNSIGNED};
+    ea::vector<IntVector3, TrackedAllocator<MC_SELECTION>> corners_;
+    ea::vector<unsigned, TrackedAllocator<MC_SELECTION>> neighbours_;
+    ea::vector<unsigned char, TrackedAllocator<MC_SELECTION>> neighbourEdges_;
+    float buildTimeMs_{0.f};
+};
+
+}
@@ -0,0 +1,449 @@
+#include "FigureUvAtlas.h"
+#include "Parallel.h"
+
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/IO/Log.h>
+
+#include <EASTL/sort.h>
+
+using namespace Redi;
+
+namespace
+{
+    /// Atlas never starts smaller than this.
+    const unsigned MIN_ATLAS_SIZE = 64;
+    /// Largest atlas tried before lowering the texel density.
+    const unsigned MAX_ATLAS_SIZE = 1u << 15;
+    /// Lowest pack scale tried before giving up on a pack.
+    const float MIN_PACK_SCALE = 1.0f / 1024.0f;
+
+    struct FEdgeRecord
+    {
+        IntVector3 a;
+        IntVector3 b;
+        unsigned face;
+    };
+
+    unsigned FindRoot(ea::vector<unsigned>& parents, unsigned index)
+    {
+        while (parents[index] != index)
+        {
+            parents[index] = parents[parents[index]];
+            index = parents[index];
+        }
+        return index;
+    }
+}
+
+FigureUvAtlas::FigureUvAtlas(Context* context)
+    : context_(context)
+{
+}
+
+void FigureUvAtlas::SetTexelsPerUnit(float texelsPerUnit)
+{
+    texelsPerUnit_ = Max(texelsPerUnit, M_EPSILON);
+    repackAll_ = true;
+}
+
+float FigureUvAtlas::GetFillRatio() const
+{
+    return atlasSize_ > 0 ? (float)usedArea_ / ((float)atlasSize_ * atlasSize_) : 0.f;
+}
+
+unsigned long long FigureUvAtlas::GetPlaneKey(const FFace& face)
+{
+    // Orientation in 8 bits per axis and distance from the origin at 1/256 units.
+    const Vector3 normal = face.normal.Normalized();
+    const auto axis = [](float v) { return (unsigned long long)(RoundToInt(v * 127.0f) + 128) & 0xff; };
+    const int distance = face.vertices.empty() ? 0 : RoundToInt(normal.DotProduct(face.vertices[0].position) * 256.0f);
+    return (axis(normal.x_) << 48) | (axis(normal.y_) << 40) | (axis(normal.z_) << 32) | (unsigned)distance;
+}
+
+void FigureUvAtlas::Update(const Figure& figure)
+{
+    HiresTimer timer;
+    if (figure_ != &figure)
+    {
+        figure_ = &figure;
+        faceKeys_.clear();
+        chunkRevisions_.clear();
+        planes_.clear();
+        usedArea_ = 0;
+        freedArea_ = 0;
+        numCharts_ = 0;
+        repackAll_ = true;
+    }
+
+    // Planes of faces in changed chunks, before and after the change.
+    const unsigned numFaces = figure.faces.size();
+    const unsigned oldNumFaces = faceKeys_.size();
+    ea::unordered_set<unsigned long long> dirty;
+    for (unsigned i = numFaces; i < oldNumFaces; ++i)
+    {
+        dirty.insert(faceKeys_[i]);
+    }
+    faceKeys_.resize(numFaces, 0);
+
+    const unsigned numChunks = figure.GetNumChunks();
+    chunkRevisions_.resize(numChunks, M_MAX_UNSIGNED);
+    for (unsigned chunk = 0; chunk < numChunks; ++chunk)
+    {
+        const unsigned revision = figure.GetChunkRevision(chunk);
+        if (chunkRevisions_[chunk] == revision && !repackAll_)
+        {
+            continue;
+        }
+        // Faces that only moved since the last update give their range, others the whole chunk.
+        unsigned begin, end;
+        if (repackAll_ || !figure.GetMovedRange(chunk, chunkRevisions_[chunk], begin, end))
+        {
+            begin = chunk * Figure::FACES_PER_CHUNK;
+            end = Min(begin + Figure::FACES_PER_CHUNK, numFaces);
+        }
+        chunkRevisions_[chunk] = revision;
+        for (unsigned i = begin; i < end; ++i)
+        {
+            if (i < oldNumFaces)
+            {
+                dirty.insert(faceKeys_[i]);
+            }
+            faceKeys_[i] = GetPlaneKey(figure.faces[i]);
+            dirty.insert(faceKeys_[i]);
+        }
+    }
+    if (dirty.empty() && !repackAll_)
+    {
+        return;
+    }
+
+    // Charts of dirty planes give their space back.
+    for (unsigned long long key : dirty)
+    {
+        auto it = planes_.find(key);
+        if (it == planes_.end())
+        {
+            continue;
+        }
+        for (const FChart& chart : it->second)
+        {
+            const unsigned long long area = (unsigned long long)chart.width * chart.height;
+            usedArea_ -= area;
+            freedArea_ += area;
+            --numCharts_;
+        }
+        planes_.erase(it);
+    }
+
+    ea::unordered_map<unsigned long long, unsigned> groupIndices;
+    ea::vector<unsigned long long> groupKeys;
+    ea::vector<ea::vector<unsigned>> groupFaces;
+    for (unsigned i = 0; i < numFaces; ++i)
+    {
+        if (dirty.find(faceKeys_[i]) == dirty.end())
+        {
+            continue;
+        }
+        auto it = groupIndices.find(faceKeys_[i]);
+        if (it == groupIndices.end())
+        {
+            it = groupIndices.emplace(faceKeys_[i], (unsigned)groupKeys.size()).first;
+            groupKeys.push_back(faceKeys_[i]);
+            groupFaces.emplace_back();
+        }
+        groupFaces[it->second].push_back(i);
+    }
+
+    ea::vector<ChartVector> built(groupFaces.size());
+    ParallelFor(context_, groupFaces.size(), 16, [&](unsigned begin, unsigned end)
+    {
+        for (unsigned group = begin; group < end; ++group)
+        {
+            BuildCharts(figure, groupFaces[group], built[group]);
+        }
+    });
+
+    ea::vector<FChart*> added;
+    for (unsigned group = 0; group < built.size(); ++group)
+    {
+        ChartVector& charts = planes_[groupKeys[group]];
+        charts = ea::move(built[group]);
+        for (FChart& chart : charts)
+        {
+            usedArea_ += (unsigned long long)chart.width * chart.height;
+            ++numCharts_;
+            added.push_back(&chart);
+        }
+    }
+    uvs_.resize(numFaces * 4, Vector2::ZERO);
+
+    // Tall charts first keep the skyline flat.
+    ea::sort(added.begin(), added.end(), [](const FChart* lhs, const FChart* rhs)
+        { return lhs->height != rhs->height ? lhs->height > rhs->height : lhs->width > rhs->width; });
+
+    bool fullRepack = repackAll_ || atlasSize_ == 0 || freedArea_ * 3 > usedArea_;
+    for (unsigned i = 0; i < added.size() && !fullRepack; ++i)
+    {
+        fullRepack = !Insert(added[i]->width, added[i]->height, added[i]->x, added[i]->y);
+    }
+
+    if (fullRepack)
+    {
+        Repack();
+    }
+    else
+    {
+        for (const FChart* chart : added)
+        {
+            WriteUvs(figure, *chart);
+        }
+    }
+
+    repackAll_ = false;
+    lastFullRepack_ = fullRepack;
+    ++revision_;
+    lastUpdateMs_ = timer.GetUSec(false) / 1000.0f;
+    URHO3D_LOGDEBUG("UV atlas {}: {} planes rebuilt, {} charts in {}x{}, {:.1f}% filled, {:.2f} ms", fullRepack ? "repacked" : "updated",
+        groupFaces.size(), numCharts_, atlasSize_, atlasSize_, GetFillRatio() * 100.0f, lastUpdateMs_);
+}
+
+void FigureUvAtlas::BuildCharts(const Figure& figure, const ea::vector<unsigned>& faces, ChartVector& charts) const
+{
+    if (faces.empty())
+    {
+        return;
+    }
+
+    // Project along the dominant axis of the plane normal.
+    const Vector3 normal = figure.faces[faces[0]].normal;
+    const Vector3 absNormal = normal.Abs();
+    const unsigned axis = absNormal.x_ >= absNormal.y_ && absNormal.x_ >= absNormal.z_ ? 0 : (absNormal.y_ >= absNormal.z_ ? 1 : 2);
+    const unsigned axisU = (axis + 1) % 3;
+    const unsigned axisV = (axis + 2) % 3;
+
+    // Faces sharing an edge end up next to each other after sorting the edges.
+    ea::vector<FEdgeRecord> records;
+    records.reserve(faces.size() * 4);
+    for (unsigned local = 0; local < faces.size(); ++local)
+    {
+        const FVertexArray& vertices = figure.faces[faces[local]].vertices;
+        for (unsigned corner = 0; corner < vertices.size(); ++corner)
+        {
+            const IntVector3 a = Figure::GetPositionKey(vertices[corner].position);
+            const IntVector3 b = Figure::GetPositionKey(vertices[(corner + 1) % vertices.size()].position);
+            const bool ordered = FCellKeyLess()(a, b);
+            records.push_back(FEdgeRecord{ordered ? a : b, ordered ? b : a, local});
+        }
+    }
+    ea::sort(records.begin(), records.end(), [](const FEdgeRecord& lhs, const FEdgeRecord& rhs)
+        { return lhs.a != rhs.a ? FCellKeyLess()(lhs.a, rhs.a) : FCellKeyLess()(lhs.b, rhs.b); });
+
+    ea::vector<unsigned> parents(faces.size());
+    for (unsigned i = 0; i < parents.size(); ++i)
+    {
+        parents[i] = i;
+    }
+    for (unsigned i = 1; i < records.size(); ++i)
+    {
+        if (records[i].a == records[i - 1].a && records[i].b == records[i - 1].b)
+        {
+            parents[FindRoot(parents, records[i].face)] = FindRoot(parents, records[i - 1].face);
+        }
+    }
+
+    ea::vector<unsigned> chartOfRoot(faces.size(), M_MAX_UNSIGNED);
+    for (unsigned local = 0; local < faces.size(); ++local)
+    {
+        const unsigned root = FindRoot(parents, local);
+        if (chartOfRoot[root] == M_MAX_UNSIGNED)
+        {
+            chartOfRoot[root] = charts.size();
+            charts.emplace_back();
+            charts.back().axisU = axisU;
+            charts.back().axisV = axisV;
+            charts.back().min = Vector2(M_INFINITY, M_INFINITY);
+            charts.back().max = Vector2(-M_INFINITY, -M_INFINITY);
+        }
+        FChart& chart = charts[chartOfRoot[root]];
+        chart.faces.push_back(faces[local]);
+        for (const FVertex& vertex : figure.faces[faces[local]].vertices)
+        {
+            const Vector2 point(vertex.position.Data()[axisU], vertex.position.Data()[axisV]);
+            chart.min = Vector2(Min(chart.min.x_, point.x_), Min(chart.min.y_, point.y_));
+            chart.max = Vector2(Max(chart.max.x_, point.x_), Max(chart.max.y_, point.y_));
+        }
+    }
+
+    for (FChart& chart : charts)
+    {
+        SizeChart(chart);
+    }
+}
+
+void FigureUvAtlas::SizeChart(FChart& chart) const
+{
+    const Vector2 size = (chart.max - chart.min) * (texelsPerUnit_ * packScale_);
+    chart.width = Max(CeilToInt(size.x_), 1) + PADDING * 2;
+    chart.height = Max(CeilToInt(size.y_), 1) + PADDING * 2;
+}
+
+void FigureUvAtlas::Repack()
+{
+    ea::vector<FChart*> charts;
+    for (auto& plane : planes_)
+    {
+        for (FChart& chart : plane.second)
+        {
+            charts.push_back(&chart);
+        }
+    }
+
+    // Every full repack tries the requested density first, so a figure that shrank gets it back.
+    const unsigned lastAtlasSize = atlasSize_;
+    bool fits = false;
+    unsigned long long area = 0;
+    for (packScale_ = 1.0f; packScale_ >= MIN_PACK_SCALE; packScale_ *= 0.5f)
+    {
+        area = 0;
+        unsigned maxSide = 0;
+        for (FChart* chart : charts)
+        {
+            SizeChart(*chart);
+            area += (unsigned long long)chart->width * chart->height;
+            maxSide = Max(maxSide, Max(chart->width, chart->height));
+        }
+        ea::sort(charts.begin(), charts.end(), [](const FChart* lhs, const FChart* rhs)
+            { return lhs->height != rhs->height ? lhs->height > rhs->height : lhs->width > rhs->width; });
+
+        // Leave a quarter of headroom, so later edits mostly pack incrementally.
+        unsigned size = MIN_ATLAS_SIZE;
+        while ((unsigned long long)size * size < area + area / 4 || size < maxSide)
+        {
+            size *= 2;
+        }
+        for (; size <= MAX_ATLAS_SIZE && !fits; size *= 2)
+        {
+            atlasSize_ = size;
+            skyline_.clear();
+            skyline_.push_back(FSkylineSegment{0, 0, size});
+            fits = true;
+            for (unsigned i = 0; i < charts.size() && fits; ++i)
+            {
+                fits = Insert(charts[i]->width, charts[i]->height, charts[i]->x, charts[i]->y);
+            }
+        }
+        if (fits)
+        {
+            break;
+        }
+    }
+
+    usedArea_ = area;
+    freedArea_ = 0;
+    if (!fits)
+    {
+        // Keep the uvs of the last good layout. A full skyline sends the next edit back here.
+        URHO3D_LOGERROR("UV atlas of {} charts does not fit {}x{} texels even at 1/{} of the texel density", charts.size(),
+            MAX_ATLAS_SIZE, MAX_ATLAS_SIZE, (unsigned)(1.0f / MIN_PACK_SCALE));
+        packScale_ = MIN_PACK_SCALE;
+        atlasSize_ = lastAtlasSize;
+        skyline_.clear();
+        skyline_.push_back(FSkylineSegment{0, atlasSize_, atlasSize_});
+        return;
+    }
+    if (packScale_ < 1.0f)
+    {
+        URHO3D_LOGWARNING("UV atlas of {} charts packed at {:.3f} of the texel density to fit {}x{} texels", charts.size(),
+            packScale_, MAX_ATLAS_SIZE, MAX_ATLAS_SIZE);
+    }
+
+    const Figure& figure = *figure_;
+    ParallelFor(context_, charts.size(), 256, [&](unsigned begin, unsigned end)
+    {
+        for (unsigned i = begin; i < end; ++i)
+        {
+            WriteUvs(figure, *charts[i]);
+        }
+    });
+}
+
+bool FigureUvAtlas::Insert(unsigned width, unsigned height, unsigned& x, unsigned& y)
+{
+    unsigned bestIndex = M_MAX_UNSIGNED;
+    unsigned bestX = 0;
+    unsigned bestY = M_MAX_UNSIGNED;
+    for (unsigned i = 0; i < skyline_.size(); ++i)
+    {
+        const unsigned left = skyline_[i].x;
+        if (left + width > atlasSize_)
+        {
+            break;
+        }
+        // Resting height is the highest segment under the rectangle.
+        unsigned top = 0;
+        for (unsigned j = i; j < skyline_.size() && skyline_[j].x < left + width; ++j)
+        {
+            top = Max(top, skyline_[j].y);
+        }
+        if (top + height <= atlasSize_ && top < bestY)
+        {
+            bestIndex = i;
+            bestX = left;
+            bestY = top;
+        }
+    }
+    if (bestIndex == M_MAX_UNSIGNED)
+    {
+        return false;
+    }
+
+    x = bestX;
+    y = bestY;
+    const unsigned right = bestX + width;
+    skyline_.insert(skyline_.begin() + bestIndex, FSkylineSegment{bestX, bestY + height, width});
+    for (unsigned i = bestIndex + 1; i < skyline_.size();)
+    {
+        FSkylineSegment& segment = skyline_[i];
+        if (segment.x >= right)
+        {
+            break;
+        }
+        if (segment.x + segment.width <= right)
+        {
+            skyline_.erase(skyline_.begin() + i);
+            continue;
+        }
+        segment.width -= right - segment.x;
+        segment.x = right;
+        break;
+    }
+    for (unsigned i = 1; i < skyline_.size();)
+    {
+        if (skyline_[i].y == skyline_[i - 1].y)
+        {
+            skyline_[i - 1].width += skyline_[i].width;
+            skyline_.erase(skyline_.begin() + i);
+        }
+        else
+        {
+            ++i;
+        }
+    }
+    return true;
+}
+
+void FigureUvAtlas::WriteUvs(const Figure& figure, const FChart& chart)
+{
+    const float invSize = 1.0f / atlasSize_;
+    const Vector2 offset((float)(chart.x + PADDING), (float)(chart.y + PADDING));
+    for (unsigned arrayIndex : chart.faces)
+    {
+        const FVertexArray& vertices = figure.faces[arrayIndex].vertices;
+        for (unsigned corner = 0; corner < vertices.size() && corner < 4; ++corner)
+        {
+            const Vector3& position = vertices[corner].position;
+            const Vector2 local(position.Data()[chart.axisU] - chart.min.x_, position.Data()[chart.axisV] - chart.min.y_);
+            uvs_[arrayIndex * 4 + corner] = (offset + local * (texelsPerUnit_ * packScale_)) * invSize;
+        }
+    }
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <EASTL/unordered_map.h>
+#include <EASTL/unordered_set.h>
+#include <EASTL/vector.h>
+
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Math/Vector2.h>
+
+#include "Figure.h"
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+/// Non-overlapping second UV set of a Figure for lightmaps and painting.
+/// Faces on one plane that share edges form a chart, projected along the plane axis and sized by world area.
+/// Charts are packed into one square atlas with a bottom-left skyline packer.
+/// Charts are rebuilt only for planes touched by changed chunks, in parallel per plane. Their new charts go on
+/// top of the skyline while all other charts keep their place. A full repack happens when the atlas overflows
+/// or removed charts left too much unused space. Charts that do not fit the largest atlas at the requested texel
+/// density are packed again at a lower one, see GetPackScale.
+class FigureUvAtlas
+{
+public:
+    explicit FigureUvAtlas(Context* context);
+
+    /// Rebuild charts of changed planes and repack. Main thread.
+    void Update(const Figure& figure);
+    /// Texel density, charts are at least one texel plus padding. Repacks everything on the next Update.
+    void SetTexelsPerUnit(float texelsPerUnit);
+    float GetTexelsPerUnit() const { return texelsPerUnit_; }
+    /// Fraction of the texel density the charts are packed at, below 1 when they did not fit the largest atlas.
+    float GetPackScale() const { return packScale_; }
+
+    /// Atlas coordinates of faces[arrayIndex].vertices[corner] at arrayIndex * 4 + corner, in [0, 1].
+    const ea::vector<Vector2, TrackedAllocator<MC_UV>>& GetUvs() const { return uvs_; }
+    /// Changes whenever any uv changed.
+    unsigned GetRevision() const { return revision_; }
+
+    /// Width and height of the atlas in texels.
+    unsigned GetAtlasSize() const { return atlasSize_; }
+    unsigned GetNumCharts() const { return numCharts_; }
+    /// Chart texels over atlas texels.
+    float GetFillRatio() const;
+    float GetLastUpdateMs() const { return lastUpdateMs_; }
+    bool WasFullRepack() const { return lastFullRepack_; }
+
+    /// Texels left free around every chart against bleeding.
+    static const unsigned PADDING = 2;
+
+private:
+    struct FChart
+    {
+        /// Face array indices.
+        ea::vector<unsigned, TrackedAllocator<MC_UV>> faces;
+        /// Plane axes the chart is projected on.
+        unsigned axisU{0};
+        unsigned axisV{1};
+        Vector2 min{Vector2::ZERO};
+        Vector2 max{Vector2::ZERO};
+        /// Size with padding and bottom-left corner in the atlas, in texels.
+        unsigned width{0};
+        unsigned height{0};
+        unsigned x{0};
+        unsigned y{0};
+    };
+
+    using ChartVector = ea::vector<FChart, TrackedAllocator<MC_UV>>;
+
+    /// Skyline of the packed area, segments ordered by x and covering the atlas width.
+    struct FSkylineSegment
+    {
+        unsigned x;
+        unsigned y;
+        unsigned width;
+    };
+
+    /// Rebuild the charts of one plane from its faces. Worker threads.
+    void BuildCharts(const Figure& figure, const ea::vector<unsigned>& faces, ChartVector& charts) const;
+    /// Pack every chart into a new atlas, lowering the pack scale until they fit.
+    void Repack();
+    /// Size of chart in texels with padding at the current pack scale.
+    void SizeChart(FChart& chart) const;
+    /// Bottom-left position of a width x height rectangle on the skyline, false when it does not fit.
+    bool Insert(unsigned width, unsigned height, unsigned& x, unsigned& y);
+    void WriteUvs(const Figure& figure, const FChart& chart);
+
+    static unsigned long long GetPlaneKey(const FFace& face);
+
+    Context* context_;
+    const Figure* figure_{nullptr};
+    float texelsPerUnit_{16.0f};
+    float packScale_{1.0f};
+    bool repackAll_{true};
+
+    /// Plane key of each face at the last Update, by array index.
+    ea::vector<unsigned long long, TrackedAllocator<MC_UV>> faceKeys_;
+    ea::vector<unsigned> chunkRevisions_;
+    ea::unordered_map<unsigned long long, ChartVector, ea::hash<unsigned long long>, ea::equal_to<unsigned long long>, TrackedAllocator<MC_UV>> planes_;
+
+    unsigned atlasSize_{0};
+    ea::vector<FSkylineSegment, TrackedAllocator<MC_UV>> skyline_;
+    /// Texels of all charts and of removed charts still holding space in the skyline.
+    unsigned long long usedArea_{0};
+    unsigned long long freedArea_{0};
+    unsigned numCharts_{0};
+
+    ea::vector<Vector2, TrackedAllocator<MC_UV>> uvs_;
+    unsigned revision_{0};
+    float lastUpdateMs_{0.f};
+    bool lastFullRepack_{false};
+};
+
+}
@@ -0,0 +1,138 @@
+#include "FrameGraph.h"
+#include "Parallel.h"
+
+#include <Urho3D/Core/Thread.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Core/WorkQueue.h>
+
+using namespace Redi;
+
+FrameGraph::FrameGraph(Context* context)
+    : context_(context)
+{
+}
+
+FrameGraph::~FrameGraph()
+{
+    // Run always joins, a queued item left behind only finds its task claimed.
+    for (const ea::shared_ptr<FTask>& task : tasks_)
+    {
+        while (task->claimed && !task->done)
+        {
+            Thread::Sleep(1);
+        }
+    }
+}
+
+unsigned FrameGraph::Add(const ea::string& name, EFrameTaskThread thread, ea::function<void()> fn,
+    std::initializer_list<unsigned> dependencies)
+{
+    auto task = ea::make_shared<FTask>();
+    task->name = name;
+    task->thread = thread;
+    task->fn = ea::move(fn);
+    for (unsigned dependency : dependencies)
+    {
+        if (dependency < tasks_.size())
+        {
+            task->dependencies.push_back(dependency);
+        }
+    }
+    tasks_.push_back(task);
+    return tasks_.size() - 1;
+}
+
+void FrameGraph::Clear()
+{
+    tasks_.clear();
+}
+
+void FrameGraph::Execute(FTask& task)
+{
+    if (task.claimed.exchange(true))
+    {
+        return;
+    }
+    HiresTimer timer;
+    task.fn();
+    task.timeMs = timer.GetUSec(false) / 1000.0f;
+    task.done = true;
+}
+
+bool FrameGraph::IsReady(const FTask& task) const
+{
+    for (unsigned dependency : task.dependencies)
+    {
+        if (!tasks_[dependency]->done)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void FrameGraph::Dispatch()
+{
+    auto* queue = context_->GetSubsystem<WorkQueue>();
+    if (!queue || queue->GetNumThreads() == 0)
+    {
+        return;
+    }
+    for (const ea::shared_ptr<FTask>& task : tasks_)
+    {
+        if (task->thread == TT_WORKER && !task->queued && IsReady(*task))
+        {
+            task->queued = true;
+            queue->AddWorkItem([task](unsigned) { Execute(*task); }, JOB_PRIORITY_FRAME);
+        }
+    }
+}
+
+void FrameGraph::Wait(unsigned id)
+{
+    FTask& task = *tasks_[id];
+    if (task.done)
+    {
+        return;
+    }
+
+    for (unsigned dependency : task.dependencies)
+    {
+        Wait(dependency);
+    }
+    Execute(task);
+    while (!task.done)
+    {
+        Thread::Sleep(0);
+    }
+}
+
+void FrameGraph::Run()
+{
+    HiresTimer timer;
+    lastWaitMs_ = 0.f;
+    for (unsigned id = 0; id < tasks_.size(); ++id)
+    {
+        Dispatch();
+        FTask& task = *tasks_[id];
+        if (task.thread != TT_MAIN)
+        {
+            continue;
+        }
+        HiresTimer waitTimer;
+        for (unsigned dependency : task.dependencies)
+        {
+            Wait(dependency);
+        }
+        lastWaitMs_ += waitTimer.GetUSec(false) / 1000.0f;
+        Execute(task);
+    }
+
+    HiresTimer waitTimer;
+    for (unsigned id = 0; id < tasks_.size(); ++id)
+    {
+        Wait(id);
+    }
+    lastWaitMs_ += waitTimer.GetUSec(false) / 1000.0f;
+    lastRunMs_ = timer.GetUSec(false) / 1000.0f;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <EASTL/functional.h>
+#include <EASTL/shared_ptr.h>
+#include <EASTL/string.h>
+#include <EASTL/vector.h>
+
+#include <atomic>
+#include <initializer_list>
+
+#include <Urho3D/Core/Context.h>
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+    enum EFrameTaskThread : unsigned
+    {
+        TT_MAIN, TT_WORKER
+    };
+
+/// Tasks of one frame with their dependencies. Main thread tasks run in the order they were added, each only waits
+/// for its own dependencies. Worker tasks go to the WorkQueue as soon as their dependencies finished and run
+/// alongside the main thread. A main task that needs a worker task not started yet runs it itself, so a queue
+/// busy with background jobs never stalls the frame. Every task has finished when Run returns.
+class FrameGraph
+{
+public:
+    explicit FrameGraph(Context* context);
+    ~FrameGraph();
+
+    /// Add a task running after all dependencies, returns its id for later dependencies.
+    unsigned Add(const ea::string& name, EFrameTaskThread thread, ea::function<void()> fn,
+        std::initializer_list<unsigned> dependencies = {});
+    /// Run every task, main thread only.
+    void Run();
+    /// Remove all tasks. Timings of the last Run stay readable until the next one.
+    void Clear();
+
+    unsigned GetNumTasks() const { return tasks_.size(); }
+    const ea::string& GetTaskName(unsigned id) const { return tasks_[id]->name; }
+    EFrameTaskThread GetTaskThread(unsigned id) const { return tasks_[id]->thread; }
+    float GetTaskMs(unsigned id) const { return tasks_[id]->timeMs; }
+    float GetLastRunMs() const { return lastRunMs_; }
+    /// Main thread time spent waiting for worker tasks in the last Run.
+    float GetLastWaitMs() const { return lastWaitMs_; }
+
+private:
+    /// Shared with the queued work item, which may outlive Clear when the main thread ran the task itself.
+    struct FTask
+    {
+        ea::string name;
+        EFrameTaskThread thread{TT_MAIN};
+        ea::function<void()> fn;
+        ea::vector<unsigned> dependencies;
+        bool queued{false};
+        std::atomic<bool> claimed{false};
+        std::atomic<bool> done{false};
+        float timeMs{0.f};
+    };
+
+    /// Run task on the calling thread unless another thread claimed it first.
+    static void Execute(FTask& task);
+    bool IsReady(const FTask& task) const;
+    /// Queue worker tasks whose dependencies finished.
+    void Dispatch();
+    /// Return once task finished, running it here when nobody started it yet.
+    void Wait(unsigned id);
+
+    Context* context_;
+    ea::vector<ea::shared_ptr<FTask>> tasks_;
+    float lastRunMs_{0.f};
+    float lastWaitMs_{0.f};
+};
+
+}
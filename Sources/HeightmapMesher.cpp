@@ -0,0 +1,243 @@
+#include "HeightmapMesher.h"
+#include "Parallel.h"
+
+#include <Urho3D/Math/MathDefs.h>
+
+#include <cstring>
+
+#if defined(URHO3D_SSE)
+#include <xmmintrin.h>
+#endif
+
+using namespace Redi;
+
+HeightmapMesher::HeightmapMesher(Image* heightmap, const FTerrainSettings& settings)
+    : heightmap_(heightmap),
+    settings_(settings)
+{
+    settings_.step = Max(settings_.step, 1);
+    // (tileQuads + 1) * (tileQuads + 5) grid and skirt vertices must be addressable with 16-bit indices.
+    settings_.tileQuads = Clamp(settings_.tileQuads, 1, 253);
+    settings_.skirtDepth = Max(settings_.skirtDepth, 0.0f);
+    width_ = heightmap_ ? heightmap_->GetWidth() : 0;
+    height_ = heightmap_ ? heightmap_->GetHeight() : 0;
+
+    const int tileTexels = settings_.tileQuads * settings_.step;
+    tilesX_ = width_ > 1 ? (width_ - 2) / tileTexels + 1 : 0;
+    tilesZ_ = height_ > 1 ? (height_ - 2) / tileTexels + 1 : 0;
+}
+
+const ea::vector<VertexElement>& HeightmapMesher::GetVertexElements()
+{
+    static const ea::vector<VertexElement> elements = {
+        VertexElement(TYPE_VECTOR3, SEM_POSITION),
+        VertexElement(TYPE_VECTOR3, SEM_NORMAL),
+        VertexElement(TYPE_VECTOR2, SEM_TEXCOORD)
+    };
+    return elements;
+}
+
+unsigned HeightmapMesher::GetNumLods() const
+{
+    // Coarsest LOD still has at least one quad per tile.
+    unsigned numLods = 1;
+    while (numLods < settings_.numLods && (settings_.tileQuads >> numLods) > 0 && settings_.tileQuads % (1 << numLods) == 0)
+    {
+        ++numLods;
+    }
+    return numLods;
+}
+
+float HeightmapMesher::GetHeight(int x, int z) const
+{
+    x = Clamp(x, 0, width_ - 1);
+    z = Clamp(z, 0, height_ - 1);
+    return heights_[z * width_ + x];
+}
+
+void HeightmapMesher::BuildTiles(Context* context, ea::vector<FTerrainTile>& tiles)
+{
+    tiles.clear();
+    if (tilesX_ == 0 || tilesZ_ == 0)
+    {
+        return;
+    }
+
+    heights_.resize(width_ * height_);
+    const unsigned char* data = heightmap_->GetData();
+    const unsigned components = heightmap_->GetComponents();
+    const float scale = settings_.heightScale / 255.0f;
+    ParallelFor(context, height_, 64, [&](unsigned begin, unsigned end)
+    {
+        for (unsigned z = begin; z < end; ++z)
+        {
+            const unsigned char* src = data + z * width_ * components;
+            float* dest = heights_.data() + z * width_;
+            for (int x = 0; x < width_; ++x)
+            {
+                dest[x] = src[x * components] * scale;
+            }
+        }
+    });
+
+    tiles.resize(tilesX_ * tilesZ_);
+    const int tileTexels = settings_.tileQuads * settings_.step;
+    for (int tz = 0; tz < tilesZ_; ++tz)
+    {
+        for (int tx = 0; tx < tilesX_; ++tx)
+        {
+            FTerrainTile& tile = tiles[tz * tilesX_ + tx];
+            tile.x = tx * tileTexels;
+            tile.z = tz * tileTexels;
+        }
+    }
+
+    ParallelFor(context, tiles.size(), 8, [&](unsigned begin, unsigned end)
+    {
+        for (unsigned i = begin; i < end; ++i)
+        {
+            BuildTile(tiles[i]);
+        }
+    });
+}
+
+void HeightmapMesher::BuildTile(FTerrainTile& tile) const
+{
+    const int row = settings_.tileQuads + 1;
+    const int step = settings_.step;
+    tile.vertices.resize(GetVerticesPerTile() * FLOATS_PER_VERTEX);
+    tile.bounds.Clear();
+
+    ea::vector<float> left(row), right(row), down(row), up(row), normals(row * 3);
+    for (int j = 0; j < row; ++j)
+    {
+        // Vertices past the heightmap edge are clamped onto it and form degenerate triangles.
+        const int z = Min(tile.z + j * step, height_ - 1);
+        for (int i = 0; i < row; ++i)
+        {
+            const int x = Min(tile.x + i * step, width_ - 1);
+            left[i] = GetHeight(x - step, z);
+            right[i] = GetHeight(x + step, z);
+            down[i] = GetHeight(x, z - step);
+            up[i] = GetHeight(x, z + step);
+        }
+        ComputeNormals(left.data(), right.data(), down.data(), up.data(), normals.data(), row);
+
+        float* vertex = tile.vertices.data() + j * row * FLOATS_PER_VERTEX;
+        for (int i = 0; i < row; ++i, vertex += FLOATS_PER_VERTEX)
+        {
+            const int x = Min(tile.x + i * step, width_ - 1);
+            const Vector3 position(x * settings_.spacing, GetHeight(x, z), z * settings_.spacing);
+            vertex[0] = position.x_;
+            vertex[1] = position.y_;
+            vertex[2] = position.z_;
+            vertex[3] = normals[i * 3 + 0];
+            vertex[4] = normals[i * 3 + 1];
+            vertex[5] = normals[i * 3 + 2];
+            vertex[6] = (float)x / (float)(width_ - 1);
+            vertex[7] = (float)z / (float)(height_ - 1);
+            tile.bounds.Merge(position);
+        }
+    }
+
+    // Skirt rows copy the edge vertices in the order BuildLodIndices expects and only lower them.
+    const float* grid = tile.vertices.data();
+    float* skirt = tile.vertices.data() + row * row * FLOATS_PER_VERTEX;
+    for (int edge = 0; edge < 4; ++edge)
+    {
+        for (int k = 0; k < row; ++k, skirt += FLOATS_PER_VERTEX)
+        {
+            const int i = edge < 2 ? k : (edge == 2 ? 0 : row - 1);
+            const int j = edge < 2 ? (edge == 0 ? 0 : row - 1) : k;
+            memcpy(skirt, grid + (j * row + i) * FLOATS_PER_VERTEX, FLOATS_PER_VERTEX * sizeof(float));
+            skirt[1] -= settings_.skirtDepth;
+            tile.bounds.Merge(Vector3(skirt));
+        }
+    }
+}
+
+void HeightmapMesher::ComputeNormals(const float* left, const float* right, const float* down, const float* up, float* dest, unsigned count) const
+{
+    const float ny = 2.0f * settings_.step * settings_.spacing;
+    unsigned i = 0;
+#if defined(URHO3D_SSE)
+    const __m128 y = _mm_set1_ps(ny);
+    const __m128 yy = _mm_mul_ps(y, y);
+    const __m128 one = _mm_set1_ps(1.0f);
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128 x = _mm_sub_ps(_mm_loadu_ps(left + i), _mm_loadu_ps(right + i));
+        const __m128 z = _mm_sub_ps(_mm_loadu_ps(down + i), _mm_loadu_ps(up + i));
+        const __m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), yy), _mm_mul_ps(z, z));
+        const __m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSquared));
+
+        alignas(16) float xs[4];
+        alignas(16) float ys[4];
+        alignas(16) float zs[4];
+        _mm_store_ps(xs, _mm_mul_ps(x, invLength));
+        _mm_store_ps(ys, _mm_mul_ps(y, invLength));
+        _mm_store_ps(zs, _mm_mul_ps(z, invLength));
+        for (unsigned k = 0; k < 4; ++k)
+        {
+            dest[(i + k) * 3 + 0] = xs[k];
+            dest[(i + k) * 3 + 1] = ys[k];
+            dest[(i + k) * 3 + 2] = zs[k];
+        }
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        const Vector3 normal = Vector3(left[i] - right[i], ny, down[i] - up[i]).Normalized();
+        dest[i * 3 + 0] = normal.x_;
+        dest[i * 3 + 1] = normal.y_;
+        dest[i * 3 + 2] = normal.z_;
+    }
+}
+
+ea::vector<unsigned short> HeightmapMesher::BuildLodIndices(unsigned lod) const
+{
+    const unsigned row = settings_.tileQuads + 1;
+    const unsigned stride = 1u << lod;
+    const unsigned quads = settings_.tileQuads >> lod;
+
+    ea::vector<unsigned short> indices;
+    indices.reserve(quads * quads * 6 + quads * 4 * 12);
+    for (unsigned b = 0; b < quads; ++b)
+    {
+        for (unsigned a = 0; a < quads; ++a)
+        {
+            const unsigned x = a * stride;
+            const unsigned z = b * stride;
+            const auto v00 = (unsigned short)(z * row + x);
+            const auto v10 = (unsigned short)(z * row + x + stride);
+            const auto v01 = (unsigned short)((z + stride) * row + x);
+            const auto v11 = (unsigned short)((z + stride) * row + x + stride);
+            indices.push_back(v00);
+            indices.push_back(v01);
+            indices.push_back(v10);
+            indices.push_back(v10);
+            indices.push_back(v01);
+            indices.push_back(v11);
+        }
+    }
+
+    // Skirt quads along each edge at this LOD's stride. Both windings, a crack may be seen from either tile.
+    const unsigned skirtBase = row * row;
+    const auto gridVertex = [row](unsigned edge, unsigned k)
+    {
+        return edge < 2 ? (edge == 0 ? 0 : row - 1) * row + k : k * row + (edge == 2 ? 0 : row - 1);
+    };
+    for (unsigned edge = 0; edge < 4; ++edge)
+    {
+        for (unsigned a = 0; a < quads; ++a)
+        {
+            const auto e0 = (unsigned short)gridVertex(edge, a * stride);
+            const auto e1 = (unsigned short)gridVertex(edge, (a + 1) * stride);
+            const auto s0 = (unsigned short)(skirtBase + edge * row + a * stride);
+            const auto s1 = (unsigned short)(skirtBase + edge * row + (a + 1) * stride);
+            const unsigned short quad[12] = {e0, s0, e1, e1, s0, s1, e0, e1, s0, e1, s1, s0};
+            indices.insert(indices.end(), quad, quad + 12);
+        }
+    }
+    return indices;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <EASTL/vector.h>
+
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Graphics/GraphicsDefs.h>
+#include <Urho3D/Math/BoundingBox.h>
+#include <Urho3D/Resource/Image.h>
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+    struct FTerrainSettings
+    {
+        /// Heightmap texels between neighbour vertices.
+        int step{1};
+        /// Quads per tile side at LOD 0, (tileQuads + 1)^2 grid and 4 * (tileQuads + 1) skirt vertices must fit
+        /// 16-bit indices.
+        int tileQuads{64};
+        /// World distance between neighbour texels.
+        float spacing{1.0f};
+        float heightScale{30.0f};
+        /// Each LOD halves the vertex density of the previous one.
+        unsigned numLods{4};
+        float lodDistance{150.0f};
+        /// Depth the skirt below every tile edge hangs down, covering cracks where neighbour tiles use other LODs.
+        float skirtDepth{4.0f};
+    };
+
+    struct FTerrainTile
+    {
+        /// First heightmap texel of the tile.
+        int x{0};
+        int z{0};
+        /// Interleaved position, normal and uv.
+        ea::vector<float> vertices;
+        BoundingBox bounds;
+    };
+
+/// Builds tiled terrain geometry from a heightmap.
+/// Tiles have identical topology, so index buffers are built once per LOD and shared by every tile.
+/// Neighbour tiles at different LODs do not share edge vertices, so every tile carries a skirt: a copy of its edge
+/// vertices lowered by skirtDepth after the grid. Each LOD closes its edge strips down to the skirt, which hides the
+/// T-junction cracks without stitching index buffers per neighbour LOD combination.
+class HeightmapMesher
+{
+public:
+    HeightmapMesher(Image* heightmap, const FTerrainSettings& settings);
+
+    /// Convert heights and build vertex data of all tiles in parallel. Main thread only.
+    void BuildTiles(Context* context, ea::vector<FTerrainTile>& tiles);
+    /// Build triangle list for lod, referencing the LOD 0 vertex grid, followed by the skirt strips of lod.
+    ea::vector<unsigned short> BuildLodIndices(unsigned lod) const;
+
+    unsigned GetNumLods() const;
+    int GetNumTilesX() const { return tilesX_; }
+    int GetNumTilesZ() const { return tilesZ_; }
+    /// Grid vertices followed by four rows of skirt vertices: bottom, top, left and right edge.
+    unsigned GetVerticesPerTile() const { return (settings_.tileQuads + 1) * (settings_.tileQuads + 5); }
+    const FTerrainSettings& GetSettings() const { return settings_; }
+
+    static const ea::vector<VertexElement>& GetVertexElements();
+    static const unsigned FLOATS_PER_VERTEX = 8;
+
+private:
+    float GetHeight(int x, int z) const;
+    void BuildTile(FTerrainTile& tile) const;
+    /// Central difference normals for one row of the tile, four vertices at a time.
+    void ComputeNormals(const float* left, const float* right, const float* down, const float* up, float* dest, unsigned count) const;
+
+    SharedPtr<Image> heightmap_;
+    FTerrainSettings settings_;
+    int width_{0};
+    int height_{0};
+    int tilesX_{0};
+    int tilesZ_{0};
+    ea::vector<float> heights_;
+};
+
+}
@@ -0,0 +1,229 @@
+#include "InputRecorder.h"
+
+#include <Urho3D/Core/StringUtils.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/IO/MemoryBuffer.h>
+#include <Urho3D/IO/VectorBuffer.h>
+
+#include <EASTL/sort.h>
+
+using namespace Redi;
+
+namespace
+{
+    const unsigned INPUT_LOG_VERSION = 2;
+
+    /// Bits of the per-frame mask telling which fields follow the timestep.
+    enum EFrameFields : unsigned char
+    {
+        FF_CAMERA = 1,
+        FF_MOUSE = 2,
+        FF_FLAGS = 4,
+        FF_BUTTONS = 8,
+        FF_VIEW = 16
+    };
+}
+
+InputRecorder::InputRecorder(Context* context)
+    : context_(context)
+{
+}
+
+InputRecorder::~InputRecorder()
+{
+    StopRecording();
+}
+
+bool InputRecorder::StartRecording(const ea::string& fileName)
+{
+    StopRecording();
+    file_ = MakeShared<File>(context_, fileName, FILE_WRITE);
+    if (!file_->IsOpen())
+    {
+        URHO3D_LOGERROR("Failed to open input log {}", fileName);
+        file_ = nullptr;
+        return false;
+    }
+
+    file_->WriteFileID("RINP");
+    file_->WriteUInt(INPUT_LOG_VERSION);
+    // First frame always stores every field.
+    last_ = FFrameInput();
+    last_.cameraRotation = Quaternion(0.f, 0.f, 0.f, 0.f);
+    last_.mouse = Vector2(-1.f, -1.f);
+    last_.fov = -1.f;
+    numRecorded_ = 0;
+    return true;
+}
+
+void InputRecorder::Record(const FFrameInput& frame)
+{
+    if (!file_)
+    {
+        return;
+    }
+
+    unsigned char fields = 0;
+    if (frame.cameraPosition != last_.cameraPosition || frame.cameraRotation != last_.cameraRotation)
+        fields |= FF_CAMERA;
+    if (frame.mouse != last_.mouse)
+        fields |= FF_MOUSE;
+    if (frame.flags != last_.flags)
+        fields |= FF_FLAGS;
+    if (frame.mouseButtons != last_.mouseButtons)
+        fields |= FF_BUTTONS;
+    if (frame.fov != last_.fov || frame.aspectRatio != last_.aspectRatio)
+        fields |= FF_VIEW;
+
+    VectorBuffer data;
+    data.WriteUByte(fields);
+    data.WriteFloat(frame.timeStep);
+    if (fields & FF_CAMERA)
+    {
+        data.WriteVector3(frame.cameraPosition);
+        data.WriteQuaternion(frame.cameraRotation);
+    }
+    if (fields & FF_MOUSE)
+        data.WriteVector2(frame.mouse);
+    if (fields & FF_FLAGS)
+        data.WriteVLE(frame.flags);
+    if (fields & FF_BUTTONS)
+        data.WriteVLE(frame.mouseButtons);
+    if (fields & FF_VIEW)
+    {
+        data.WriteFloat(frame.fov);
+        data.WriteFloat(frame.aspectRatio);
+    }
+    file_->WriteUByte((unsigned char)data.GetSize());
+    file_->Write(data.GetData(), data.GetSize());
+
+    last_ = frame;
+    ++numRecorded_;
+}
+
+void InputRecorder::StopRecording()
+{
+    if (file_)
+    {
+        URHO3D_LOGINFO("Recorded {} frames to {}", numRecorded_, file_->GetName());
+        file_->Close();
+        file_ = nullptr;
+    }
+}
+
+bool InputRecorder::LoadReplay(const ea::string& fileName)
+{
+    File file(context_, fileName, FILE_READ);
+    if (!file.IsOpen() || file.ReadFileID() != "RINP" || file.ReadUInt() != INPUT_LOG_VERSION)
+    {
+        URHO3D_LOGERROR("Failed to load input log {}", fileName);
+        return false;
+    }
+
+    frames_.clear();
+    frameTimesMs_.clear();
+    FFrameInput frame;
+    unsigned char buffer[256];
+    while (!file.IsEof())
+    {
+        // A crash while recording can cut the last frame short, it is dropped with everything after it.
+        const unsigned size = file.ReadUByte();
+        if (size == 0 || file.GetSize() - file.GetPosition() < size)
+        {
+            URHO3D_LOGWARNING("Input log {} ends with an incomplete frame", fileName);
+            break;
+        }
+        file.Read(buffer, size);
+
+        MemoryBuffer data(buffer, size);
+        const unsigned char fields = data.ReadUByte();
+        frame.timeStep = data.ReadFloat();
+        if (fields & FF_CAMERA)
+        {
+            frame.cameraPosition = data.ReadVector3();
+            frame.cameraRotation = data.ReadQuaternion();
+        }
+        if (fields & FF_MOUSE)
+            frame.mouse = data.ReadVector2();
+        if (fields & FF_FLAGS)
+            frame.flags = data.ReadVLE();
+        if (fields & FF_BUTTONS)
+            frame.mouseButtons = data.ReadVLE();
+        if (fields & FF_VIEW)
+        {
+            frame.fov = data.ReadFloat();
+            frame.aspectRatio = data.ReadFloat();
+        }
+        if (data.GetPosition() != size)
+        {
+            URHO3D_LOGWARNING("Input log {} has a corrupt frame", fileName);
+            break;
+        }
+        frames_.push_back(frame);
+    }
+
+    frameTimesMs_.reserve(frames_.size());
+    position_ = 0;
+    replaying_ = true;
+    URHO3D_LOGINFO("Replaying {} frames from {}", frames_.size(), fileName);
+    return true;
+}
+
+bool InputRecorder::NextFrame(FFrameInput& frame)
+{
+    if (!replaying_ || position_ >= frames_.size())
+    {
+        return false;
+    }
+    frame = frames_[position_++];
+    return true;
+}
+
+bool InputRecorder::PeekTimeStep(float& timeStep) const
+{
+    if (!replaying_ || position_ >= frames_.size())
+    {
+        return false;
+    }
+    timeStep = frames_[position_].timeStep;
+    return true;
+}
+
+void InputRecorder::AddFrameTime(float timeMs)
+{
+    frameTimesMs_.push_back(timeMs);
+}
+
+bool InputRecorder::WriteReport(const ea::string& fileName) const
+{
+    File file(context_, fileName, FILE_WRITE);
+    if (!file.IsOpen())
+    {
+        return false;
+    }
+
+    file.WriteLine("frame;timestep;time_ms");
+    for (unsigned i = 0; i < frameTimesMs_.size(); ++i)
+    {
+        file.WriteLine(Format("{};{:.5f};{:.3f}", i, frames_[i].timeStep, frameTimesMs_[i]));
+    }
+    return true;
+}
+
+void InputRecorder::LogSummary() const
+{
+    if (frameTimesMs_.empty())
+    {
+        return;
+    }
+
+    ea::vector<float> sorted = frameTimesMs_;
+    ea::sort(sorted.begin(), sorted.end());
+    float total = 0.f;
+    for (float time : sorted)
+    {
+        total += time;
+    }
+    URHO3D_LOGINFO("Replay {} frames: avg {:.3f} ms, median {:.3f} ms, 95% {:.3f} ms, max {:.3f} ms", sorted.size(),
+        total / sorted.size(), sorted[sorted.size() / 2], sorted[sorted.size() * 95 / 100], sorted.back());
+}
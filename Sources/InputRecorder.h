@@ -0,0 +1,87 @@
+#pragma once
+#include <EASTL/string.h>
+#include <EASTL/vector.h>
+
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/Math/Quaternion.h>
+#include <Urho3D/Math/Vector2.h>
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+    enum EFrameInputFlags : unsigned
+    {
+        FI_NONE = 0,
+        /// KEY_E pressed this frame.
+        FI_EXTRUDE = 1,
+        /// Shift held, clicks add to the selection.
+        FI_SELECT_ADD = 2,
+        /// Alt held, clicks select a face ring.
+        FI_SELECT_RING = 4,
+        /// Ctrl held, clicks select an edge loop.
+        FI_SELECT_LOOP = 8,
+        /// KEY_ESCAPE pressed this frame, cancels an extrude drag.
+        FI_CANCEL = 16
+    };
+
+    /// Everything the editor reads from input during one frame.
+    struct FFrameInput
+    {
+        /// Engine timestep of the frame, replays drive the engine with it.
+        float timeStep{0.f};
+        Vector3 cameraPosition{Vector3::ZERO};
+        Quaternion cameraRotation{Quaternion::IDENTITY};
+        /// Vertical field of view and aspect ratio of the camera, screen rays of a replay need the recorded ones.
+        float fov{45.f};
+        float aspectRatio{1.f};
+        /// Mouse position normalized to the screen.
+        Vector2 mouse{0.5f, 0.5f};
+        unsigned flags{FI_NONE};
+        /// MouseButton bits pressed this frame.
+        unsigned mouseButtons{0};
+    };
+
+/// Records FFrameInput per frame to a binary log and plays it back.
+/// Each frame stores only the fields that changed since the previous one, prefixed by its size so a torn tail of
+/// a log cut off mid-frame is dropped instead of replayed as a frame.
+class InputRecorder
+{
+public:
+    explicit InputRecorder(Context* context);
+    ~InputRecorder();
+
+    bool StartRecording(const ea::string& fileName);
+    void Record(const FFrameInput& frame);
+    void StopRecording();
+    bool IsRecording() const { return file_ != nullptr; }
+
+    bool LoadReplay(const ea::string& fileName);
+    /// Get next recorded frame, false when the replay is finished.
+    bool NextFrame(FFrameInput& frame);
+    /// Timestep of the frame NextFrame returns next, false when the replay is finished.
+    bool PeekTimeStep(float& timeStep) const;
+    bool IsReplaying() const { return replaying_; }
+    /// Store time the editor spent on the current replayed frame.
+    void AddFrameTime(float timeMs);
+    /// Write per-frame timings as CSV.
+    bool WriteReport(const ea::string& fileName) const;
+    void LogSummary() const;
+
+    unsigned GetNumFrames() const { return frames_.size(); }
+
+private:
+    Context* context_;
+    SharedPtr<File> file_;
+    FFrameInput last_;
+    unsigned numRecorded_{0};
+
+    ea::vector<FFrameInput> frames_;
+    ea::vector<float> frameTimesMs_;
+    unsigned position_{0};
+    bool replaying_{false};
+};
+
+}
@@ -0,0 +1,114 @@
+#include "MemoryStats.h"
+
+#include <Urho3D/Core/StringUtils.h>
+
+using namespace Redi;
+using namespace Urho3D;
+
+namespace
+{
+    struct FMemoryCounter
+    {
+        std::atomic<long long> current{0};
+        std::atomic<long long> peak{0};
+        std::atomic<unsigned long long> allocated{0};
+        std::atomic<unsigned long long> numAllocations{0};
+    };
+
+    FMemoryCounter counters[MC_COUNT];
+
+    /// Main thread rate sampling.
+    unsigned long long lastAllocated[MC_COUNT] = {};
+    float rates[MC_COUNT] = {};
+    float sampleTime = 0.f;
+
+    const char* categoryNames[MC_COUNT] = {"mesh", "selection", "pick", "gpu", "debug", "autosave", "snap", "subdiv", "uv", "outliner", "ao"};
+
+    void UpdatePeak(FMemoryCounter& counter, long long current)
+    {
+        long long peak = counter.peak.load(std::memory_order_relaxed);
+        while (current > peak && !counter.peak.compare_exchange_weak(peak, current, std::memory_order_relaxed))
+        {
+        }
+    }
+}
+
+void MemoryStats::OnAllocate(EMemoryCategory category, size_t bytes)
+{
+    FMemoryCounter& counter = counters[category];
+    const long long current = counter.current.fetch_add(bytes, std::memory_order_relaxed) + (long long)bytes;
+    counter.allocated.fetch_add(bytes, std::memory_order_relaxed);
+    counter.numAllocations.fetch_add(1, std::memory_order_relaxed);
+    UpdatePeak(counter, current);
+}
+
+void MemoryStats::OnFree(EMemoryCategory category, size_t bytes)
+{
+    counters[category].current.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+void MemoryStats::SetUsage(EMemoryCategory category, size_t bytes)
+{
+    FMemoryCounter& counter = counters[category];
+    const long long previous = counter.current.exchange(bytes, std::memory_order_relaxed);
+    if ((long long)bytes > previous)
+    {
+        counter.allocated.fetch_add(bytes - previous, std::memory_order_relaxed);
+    }
+    UpdatePeak(counter, bytes);
+}
+
+void MemoryStats::Update(float timeStep)
+{
+    sampleTime += timeStep;
+    if (sampleTime < 1.0f)
+    {
+        return;
+    }
+
+    for (unsigned i = 0; i < MC_COUNT; ++i)
+    {
+        const unsigned long long allocated = counters[i].allocated.load(std::memory_order_relaxed);
+        rates[i] = (allocated - lastAllocated[i]) / sampleTime;
+        lastAllocated[i] = allocated;
+    }
+    sampleTime = 0.f;
+}
+
+long long MemoryStats::GetCurrent(EMemoryCategory category)
+{
+    return counters[category].current.load(std::memory_order_relaxed);
+}
+
+long long MemoryStats::GetPeak(EMemoryCategory category)
+{
+    return counters[category].peak.load(std::memory_order_relaxed);
+}
+
+unsigned long long MemoryStats::GetNumAllocations(EMemoryCategory category)
+{
+    return counters[category].numAllocations.load(std::memory_order_relaxed);
+}
+
+float MemoryStats::GetAllocationRate(EMemoryCategory category)
+{
+    return rates[category];
+}
+
+const char* MemoryStats::GetCategoryName(EMemoryCategory category)
+{
+    return category < MC_COUNT ? categoryNames[category] : "unknown";
+}
+
+ea::string MemoryStats::ToJSON()
+{
+    ea::string json = "{";
+    for (unsigned i = 0; i < MC_COUNT; ++i)
+    {
+        const auto category = (EMemoryCategory)i;
+        json += Format("{}\"{}\": {{\"current\": {}, \"peak\": {}, \"allocations\": {}, \"rate\": {:.0f}}}", i > 0 ? ", " : "",
+            GetCategoryName(category), GetCurrent(category), GetPeak(category), GetNumAllocations(category), GetAllocationRate(category));
+    }
+    json += "}";
+    return json;
+}
@@ -0,0 +1,138 @@
+#pragma once
+#include <EASTL/allocator.h>
+#include <EASTL/string.h>
+
+#include <atomic>
+
+namespace Redi
+{
+
+    enum EMemoryCategory : unsigned
+    {
+        /// Figure faces, per-face vertices and face lookup.
+        MC_MESH,
+        MC_SELECTION,
+        /// Face and top level BVHs of FigureRegistry with the boxes they are fitted to.
+        MC_PICK,
+        /// Vertex and index buffers of FigureGpuMesh.
+        MC_GPU,
+        /// Lines and triangles queued to the debug renderer.
+        MC_DEBUG,
+        /// Compressed chunk copies of the autosave worker.
+        MC_AUTOSAVE,
+        /// Vertex, edge and plane index of FigureSnap.
+        MC_SNAP,
+        /// Stencil tables and limit samples of FigureSubdivision.
+        MC_SUBDIV,
+        /// Charts, skyline and uvs of FigureUvAtlas.
+        MC_UV,
+        /// Row columns of FigureOutliner.
+        MC_OUTLINER,
+        /// Occlusion per corner and the scene copy with its BVH of FigureAoBaker.
+        MC_AO,
+        MC_COUNT
+    };
+
+/// Per-category memory counters: current and peak bytes, allocation count and allocated bytes per second.
+/// Containers count themselves through TrackedAllocator, memory owned elsewhere is reported with SetUsage.
+/// Counters are atomic and may be updated from any thread.
+class MemoryStats
+{
+public:
+    static void OnAllocate(EMemoryCategory category, size_t bytes);
+    static void OnFree(EMemoryCategory category, size_t bytes);
+    /// Replace current usage of a category whose memory is not allocated through TrackedAllocator.
+    static void SetUsage(EMemoryCategory category, size_t bytes);
+    /// Sample allocation rates once per second. Main thread, once per frame.
+    static void Update(float timeStep);
+
+    static long long GetCurrent(EMemoryCategory category);
+    static long long GetPeak(EMemoryCategory category);
+    static unsigned long long GetNumAllocations(EMemoryCategory category);
+    /// Bytes allocated per second over the last sample.
+    static float GetAllocationRate(EMemoryCategory category);
+    static const char* GetCategoryName(EMemoryCategory category);
+
+    /// All counters as JSON object keyed by category name.
+    static ea::string ToJSON();
+};
+
+/// EASTL allocator forwarding to the default one and counting bytes in MemoryStats under Category.
+template <EMemoryCategory Category>
+class TrackedAllocator
+{
+public:
+    explicit TrackedAllocator(const char* name = nullptr) { (void)name; }
+    TrackedAllocator(const TrackedAllocator&) = default;
+    TrackedAllocator(const TrackedAllocator&, const char*) {}
+    TrackedAllocator& operator=(const TrackedAllocator&) = default;
+
+    void* allocate(size_t n, int flags = 0)
+    {
+        MemoryStats::OnAllocate(Category, n);
+        return EASTLAllocatorType().allocate(n, flags);
+    }
+
+    void* allocate(size_t n, size_t alignment, size_t offset, int flags = 0)
+    {
+        MemoryStats::OnAllocate(Category, n);
+        return EASTLAllocatorType().allocate(n, alignment, offset, flags);
+    }
+
+    void deallocate(void* p, size_t n)
+    {
+        MemoryStats::OnFree(Category, n);
+        EASTLAllocatorType().deallocate(p, n);
+    }
+
+    const char* get_name() const { return MemoryStats::GetCategoryName(Category); }
+    void set_name(const char*) {}
+};
+
+template <EMemoryCategory Category>
+inline bool operator==(const TrackedAllocator<Category>&, const TrackedAllocator<Category>&) { return true; }
+
+template <EMemoryCategory Category>
+inline bool operator!=(const TrackedAllocator<Category>&, const TrackedAllocator<Category>&) { return false; }
+
+/// TrackedAllocator with the category chosen at run time, for containers of classes used by several categories
+/// like Bvh. Default constructed ones count under MC_PICK.
+class CategoryAllocator
+{
+public:
+    explicit CategoryAllocator(const char* name = nullptr) { (void)name; }
+    explicit CategoryAllocator(EMemoryCategory category) : category_(category) {}
+    CategoryAllocator(const CategoryAllocator&) = default;
+    CategoryAllocator(const CategoryAllocator& other, const char*) : category_(other.category_) {}
+    CategoryAllocator& operator=(const CategoryAllocator&) = default;
+
+    void* allocate(size_t n, int flags = 0)
+    {
+        MemoryStats::OnAllocate(category_, n);
+        return EASTLAllocatorType().allocate(n, flags);
+    }
+
+    void* allocate(size_t n, size_t alignment, size_t offset, int flags = 0)
+    {
+        MemoryStats::OnAllocate(category_, n);
+        return EASTLAllocatorType().allocate(n, alignment, offset, flags);
+    }
+
+    void deallocate(void* p, size_t n)
+    {
+        MemoryStats::OnFree(category_, n);
+        EASTLAllocatorType().deallocate(p, n);
+    }
+
+    EMemoryCategory GetCategory() const { return category_; }
+    const char* get_name() const { return MemoryStats::GetCategoryName(category_); }
+    void set_name(const char*) {}
+
+private:
+    EMemoryCategory category_{MC_PICK};
+};
+
+inline bool operator==(const CategoryAllocator& a, const CategoryAllocator& b) { return a.GetCategory() == b.GetCategory(); }
+inline bool operator!=(const CategoryAllocator& a, const CategoryAllocator& b) { return a.GetCategory() != b.GetCategory(); }
+
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include <EASTL/unique_ptr.h>
+
+#include <atomic>
+
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Core/Mutex.h>
+#include <Urho3D/Core/WorkQueue.h>
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+    /// Priority of short jobs the main thread waits for. Background jobs use priority 0 and are not waited for.
+    static const unsigned JOB_PRIORITY_PARALLEL = 0x10000;
+    /// Priority of FrameGraph worker tasks. Below JOB_PRIORITY_PARALLEL, so a ParallelFor of a main thread task neither
+    /// waits for them nor runs them, and workers finish its ranges first.
+    static const unsigned JOB_PRIORITY_FRAME = 0x8000;
+
+    /// Split [0, count) into ranges of at most grain items and run fn(begin, end) on worker threads.
+    /// Blocks until all ranges are done, the main thread takes ranges as well. Call from the main thread only.
+    template <class F>
+    void ParallelFor(Context* context, unsigned count, unsigned grain, const F& fn)
+    {
+        auto* queue = context->GetSubsystem<WorkQueue>();
+        grain = grain > 0 ? grain : 1;
+        if (!queue || queue->GetNumThreads() == 0 || count <= grain)
+        {
+            if (count > 0)
+            {
+                fn(0u, count);
+            }
+            return;
+        }
+
+        for (unsigned begin = 0; begin < count; begin += grain)
+        {
+            const unsigned end = begin + grain < count ? begin + grain : count;
+            queue->AddWorkItem([&fn, begin, end](unsigned) { fn(begin, end); }, JOB_PRIORITY_PARALLEL);
+        }
+        queue->Complete(JOB_PRIORITY_PARALLEL);
+    }
+
+    /// Tasks [0, count) split into one contiguous range per worker. A worker takes tasks from the front of its own
+    /// range and, when it runs dry, steals the back half of the largest other range. Neighbouring tasks stay on one
+    /// thread, which keeps their data in its cache, and no thread idles while another has a backlog.
+    class TaskRanges
+    {
+    public:
+        void Reset(unsigned count, unsigned numWorkers)
+        {
+            numWorkers_ = numWorkers > 0 ? numWorkers : 1;
+            ranges_ = ea::make_unique<FRange[]>(numWorkers_);
+            for (unsigned i = 0; i < numWorkers_; ++i)
+            {
+                ranges_[i].begin = (unsigned)((unsigned long long)count * i / numWorkers_);
+                ranges_[i].end = (unsigned)((unsigned long long)count * (i + 1) / numWorkers_);
+            }
+        }
+
+        /// Next task of worker, false when every range is empty. Any thread, one worker index per thread.
+        bool Pop(unsigned worker, unsigned& task)
+        {
+            FRange& own = ranges_[worker];
+            {
+                MutexLock lock(own.mutex);
+                if (own.begin < own.end)
+                {
+                    task = own.begin++;
+                    return true;
+                }
+            }
+
+            while (true)
+            {
+                // Sizes read without locks only choose the victim, the steal itself is checked under its lock.
+                unsigned victim = worker;
+                unsigned largest = 0;
+                for (unsigned i = 0; i < numWorkers_; ++i)
+                {
+                    const unsigned rangeBegin = ranges_[i].begin;
+                    const unsigned rangeEnd = ranges_[i].end;
+                    const unsigned size = rangeEnd > rangeBegin ? rangeEnd - rangeBegin : 0;
+                    if (i != worker && size > largest)
+                    {
+                        largest = size;
+                        victim = i;
+                    }
+                }
+                if (victim == worker)
+                {
+                    return false;
+                }
+
+                unsigned begin, end;
+                {
+                    MutexLock lock(ranges_[victim].mutex);
+                    FRange& range = ranges_[victim];
+                    if (range.begin >= range.end)
+                    {
+                        continue;
+                    }
+                    end = range.end;
+                    begin = range.begin + (end - range.begin) / 2;
+                    range.end = begin;
+                }
+
+                MutexLock lock(own.mutex);
+                own.begin = begin + 1;
+                own.end = end;
+                task = begin;
+                return true;
+            }
+        }
+
+        unsigned GetNumWorkers() const { return numWorkers_; }
+
+    private:
+        struct FRange
+        {
+            Mutex mutex;
+            /// Written under the mutex, atomic so victims can be sized without it.
+            std::atomic<unsigned> begin{0};
+            std::atomic<unsigned> end{0};
+        };
+
+        ea::unique_ptr<FRange[]> ranges_;
+        unsigned numWorkers_{0};
+    };
+
+}
@@ -1,7 +1,9 @@
 #include "REApplication.h"
 
 #include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/Core/ProcessUtils.h>
 #include <Urho3D/Engine/EngineDefs.h>
+#include <Urho3D/Engine/EngineEvents.h>
 #include <Urho3D/Engine/Application.h>
 #include <Urho3D/Graphics/Octree.h>
 #include <Urho3D/Graphics/Renderer.h>
@@ -16,29 +18,72 @@
 #include <Urho3D/Graphics/IndexBuffer.h>
 #include <Urho3D/Graphics/VertexBuffer.h>
 #include <Urho3D/Graphics/Geometry.h>
+#include <Urho3D/Graphics/Graphics.h>
 #include <Urho3D/Graphics/DebugRenderer.h>
 #include <Urho3D/UI/UI.h>
+#include <Urho3D/IO/File.h>
 #include <Urho3D/IO/FileSystem.h>
 #include "PugiXml/pugixml.hpp"
 #include <Urho3D/Math/MathDefs.h>
+#include <Urho3D/Math/Plane.h>
+#include <Urho3D/Math/Sphere.h>
 #include <Urho3D/Graphics/ModelView.h>
+#include <Urho3D/Graphics/Texture2D.h>
+#include <Urho3D/Core/Timer.h>
+
+#include "FigureExporter.h"
+#include "FigureGenerator.h"
+#include "FigureGpuMesh.h"
+#include "HeightmapMesher.h"
 
 REApplication::REApplication(Urho3D::Context* context)
     : Application(context),
+    sceneImporter_(context),
+    inputRecorder_(context),
     yaw_(0.0f),
-    pitch_(0.0f)
+    pitch_(0.0f),
+    outliner_(context),
+    aoBaker_(context),
+    uvAtlas_(context),
+    materialArray_(context),
+    subdivision_(context),
+    frameGraph_(context)
 {
 }
 
 void REApplication::Setup()
 {
+    // -batch <script> [-batch-report <file.csv>] runs Figure operations without window and exits.
+    // -record <file> saves editor input of the session, -replay <file> [-replay-report <file.csv>] plays it back and exits,
+    // add -headless to replay without window. -events <pick,edit,input,io|all> writes those events to Events.log.
+    const ea::vector<ea::string>& arguments = GetArguments();
+    for (unsigned i = 0; i + 1 < arguments.size(); ++i)
+    {
+        if (arguments[i] == "-batch")
+            batchScript_ = arguments[i + 1];
+        else if (arguments[i] == "-batch-report")
+            batchReport_ = arguments[i + 1];
+        else if (arguments[i] == "-record")
+            recordFile_ = arguments[i + 1];
+        else if (arguments[i] == "-replay")
+            replayFile_ = arguments[i + 1];
+        else if (arguments[i] == "-replay-report")
+            replayReport_ = arguments[i + 1];
+        else if (arguments[i] == "-events")
+            eventCategories_ = arguments[i + 1];
+    }
+    const bool headless = !batchScript_.empty() || (engineParameters_.contains(Urho3D::EP_HEADLESS) && engineParameters_[Urho3D::EP_HEADLESS].GetBool());
+
     engineParameters_[Urho3D::EP_WINDOW_TITLE] = "REditor";
     //engineParameters_[Urho3D::EP_LOG_NAME]     = GetSubsystem<Urho3D::FileSystem>()->GetAppPreferencesDir("rbfx", "samples") + GetTypeName() + ".log";
     engineParameters_[Urho3D::EP_FULL_SCREEN]  = false;
-    engineParameters_[Urho3D::EP_HEADLESS]     = false;
-    engineParameters_[Urho3D::EP_SOUND]        = true;
+    engineParameters_[Urho3D::EP_HEADLESS]     = headless;
+    engineParameters_[Urho3D::EP_SOUND]        = !headless;
     engineParameters_[Urho3D::EP_HIGH_DPI]     = false;
-    engineParameters_[Urho3D::EP_RESOURCE_PATHS] = "CoreData;Data";
+    engineParameters_[Urho3D::EP_RESOURCE_PATHS] = "CoreData;Data;EditorData";
+    // Replay runs as fast as possible, frames use recorded timesteps.
+    if (!replayFile_.empty())
+        engineParameters_[Urho3D::EP_FRAME_LIMITER] = false;
 
     if (!engineParameters_.contains(Urho3D::EP_RESOURCE_PREFIX_PATHS))
         engineParameters_[Urho3D::EP_RESOURCE_PREFIX_PATHS] = ";..;../..";
@@ -46,9 +91,32 @@ void REApplication::Setup()
 
 void REApplication::Start()
 {
-    CreateConsoleAndDebugHud();
+    if (!batchScript_.empty())
+    {
+        RunBatch();
+        return;
+    }
+
+    if (!eventCategories_.empty())
+    {
+        for (const ea::string& name : eventCategories_.split(','))
+        {
+            for (unsigned i = 0; i < Redi::EC_COUNT; ++i)
+            {
+                if (name == "all" || Redi::EventLog::ParseCategory(name) == i)
+                    Redi::EventLog::SetEnabled((Redi::EEventCategory)i, true);
+            }
+        }
+        Redi::EventLog::Start(context_, GetSubsystem<FileSystem>()->GetAppPreferencesDir("REditor", "Logs") + "Events.log");
+    }
 
+    // Request editor resources first so they load in the background while the rest of the editor is set up.
     LoadResorces();
+
+    if (GetSubsystem<Graphics>())
+        CreateConsoleAndDebugHud();
+
+    ReadFile("EditorStrings.json");
     
     // Create scene providing a colored background.
     CreateScene();
@@ -62,6 +130,49 @@ void REApplication::Start()
 
     CreateFigureBox();
 
+    if (!replayFile_.empty())
+    {
+        if (inputRecorder_.LoadReplay(replayFile_))
+        {
+            // Camera follows the recording, including the view of the recording window whatever the size of this one.
+            cameraNode_->GetComponent<FreeFlyController>()->SetEnabled(false);
+            cameraNode_->GetComponent<Camera>()->SetAutoAspectRatio(false);
+            // The engine runs every frame with its recorded timestep, so everything reading the frame time replays alike.
+            SubscribeToEvent(E_ENDFRAME, URHO3D_HANDLER(REApplication, HandleReplayEndFrame));
+            float timeStep;
+            if (inputRecorder_.PeekTimeStep(timeStep))
+                engine_->SetNextTimeStep(timeStep);
+        }
+        else
+        {
+            exitCode_ = EXIT_FAILURE;
+            engine_->Exit();
+            return;
+        }
+    }
+    else
+    {
+        if (!recordFile_.empty())
+        {
+            inputRecorder_.StartRecording(recordFile_);
+        }
+
+        // Replays stay deterministic, so only interactive sessions recover and autosave. A journal left on disk means
+        // the last session did not exit cleanly.
+        auto* fileSystem = GetSubsystem<FileSystem>();
+        autoSave_ = ea::make_unique<Redi::AutoSave>(context_, fileSystem->GetAppPreferencesDir("REditor", "AutoSave") + "Figure.rjnl");
+        if (fileSystem->FileExists(autoSave_->GetFileName()))
+        {
+            autoSave_->Recover(*figure_mesh_);
+            materialArray_.Reserve(*figure_mesh_);
+        }
+    }
+
+    if (!GetSubsystem<Graphics>())
+    {
+        return;
+    }
+
     // Set the mouse mode to use in the sample
     InitMouseMode(Urho3D::MM_RELATIVE);
 
@@ -70,84 +181,31 @@ void REApplication::Start()
     GetSubsystem<Console>()->RefreshInterpreters();
 }
 
-void REApplication::CreateFaceDirection(Redi::EFaceDirection eDirection, const Vector3& Position)
+void REApplication::RunBatch()
 {
-    switch (eDirection)
-    {
-    default:
-        break;
-    case Redi::FD_FORWARD:
-        //forward
-    {
-        Redi::FVertex v1{ Position + Vector3(0.5f,-0.5f,-0.5f), Vector3(0,0,1), Vector2(1,1) };
-        Redi::FVertex v2{ Position + Vector3(0.5f,0.5f,-0.5f), Vector3(0,0,1), Vector2(1,0) };
-        Redi::FVertex v3{ Position + Vector3(-0.5f,0.5f,-0.5f), Vector3(0,0,1), Vector2(0,0) };
-        Redi::FVertex v4{ Position + Vector3(-0.5f,-0.5f,-0.5f), Vector3(0,0,1), Vector2(0,1) };
-        figure_mesh_->AddFace(v1, v2, v3, v4);
-    }
-    break;
-    case Redi::FD_BACK:
-        //backward
+    Redi::BatchRunner runner(context_);
+    const bool success = runner.Run(batchScript_);
+    if (!batchReport_.empty() && !runner.WriteReport(batchReport_))
     {
-        Redi::FVertex v1{ Position + Vector3(-0.5f,-0.5f,0.5f), Vector3(0,0,-1), Vector2(0,1) };
-        Redi::FVertex v2{ Position + Vector3(-0.5f,0.5f,0.5f), Vector3(0,0,-1), Vector2(0,0) };
-        Redi::FVertex v3{ Position + Vector3(0.5f,0.5f,0.5f), Vector3(0,0,-1), Vector2(1,0) };
-        Redi::FVertex v4{ Position + Vector3(0.5f,-0.5f,0.5f), Vector3(0,0,-1), Vector2(1,1) };
-        figure_mesh_->AddFace(v1, v2, v3, v4);
-    }
-    break;
-    case Redi::FD_LEFT:
-        //left
-    {
-        Redi::FVertex v1{ Position + Vector3(-0.5f,-0.5f,0.5f), Vector3(-1,0,0), Vector2(0,1) };
-        Redi::FVertex v2{ Position + Vector3(-0.5f,0.5f,0.5f), Vector3(-1,0,0), Vector2(0,0) };
-        Redi::FVertex v3{ Position + Vector3(-0.5f,0.5f,-0.5f), Vector3(-1,0,0), Vector2(1,0) };
-        Redi::FVertex v4{ Position + Vector3(-0.5f,-0.5f,-0.5f), Vector3(-1,0,0), Vector2(1,1) };
-        figure_mesh_->AddFace(v1, v2, v3, v4);
-    }
-    break;
-    case Redi::FD_RIGHT:
-        //right
-    {
-        Redi::FVertex v1{ Position + Vector3(0.5f,-0.5f,-0.5f), Vector3(1,0,0), Vector2(1,1) };
-        Redi::FVertex v2{ Position + Vector3(0.5f,0.5f,-0.5f), Vector3(1,0,0), Vector2(1,0) };
-        Redi::FVertex v3{ Position + Vector3(0.5f,0.5f,0.5f), Vector3(1,0,0), Vector2(0,0) };
-        Redi::FVertex v4{ Position + Vector3(0.5f,-0.5f,0.5f), Vector3(1,0,0), Vector2(0,1) };
-        figure_mesh_->AddFace(v1, v2, v3, v4);
-    }
-    break;
-    case Redi::FD_UP:
-        //top
-    {
-        Redi::FVertex v1{ Position + Vector3(-0.5f,+0.5f,-0.5f), Vector3(0,1,0), Vector2(0,1) };
-        Redi::FVertex v2{ Position + Vector3(-0.5f,+0.5f,0.5f), Vector3(0,1,0), Vector2(0,0) };
-        Redi::FVertex v3{ Position + Vector3(0.5f,+0.5f,0.5f), Vector3(0,1,0), Vector2(1,0) };
-        Redi::FVertex v4{ Position + Vector3(0.5f,+0.5f,-0.5f), Vector3(0,1,0), Vector2(1,1) };
-        figure_mesh_->AddFace(v1, v2, v3, v4);
-    }
-    break;
-    case Redi::FD_DOWN:
-        //bottom
-    {
-        Redi::FVertex v1{ Position + Vector3(0.5f,-0.5f,-0.5f), Vector3(0,-1,0), Vector2(1,1) };
-        Redi::FVertex v2{ Position + Vector3(0.5f,-0.5f,0.5f), Vector3(0,-1,0), Vector2(1,0) };
-        Redi::FVertex v3{ Position + Vector3(-0.5f,-0.5f,0.5f), Vector3(0,-1,0), Vector2(0,0) };
-        Redi::FVertex v4{ Position + Vector3(-0.5f,-0.5f,-0.5f), Vector3(0,-1,0), Vector2(0,1) };
-        figure_mesh_->AddFace(v1, v2, v3, v4);
-    }
-    break;
+        URHO3D_LOGERROR("Failed to write batch report {}", batchReport_);
     }
+
+    exitCode_ = success ? EXIT_SUCCESS : EXIT_FAILURE;
+    engine_->Exit();
 }
 
 void REApplication::CreateFigureBox()
 {
     figure_mesh_ = new Redi::Figure(Redi::EFigureType::FT_QUAD);
-    CreateFaceDirection(Redi::EFaceDirection::FD_FORWARD, Vector3(0.5f, 0.5f, 0.5f));
-    CreateFaceDirection(Redi::EFaceDirection::FD_BACK, Vector3(0.5f, 0.5f, 0.5f));
-    CreateFaceDirection(Redi::EFaceDirection::FD_LEFT, Vector3(0.5f, 0.5f, 0.5f));
-    CreateFaceDirection(Redi::EFaceDirection::FD_RIGHT, Vector3(0.5f, 0.5f, 0.5f));
-    CreateFaceDirection(Redi::EFaceDirection::FD_UP, Vector3(0.5f, 0.5f, 0.5f));
-    CreateFaceDirection(Redi::EFaceDirection::FD_DOWN, Vector3(0.5f, 0.5f, 0.5f));
+    figure_mesh_->AddBox(Vector3(0.5f, 0.5f, 0.5f));
+    figureRegistry_.AddFigure(figure_mesh_);
+
+    // Without GPU or packed shader support the figure is only drawn by the debug renderer.
+    if (Redi::FigureGpuMesh::IsSupported(context_))
+    {
+        figureGpuMesh_ = ea::make_unique<Redi::FigureGpuMesh>(context_, scene_, figure_mesh_, figureMaterial_);
+        figureGpuMesh_->SetOcclusion(&aoBaker_);
+    }
 }
 
 void REApplication::CreateConsoleAndDebugHud()
@@ -161,6 +219,14 @@ void REApplication::CreateConsoleAndDebugHud()
 
 void REApplication::Stop()
 {
+    Redi::EventLog::Stop();
+    inputRecorder_.StopRecording();
+    // The journal is only for crashes, a clean exit removes it so the next start does not replay this session.
+    if (autoSave_)
+    {
+        autoSave_->Discard();
+    }
+
     // Only necessary so sample can be reopened. Under normal circumnstances applications do not need to do this.
     //context_->RemoveFactory<SimpleWindow>();
 }
@@ -170,24 +236,221 @@ void REApplication::SubscribeToEvents()
     SubscribeToEvent(E_KEYDOWN, URHO3D_HANDLER(REApplication, HandleKeyDown));
     SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(REApplication, OnUpdate));
     SubscribeToEvent(E_MOUSEBUTTONDOWN, URHO3D_HANDLER(REApplication, HandleMouseModeRequest));
+    SubscribeToEvent(E_CONSOLECOMMAND, URHO3D_HANDLER(REApplication, HandleConsoleCommand));
 
     // Subscribe HandlePostRenderUpdate() function for processing the post-render update event, during which we request
     // debug geometry
     SubscribeToEvent(E_POSTRENDERUPDATE, URHO3D_HANDLER(REApplication, HandlePostRenderUpdate));
 }
 
+void REApplication::CreateVertexBufferFromFloatArray(int step, Texture2D* Displacement, int w, int h)
+{
+    SharedPtr<Image> heightmap = Displacement ? Displacement->GetImage() : SharedPtr<Image>();
+    if (!heightmap)
+    {
+        URHO3D_LOGWARNING("Terrain displacement texture is not readable");
+        return;
+    }
+    if (w > 0 && h > 0 && (heightmap->GetWidth() != w || heightmap->GetHeight() != h))
+    {
+        heightmap->Resize(w, h);
+    }
+
+    HiresTimer timer;
+    Redi::FTerrainSettings settings;
+    settings.step = step;
+    Redi::HeightmapMesher mesher(heightmap, settings);
+    ea::vector<Redi::FTerrainTile> tiles;
+    mesher.BuildTiles(context_, tiles);
+    const long long buildUSec = timer.GetUSec(true);
+
+    // Every tile has the same topology, one index buffer per LOD serves all of them.
+    ea::vector<SharedPtr<IndexBuffer>> indexBuffers;
+    for (unsigned lod = 0; lod < mesher.GetNumLods(); ++lod)
+    {
+        const ea::vector<unsigned short> indices = mesher.BuildLodIndices(lod);
+        auto indexBuffer = MakeShared<IndexBuffer>(context_);
+        indexBuffer->SetShadowed(true);
+        indexBuffer->SetSize(indices.size(), false);
+        indexBuffer->SetData(indices.data());
+        indexBuffers.push_back(indexBuffer);
+    }
+
+    if (terrainNode_)
+    {
+        terrainNode_->Remove();
+    }
+    terrainNode_ = scene_->CreateChild("Terrain");
+
+    const unsigned vertexCount = mesher.GetVerticesPerTile();
+    for (Redi::FTerrainTile& tile : tiles)
+    {
+        auto vertexBuffer = MakeShared<VertexBuffer>(context_);
+        vertexBuffer->SetShadowed(true);
+        vertexBuffer->SetSize(vertexCount, Redi::HeightmapMesher::GetVertexElements());
+        vertexBuffer->SetData(tile.vertices.data());
+        tile.vertices = {};
+
+        Node* tileNode = terrainNode_->CreateChild("TerrainTile");
+        auto* staticModel = tileNode->CreateComponent<StaticModel>();
+        staticModel->SetModel(CreateModel(vertexBuffer, indexBuffers, tile.bounds, vertexCount, mesher.GetSettings().lodDistance));
+        staticModel->SetMaterial(GetLoadedMaterial(1));
+    }
+
+    URHO3D_LOGINFO("Terrain {}x{}: {} tiles, {} LODs, built in {:.2f} ms, uploaded in {:.2f} ms", heightmap->GetWidth(), heightmap->GetHeight(),
+        tiles.size(), indexBuffers.size(), buildUSec / 1000.0f, timer.GetUSec(false) / 1000.0f);
+}
+
+SharedPtr<Model> REApplication::CreateModel(const SharedPtr<VertexBuffer>& vertex_buffer, const ea::vector<SharedPtr<IndexBuffer>>& index_buffers, const BoundingBox& bounds, int vertexCount, float lodDistance)
+{
+    auto model = MakeShared<Model>(context_);
+    model->SetNumGeometries(1);
+    model->SetNumGeometryLodLevels(0, index_buffers.size());
+    for (unsigned lod = 0; lod < index_buffers.size(); ++lod)
+    {
+        auto geometry = MakeShared<Geometry>(context_);
+        geometry->SetVertexBuffer(0, vertex_buffer);
+        geometry->SetIndexBuffer(index_buffers[lod]);
+        geometry->SetDrawRange(TRIANGLE_LIST, 0, index_buffers[lod]->GetIndexCount(), 0, vertexCount);
+        geometry->SetLodDistance(lod * lodDistance);
+        model->SetGeometry(0, lod, geometry);
+    }
+    model->SetVertexBuffers({vertex_buffer}, {}, {});
+    model->SetIndexBuffers(index_buffers);
+    model->SetBoundingBox(bounds);
+    return model;
+}
+
 void REApplication::LoadResorces()
 {
-    auto* cache_ = GetSubsystem<ResourceCache>();
-    ballTexture_ = cache_->GetResource<Texture2D>("Urho2D/Ball.png");
+    materials_.clear();
+    materials_.resize(2);
+    if (GetSubsystem<Graphics>())
+    {
+        placeholderModel_ = CreatePlaceholderBox();
+    }
+
+    // Preload manifest. Nodes are created with placeholders and pick the resources up when they arrive.
+    preloader_ = MakeShared<Redi::ResourcePreloader>(context_);
+    preloader_->Add<Texture2D>("Urho2D/Ball.png", [this](Texture2D* texture) { ballTexture_ = texture; });
+    preloader_->Add<Model>("Models/Box.mdl", [this](Model* model)
+    {
+        boxModel_ = model;
+        ApplyLoadedResources();
+    });
+    preloader_->Add<Material>("Materials/GreenTransparent.xml", [this](Material* material)
+    {
+        materials_[0] = material;
+        ApplyLoadedResources();
+    });
+    preloader_->Add<Material>("Materials/DefaultWhite.xml", [this](Material* material)
+    {
+        materials_[1] = material;
+        ApplyLoadedResources();
+    });
+    preloader_->Add<Material>("Materials/FigurePacked.xml", [this](Material* material)
+    {
+        figureMaterial_ = material;
+        materialArray_.Apply(material);
+        ApplyLoadedResources();
+    });
+    preloader_->Add<Material>("Materials/FigureSubdivision.xml", [this](Material* material)
+    {
+        subdivisionMaterial_ = material;
+        ApplyLoadedResources();
+    });
+    preloader_->Start();
 }
 
-void REApplication::CreateScene()
+void REApplication::ApplyLoadedResources()
 {
-    ui::GetIO().ConfigFlags |= ImGuiConfigFlags_DockingEnable | ImGuiConfigFlags_NavEnableKeyboard;
-    ui::GetIO().BackendFlags |= ImGuiBackendFlags_HasMouseCursors;
+    Model* boxModel = boxModel_ ? boxModel_ : placeholderModel_.Get();
+    if (boxNode_)
+    {
+        auto* staticModel = boxNode_->GetComponent<StaticModel>();
+        staticModel->SetModel(boxModel);
+        staticModel->SetMaterial(GetLoadedMaterial(1));
+    }
+
+    // Same materials as RepaintFace, so an arrival keeps the selected corners highlighted.
+    for (unsigned i = 0; i < cubes.size(); ++i)
+    {
+        auto* staticModel = cubes[i]->GetComponent<StaticModel>();
+        staticModel->SetModel(boxModel);
+        staticModel->SetMaterial(GetLoadedMaterial(selected_vertex.contains(i) ? 1 : 0));
+    }
 
-    auto* cache_ = GetSubsystem<ResourceCache>();
+    if (terrainNode_)
+    {
+        for (Node* tileNode : terrainNode_->GetChildren())
+        {
+            tileNode->GetComponent<StaticModel>()->SetMaterial(GetLoadedMaterial(1));
+        }
+    }
+
+    if (figureGpuMesh_)
+    {
+        figureGpuMesh_->SetMaterial(figureMaterial_);
+    }
+    if (subdivisionMesh_)
+    {
+        subdivisionMesh_->SetMaterial(subdivisionMaterial_);
+    }
+}
+
+SharedPtr<Model> REApplication::CreatePlaceholderBox()
+{
+    // Four corners per side with the side normal, position and normal as floats.
+    ea::vector<float> vertices;
+    ea::vector<unsigned short> indices;
+    for (unsigned side = 0; side < 6; ++side)
+    {
+        const unsigned axis = side / 2;
+        const float sign = side % 2 ? 1.0f : -1.0f;
+        float n[3] = {}, du[3] = {}, dv[3] = {};
+        n[axis] = sign;
+        du[(axis + 1) % 3] = 0.5f;
+        dv[(axis + 2) % 3] = 0.5f * sign;
+        const Vector3 normal(n), u(du), v(dv);
+        const auto first = (unsigned short)(vertices.size() / 6);
+        const Vector3 corners[4] = {normal * 0.5f - u - v, normal * 0.5f + u - v, normal * 0.5f + u + v, normal * 0.5f - u + v};
+        for (const Vector3& corner : corners)
+        {
+            vertices.insert(vertices.end(), {corner.x_, corner.y_, corner.z_, normal.x_, normal.y_, normal.z_});
+        }
+        const unsigned short quad[6] = {first, (unsigned short)(first + 2), (unsigned short)(first + 1), first,
+            (unsigned short)(first + 3), (unsigned short)(first + 2)};
+        indices.insert(indices.end(), quad, quad + 6);
+    }
+
+    auto vertexBuffer = MakeShared<VertexBuffer>(context_);
+    vertexBuffer->SetShadowed(true);
+    vertexBuffer->SetSize(vertices.size() / 6, {VertexElement(TYPE_VECTOR3, SEM_POSITION), VertexElement(TYPE_VECTOR3, SEM_NORMAL)});
+    vertexBuffer->SetData(vertices.data());
+    auto indexBuffer = MakeShared<IndexBuffer>(context_);
+    indexBuffer->SetShadowed(true);
+    indexBuffer->SetSize(indices.size(), false);
+    indexBuffer->SetData(indices.data());
+    return CreateModel(vertexBuffer, {indexBuffer}, BoundingBox(-0.5f, 0.5f), vertices.size() / 6, 0.f);
+}
+
+Material* REApplication::GetLoadedMaterial(unsigned index) const
+{
+    if (index < materials_.size() && materials_[index])
+    {
+        return materials_[index];
+    }
+    auto* renderer = GetSubsystem<Renderer>();
+    return renderer ? renderer->GetDefaultMaterial() : nullptr;
+}
+
+void REApplication::CreateScene()
+{
+    if (GetSubsystem<Graphics>())
+    {
+        ui::GetIO().ConfigFlags |= ImGuiConfigFlags_DockingEnable | ImGuiConfigFlags_NavEnableKeyboard;
+        ui::GetIO().BackendFlags |= ImGuiBackendFlags_HasMouseCursors;
+    }
 
     scene_ = new Scene(context_);
 
@@ -217,28 +480,21 @@ void REApplication::CreateScene()
 
     boxNode_ = scene_->CreateChild("Box");
     boxNode_->SetPosition(Vector3(10,0, 10));
-    const auto staticModel = boxNode_->CreateComponent<StaticModel>();
-    staticModel->SetModel(cache_->GetResource<Model>("Models/Box.mdl"));
-    
-    materials_.clear();
-    materials_.resize(2);
-    materials_[0] = cache_->GetResource<Material>("Materials/GreenTransparent.xml");
-    materials_[1] = cache_->GetResource<Material>("Materials/DefaultWhite.xml");
-    staticModel->SetMaterial(materials_[1]);
+    boxNode_->CreateComponent<StaticModel>();
 
     for(unsigned i=0; i<4; i++)
     {
         Node* n = scene_->CreateChild("node");
         cubes.push_back(n);
-        auto* st = n->CreateComponent<StaticModel>();
-        st->SetModel(cache_->GetResource<Model>("Models/Box.mdl"));
-        st->SetMaterial(materials_[0]);
+        n->CreateComponent<StaticModel>();
         n->Scale(Vector3(0.1f, 0.1f, 0.0001f));
     }
 
     gizmo_ = MakeShared<Gizmo>(context_);
 
-    //this->ReadFile("Scenes/RenderingShowcase_2_BakedDirect.xml");
+    // Some resources may already be loaded.
+    ApplyLoadedResources();
+
 }
 
 void REApplication::SetViewport(unsigned index, Viewport* viewport)
@@ -260,53 +516,28 @@ void REApplication::SetupViewport()
 
 void REApplication::ReadFile(const ea::string Filename)
 {
-    /*
-    pugi::xml_document* doc = xml_file_->GetDocument();
-    auto sc = doc->root().first_child();
-    auto str_c = sc.child_value();
-    URHO3D_LOGINFO("{}", str_c);
-    */
-
-    //xml_file_ = cache_->GetResource<XMLFile>("Scenes/RenderingShowcase_2_BakedDirect.xml");
-
-    auto* cache_ = GetSubsystem<ResourceCache>();
-    if(JSONFile* source = cache_->GetResource<JSONFile>("EditorStrings.json"))
+    if (!strings_.Load(context_, Filename))
     {
-        URHO3D_LOGINFO("JSON");
-        const auto jObj = source->GetRoot().GetObject();
-        for (auto it = jObj.begin(); it != jObj.end(); it++)
-        {
-            ea::string unitString = it->first.trimmed();
-            if(unitString == "Language")
-            {
-                ea::string name = it->second.GetString();
-                const auto jLangValues = it->second.GetObject();
-                for (auto it = jLangValues.begin(); it != jLangValues.end(); it++)
-                {
-                    ea::string unitString = it->first.trimmed();
-                    ea::string v = it->second.GetString();
-                    URHO3D_LOGINFO("{}={}", unitString, v);
-                }
-
-            }
-        }
-        //
-        URHO3D_LOGINFO("JSON END");
+        URHO3D_LOGWARNING("Editor strings {} are not loaded", Filename);
+        return;
     }
+    REDI_EVENT(Redi::EF_IO_STRINGS, strings_.GetNumStrings());
 }
 
-void REApplication::Dump(ea::string Path, const XMLElement element)
+void REApplication::ImportScene(const ea::string& Filename)
 {
-    URHO3D_LOGINFO("{}:{}, ats:{}", Path, element.GetName(), element.GetNumAttributes());
-    for( const auto at : element.GetAttributeNames())
+    if (sceneImporter_.IsBusy())
     {
-        URHO3D_LOGINFO("at:{}", at);
+        return;
     }
-    if(const XMLElement child = element.GetNext())
+
+    Node* importRoot = scene_->CreateChild(GetFileName(Filename));
+    if (!sceneImporter_.Start(Filename, importRoot))
     {
-        Path += element.GetName() + "/";
-        Dump(Path, child);
+        importRoot->Remove();
+        return;
     }
+    figureRegistry_.AddDrawableRoot(importRoot);
 }
 
 void REApplication::HandleKeyDown(StringHash eventType, VariantMap& eventData)
@@ -321,12 +552,381 @@ void REApplication::HandleKeyDown(StringHash eventType, VariantMap& eventData)
     }
 }
 
+void REApplication::HandleConsoleCommand(StringHash, VariantMap& eventData)
+{
+    using namespace ConsoleCommand;
+    if (eventData[P_ID].GetString() != GetTypeName())
+        return;
+
+    const ea::vector<ea::string> args = eventData[P_COMMAND].GetString().split(' ');
+    if (args.empty())
+        return;
+
+    if (args[0] == "terrain.generate" && args.size() >= 2)
+    {
+        // terrain.generate <texture> [step]
+        auto* texture = GetSubsystem<ResourceCache>()->GetResource<Texture2D>(args[1]);
+        CreateVertexBufferFromFloatArray(args.size() >= 3 ? ToInt(args[2]) : 1, texture, 0, 0);
+    }
+    else if (args[0] == "figure.export" && args.size() >= 2)
+    {
+        // figure.export <file.mdl|file.rfig>
+        bool saved = false;
+        if (GetExtension(args[1]) == ".mdl")
+        {
+            Redi::FigureExporter exporter(context_);
+            saved = exporter.Export(*figure_mesh_, args[1]);
+        }
+        else
+        {
+            File file(context_, args[1], FILE_WRITE);
+            saved = file.IsOpen() && figure_mesh_->Save(file);
+        }
+        if (!saved)
+            URHO3D_LOGERROR("Failed to export figure to {}", args[1]);
+    }
+    else if (args[0] == "figure.generate" && args.size() >= 3)
+    {
+        // figure.generate walls|cave|city <size> [seed]
+        Redi::EGeneratorKind kind;
+        if (Redi::FigureGenerator::ParseKind(args[1], kind))
+        {
+            Redi::FigureGenerator generator(context_, args.size() >= 4 ? ToUInt(args[3]) : 1);
+            generator.Generate(*figure_mesh_, kind, ToUInt(args[2]));
+        }
+        else
+        {
+            URHO3D_LOGERROR("Unknown figure kind '{}', use walls, cave or city", args[1]);
+        }
+    }
+    else if (args[0] == "figure.csg" && args.size() >= 8)
+    {
+        // figure.csg union|subtract|intersect <x0 y0 z0> <x1 y1 z1>, box of cells [x0, x1) on each axis
+        Redi::ECsgOperation op;
+        if (Redi::FigureCsg::ParseOperation(args[1], op))
+        {
+            figureCsg_.ApplyBox(*figure_mesh_, IntVector3(ToInt(args[2]), ToInt(args[3]), ToInt(args[4])),
+                IntVector3(ToInt(args[5]), ToInt(args[6]), ToInt(args[7])), op);
+        }
+        else
+        {
+            URHO3D_LOGERROR("Unknown CSG operation '{}', use union, subtract or intersect", args[1]);
+        }
+    }
+    else if (args[0] == "figure.add" && args.size() >= 2)
+    {
+        // figure.add <file.rfig> [x y z], loads a figure next to the edited one. The same file again adds an instance
+        // that shares faces and GPU buffers with the first one.
+        SharedPtr<Node> node(scene_->CreateChild(GetFileName(args[1])));
+        if (args.size() >= 5)
+            node->SetPosition(Vector3(ToFloat(args[2]), ToFloat(args[3]), ToFloat(args[4])));
+
+        auto loaded = ea::find_if(sceneFigures_.begin(), sceneFigures_.end(), [&](const FSceneFigure& sceneFigure) { return sceneFigure.fileName == args[1]; });
+        if (loaded != sceneFigures_.end())
+        {
+            if (loaded->gpuMesh)
+                loaded->gpuMesh->AddInstance(node);
+            figureRegistry_.AddFigure(loaded->figure.get(), node);
+            loaded->nodes.push_back(node);
+            return;
+        }
+
+        FSceneFigure sceneFigure;
+        sceneFigure.fileName = args[1];
+        sceneFigure.figure = ea::make_unique<Redi::Figure>(Redi::EFigureType::FT_QUAD);
+        File file(context_, args[1], FILE_READ);
+        if (!file.IsOpen() || !sceneFigure.figure->Load(file))
+        {
+            URHO3D_LOGERROR("Failed to load figure {}", args[1]);
+            node->Remove();
+        }
+        else
+        {
+            sceneFigure.nodes.push_back(node);
+            materialArray_.Reserve(*sceneFigure.figure);
+            if (Redi::FigureGpuMesh::IsSupported(context_))
+                sceneFigure.gpuMesh = ea::make_unique<Redi::FigureGpuMesh>(context_, node, sceneFigure.figure.get(), figureMaterial_);
+            figureRegistry_.AddFigure(sceneFigure.figure.get(), sceneFigure.nodes.back());
+            sceneFigures_.push_back(ea::move(sceneFigure));
+        }
+    }
+    else if (args[0] == "figure.instance")
+    {
+        // figure.instance [x y z], places the edited figure again, edits show on every instance
+        SharedPtr<Node> node(scene_->CreateChild("FigureInstance"));
+        if (args.size() >= 4)
+            node->SetPosition(Vector3(ToFloat(args[1]), ToFloat(args[2]), ToFloat(args[3])));
+        if (figureGpuMesh_)
+            figureGpuMesh_->AddInstance(node);
+        figureRegistry_.AddFigure(figure_mesh_, node);
+        figureInstances_.push_back(node);
+    }
+    else if (args[0] == "figure.material" && args.size() >= 2)
+    {
+        // figure.material <slot>, assigns the slot to the selected faces
+        const unsigned char material = (unsigned char)Clamp(ToInt(args[1]), 0, 255);
+        materialArray_.Reserve(material);
+        for (unsigned idx : figure_mesh_->GetSelectedFaces())
+        {
+            figure_mesh_->SetFaceMaterial(idx, material);
+        }
+        REDI_EVENT(Redi::EF_EDIT_MATERIAL, material, figure_mesh_->GetNumSelected());
+    }
+    else if (args[0] == "figure.material.image" && args.size() >= 3)
+    {
+        // figure.material.image <slot> <image>, textures the slot, faces keep their slot
+        const unsigned char material = (unsigned char)Clamp(ToInt(args[1]), 0, 255);
+        auto* image = GetSubsystem<ResourceCache>()->GetResource<Image>(args[2]);
+        if (!materialArray_.SetSlotImage(material, image))
+            URHO3D_LOGERROR("Image {} can not be used for material slot {}", args[2], (unsigned)material);
+    }
+    else if (args[0] == "figure.lock")
+    {
+        // Lock the selected faces, they stay tinted and ignore selection and extrusion.
+        ea::vector<unsigned> ids;
+        for (const Redi::FFace& face : figure_mesh_->faces)
+        {
+            if (figure_mesh_->IsSelected(face.idx))
+                ids.push_back(face.idx);
+        }
+        for (unsigned idx : ids)
+        {
+            figure_mesh_->SetLocked(idx, true);
+        }
+    }
+    else if (args[0] == "figure.unlock")
+    {
+        for (const Redi::FFace& face : figure_mesh_->faces)
+        {
+            figure_mesh_->SetLocked(face.idx, false);
+        }
+    }
+    else if (args[0] == "snap.radius" && args.size() >= 2)
+    {
+        snapRadius_ = Max(ToFloat(args[1]), 0.f);
+    }
+    else if (args[0] == "ao.radius" && args.size() >= 2)
+    {
+        // ao.radius <distance>, rays longer than this are open
+        aoBaker_.SetRadius(ToFloat(args[1]));
+    }
+    else if (args[0] == "ao.samples" && args.size() >= 2)
+    {
+        aoBaker_.SetMaxSamples(ToUInt(args[1]));
+    }
+    else if (args[0] == "uv.pack" && figure_mesh_)
+    {
+        // uv.pack [texelsPerUnit], repacks only planes changed since the last pack
+        if (args.size() >= 2)
+        {
+            uvAtlas_.SetTexelsPerUnit(ToFloat(args[1]));
+        }
+        uvAtlas_.Update(*figure_mesh_);
+        URHO3D_LOGINFO("UV atlas {}: {} charts in {}x{}, {:.1f}% filled, {:.2f} ms", uvAtlas_.WasFullRepack() ? "repacked" : "updated",
+            uvAtlas_.GetNumCharts(), uvAtlas_.GetAtlasSize(), uvAtlas_.GetAtlasSize(), uvAtlas_.GetFillRatio() * 100.0f,
+            uvAtlas_.GetLastUpdateMs());
+    }
+    else if (args[0] == "pick.latency" && args.size() >= 3)
+    {
+        // pick.latency <select|move|extrude> <same|next>, next lets the pick overlap the whole frame
+        const Redi::EPickLatency latency = args[2] == "next" ? Redi::PL_NEXT_FRAME : Redi::PL_SAME_FRAME;
+        if (args[1] == "select")
+            pickLatency_[Redi::EM_SELECT] = latency;
+        else if (args[1] == "move")
+            pickLatency_[Redi::EM_MOVE] = latency;
+        else if (args[1] == "extrude")
+            pickLatency_[Redi::EM_EXTRUDE] = latency;
+    }
+    else if (args[0] == "log.events" && args.size() >= 3)
+    {
+        // log.events <pick|edit|input|io|all> <on|off>, the first enabled category starts the sink
+        const bool enable = args[2] == "on";
+        for (unsigned i = 0; i < Redi::EC_COUNT; ++i)
+        {
+            if (args[1] == "all" || Redi::EventLog::ParseCategory(args[1]) == i)
+                Redi::EventLog::SetEnabled((Redi::EEventCategory)i, enable);
+        }
+        if (enable && !Redi::EventLog::IsRunning())
+            Redi::EventLog::Start(context_, GetSubsystem<FileSystem>()->GetAppPreferencesDir("REditor", "Logs") + "Events.log");
+    }
+    else if (args[0] == "subdiv.preview" && args.size() >= 2)
+    {
+        // subdiv.preview <on|off> [level], level 1 to 4
+        if (args.size() >= 3)
+        {
+            subdivision_.SetLevel(ToUInt(args[2]));
+        }
+        SetSmoothPreview(args[1] == "on");
+    }
+    else if (args[0] == "subdiv.crease" && args.size() >= 2)
+    {
+        // subdiv.crease <degrees>, edges folding more stay sharp
+        subdivision_.SetCreaseAngle(ToFloat(args[1]));
+    }
+    else if (args[0] == "snap.grid" && args.size() >= 2)
+    {
+        // snap.grid <step>, 0 turns grid snapping off
+        figureSnap_.SetGridStep(Max(ToFloat(args[1]), 0.f));
+    }
+    else if (args[0] == "memory.dump")
+    {
+        // memory.dump [file.json]
+        const ea::string json = Redi::MemoryStats::ToJSON();
+        if (args.size() >= 2)
+        {
+            File file(context_, args[1], FILE_WRITE);
+            if (!file.IsOpen() || !file.WriteString(json))
+                URHO3D_LOGERROR("Failed to write memory stats to {}", args[1]);
+        }
+        else
+        {
+            URHO3D_LOGINFO("{}", json);
+        }
+    }
+    else
+    {
+        URHO3D_LOGWARNING("Unknown command '{}'", args[0]);
+    }
+}
+
 void REApplication::OnUpdate(StringHash, VariantMap& eventData)
 {
     float deltaTime = eventData[Update::P_TIMESTEP].GetFloat();
 
-    TraceLine(deltaTime);
-    RenderUi(deltaTime);
+    Redi::MemoryStats::Update(deltaTime);
+
+    if (inputRecorder_.IsReplaying())
+    {
+        if (!inputRecorder_.NextFrame(frameInput_))
+        {
+            FinishReplay();
+            return;
+        }
+        deltaTime = frameInput_.timeStep;
+        cameraNode_->SetTransform(frameInput_.cameraPosition, frameInput_.cameraRotation);
+        auto* camera = cameraNode_->GetComponent<Camera>();
+        camera->SetFov(frameInput_.fov);
+        camera->SetAspectRatio(frameInput_.aspectRatio);
+    }
+    else
+    {
+        CaptureFrameInput(deltaTime);
+        inputRecorder_.Record(frameInput_);
+    }
+
+    // The pick task only reads figures and the registry, every task editing them runs before PreparePick or after
+    // the pick is joined. UI building only changes selection state, which picking does not read.
+    // Same frame: import, prepare, [pick | UI], pick drawables, apply and edit, upload, autosave.
+    // Next frame: import, apply the previous pick and edit, prepare, [pick | UI, upload, autosave], pick drawables.
+    HiresTimer frameTimer;
+    const bool hasGraphics = GetSubsystem<Graphics>() != nullptr;
+    const bool nextFrame = pickLatency_[Min((unsigned)editor_mode_, 2u)] == Redi::PL_NEXT_FRAME;
+    frameGraph_.Clear();
+    const unsigned import = frameGraph_.Add("import", Redi::TT_MAIN, [this]() { sceneImporter_.Update(importBudgetMs_); });
+    const auto addEdit = [&](unsigned dependency)
+    {
+        return frameGraph_.Add("edit", Redi::TT_MAIN, [this, deltaTime]()
+        {
+            TraceLine(deltaTime);
+            ProcessMouseButtons(frameInput_.mouseButtons);
+        }, {dependency});
+    };
+    const unsigned edit = nextFrame ? addEdit(import) : M_MAX_UNSIGNED;
+    const unsigned prepare = frameGraph_.Add("prepare pick", Redi::TT_MAIN, [this]() { PreparePick(); }, {nextFrame ? edit : import});
+    const unsigned pick = frameGraph_.Add("pick", Redi::TT_WORKER, [this]() { RunPick(); }, {prepare});
+    if (hasGraphics)
+    {
+        frameGraph_.Add("ui", Redi::TT_MAIN, [this, deltaTime]() { RenderUi(deltaTime); }, {prepare});
+    }
+    // Main tasks run in the order added, so the next frame latency adds this last to keep upload next to the pick.
+    const auto addFinishPick = [&]() { return frameGraph_.Add("pick drawables", Redi::TT_MAIN, [this]() { FinishPick(); }, {pick}); };
+    const unsigned edited = nextFrame ? edit : addEdit(addFinishPick());
+    const unsigned upload = frameGraph_.Add("upload", Redi::TT_MAIN, [this, hasGraphics]()
+    {
+        if (hasGraphics)
+        {
+            aoBaker_.Update(*figure_mesh_);
+            materialArray_.Update();
+        }
+        if (figureGpuMesh_)
+        {
+            figureGpuMesh_->Update();
+        }
+        if (smoothPreview_)
+        {
+            subdivision_.Update(*figure_mesh_);
+            if (subdivisionMesh_)
+                subdivisionMesh_->Update(subdivision_);
+        }
+        for (FSceneFigure& sceneFigure : sceneFigures_)
+        {
+            if (sceneFigure.gpuMesh)
+                sceneFigure.gpuMesh->Update();
+        }
+    }, {edited});
+    if (autoSave_)
+    {
+        frameGraph_.Add("autosave", Redi::TT_MAIN, [this, deltaTime]() { autoSave_->Update(*figure_mesh_, deltaTime); }, {upload});
+    }
+    if (nextFrame)
+    {
+        addFinishPick();
+    }
+    frameGraph_.Run();
+
+    if (inputRecorder_.IsReplaying())
+    {
+        inputRecorder_.AddFrameTime(frameTimer.GetUSec(false) / 1000.0f);
+    }
+}
+
+void REApplication::CaptureFrameInput(float deltaTime)
+{
+    auto* input = GetSubsystem<Input>();
+    auto* graphics = GetSubsystem<Graphics>();
+
+    frameInput_.timeStep = deltaTime;
+    frameInput_.cameraPosition = cameraNode_->GetPosition();
+    frameInput_.cameraRotation = cameraNode_->GetRotation();
+    auto* camera = cameraNode_->GetComponent<Camera>();
+    frameInput_.fov = camera->GetFov();
+    frameInput_.aspectRatio = camera->GetAspectRatio();
+    if (graphics && graphics->GetWidth() > 0 && graphics->GetHeight() > 0)
+    {
+        const IntVector2 mousePos = input->GetMousePosition();
+        frameInput_.mouse = Vector2((float)mousePos.x_ / graphics->GetWidth(), (float)mousePos.y_ / graphics->GetHeight());
+    }
+    frameInput_.flags = input->GetKeyPress(KEY_E) ? Redi::FI_EXTRUDE : Redi::FI_NONE;
+    if (input->GetQualifierDown(QUAL_SHIFT))
+        frameInput_.flags |= Redi::FI_SELECT_ADD;
+    if (input->GetQualifierDown(QUAL_ALT))
+        frameInput_.flags |= Redi::FI_SELECT_RING;
+    if (input->GetQualifierDown(QUAL_CTRL))
+        frameInput_.flags |= Redi::FI_SELECT_LOOP;
+    if (input->GetKeyPress(KEY_ESCAPE))
+        frameInput_.flags |= Redi::FI_CANCEL;
+    frameInput_.mouseButtons = pendingMouseButtons_;
+    pendingMouseButtons_ = 0;
+}
+
+void REApplication::HandleReplayEndFrame(StringHash, VariantMap&)
+{
+    // After the engine measured the next timestep, so the recorded one replaces it.
+    float timeStep;
+    if (inputRecorder_.PeekTimeStep(timeStep))
+        engine_->SetNextTimeStep(timeStep);
+}
+
+void REApplication::FinishReplay()
+{
+    inputRecorder_.LogSummary();
+    if (!replayReport_.empty() && !inputRecorder_.WriteReport(replayReport_))
+    {
+        URHO3D_LOGERROR("Failed to write replay report {}", replayReport_);
+    }
+
+    exitCode_ = EXIT_SUCCESS;
+    engine_->Exit();
 }
 
 void REApplication::SetEditorMode(Redi::EEditorMode editor_mode)
@@ -334,25 +934,93 @@ void REApplication::SetEditorMode(Redi::EEditorMode editor_mode)
     editor_mode_ = editor_mode;
 }
 
-void REApplication::CreateFigureBoxWithoutFace(Redi::FFace* face)
+void REApplication::BeginExtrudeDrag()
 {
-    ea::vector<Redi::EFaceDirection> directions = {Redi::FD_FORWARD, Redi::FD_BACK, Redi::FD_LEFT, Redi::FD_RIGHT, Redi::FD_UP, Redi::FD_DOWN};
-    Redi::EFaceDirection eDirection = figure_mesh_->GetFaceDirection(face);
-    Redi::EFaceDirection iDirection = figure_mesh_->InvertFaceDirection(eDirection);
-    Vector3 origin = face->boundingBox.Center() + face->normal/2.0f;
-    figure_mesh_->MoveFace(face->idx, face->normal);
-    for(Redi::EFaceDirection fDir : directions)
+    ea::vector<unsigned> ids = figure_mesh_->GetSelectedFaces();
+    if (ids.empty() && pick_.faceIdx >= 0)
     {
-        if(eDirection != fDir && iDirection != fDir)
-        {
-            CreateFaceDirection(fDir, origin + figure_mesh_->GetVector3(fDir)/2.0f);
-        }
+        ids.push_back(pick_.faceIdx);
+    }
+    if (!extrudeDrag_.Begin(*figure_mesh_, ids))
+    {
+        return;
+    }
+    extrudeAnchor_ = pick_.localPosition;
+    extrudeInverse_ = pick_.node ? pick_.node->GetWorldTransform().Inverse() : Matrix3x4::IDENTITY;
+    // The dragged faces and their sides leave the snap index, the face would snap onto itself otherwise.
+    figureSnap_.SetExcludedFaces(*figure_mesh_, extrudeDrag_.GetMovingFaces());
+    SetEditorMode(Redi::EM_EXTRUDE);
+}
+
+void REApplication::UpdateExtrudeDrag()
+{
+    // Ray of this frame's cursor, the pick would only hit the faces being dragged.
+    const Ray ray = cameraNode_->GetComponent<Camera>()->GetScreenRay(frameInput_.mouse.x_, frameInput_.mouse.y_);
+    const Vector3 origin = extrudeInverse_ * ray.origin_;
+    const Vector3 direction = extrudeInverse_.ToMatrix3() * ray.direction_;
+    const Vector3 axis = extrudeDrag_.GetAxis();
+
+    // Point of the axis through the anchor closest to the ray. Looking along the axis keeps the last distance.
+    const Vector3 offset = extrudeAnchor_ - origin;
+    const float b = axis.DotProduct(direction);
+    const float c = direction.DotProduct(direction);
+    const float denominator = axis.LengthSquared() * c - b * b;
+    if (Abs(denominator) < M_EPSILON)
+    {
+        return;
+    }
+    const float distance = (b * direction.DotProduct(offset) - c * axis.DotProduct(offset)) / denominator;
+
+    // Snap the face from where it is now onto nearby vertices, edges and planes, the grid along its normal otherwise.
+    const float current = extrudeDrag_.GetDistance();
+    figureSnap_.Update(*figure_mesh_);
+    const Vector3 snapped = figureSnap_.SnapFaceOffset(*figure_mesh_, extrudeDrag_.GetFirstFace(), axis * (distance - current), snapRadius_,
+        Redi::SK_ALL, snapResult_);
+    extrudeDrag_.SetDistance(current + snapped.DotProduct(axis));
+}
+
+void REApplication::EndExtrudeDrag(bool commit)
+{
+    figureSnap_.SetExcludedFaces(*figure_mesh_, {});
+    if (commit)
+    {
+        // Outside the event, its arguments are not evaluated while the category is off.
+        const float distance = extrudeDrag_.GetDistance();
+        const unsigned numExtruded = extrudeDrag_.Commit();
+        REDI_EVENT(Redi::EF_EDIT_EXTRUDE, numExtruded, distance);
+    }
+    else
+    {
+        extrudeDrag_.Cancel();
+    }
+    SetEditorMode(Redi::EM_SELECT);
+}
+
+void REApplication::SetSmoothPreview(bool enable)
+{
+    if (enable && !subdivisionMesh_ && GetSubsystem<Graphics>())
+    {
+        subdivisionMesh_ = ea::make_unique<Redi::FigureSubdivisionMesh>(context_, scene_, subdivisionMaterial_);
+    }
+    smoothPreview_ = enable;
+    if (subdivisionMesh_)
+    {
+        subdivisionMesh_->SetEnabled(enable);
+    }
+    if (figureGpuMesh_)
+    {
+        figureGpuMesh_->SetVisible(!enable);
+    }
+    // Samples are evaluated again on the next enable, the stencil tables of every level stay for it.
+    if (!enable)
+    {
+        subdivision_.ReleaseSamples();
     }
 }
 
 void REApplication::OnChangeTraceNode(Node* old, Node* current)
 {
-    if (Redi::FFace* face = figure_mesh_->GetSelectedFace())
+    if (Redi::FFace* face = figure_mesh_->GetHoveredFace())
     {
         Vector3 Rotation = cameraNode_->GetRotation().EulerAngles();
         unsigned i = 0;
@@ -374,41 +1042,80 @@ void REApplication::OnChangeTraceNode(Node* old, Node* current)
     RepaintFace();
 }
 
+void REApplication::PreparePick()
+{
+    // Node transforms and drawable bounds are cached here, the pick task then reads them without touching nodes.
+    figureRegistry_.Update();
+    pickRay_ = cameraNode_->GetComponent<Camera>()->GetScreenRay(frameInput_.mouse.x_, frameInput_.mouse.y_);
+}
+
+void REApplication::RunPick()
+{
+    // Figures only, drawable ray queries read nodes and models and wait for FinishPick on the main thread.
+    figureRegistry_.RaycastFigures(pickRay_, 250.0f, pendingPick_);
+}
+
+void REApplication::FinishPick()
+{
+    // Only a hit on figure_mesh_ hovers and edits, imported models in front of it still block it.
+    if (figureRegistry_.RaycastDrawables(pickRay_, 250.0f, pendingPick_))
+        REDI_EVENT(Redi::EF_PICK_HIT, pendingPick_.faceIdx, pendingPick_.distance);
+    else
+        REDI_EVENT(Redi::EF_PICK_MISS);
+    pendingPickReady_ = true;
+}
+
 void REApplication::TraceLine(float deltaTime)
 {
-    auto* input = GetSubsystem<Input>();
+    // E again or a click keeps the extrusion, Escape puts it back.
+    if (extrudeDrag_.IsActive())
+    {
+        if (frameInput_.flags & Redi::FI_CANCEL)
+            EndExtrudeDrag(false);
+        else if (frameInput_.flags & Redi::FI_EXTRUDE)
+            EndExtrudeDrag(true);
+        else
+            UpdateExtrudeDrag();
+        return;
+    }
+    if (!pendingPickReady_)
+    {
+        return;
+    }
+    pick_ = pendingPick_;
 
     Node* old_node = current_node;
-    Redi::FFace* old_face = figure_mesh_->GetSelectedFace();
+    Redi::FFace* old_face = figure_mesh_->GetHoveredFace();
     current_node = nullptr;
     current_face = Redi::FFace();
     indexes_.clear();
     vertices_.clear();
 
-    auto* graphics = GetSubsystem<Graphics>();
-    auto* camera = cameraNode_->GetComponent<Camera>();
-    Ray cameraRay = camera->GetScreenRayFromMouse();
     selected_vertex.clear();
-    if(figure_mesh_->TraceLine(cameraRay, 250.0f, hitPos))
+    snapResult_ = Redi::FSnapResult();
+
+    // Instances of figure_mesh_ hover and edit it in figure space, so every instance follows.
+    hitDrawable = pick_.drawable;
+    if (pick_.figure || pick_.drawable)
+    {
+        hitPos = pick_.position;
+    }
+    figure_mesh_->SetHoveredFace(pick_.figure == figure_mesh_ ? pick_.faceIdx : -1);
+
+    if (pick_.figure == figure_mesh_)
     {
-        if (old_node != current_node || old_face != figure_mesh_->GetSelectedFace())
+        figureSnap_.Update(*figure_mesh_);
+        figureSnap_.FindNearest(pick_.localPosition, snapRadius_, Redi::SK_VERTEX | Redi::SK_EDGE, snapResult_);
+
+        if (old_node != current_node || old_face != figure_mesh_->GetHoveredFace())
         {
             OnChangeTraceNode(old_node, current_node);
         }
-        if (editor_mode_ != Redi::EM_EXTRUDE && input->GetKeyPress(KEY_E))
+        if (frameInput_.flags & Redi::FI_EXTRUDE)
         {
-            SetEditorMode(Redi::EEditorMode::EM_EXTRUDE);
-            Redi::FFace* face = figure_mesh_->GetSelectedFace();
-            CreateFigureBoxWithoutFace(face);
-            SetEditorMode(Redi::EEditorMode::EM_SELECT);
+            BeginExtrudeDrag();
         }
     }
-
-    /*
-    if (Raycast(250.0f))
-    {
-    }
-    */
 }
 
 void REApplication::RenderUi(float deltaTime)
@@ -444,9 +1151,92 @@ void REApplication::RenderUi(float deltaTime)
 
         if (ui::Button("Toggle metrics window"))
             metricsOpen_ ^= true;
+
+        if (ui::Button("Toggle outliner"))
+            outlinerOpen_ ^= true;
+
+        if (ui::Button("Toggle smooth preview"))
+            SetSmoothPreview(!smoothPreview_);
         
         ui::Text(cameraNode_->GetPosition().ToString().c_str());
-        ui::Text(std::to_string(figure_mesh_->faces.size()).c_str());
+        ui::Text("Faces: %u", (unsigned)figure_mesh_->faces.size());
+        if (figureGpuMesh_)
+        {
+            ui::Text("GPU: %u chunks, %.1f KB (%.1f KB unpacked)", figureGpuMesh_->GetNumChunks(),
+                figureGpuMesh_->GetMemoryUse() / 1024.0f, figureGpuMesh_->GetUnpackedMemoryUse() / 1024.0f);
+            ui::Text("Upload: %u state bytes, %u position bytes", figureGpuMesh_->GetLastStateUpload(), figureGpuMesh_->GetLastPositionUpload());
+        }
+        ui::Text("Selected: %u faces", figure_mesh_->GetNumSelected());
+        if (extrudeDrag_.IsActive())
+            ui::Text("Extrude: %u faces by %.2f", extrudeDrag_.GetNumFaces(), extrudeDrag_.GetDistance());
+        if (smoothPreview_)
+        {
+            ui::Text("Subdivision: level %u, %u patch faces, %u refined faces", subdivision_.GetLevel(), subdivision_.GetNumPatchFaces(),
+                subdivision_.GetNumRefinedFaces());
+            ui::Text("Subdivision update: %u chunks rebuilt, %u faces evaluated, %.2f ms topology, %.2f ms stencils, %.2f ms evaluate",
+                subdivision_.GetLastNumRebuilt(), subdivision_.GetLastNumEvaluated(), subdivision_.GetLastTopologyMs(),
+                subdivision_.GetLastStencilMs(), subdivision_.GetLastEvaluateMs());
+        }
+        ui::Text("AO: %.0f%% of %u samples, pass %.1f ms", aoBaker_.GetProgress() * 100.0f, aoBaker_.GetMaxSamples(), aoBaker_.GetLastPassMs());
+        ui::Text("Pick: %u figures, %u instances, %u models, %.2f ms", figureRegistry_.GetNumFigures(), figureRegistry_.GetNumInstances(),
+            figureRegistry_.GetNumDrawables(), figureRegistry_.GetLastUpdateMs());
+        ui::Text("Frame tasks: %.2f ms, %.2f ms waiting for workers", frameGraph_.GetLastRunMs(), frameGraph_.GetLastWaitMs());
+        if (Redi::EventLog::IsRunning())
+            ui::Text("Events: %llu written, %llu dropped", Redi::EventLog::GetNumWritten(), Redi::EventLog::GetNumDropped());
+        ui::Text("Snap: %u vertices, %u edges, %.1f us", figureSnap_.GetNumVertices(), figureSnap_.GetNumEdges(), figureSnap_.GetLastQueryUs());
+        if (autoSave_ && autoSave_->GetNumSaves() > 0)
+        {
+            if (autoSave_->IsBusy())
+                ui::Text("Autosave: writing");
+            else
+                ui::Text("Autosave: %u chunks, %.2f ms snapshot, %.2f ms write, %.1f KB journal", autoSave_->GetLastNumChunks(),
+                    autoSave_->GetLastSnapshotMs(), autoSave_->GetLastWriteMs(), autoSave_->GetJournalSize() / 1024.0f);
+        }
+
+        if (ui::CollapsingHeader("Memory"))
+        {
+            ui::Columns(4);
+            ui::Text("Category"); ui::NextColumn();
+            ui::Text("Current KB"); ui::NextColumn();
+            ui::Text("Peak KB"); ui::NextColumn();
+            ui::Text("KB/s"); ui::NextColumn();
+            for (unsigned i = 0; i < Redi::MC_COUNT; ++i)
+            {
+                const auto category = (Redi::EMemoryCategory)i;
+                ui::Text("%s", Redi::MemoryStats::GetCategoryName(category)); ui::NextColumn();
+                ui::Text("%.1f", Redi::MemoryStats::GetCurrent(category) / 1024.0f); ui::NextColumn();
+                ui::Text("%.1f", Redi::MemoryStats::GetPeak(category) / 1024.0f); ui::NextColumn();
+                ui::Text("%.1f", Redi::MemoryStats::GetAllocationRate(category) / 1024.0f); ui::NextColumn();
+            }
+            ui::Columns(1);
+        }
+
+        if (ui::CollapsingHeader("Preload"))
+        {
+            for (const Redi::FPreloadEntry& entry : preloader_->GetEntries())
+            {
+                if (entry.finished)
+                    ui::Text("%s: %.2f ms%s", entry.name.c_str(), entry.GetLoadTimeMs(), entry.success ? "" : " (failed)");
+                else
+                    ui::Text("%s: loading", entry.name.c_str());
+            }
+            if (preloader_->IsFinished())
+                ui::Text("Total: %.2f ms", preloader_->GetTotalTimeMs());
+        }
+
+        if (sceneImporter_.IsBusy())
+        {
+            const ea::string progress = Format("{} / {}", sceneImporter_.GetNumInstantiated(), sceneImporter_.GetNumDiscovered());
+            ui::ProgressBar(sceneImporter_.GetProgress(), ImVec2(-1, 0), progress.c_str());
+            if (ui::Button("Cancel import"))
+                sceneImporter_.Cancel();
+        }
+        else if (ui::Button("Import showcase scene"))
+        {
+            ImportScene("Scenes/RenderingShowcase_2_BakedDirect.xml");
+        }
+        if (sceneImporter_.GetState() == Redi::IS_FAILED)
+            ui::Text("Import of %s failed", sceneImporter_.GetResourceName().c_str());
 
         gizmo_->RenderUI();
     }
@@ -487,6 +1277,80 @@ void REApplication::RenderUi(float deltaTime)
     
     if (metricsOpen_)
         ui::ShowMetricsWindow(&metricsOpen_);
+
+    if (outlinerOpen_)
+        RenderOutliner();
+}
+
+void REApplication::RenderOutliner()
+{
+    // Columns and results refresh only while the panel is open.
+    outliner_.Update(*figure_mesh_);
+
+    ui::SetNextWindowSize(ImVec2(420, 480), ImGuiCond_FirstUseEver);
+    if (ui::Begin("Outliner", &outlinerOpen_))
+    {
+        static const char* directionNames[] = {"Any", "Forward", "Back", "Left", "Right", "Up", "Down"};
+        static const char* sortNames[] = {"Figure order", "Index", "Area", "Direction", "Material"};
+
+        Redi::FOutlinerFilter filter = outliner_.GetFilter();
+        int direction = filter.direction;
+        int sort = filter.sort;
+        ui::Combo("Direction", &direction, directionNames, 7);
+        ui::InputFloat("Min area", &filter.minArea);
+        ui::InputFloat("Max area", &filter.maxArea);
+        ui::InputInt("Material (-1 any)", &filter.material);
+        ui::Combo("Sort", &sort, sortNames, 5);
+        ui::SameLine();
+        ui::Checkbox("Descending", &filter.descending);
+        filter.direction = (Redi::EFaceDirection)direction;
+        filter.sort = (Redi::EOutlinerSort)sort;
+        outliner_.SetFilter(filter);
+
+        const Redi::OutlinerRows& rows = outliner_.GetRows();
+        ui::Text("%u of %u faces, %.2f ms%s", (unsigned)rows.size(), outliner_.GetNumFaces(), outliner_.GetLastJobMs(),
+            outliner_.IsBusy() ? ", updating" : "");
+        if (ui::Button("Select filtered"))
+        {
+            ea::vector<unsigned> ids;
+            ids.reserve(rows.size());
+            for (const Redi::FOutlinerRow& row : rows)
+                ids.push_back(row.idx);
+            figure_mesh_->SelectFaces(ids);
+        }
+
+        ui::Separator();
+        ui::Columns(4, "OutlinerHeader");
+        ui::Text("Face"); ui::NextColumn();
+        ui::Text("Direction"); ui::NextColumn();
+        ui::Text("Area"); ui::NextColumn();
+        ui::Text("Material"); ui::NextColumn();
+        ui::Columns(1);
+
+        // Only rows inside the scrolled view are formatted, the cost does not depend on the face count.
+        ui::BeginChild("OutlinerRows");
+        ui::Columns(4, "OutlinerRows");
+        ImGuiListClipper clipper;
+        clipper.Begin((int)rows.size());
+        while (clipper.Step())
+        {
+            for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i)
+            {
+                const Redi::FOutlinerRow& row = rows[i];
+                char label[32];
+                snprintf(label, sizeof(label), "%u", row.idx);
+                if (ui::Selectable(label, figure_mesh_->IsSelected(row.idx), ImGuiSelectableFlags_SpanAllColumns))
+                    figure_mesh_->SelectFace(row.idx, (frameInput_.flags & Redi::FI_SELECT_ADD) != 0);
+                ui::NextColumn();
+                ui::Text("%s", directionNames[Min((unsigned)row.direction, 6u)]); ui::NextColumn();
+                ui::Text("%.3f", row.area); ui::NextColumn();
+                ui::Text("%u", (unsigned)row.material); ui::NextColumn();
+            }
+        }
+        ui::Columns(1);
+        ui::EndChild();
+    }
+    ui::End();
 }
 
 void REApplication::InitMouseMode(MouseMode mode)
@@ -625,21 +1489,14 @@ bool REApplication::Raycast(float maxDistance)
 
 void REApplication::RepaintFace()
 {
-    if (Redi::FFace* face = figure_mesh_->GetSelectedFace())
+    if (Redi::FFace* face = figure_mesh_->GetHoveredFace())
     {
         unsigned i = 0;
         for (unsigned i = 0; i < face->vertices.size(); ++i)
         {
             cubes[i]->SetWorldPosition(face->vertices[i].position);
             cubes[i]->SetDirection(cameraNode_->GetDirection());
-            if (selected_vertex.contains(i))
-            {
-                cubes[i]->GetComponent<StaticModel>()->SetMaterial(materials_[1]);
-            }
-            else
-            {
-                cubes[i]->GetComponent<StaticModel>()->SetMaterial(materials_[0]);
-            }
+            cubes[i]->GetComponent<StaticModel>()->SetMaterial(GetLoadedMaterial(selected_vertex.contains(i) ? 1 : 0));
         }
     }
 }
@@ -651,23 +1508,65 @@ void REApplication::HandleMouseModeRequest(StringHash, VariantMap& eventData)
     if (console && console->IsVisible())
         return;
 #endif
-    Urho3D::Input* input = GetSubsystem<Urho3D::Input>();
+    // Handled in OnUpdate together with the rest of the frame input, so replays can feed the same path.
+    pendingMouseButtons_ |= eventData[MouseButtonDown::P_BUTTON].GetUInt();
+    REDI_EVENT(Redi::EF_INPUT_MOUSE, eventData[MouseButtonDown::P_BUTTON].GetUInt());
+}
 
-    unsigned buttonID = eventData[MouseButtonDown::P_BUTTON].GetInt();
-    URHO3D_LOGINFO("mouse:{}", buttonID);
-    if (buttonID == 1)
+void REApplication::SelectHoveredFace()
+{
+    const bool add = (frameInput_.flags & Redi::FI_SELECT_ADD) != 0;
+    Redi::FFace* face = figure_mesh_->GetHoveredFace();
+    if (!face)
     {
-        if (figure_mesh_->GetSelectedFace())
+        if (!add)
+        {
+            figure_mesh_->ClearSelection();
+        }
+        return;
+    }
+
+    if (!(frameInput_.flags & (Redi::FI_SELECT_RING | Redi::FI_SELECT_LOOP)))
+    {
+        figure_mesh_->SelectFace(face->idx, add);
+        REDI_EVENT(Redi::EF_EDIT_SELECT, face->idx, figure_mesh_->GetNumSelected());
+        return;
+    }
+
+    // The edge nearest to the picked point picks the direction of the ring or loop.
+    HiresTimer timer;
+    const unsigned edge = Redi::FigureTopology::GetNearestEdge(*face, pick_.localPosition);
+    const unsigned arrayIndex = figure_mesh_->GetFaceIndex(face->idx);
+
+    figureTopology_.Update(*figure_mesh_);
+    const ea::vector<unsigned> ids = (frameInput_.flags & Redi::FI_SELECT_RING) ? figureTopology_.GetFaceRing(*figure_mesh_, arrayIndex, edge)
+        : figureTopology_.GetEdgeLoop(*figure_mesh_, arrayIndex, edge);
+    figure_mesh_->SelectFaces(ids, add);
+    REDI_EVENT(Redi::EF_EDIT_SELECT, face->idx, figure_mesh_->GetNumSelected());
+    URHO3D_LOGINFO("Selected {} faces in {:.2f} ms", ids.size(), timer.GetUSec(false) / 1000.0f);
+}
+
+void REApplication::ProcessMouseButtons(unsigned buttons)
+{
+    if (extrudeDrag_.IsActive() && (buttons & MOUSEB_LEFT))
+    {
+        EndExtrudeDrag(true);
+        buttons &= ~MOUSEB_LEFT;
+    }
+    if (buttons & MOUSEB_LEFT)
+    {
+        SelectHoveredFace();
+        if (figure_mesh_->GetHoveredFace())
         {
             selected_vertex.clear();
-            for (unsigned i = 0; i < figure_mesh_->GetSelectedFace()->vertices.size(); ++i)
+            for (unsigned i = 0; i < figure_mesh_->GetHoveredFace()->vertices.size(); ++i)
             {
                 selected_vertex.push_back(i);
             }
         }
         RepaintFace();
     }
-    else if(buttonID == 4)
+    if (buttons & MOUSEB_RIGHT)
     {
         if(useMouseMode_ != Urho3D::MM_FREE)
         {
@@ -867,7 +1766,12 @@ void REApplication::HandlePostRenderUpdate(StringHash eventType, VariantMap& eve
             }
         }
 
-        figure_mesh_->render(dbgRenderer);
+        figure_mesh_->render(dbgRenderer, !figureGpuMesh_, &aoBaker_.GetOcclusion());
+        if (snapResult_.kind != Redi::SK_NONE)
+        {
+            const Vector3 snapPosition = pick_.node ? pick_.node->GetWorldTransform() * snapResult_.position : snapResult_.position;
+            dbgRenderer->AddSphere(Sphere(snapPosition, 0.05f), snapResult_.kind == Redi::SK_VERTEX ? Color::YELLOW : Color::CYAN, false);
+        }
         for(unsigned i=0; i<cubes.size(); ++i)
         {
             cubes[i]->SetDirection(cameraNode_->GetDirection());
@@ -892,7 +1796,7 @@ void REApplication::HandlePostRenderUpdate(StringHash eventType, VariantMap& eve
         }
         dbgRenderer->AddCross(hitPos, 0.5f, Color::GREEN, true);
 
-        if (auto* face = figure_mesh_->GetSelectedFace())
+        if (auto* face = figure_mesh_->GetHoveredFace())
         {
             //Ray ray(Vector3(1.64f, 2.17f, -1.415f), cameraNode_->GetDirection());
             auto ray = cameraNode_->GetComponent<Camera>()->GetScreenRayFromMouse();
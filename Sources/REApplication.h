@@ -10,7 +10,29 @@
 #include <Urho3D/SystemUI/SystemMessageBox.h>
 #include <Urho3D/SystemUI/Gizmo.h>
 
+#include <EASTL/unique_ptr.h>
+
+#include "AutoSave.h"
+#include "BatchRunner.h"
+#include "EventLog.h"
 #include "Figure.h"
+#include "FigureCsg.h"
+#include "FigureExtrudeDrag.h"
+#include "FigureGpuMesh.h"
+#include "FigureMaterialArray.h"
+#include "FigureAoBaker.h"
+#include "FigureOutliner.h"
+#include "FigureRegistry.h"
+#include "FigureSnap.h"
+#include "FigureSubdivision.h"
+#include "FigureSubdivisionMesh.h"
+#include "FigureTopology.h"
+#include "FigureUvAtlas.h"
+#include "FrameGraph.h"
+#include "InputRecorder.h"
+#include "ResourcePreloader.h"
+#include "SceneImporter.h"
+#include "StringTable.h"
 #include "Structures.h"
 
 using namespace Urho3D;
@@ -27,8 +49,9 @@ public:
     /// Setup after engine initialization and before running the main loop.
     void Start() override;
 
-    void CreateFaceDirection(Redi::EFaceDirection eDirection, const Vector3& Position);
     void CreateFigureBox();
+    /// Run batch script given by -batch and exit.
+    void RunBatch();
     
     void CreateConsoleAndDebugHud();
 
@@ -36,10 +59,19 @@ public:
     void Stop() override;
 
 private:
+    /// Build tiled terrain from displacement texture, w and h resize the heightmap when positive.
     void CreateVertexBufferFromFloatArray(int step, Texture2D* Displacement, int w, int h);
-    SharedPtr<Model> CreateModel(const SharedPtr<VertexBuffer>& vertex_buffer, const SharedPtr<IndexBuffer>& index_buffer, int w, int h, int vertexCount);
+    /// Create model with one LOD level per index buffer, all sharing the vertex buffer.
+    SharedPtr<Model> CreateModel(const SharedPtr<VertexBuffer>& vertex_buffer, const ea::vector<SharedPtr<IndexBuffer>>& index_buffers, const BoundingBox& bounds, int vertexCount, float lodDistance);
 
+    /// Request editor resources through background loading.
     void LoadResorces();
+    /// Assign preloaded resources to the nodes that use them, placeholders for those still loading.
+    void ApplyLoadedResources();
+    /// Unit box built in code, stands in for Box.mdl until it is loaded.
+    SharedPtr<Model> CreatePlaceholderBox();
+    /// Material slot of materials_, the renderer's default material while it is loading.
+    Material* GetLoadedMaterial(unsigned index) const;
     /// Creates a scene. Only required to provide background color that is not black.
     void CreateScene();
 
@@ -50,19 +82,47 @@ private:
     void SubscribeToEvents();
     
     void ReadFile(ea::string Filename);
-    void Dump(ea::string Path, const XMLElement element);
+    /// Import scene XML into a new child of the scene in the background.
+    void ImportScene(const ea::string& Filename);
+    /// Execute editor console commands.
+    void HandleConsoleCommand(StringHash eventType, VariantMap& eventData);
     /// Process key events like opening a console window.
     void HandleKeyDown(StringHash eventType, VariantMap& eventData);
     
     /// Animate cube, handle keys.
     void OnUpdate(StringHash, VariantMap& eventData);
+    /// Fill frameInput_ from live input.
+    void CaptureFrameInput(float deltaTime);
+    /// Hand the timestep of the next recorded frame to the engine.
+    void HandleReplayEndFrame(StringHash, VariantMap&);
+    /// Report replay timings and exit.
+    void FinishReplay();
+    /// Extrude drag end, selection and mouse mode toggle for buttons pressed this frame.
+    void ProcessMouseButtons(unsigned buttons);
+    /// Click on the hovered face: select it, or its ring with Alt and its loop with Ctrl. Shift adds to the selection.
+    void SelectHoveredFace();
 
     void SetEditorMode(Redi::EEditorMode editor_mode);
-    void CreateFigureBoxWithoutFace(Redi::FFace* face);
+    /// Start dragging an extrusion of the selection, or of the hovered face when nothing is selected.
+    void BeginExtrudeDrag();
+    /// Follow the cursor ray along the extrude axis.
+    void UpdateExtrudeDrag();
+    void EndExtrudeDrag(bool commit);
+    /// Draw figure_mesh_ as its subdivision surface instead of its faces at the main placement.
+    void SetSmoothPreview(bool enable);
     void OnChangeTraceNode(Node* old, Node* current);
+    /// Refresh the registry and cast the cursor ray on the main thread, before RunPick.
+    void PreparePick();
+    /// Frame graph worker task, reads the figures of the registry and writes only pendingPick_.
+    void RunPick();
+    /// Main thread after RunPick, adds imported drawables nearer than the figure hit and publishes the pick.
+    void FinishPick();
+    /// Hover, snap and extrusion from the last finished pick.
     void TraceLine(float deltaTime);
     /// Assemble debug UI and handle UI events.
     void RenderUi(float deltaTime);
+    /// Face list with filters, rows come from outliner_.
+    void RenderOutliner();
 
     void InitMouseMode(MouseMode mode);
 
@@ -93,14 +153,33 @@ private:
     SharedPtr<SystemMessageBox> messageBox_;
     /// Box node.
     SharedPtr<Node> boxNode_;
+    /// Parent of terrain tile nodes.
+    SharedPtr<Node> terrainNode_;
     /// Box node.
     SharedPtr<Gizmo> gizmo_;
     /// Flag controlling display of imgui demo window.
     bool metricsOpen_ = false;
+    bool outlinerOpen_ = false;
 
     MouseMode useMouseMode_;
 
-    XMLFile* xml_file_;
+    /// Background scene XML importer.
+    Redi::SceneImporter sceneImporter_;
+    /// Time per frame spent on instantiating imported nodes.
+    float importBudgetMs_{4.0f};
+
+    /// Input of the current frame, live or replayed.
+    Redi::FFrameInput frameInput_;
+    /// Mouse buttons pressed since the last frame.
+    unsigned pendingMouseButtons_{0};
+    Redi::InputRecorder inputRecorder_;
+    ea::string recordFile_;
+    ea::string replayFile_;
+    ea::string replayReport_;
+    /// Event categories enabled from the command line, comma separated or "all".
+    ea::string eventCategories_;
+    /// Crash recovery journal of figure_mesh_, null in replay and batch mode.
+    ea::unique_ptr<Redi::AutoSave> autoSave_;
 
     float yaw_;
     float pitch_;
@@ -114,14 +193,73 @@ private:
     Vector3 hitPos{Vector3::ZERO};
     Drawable* hitDrawable{nullptr};
     
-    ea::vector<Vector3> vertices_{};
-    ea::vector<unsigned> indexes_{};
-    Redi::EEditorMode editor_mode_;
+    ea::vector<Vector3, Redi::TrackedAllocator<Redi::MC_PICK>> vertices_{};
+    ea::vector<unsigned, Redi::TrackedAllocator<Redi::MC_PICK>> indexes_{};
+    Redi::EEditorMode editor_mode_{Redi::EM_SELECT};
 
-    Redi::Figure* figure_mesh_;
+    Redi::Figure* figure_mesh_{nullptr};
+    /// Packed vertex buffers of figure_mesh_, null when headless.
+    ea::unique_ptr<Redi::FigureGpuMesh> figureGpuMesh_;
+    /// Keeps the voxel grid of figure_mesh_ between CSG commands.
+    Redi::FigureCsg figureCsg_;
+    /// Snap index of figure_mesh_ and the target under the cursor.
+    Redi::FigureSnap figureSnap_;
+    Redi::FSnapResult snapResult_;
+    float snapRadius_{0.25f};
+    /// Adjacency of figure_mesh_ for ring and loop selection.
+    Redi::FigureTopology figureTopology_;
+    /// Filtered face list of figure_mesh_ for the outliner panel.
+    Redi::FigureOutliner outliner_;
+    /// Vertex occlusion of figure_mesh_ for its GPU mesh, baked in the background while a window is open.
+    Redi::FigureAoBaker aoBaker_;
+    /// Lightmap UV set of figure_mesh_, packed on demand.
+    Redi::FigureUvAtlas uvAtlas_;
+    /// Texture layer per face material slot on figureMaterial_.
+    Redi::FigureMaterialArray materialArray_;
+    /// Extrusion of figure_mesh_ following the cursor while editor_mode_ is EM_EXTRUDE.
+    Redi::FigureExtrudeDrag extrudeDrag_;
+    /// Figure space point under the cursor when the drag began, and the inverse transform of the picked instance.
+    Vector3 extrudeAnchor_{Vector3::ZERO};
+    Matrix3x4 extrudeInverse_{Matrix3x4::IDENTITY};
+    /// Catmull-Clark limit surface of figure_mesh_, updated only while smoothPreview_ is on.
+    Redi::FigureSubdivision subdivision_;
+    /// Draws subdivision_ under the scene in place of figureGpuMesh_, null when headless.
+    ea::unique_ptr<Redi::FigureSubdivisionMesh> subdivisionMesh_;
+    Material* subdivisionMaterial_{nullptr};
+    bool smoothPreview_{false};
+    /// Figure file loaded next to figure_mesh_, picked but not edited. Every placement is an instance node.
+    struct FSceneFigure
+    {
+        ea::string fileName;
+        ea::unique_ptr<Redi::Figure> figure;
+        ea::vector<SharedPtr<Node>> nodes;
+        ea::unique_ptr<Redi::FigureGpuMesh> gpuMesh;
+    };
+    ea::vector<FSceneFigure> sceneFigures_;
+    /// Extra placements of figure_mesh_.
+    ea::vector<SharedPtr<Node>> figureInstances_;
+    /// Picking over figure_mesh_, sceneFigures_ and imported models, and the hit under the cursor.
+    Redi::FigureRegistry figureRegistry_;
+    Redi::FPickResult pick_;
+    /// Ray and result of the pick task, pick_ takes the result in TraceLine.
+    Ray pickRay_;
+    Redi::FPickResult pendingPick_;
+    bool pendingPickReady_{false};
+    /// Per EEditorMode, selection tolerates a late hover while moving and extruding need the current one.
+    Redi::EPickLatency pickLatency_[3]{Redi::PL_NEXT_FRAME, Redi::PL_SAME_FRAME, Redi::PL_SAME_FRAME};
+    Redi::FrameGraph frameGraph_;
+    Material* figureMaterial_{nullptr};
     ea::vector<Node*> cubes;
 
     ea::vector<unsigned> selected_vertex;
     ea::vector<Material*> materials_;
-    Urho3D::Texture2D* ballTexture_;
+    /// Batch script and report file from the command line.
+    ea::string batchScript_;
+    ea::string batchReport_;
+    /// Localised editor strings.
+    Redi::StringTable strings_;
+    Urho3D::Texture2D* ballTexture_{nullptr};
+    Model* boxModel_{nullptr};
+    SharedPtr<Model> placeholderModel_;
+    SharedPtr<Redi::ResourcePreloader> preloader_;
 };
\ No newline at end of file
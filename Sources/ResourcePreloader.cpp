@@ -0,0 +1,134 @@
+#include "ResourcePreloader.h"
+
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/Resource/ResourceCache.h>
+#include <Urho3D/Resource/ResourceEvents.h>
+
+using namespace Redi;
+
+ResourcePreloader::ResourcePreloader(Context* context)
+    : Object(context)
+{
+    SubscribeToEvent(E_RESOURCEBACKGROUNDLOADED, URHO3D_HANDLER(ResourcePreloader, HandleResourceLoaded));
+}
+
+void ResourcePreloader::Add(StringHash type, const ea::string& name, std::function<void(Resource*)> callback)
+{
+    for (FPreloadEntry& entry : entries_)
+    {
+        if (entry.type == type && entry.name == name)
+        {
+            if (callback)
+            {
+                if (entry.finished)
+                {
+                    callback(GetSubsystem<ResourceCache>()->GetExistingResource(type, name));
+                }
+                else
+                {
+                    entry.callbacks.push_back(ea::move(callback));
+                }
+            }
+            return;
+        }
+    }
+
+    FPreloadEntry entry;
+    entry.type = type;
+    entry.name = name;
+    if (callback)
+    {
+        entry.callbacks.push_back(ea::move(callback));
+    }
+    entries_.push_back(ea::move(entry));
+    if (started_)
+    {
+        Request(entries_.size() - 1);
+    }
+}
+
+void ResourcePreloader::Start()
+{
+    started_ = true;
+    startUSec_ = timer_.GetUSec(false);
+    lastFinishUSec_ = startUSec_;
+
+    // Index loop, finishing an entry may run callbacks that add more entries.
+    for (unsigned i = 0; i < entries_.size(); ++i)
+    {
+        Request(i);
+    }
+}
+
+void ResourcePreloader::Request(unsigned index)
+{
+    auto* cache = GetSubsystem<ResourceCache>();
+    FPreloadEntry& entry = entries_[index];
+    if (entry.finished || entry.requested)
+    {
+        return;
+    }
+
+    entry.requested = true;
+    entry.requestUSec = timer_.GetUSec(false);
+    if (!cache->BackgroundLoadResource(entry.type, entry.name))
+    {
+        // Already loaded, already queued (for example as a dependency of another resource) or missing. A queued one
+        // finishes through HandleResourceLoaded like our own requests.
+        if (Resource* resource = cache->GetExistingResource(entry.type, entry.name))
+        {
+            Finish(entry, resource);
+        }
+        else if (!cache->Exists(entry.name))
+        {
+            Finish(entry, nullptr);
+        }
+    }
+}
+
+void ResourcePreloader::HandleResourceLoaded(StringHash, VariantMap& eventData)
+{
+    using namespace ResourceBackgroundLoaded;
+    const ea::string& name = eventData[P_RESOURCENAME].GetString();
+    auto* resource = static_cast<Resource*>(eventData[P_RESOURCE].GetPtr());
+
+    for (FPreloadEntry& entry : entries_)
+    {
+        if (entry.requested && !entry.finished && entry.name == name && (!resource || resource->GetType() == entry.type))
+        {
+            Finish(entry, eventData[P_SUCCESS].GetBool() ? resource : nullptr);
+            break;
+        }
+    }
+}
+
+void ResourcePreloader::Finish(FPreloadEntry& entry, Resource* resource)
+{
+    entry.finishUSec = timer_.GetUSec(false);
+    entry.finished = true;
+    entry.success = resource != nullptr;
+    lastFinishUSec_ = Max(lastFinishUSec_, entry.finishUSec);
+    ++numFinished_;
+
+    if (entry.success)
+    {
+        URHO3D_LOGINFO("Preloaded {} in {:.2f} ms", entry.name, entry.GetLoadTimeMs());
+    }
+    else
+    {
+        URHO3D_LOGWARNING("Failed to preload {}", entry.name);
+    }
+
+    // Callbacks may add entries, so do not keep references into entries_ while calling them.
+    const auto callbacks = ea::move(entry.callbacks);
+    entry.callbacks.clear();
+    for (const auto& callback : callbacks)
+    {
+        callback(resource);
+    }
+
+    if (IsFinished())
+    {
+        URHO3D_LOGINFO("Preloaded {} resources in {:.2f} ms", entries_.size(), GetTotalTimeMs());
+    }
+}
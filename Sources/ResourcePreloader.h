@@ -0,0 +1,67 @@
+#pragma once
+#include <EASTL/string.h>
+#include <EASTL/vector.h>
+
+#include <functional>
+
+#include <Urho3D/Core/Object.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Resource/Resource.h>
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+    struct FPreloadEntry
+    {
+        StringHash type;
+        ea::string name;
+        /// Time since preloader construction when the request was issued and when it finished.
+        long long requestUSec{0};
+        long long finishUSec{0};
+        bool requested{false};
+        bool finished{false};
+        bool success{false};
+        ea::vector<std::function<void(Resource*)>> callbacks;
+
+        float GetLoadTimeMs() const { return (float)(finishUSec - requestUSec) / 1000.0f; }
+    };
+
+/// Requests a manifest of resources through ResourceCache background loading and calls back when each is ready.
+/// Records per-resource load time so startup regressions can be tracked.
+class ResourcePreloader : public Object
+{
+    URHO3D_OBJECT(ResourcePreloader, Object);
+public:
+    explicit ResourcePreloader(Context* context);
+
+    /// Add resource to the manifest. Resources requested several times are loaded once, every callback is called.
+    void Add(StringHash type, const ea::string& name, std::function<void(Resource*)> callback = {});
+    template <class T> void Add(const ea::string& name, std::function<void(T*)> callback)
+    {
+        Add(T::GetTypeStatic(), name, [callback](Resource* resource) { callback(static_cast<T*>(resource)); });
+    }
+    /// Issue background requests for all entries. Entries added after Start() are requested immediately.
+    void Start();
+
+    bool IsFinished() const { return numFinished_ == entries_.size(); }
+    unsigned GetNumFinished() const { return numFinished_; }
+    const ea::vector<FPreloadEntry>& GetEntries() const { return entries_; }
+    /// Time from Start() until the last resource finished loading.
+    float GetTotalTimeMs() const { return (float)(lastFinishUSec_ - startUSec_) / 1000.0f; }
+
+private:
+    void HandleResourceLoaded(StringHash eventType, VariantMap& eventData);
+    void Request(unsigned index);
+    void Finish(FPreloadEntry& entry, Resource* resource);
+
+    ea::vector<FPreloadEntry> entries_;
+    unsigned numFinished_{0};
+    bool started_{false};
+    HiresTimer timer_;
+    long long startUSec_{0};
+    long long lastFinishUSec_{0};
+};
+
+}
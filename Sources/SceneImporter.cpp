@@ -0,0 +1,262 @@
+#include "SceneImporter.h"
+
+#include <Urho3D/Core/Thread.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Core/WorkQueue.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/Resource/ResourceCache.h>
+#include <Urho3D/Scene/Component.h>
+
+#include "PugiXml/pugixml.hpp"
+
+using namespace Redi;
+
+namespace
+{
+    /// Number of records the worker accumulates before publishing them to the main thread.
+    const unsigned PUBLISH_BATCH = 256;
+}
+
+SceneImporter::SceneImporter(Context* context)
+    : context_(context)
+{
+}
+
+SceneImporter::~SceneImporter()
+{
+    Cancel();
+}
+
+bool SceneImporter::Start(const ea::string& resourceName, Node* root)
+{
+    if (IsBusy() || !root)
+    {
+        return false;
+    }
+
+    WaitForWorker();
+
+    resourceName_ = resourceName;
+    root_ = root;
+    xmlFile_ = MakeShared<XMLFile>(context_);
+    records_.clear();
+    nodes_.clear();
+    published_.clear();
+    publishedResources_.clear();
+    instantiated_ = 0;
+    discovered_ = 0;
+    cancel_ = false;
+    parsed_ = false;
+    state_ = IS_PARSING;
+    workerRunning_ = true;
+
+    context_->GetSubsystem<WorkQueue>()->AddWorkItem([this](unsigned)
+    {
+        Parse();
+        workerRunning_ = false;
+    });
+    return true;
+}
+
+void SceneImporter::Cancel()
+{
+    cancel_ = true;
+    WaitForWorker();
+    if (IsBusy())
+    {
+        state_ = IS_IDLE;
+    }
+}
+
+void SceneImporter::WaitForWorker()
+{
+    while (workerRunning_)
+    {
+        Thread::Sleep(1);
+    }
+}
+
+void SceneImporter::Parse()
+{
+    auto* cache = context_->GetSubsystem<ResourceCache>();
+    auto file = cache->GetFile(resourceName_);
+    if (!file || !xmlFile_->BeginLoad(*file))
+    {
+        URHO3D_LOGERROR("Scene import of {} failed, file could not be read", resourceName_);
+        state_ = IS_FAILED;
+        return;
+    }
+
+    const pugi::xml_node sceneElement = xmlFile_->GetDocument()->document_element();
+    if (!sceneElement)
+    {
+        URHO3D_LOGERROR("Scene import of {} failed, no root element", resourceName_);
+        state_ = IS_FAILED;
+        return;
+    }
+
+    ea::vector<FImportRecord> batch;
+    ea::vector<ea::string> resources;
+    // Scene root maps onto the import root, its own components (octree, zones) stay in the editor scene.
+    batch.push_back({-1, false, sceneElement.internal_object()});
+    unsigned numRecords = 1;
+
+    // Depth first walk with an explicit stack, records of a parent always precede records of its children.
+    ea::vector<ea::pair<pugi::xml_node, int>> stack;
+    stack.emplace_back(sceneElement, 0);
+    while (!stack.empty() && !cancel_)
+    {
+        const auto [element, recordIndex] = stack.back();
+        stack.pop_back();
+
+        for (pugi::xml_node child = element.first_child(); child; child = child.next_sibling())
+        {
+            const char* name = child.name();
+            if (recordIndex > 0 && strcmp(name, "component") == 0)
+            {
+                batch.push_back({recordIndex, true, child.internal_object()});
+                ++numRecords;
+
+                for (pugi::xml_node attribute = child.child("attribute"); attribute; attribute = attribute.next_sibling("attribute"))
+                {
+                    // Resource references look like "Type;Name" or "Type;Name1;Name2".
+                    const ea::string value = attribute.attribute("value").value();
+                    if (value.find(';') != ea::string::npos && value.find(' ') == ea::string::npos)
+                    {
+                        resources.push_back(value);
+                    }
+                }
+            }
+            else if (strcmp(name, "node") == 0)
+            {
+                batch.push_back({recordIndex, false, child.internal_object()});
+                stack.emplace_back(child, (int)numRecords);
+                ++numRecords;
+            }
+        }
+
+        if (batch.size() >= PUBLISH_BATCH)
+        {
+            Publish(batch, resources);
+        }
+    }
+
+    Publish(batch, resources);
+    parsed_ = true;
+}
+
+void SceneImporter::Publish(ea::vector<FImportRecord>& batch, ea::vector<ea::string>& resources)
+{
+    MutexLock lock(mutex_);
+    published_.insert(published_.end(), batch.begin(), batch.end());
+    publishedResources_.insert(publishedResources_.end(), resources.begin(), resources.end());
+    discovered_.fetch_add(batch.size(), std::memory_order_relaxed);
+    batch.clear();
+    resources.clear();
+}
+
+void SceneImporter::Update(float budgetMs)
+{
+    if (!IsBusy())
+    {
+        return;
+    }
+
+    // A failed parse is no longer busy and returns above, this only handles a root removed mid import.
+    Node* root = root_;
+    if (!root)
+    {
+        Cancel();
+        state_ = IS_FAILED;
+        return;
+    }
+
+    ea::vector<ea::string> resources;
+    {
+        MutexLock lock(mutex_);
+        records_.insert(records_.end(), published_.begin(), published_.end());
+        published_.clear();
+        resources.swap(publishedResources_);
+    }
+
+    // Start loading referenced resources before their components are created, so instantiation does not block on disk.
+    auto* cache = context_->GetSubsystem<ResourceCache>();
+    for (const ea::string& value : resources)
+    {
+        const ea::vector<ea::string> parts = value.split(';');
+        for (unsigned i = 1; i < parts.size(); ++i)
+        {
+            cache->BackgroundLoadResource(StringHash(parts[0]), parts[i]);
+        }
+    }
+
+    if (records_.size() > instantiated_)
+    {
+        state_ = IS_INSTANTIATING;
+    }
+    nodes_.resize(records_.size());
+
+    HiresTimer timer;
+    const long long budgetUSec = (long long)(budgetMs * 1000.0f);
+    while (instantiated_ < records_.size() && timer.GetUSec(false) < budgetUSec)
+    {
+        const FImportRecord& record = records_[instantiated_];
+        const XMLElement element(xmlFile_, record.element);
+        if (record.parent < 0)
+        {
+            nodes_[instantiated_] = root;
+        }
+        else if (Node* parent = nodes_[record.parent])
+        {
+            if (record.isComponent)
+            {
+                if (Component* component = parent->CreateComponent(StringHash(element.GetAttribute("type"))))
+                {
+                    component->LoadXML(element);
+                    component->ApplyAttributes();
+                }
+            }
+            else
+            {
+                Node* node = parent->CreateChild();
+                // Children are separate records, so load the node's own attributes only.
+                node->Animatable::LoadXML(element);
+                node->ApplyAttributes();
+                nodes_[instantiated_] = node;
+            }
+        }
+        ++instantiated_;
+    }
+
+    if (parsed_ && instantiated_ == records_.size())
+    {
+        {
+            MutexLock lock(mutex_);
+            if (!published_.empty())
+            {
+                return;
+            }
+        }
+        URHO3D_LOGINFO("Imported {} records from {}", instantiated_, resourceName_);
+        records_.clear();
+        nodes_.clear();
+        xmlFile_.Reset();
+        state_ = IS_DONE;
+    }
+}
+
+float SceneImporter::GetProgress() const
+{
+    const unsigned discovered = GetNumDiscovered();
+    if (state_ == IS_DONE)
+    {
+        return 1.0f;
+    }
+    if (discovered == 0)
+    {
+        return 0.0f;
+    }
+    // Discovery runs ahead of instantiation, so keep half of the bar for parsing until it is finished.
+    const float fraction = (float)instantiated_ / (float)discovered;
+    return parsed_ ? fraction : fraction * 0.5f;
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <EASTL/string.h>
+#include <EASTL/vector.h>
+
+#include <atomic>
+
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Core/Mutex.h>
+#include <Urho3D/Resource/XMLFile.h>
+#include <Urho3D/Scene/Node.h>
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+    enum EImportState : unsigned
+    {
+        IS_IDLE, IS_PARSING, IS_INSTANTIATING, IS_DONE, IS_FAILED
+    };
+
+/// Imports scene XML in the background.
+/// A worker thread loads the whole document with pugixml, which has no streaming reader, then walks the element tree
+/// iteratively, publishing a flat list of node and component records in batches as it goes. The main thread
+/// instantiates the records in Update() within a per-frame time budget, so only the walk overlaps instantiation and
+/// the DOM stays in memory until the import finishes.
+class SceneImporter
+{
+public:
+    explicit SceneImporter(Context* context);
+    ~SceneImporter();
+
+    /// Start importing resource into children of root. Fails if an import is already running.
+    bool Start(const ea::string& resourceName, Node* root);
+    /// Stop the import, nodes created so far are kept.
+    void Cancel();
+    /// Instantiate pending records until budget is spent. Main thread only.
+    void Update(float budgetMs);
+
+    EImportState GetState() const { return state_; }
+    bool IsBusy() const { return state_ == IS_PARSING || state_ == IS_INSTANTIATING; }
+    /// Return fraction of discovered records that are instantiated.
+    float GetProgress() const;
+    unsigned GetNumInstantiated() const { return instantiated_; }
+    unsigned GetNumDiscovered() const { return discovered_.load(std::memory_order_relaxed); }
+    const ea::string& GetResourceName() const { return resourceName_; }
+
+private:
+    struct FImportRecord
+    {
+        int parent;
+        bool isComponent;
+        pugi::xml_node_struct* element;
+    };
+
+    void Parse();
+    void Publish(ea::vector<FImportRecord>& batch, ea::vector<ea::string>& resources);
+    void WaitForWorker();
+
+    Context* context_;
+    SharedPtr<XMLFile> xmlFile_;
+    WeakPtr<Node> root_;
+    ea::string resourceName_;
+
+    std::atomic<EImportState> state_{IS_IDLE};
+    std::atomic<bool> cancel_{false};
+    std::atomic<bool> workerRunning_{false};
+    std::atomic<bool> parsed_{false};
+    std::atomic<unsigned> discovered_{0};
+
+    /// Records published by the worker and not yet taken by the main thread.
+    Mutex mutex_;
+    ea::vector<FImportRecord> published_;
+    ea::vector<ea::string> publishedResources_;
+
+    /// Main thread state.
+    ea::vector<FImportRecord> records_;
+    ea::vector<WeakPtr<Node>> nodes_;
+    unsigned instantiated_{0};
+};
+
+}
@@ -0,0 +1,314 @@
+#include "StringTable.h"
+
+#include <EASTL/algorithm.h>
+#include <EASTL/sort.h>
+
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/FileSystem.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/Resource/JSONFile.h>
+#include <Urho3D/Resource/ResourceCache.h>
+
+using namespace Redi;
+
+unsigned StringTable::Hash(ea::string_view key, unsigned seed)
+{
+    unsigned h = 2166136261u ^ (seed * 0x9e3779b9u);
+    for (const char c : key)
+    {
+        h ^= (unsigned char)c;
+        h *= 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+bool StringTable::Load(Context* context, const ea::string& resourceName)
+{
+    auto* cache = context->GetSubsystem<ResourceCache>();
+    auto* fileSystem = context->GetSubsystem<FileSystem>();
+
+    const ea::string sourceFileName = cache->GetResourceFileName(resourceName);
+    // Source packed into a package has no file on disk, so there is nothing to cache next to.
+    const unsigned sourceModifiedTime = sourceFileName.empty() ? 0 : fileSystem->GetLastModifiedTime(sourceFileName);
+    const ea::string cacheFileName = sourceFileName.empty() ? ea::string::EMPTY : ReplaceExtension(sourceFileName, ".strings.bin");
+
+    if (!cacheFileName.empty() && ReadCache(context, cacheFileName, sourceModifiedTime))
+    {
+        return true;
+    }
+
+    if (!Compile(context, resourceName, sourceModifiedTime))
+    {
+        blob_.clear();
+        return false;
+    }
+
+    if (!cacheFileName.empty())
+    {
+        WriteCache(context, cacheFileName);
+    }
+    return true;
+}
+
+bool StringTable::ReadCache(Context* context, const ea::string& cacheFileName, unsigned sourceModifiedTime)
+{
+    if (!context->GetSubsystem<FileSystem>()->FileExists(cacheFileName))
+    {
+        return false;
+    }
+
+    File file(context, cacheFileName, FILE_READ);
+    const unsigned size = file.IsOpen() ? file.GetSize() : 0;
+    if (size < sizeof(FHeader))
+    {
+        return false;
+    }
+
+    blob_.resize((size + sizeof(unsigned) - 1) / sizeof(unsigned));
+    if (file.Read(blob_.data(), size) != size)
+    {
+        blob_.clear();
+        return false;
+    }
+
+    const FHeader* header = GetHeader();
+    if (header->magic != MAGIC || header->version != VERSION || header->sourceModifiedTime != sourceModifiedTime)
+    {
+        blob_.clear();
+        return false;
+    }
+
+    // Sections are checked in 64 bits so huge counts cannot wrap back into range.
+    const unsigned long long poolSize = header->poolOffset <= size ? size - header->poolOffset : 0;
+    bool valid = header->blobSize == size && header->numBuckets > 0 && header->numSlots > 0
+        && header->seedsOffset % sizeof(unsigned) == 0 && header->slotsOffset % sizeof(unsigned) == 0
+        && header->seedsOffset + (unsigned long long)header->numBuckets * sizeof(unsigned) <= size
+        && header->slotsOffset + (unsigned long long)header->numSlots * sizeof(FSlot) <= size
+        && header->poolOffset <= size;
+
+    // Get reads keys and values straight from the pool, every used slot must lie inside it and end in a terminator.
+    const auto* bytes = reinterpret_cast<const unsigned char*>(blob_.data());
+    const char* pool = reinterpret_cast<const char*>(bytes + header->poolOffset);
+    const auto inPool = [&](unsigned offset, unsigned length)
+    {
+        return (unsigned long long)offset + length < poolSize && pool[offset + length] == '\0';
+    };
+    const auto* slots = reinterpret_cast<const FSlot*>(bytes + header->slotsOffset);
+    for (unsigned s = 0; valid && s < header->numSlots; ++s)
+    {
+        valid = slots[s].keyOffset == EMPTY_SLOT
+            || (inPool(slots[s].keyOffset, slots[s].keyLength) && inPool(slots[s].valueOffset, slots[s].valueLength));
+    }
+
+    if (!valid)
+    {
+        URHO3D_LOGWARNING("String cache {} is corrupt, compiling the source again", cacheFileName);
+        blob_.clear();
+    }
+    return valid;
+}
+
+bool StringTable::Compile(Context* context, const ea::string& resourceName, unsigned sourceModifiedTime)
+{
+    auto* cache = context->GetSubsystem<ResourceCache>();
+    auto source = cache->GetFile(resourceName);
+    if (!source)
+    {
+        return false;
+    }
+
+    JSONFile json(context);
+    if (!json.Load(*source))
+    {
+        return false;
+    }
+
+    ea::vector<ea::pair<ea::string, ea::string>> entries;
+    const auto jObj = json.GetRoot().GetObject();
+    for (auto it = jObj.begin(); it != jObj.end(); it++)
+    {
+        if (it->first.trimmed() == "Language")
+        {
+            const auto jLangValues = it->second.GetObject();
+            entries.reserve(entries.size() + jLangValues.size());
+            for (auto jt = jLangValues.begin(); jt != jLangValues.end(); jt++)
+            {
+                entries.emplace_back(jt->first.trimmed(), jt->second.GetString());
+            }
+        }
+    }
+
+    // Keys are unique in JSON but may collide after trimming, the perfect hash requires them distinct.
+    ea::stable_sort(entries.begin(), entries.end(), [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+    entries.erase(ea::unique(entries.begin(), entries.end(), [](const auto& lhs, const auto& rhs) { return lhs.first == rhs.first; }), entries.end());
+
+    const unsigned numEntries = entries.size();
+    const unsigned numBuckets = numEntries / 4 + 1;
+    unsigned numSlots = numEntries + numEntries / 4 + 1;
+
+    ea::vector<ea::vector<unsigned>> buckets(numBuckets);
+    for (unsigned i = 0; i < numEntries; ++i)
+    {
+        buckets[Hash(entries[i].first, 0) % numBuckets].push_back(i);
+    }
+
+    ea::vector<unsigned> order(numBuckets);
+    for (unsigned i = 0; i < numBuckets; ++i)
+    {
+        order[i] = i;
+    }
+    ea::sort(order.begin(), order.end(), [&](unsigned lhs, unsigned rhs) { return buckets[lhs].size() > buckets[rhs].size(); });
+
+    // Hash and displace: place the largest buckets first, searching a seed that maps every key of the bucket to a free slot.
+    ea::vector<unsigned> seeds(numBuckets, 0);
+    ea::vector<unsigned> slotEntries;
+    bool placed = false;
+    while (!placed)
+    {
+        slotEntries.assign(numSlots, EMPTY_SLOT);
+        placed = true;
+        for (unsigned b : order)
+        {
+            const ea::vector<unsigned>& bucket = buckets[b];
+            if (bucket.empty())
+            {
+                break;
+            }
+
+            bool found = false;
+            for (unsigned seed = 1; seed < 0x10000 && !found; ++seed)
+            {
+                found = true;
+                for (unsigned i = 0; i < bucket.size() && found; ++i)
+                {
+                    const unsigned slot = Hash(entries[bucket[i]].first, seed) % numSlots;
+                    if (slotEntries[slot] != EMPTY_SLOT)
+                    {
+                        found = false;
+                    }
+                    for (unsigned j = 0; j < i && found; ++j)
+                    {
+                        found = Hash(entries[bucket[j]].first, seed) % numSlots != slot;
+                    }
+                }
+                if (found)
+                {
+                    seeds[b] = seed;
+                    for (unsigned entry : bucket)
+                    {
+                        slotEntries[Hash(entries[entry].first, seed) % numSlots] = entry;
+                    }
+                }
+            }
+
+            if (!found)
+            {
+                numSlots += numSlots / 8 + 1;
+                placed = false;
+                break;
+            }
+        }
+    }
+
+    unsigned poolSize = 0;
+    for (const auto& entry : entries)
+    {
+        poolSize += entry.first.length() + 1 + entry.second.length() + 1;
+    }
+
+    const unsigned seedsOffset = sizeof(FHeader);
+    const unsigned slotsOffset = seedsOffset + numBuckets * sizeof(unsigned);
+    const unsigned poolOffset = slotsOffset + numSlots * sizeof(FSlot);
+    const unsigned blobSize = poolOffset + poolSize;
+
+    blob_.clear();
+    blob_.resize((blobSize + sizeof(unsigned) - 1) / sizeof(unsigned), 0);
+    auto* bytes = reinterpret_cast<unsigned char*>(blob_.data());
+
+    FHeader* header = reinterpret_cast<FHeader*>(bytes);
+    header->magic = MAGIC;
+    header->version = VERSION;
+    header->sourceModifiedTime = sourceModifiedTime;
+    header->numEntries = numEntries;
+    header->numBuckets = numBuckets;
+    header->numSlots = numSlots;
+    header->seedsOffset = seedsOffset;
+    header->slotsOffset = slotsOffset;
+    header->poolOffset = poolOffset;
+    header->blobSize = blobSize;
+
+    memcpy(bytes + seedsOffset, seeds.data(), numBuckets * sizeof(unsigned));
+
+    auto* slots = reinterpret_cast<FSlot*>(bytes + slotsOffset);
+    char* pool = reinterpret_cast<char*>(bytes + poolOffset);
+    unsigned poolCursor = 0;
+    for (unsigned s = 0; s < numSlots; ++s)
+    {
+        if (slotEntries[s] == EMPTY_SLOT)
+        {
+            slots[s] = {EMPTY_SLOT, 0, EMPTY_SLOT, 0};
+            continue;
+        }
+
+        const auto& entry = entries[slotEntries[s]];
+        slots[s].keyOffset = poolCursor;
+        slots[s].keyLength = entry.first.length();
+        memcpy(pool + poolCursor, entry.first.c_str(), entry.first.length() + 1);
+        poolCursor += entry.first.length() + 1;
+
+        slots[s].valueOffset = poolCursor;
+        slots[s].valueLength = entry.second.length();
+        memcpy(pool + poolCursor, entry.second.c_str(), entry.second.length() + 1);
+        poolCursor += entry.second.length() + 1;
+    }
+
+    URHO3D_LOGINFO("Compiled {} strings from {}", numEntries, resourceName);
+    return true;
+}
+
+void StringTable::WriteCache(Context* context, const ea::string& cacheFileName) const
+{
+    File file(context, cacheFileName, FILE_WRITE);
+    if (file.IsOpen())
+    {
+        file.Write(blob_.data(), GetHeader()->blobSize);
+    }
+}
+
+ea::string_view StringTable::Get(ea::string_view key) const
+{
+    if (blob_.empty())
+    {
+        return {};
+    }
+
+    const FHeader* header = GetHeader();
+    const auto* bytes = reinterpret_cast<const unsigned char*>(blob_.data());
+    const auto* seeds = reinterpret_cast<const unsigned*>(bytes + header->seedsOffset);
+    const auto* slots = reinterpret_cast<const FSlot*>(bytes + header->slotsOffset);
+    const char* pool = reinterpret_cast<const char*>(bytes + header->poolOffset);
+
+    const unsigned seed = seeds[Hash(key, 0) % header->numBuckets];
+    const FSlot& slot = slots[Hash(key, seed) % header->numSlots];
+    if (slot.keyOffset == EMPTY_SLOT || ea::string_view(pool + slot.keyOffset, slot.keyLength) != key)
+    {
+        return {};
+    }
+    return ea::string_view(pool + slot.valueOffset, slot.valueLength);
+}
+
+ea::string_view StringTable::GetOr(ea::string_view key) const
+{
+    const ea::string_view value = Get(key);
+    return value.empty() ? key : value;
+}
+
+unsigned StringTable::GetNumStrings() const
+{
+    return blob_.empty() ? 0 : GetHeader()->numEntries;
+}
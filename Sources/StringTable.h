@@ -0,0 +1,71 @@
+#pragma once
+#include <EASTL/string.h>
+#include <EASTL/string_view.h>
+#include <EASTL/vector.h>
+
+#include <Urho3D/Core/Context.h>
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+/// Editor string table backed by a precompiled binary blob.
+/// The blob is built from the JSON source on first load and cached next to it as *.strings.bin,
+/// the cache is rebuilt when the modification time of the JSON file changes.
+/// Lookups go through a perfect hash index and return views into the blob, so no string is ever copied.
+class StringTable
+{
+public:
+    StringTable() = default;
+
+    /// Load table from resource name (e.g. "EditorStrings.json"). Returns false if neither cache nor source is available.
+    bool Load(Context* context, const ea::string& resourceName);
+    /// Return null-terminated string for key, or empty view when not found.
+    ea::string_view Get(ea::string_view key) const;
+    /// Return string for key or the key itself when not found.
+    ea::string_view GetOr(ea::string_view key) const;
+
+    unsigned GetNumStrings() const;
+    bool IsLoaded() const { return !blob_.empty(); }
+
+private:
+    struct FHeader
+    {
+        unsigned magic;
+        unsigned version;
+        unsigned sourceModifiedTime;
+        unsigned numEntries;
+        unsigned numBuckets;
+        unsigned numSlots;
+        unsigned seedsOffset;
+        unsigned slotsOffset;
+        unsigned poolOffset;
+        unsigned blobSize;
+    };
+
+    struct FSlot
+    {
+        unsigned keyOffset;
+        unsigned keyLength;
+        unsigned valueOffset;
+        unsigned valueLength;
+    };
+
+    static constexpr unsigned MAGIC = 0x42545352; // "RSTB"
+    static constexpr unsigned VERSION = 1;
+    static constexpr unsigned EMPTY_SLOT = 0xffffffff;
+
+    static unsigned Hash(ea::string_view key, unsigned seed);
+
+    bool ReadCache(Context* context, const ea::string& cacheFileName, unsigned sourceModifiedTime);
+    bool Compile(Context* context, const ea::string& resourceName, unsigned sourceModifiedTime);
+    void WriteCache(Context* context, const ea::string& cacheFileName) const;
+
+    const FHeader* GetHeader() const { return reinterpret_cast<const FHeader*>(blob_.data()); }
+
+    /// Single allocation holding header, seeds, slots and the string pool.
+    ea::vector<unsigned> blob_;
+};
+
+}
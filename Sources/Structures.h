@@ -1,7 +1,10 @@
 #pragma once
+#include <EASTL/vector.h>
 #include <Urho3D/Math/Vector3.h>
 #include <Urho3D/Math/BoundingBox.h>
 
+#include "MemoryStats.h"
+
 namespace Redi {
 
     enum EEditorMode : unsigned
@@ -9,6 +12,12 @@ namespace Redi {
         EM_SELECT, EM_MOVE, EM_EXTRUDE
     };
 
+    /// When the pick of a frame reaches hover and selection. A next frame pick overlaps the whole frame.
+    enum EPickLatency : unsigned
+    {
+        PL_SAME_FRAME, PL_NEXT_FRAME
+    };
+
     enum ENormalDirection : unsigned
     {
         ND_X, ND_Y, ND_Z
@@ -24,6 +33,12 @@ namespace Redi {
         FD_NONE, FD_FORWARD, FD_BACK, FD_LEFT, FD_RIGHT, FD_UP, FD_DOWN
     };
 
+    /// Per-face editor state bits, mirrored to the GPU state stream of FigureGpuMesh.
+    enum EFaceState : unsigned char
+    {
+        FS_NONE = 0, FS_SELECTED = 1, FS_HOVERED = 2, FS_LOCKED = 4
+    };
+
     struct FVertex
     {
         Urho3D::Vector3 position{ Urho3D::Vector3::ZERO };
@@ -31,13 +46,22 @@ namespace Redi {
         Urho3D::Vector2 uv{ Urho3D::Vector2::ZERO };
     };
 
+    /// Per-face vertices, counted as mesh memory.
+    using FVertexArray = ea::vector<FVertex, TrackedAllocator<MC_MESH>>;
+    /// Baked occlusion per face corner, counted as ambient occlusion memory.
+    using FOcclusionArray = ea::vector<unsigned char, TrackedAllocator<MC_AO>>;
+
     struct FFace
     {
         int idx{-1};
-        ea::vector<FVertex> vertices{};
+        FVertexArray vertices{};
         Urho3D::Vector3 normal{Urho3D::Vector3::ZERO};
         Urho3D::BoundingBox boundingBox{0.f,0.f};
-        static FFace CreateFace(unsigned vFaceIndex, const ea::vector<FVertex>& verts, const Urho3D::Vector3& norm, const Urho3D::BoundingBox& bb)
+        /// EFaceState bits.
+        unsigned char state{FS_NONE};
+        /// Editor material slot.
+        unsigned char material{0};
+        static FFace CreateFace(unsigned vFaceIndex, const FVertexArray& verts, const Urho3D::Vector3& norm, const Urho3D::BoundingBox& bb)
         {
             FFace vFace;
             vFace.idx = vFaceIndex;
@@ -67,4 +91,22 @@ namespace Redi {
         Urho3D::Vector2 Coord{Urho3D::Vector2::ZERO};
     
     };
+
+    /// Hash of a Figure::GetCellKey cell for unordered containers.
+    struct FCellKeyHash
+    {
+        size_t operator()(const Urho3D::IntVector3& key) const
+        {
+            return ((size_t)(unsigned)key.x_ * 73856093u) ^ ((size_t)(unsigned)key.y_ * 19349663u) ^ ((size_t)(unsigned)key.z_ * 83492791u);
+        }
+    };
+
+    /// Strict order of Figure::GetCellKey cells by z, y, x, for sorting keys.
+    struct FCellKeyLess
+    {
+        bool operator()(const Urho3D::IntVector3& lhs, const Urho3D::IntVector3& rhs) const
+        {
+            return lhs.z_ != rhs.z_ ? lhs.z_ < rhs.z_ : (lhs.y_ != rhs.y_ ? lhs.y_ < rhs.y_ : lhs.x_ < rhs.x_);
+        }
+    };
 }
@@ -0,0 +1,166 @@
+#include "VoxelGrid.h"
+
+#include <EASTL/sort.h>
+
+using namespace Redi;
+
+namespace
+{
+    /// Brick coordinates are stored with this bias in 21 bits per axis.
+    const int BRICK_BIAS = 1 << 20;
+
+    unsigned long long CellBit(int x, int y, int z)
+    {
+        return 1ull << ((x & 3) + 4 * (y & 3) + 16 * (z & 3));
+    }
+}
+
+unsigned long long VoxelGrid::BrickKey(int bx, int by, int bz)
+{
+    return (unsigned long long)((bx + BRICK_BIAS) & 0x1fffff)
+        | ((unsigned long long)((by + BRICK_BIAS) & 0x1fffff) << 21)
+        | ((unsigned long long)((bz + BRICK_BIAS) & 0x1fffff) << 42);
+}
+
+IntVector3 VoxelGrid::BrickCoords(unsigned long long key)
+{
+    return IntVector3((int)(key & 0x1fffff) - BRICK_BIAS, (int)((key >> 21) & 0x1fffff) - BRICK_BIAS,
+        (int)((key >> 42) & 0x1fffff) - BRICK_BIAS);
+}
+
+void VoxelGrid::OrBits(int bx, int by, int bz, unsigned long long mask)
+{
+    bricks_[BrickKey(bx, by, bz)] |= mask;
+}
+
+bool VoxelGrid::Get(int x, int y, int z) const
+{
+    // Arithmetic shift keeps negative cells in the right brick.
+    const auto it = bricks_.find(BrickKey(x >> 2, y >> 2, z >> 2));
+    return it != bricks_.end() && (it->second & CellBit(x, y, z)) != 0;
+}
+
+void VoxelGrid::Set(int x, int y, int z, bool solid)
+{
+    const unsigned long long key = BrickKey(x >> 2, y >> 2, z >> 2);
+    if (solid)
+    {
+        bricks_[key] |= CellBit(x, y, z);
+        return;
+    }
+
+    auto it = bricks_.find(key);
+    if (it != bricks_.end())
+    {
+        it->second &= ~CellBit(x, y, z);
+        if (it->second == 0)
+        {
+            bricks_.erase(it);
+        }
+    }
+}
+
+void VoxelGrid::FillBox(const IntVector3& min, const IntVector3& max)
+{
+    for (int z = min.z_; z < max.z_; ++z)
+    {
+        for (int y = min.y_; y < max.y_; ++y)
+        {
+            // One brick row of up to four cells at a time.
+            for (int x = min.x_; x < max.x_;)
+            {
+                const int brickEnd = Min((x & ~3) + 4, max.x_);
+                const unsigned long long rowMask = ((1ull << (brickEnd - x)) - 1) << (x & 3);
+                OrBits(x >> 2, y >> 2, z >> 2, rowMask << (4 * (y & 3) + 16 * (z & 3)));
+                x = brickEnd;
+            }
+        }
+    }
+}
+
+void VoxelGrid::Voxelize(const Figure& figure)
+{
+    Clear();
+
+    // Every face perpendicular to X toggles inside/outside for the cell rows it covers.
+    ea::unordered_map<unsigned long long, ea::vector<int>> rows;
+    for (const FFace& face : figure.faces)
+    {
+        const BoundingBox& box = face.boundingBox;
+        if (box.max_.x_ - box.min_.x_ > 0.5f)
+        {
+            continue;
+        }
+        const int plane = RoundToInt(box.min_.x_);
+        for (int z = RoundToInt(box.min_.z_); z < RoundToInt(box.max_.z_); ++z)
+        {
+            for (int y = RoundToInt(box.min_.y_); y < RoundToInt(box.max_.y_); ++y)
+            {
+                rows[BrickKey(0, y, z)].push_back(plane);
+            }
+        }
+    }
+
+    for (auto& row : rows)
+    {
+        const IntVector3 coords = BrickCoords(row.first);
+        ea::vector<int>& planes = row.second;
+        ea::sort(planes.begin(), planes.end());
+        // Coincident planes of internal walls come in pairs and cancel out.
+        for (unsigned i = 0; i + 1 < planes.size(); i += 2)
+        {
+            FillBox(IntVector3(planes[i], coords.y_, coords.z_), IntVector3(planes[i + 1], coords.y_ + 1, coords.z_ + 1));
+        }
+    }
+}
+
+void VoxelGrid::Combine(const VoxelGrid& other, ECsgOperation op)
+{
+    switch (op)
+    {
+    case CSG_UNION:
+        for (const auto& brick : other.bricks_)
+        {
+            bricks_[brick.first] |= brick.second;
+        }
+        break;
+
+    case CSG_SUBTRACT:
+        for (const auto& brick : other.bricks_)
+        {
+            auto it = bricks_.find(brick.first);
+            if (it != bricks_.end() && (it->second &= ~brick.second) == 0)
+            {
+                bricks_.erase(it);
+            }
+        }
+        break;
+
+    case CSG_INTERSECT:
+        for (auto it = bricks_.begin(); it != bricks_.end();)
+        {
+            const auto otherIt = other.bricks_.find(it->first);
+            it->second &= otherIt != other.bricks_.end() ? otherIt->second : 0;
+            it = it->second == 0 ? bricks_.erase(it) : ea::next(it);
+        }
+        break;
+    }
+}
+
+bool VoxelGrid::GetBounds(IntVector3& min, IntVector3& max) const
+{
+    if (bricks_.empty())
+    {
+        return false;
+    }
+
+    min = IntVector3(M_MAX_INT, M_MAX_INT, M_MAX_INT);
+    max = IntVector3(M_MIN_INT, M_MIN_INT, M_MIN_INT);
+    for (const auto& brick : bricks_)
+    {
+        const IntVector3 cell = BrickCoords(brick.first) * 4;
+        min = IntVector3(Min(min.x_, cell.x_), Min(min.y_, cell.y_), Min(min.z_, cell.z_));
+        max = IntVector3(Max(max.x_, cell.x_ + 4), Max(max.y_, cell.y_ + 4), Max(max.z_, cell.z_ + 4));
+    }
+    return true;
+}
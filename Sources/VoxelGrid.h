@@ -0,0 +1,49 @@
+#pragma once
+#include <EASTL/unordered_map.h>
+
+#include <Urho3D/Math/Vector3.h>
+
+#include "Figure.h"
+
+namespace Redi
+{
+
+    using namespace Urho3D;
+
+    enum ECsgOperation : unsigned
+    {
+        CSG_UNION, CSG_SUBTRACT, CSG_INTERSECT
+    };
+
+/// Sparse set of unit cells, cell (x, y, z) spans [x, x + 1) on each axis like the boxes of Figure::AddBox.
+/// Cells are grouped into 4x4x4 bricks stored as one 64-bit word, bit = x + 4 * y + 16 * z inside the brick,
+/// so boolean operations combine 64 cells per instruction and empty space costs nothing.
+class VoxelGrid
+{
+public:
+    void Clear() { bricks_.clear(); }
+    /// Fill the inside of a closed figure made of axis aligned faces on the unit grid. Uses scanline parity along X.
+    void Voxelize(const Figure& figure);
+    /// Set cells in [min, max).
+    void FillBox(const IntVector3& min, const IntVector3& max);
+
+    bool Get(int x, int y, int z) const;
+    bool Get(const IntVector3& cell) const { return Get(cell.x_, cell.y_, cell.z_); }
+    void Set(int x, int y, int z, bool solid);
+
+    /// Apply op with other brick by brick.
+    void Combine(const VoxelGrid& other, ECsgOperation op);
+    /// Cell bounds [min, max) of all bricks, false when empty.
+    bool GetBounds(IntVector3& min, IntVector3& max) const;
+    unsigned GetNumBricks() const { return bricks_.size(); }
+
+private:
+    static unsigned long long BrickKey(int bx, int by, int bz);
+    static IntVector3 BrickCoords(unsigned long long key);
+    /// Or mask into brick, creates it when missing.
+    void OrBits(int bx, int by, int bz, unsigned long long mask);
+
+    ea::unordered_map<unsigned long long, unsigned long long> bricks_;
+};
+
+}